@@ -0,0 +1,45 @@
+#pragma once
+// CPUVolumeCommon
+// Constants and per-sample helpers of the cloud march that both the scalar march of CPUVolumeRenderer.cpp and
+// the packet marches, built per instruction set in CPUVolumeRendererAvx2.cpp and CPUVolumeRendererAvx512.cpp,
+// use. Everything here is scalar, so it is built for the baseline and called from either.
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdint>
+
+using namespace DirectX;
+
+namespace CPUVolumeCommon
+{
+	// the volume box of volume_ps.hlsl
+	const float kBoxMin = -8.0f, kBoxMax = 8.0f;
+	const float kPhaseG = 0.2f;
+
+	// hash11 and hash33 of the shaders, including the truncation of the coordinates to integers
+	const uint32_t kPrimes[3] = { 1597334673u, 3812015801u, 2798796415u };
+
+	inline float Hash11(int x, int y, int z)
+	{
+		uint32_t n = (uint32_t(x) * kPrimes[0]) ^ (uint32_t(y) * kPrimes[1]) ^ (uint32_t(z) * kPrimes[2]);
+		n |= 1u;
+		return float(n) / 4294967295.0f;
+	}
+
+	// the shader's jitter, which keeps every sample within [0.15, 0.85] of its step; the offset rotates it
+	inline float StepJitter(int x, int y, int n, float offset)
+	{
+		float jitter = Hash11(x, y, n);
+		if (offset != 0.0f)
+		{
+			jitter += offset;
+			jitter -= std::floor(jitter);
+		}
+		return jitter * 0.7f + 0.15f;
+	}
+
+	inline XMFLOAT3 ToVoxel(const XMFLOAT3& p, const XMFLOAT3& scale)
+	{
+		return XMFLOAT3((p.x - kBoxMin) * scale.x, (p.y - kBoxMin) * scale.y, (p.z - kBoxMin) * scale.z);
+	}
+}
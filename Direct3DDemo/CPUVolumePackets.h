@@ -0,0 +1,498 @@
+#pragma once
+// CPUVolumePackets
+// The packet march of CPUVolumeRenderer as templates over a SimdLanes width, with the lanes' exp. Only
+// CPUVolumeRendererAvx2.cpp and CPUVolumeRendererAvx512.cpp include it, each between the SIMD_LANES_BEGIN and
+// SIMD_LANES_END of its instruction set and each instantiating its own width, so the packet code is built for
+// that instruction set while everything else, CPUVolumeRenderer.cpp included, stays at the baseline. It
+// includes nothing itself: every header it needs is included ahead of the region, so that none of their
+// functions is built for the wider instruction set.
+
+namespace SimdLanes
+{
+	// e^x to about one ulp over the float range: x = n ln2 + r with |r| <= ln2 / 2, e^r from a degree 6
+	// polynomial (the Cephes expf coefficients), scaled by 2^n through the exponent bits
+	template <class L>
+	typename L::Float Exp(typename L::Float x)
+	{
+		x = L::Min(L::Max(x, L::Set1(-87.3f)), L::Set1(88.7f));
+		typename L::Float n = L::Floor(L::Add(L::Mul(x, L::Set1(1.44269504089f)), L::Set1(0.5f)));
+		typename L::Float r = L::Sub(L::Sub(x, L::Mul(n, L::Set1(0.693359375f))), L::Mul(n, L::Set1(-2.12194440e-4f)));
+
+		typename L::Float p = L::Set1(1.9875691500e-4f);
+		p = L::Add(L::Mul(p, r), L::Set1(1.3981999507e-3f));
+		p = L::Add(L::Mul(p, r), L::Set1(8.3334519073e-3f));
+		p = L::Add(L::Mul(p, r), L::Set1(4.1665795894e-2f));
+		p = L::Add(L::Mul(p, r), L::Set1(1.6666665459e-1f));
+		p = L::Add(L::Mul(p, r), L::Set1(5.0000001201e-1f));
+		p = L::Add(L::Add(L::Mul(L::Mul(p, r), r), r), L::Set1(1.0f));
+		return L::Mul(p, L::Exp2Int(n));
+	}
+}
+
+template <class L>
+void CPUVolumeRenderer::RenderTilePackets(int tile, int tilesX, const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame, int width, int height, XMFLOAT4* image, float* depth, SampleCounts& counts) const
+{
+	const int W = L::kWidth;
+	int x0 = (tile % tilesX) * m_tileSize, y0 = (tile / tilesX) * m_tileSize;
+	int x1 = std::min(x0 + m_tileSize, width), y1 = std::min(y0 + m_tileSize, height);
+
+	// x, y and z of every lane's direction one after the other, then the scene distances; the output holds r, g,
+	// b, transmittance and cloud depth the same way
+	alignas(64) float directions[3 * W];
+	alignas(64) float distances[W];
+	alignas(64) float out[5 * W];
+
+	XMVECTOR origin = XMLoadFloat3(&camera.position);
+	for (int y = y0; y < y1; y++)
+	{
+		float v = (y + 0.5f) / height;
+		for (int x = x0; x < x1; x += W)
+		{
+			// lanes past the end of the row repeat its last pixel with a zero distance, which leaves them inactive
+			int lanes = std::min(W, x1 - x);
+			for (int i = 0; i < W; i++)
+			{
+				float u = (std::min(x + i, x1 - 1) + 0.5f) / width;
+				XMVECTOR farPoint = XMVector3TransformCoord(XMVectorSet(u * 2.0f - 1.0f, (1.0f - v) * 2.0f - 1.0f, 1.0f, 1.0f), clipToWorld);
+				XMFLOAT3 direction;
+				XMStoreFloat3(&direction, XMVector3Normalize(farPoint - origin));
+				directions[i] = direction.x;
+				directions[W + i] = direction.y;
+				directions[2 * W + i] = direction.z;
+				distances[i] = i < lanes ? SceneDistance(u, v) : 0.0f;
+			}
+
+			TracePacket<L>(camera.position, directions, distances, x, y, frame, out, counts);
+
+			XMFLOAT4* row = &image[size_t(y) * width + x];
+			for (int i = 0; i < lanes; i++)
+				row[i] = XMFLOAT4(out[i], out[W + i], out[2 * W + i], out[3 * W + i]);
+			if (depth)
+				std::copy(out + 4 * W, out + 4 * W + lanes, &depth[size_t(y) * width + x]);
+		}
+	}
+}
+
+template <class L>
+void CPUVolumeRenderer::TracePacket(const XMFLOAT3& ro, const float* directions, const float* sceneDistances, int x, int y, const Frame& frame, float* out, SampleCounts& counts) const
+{
+	typedef typename L::Float Float;
+	typedef typename L::Mask Mask;
+	const int W = L::kWidth;
+
+	const Float zero = L::Set1(0.0f), one = L::Set1(1.0f);
+	const Float ox = L::Set1(ro.x), oy = L::Set1(ro.y), oz = L::Set1(ro.z);
+	const Float dx = L::Load(directions), dy = L::Load(directions + W), dz = L::Load(directions + 2 * W);
+
+	// box slabs, as IntersectBox
+	const Float boxMin = L::Set1(kBoxMin), boxMax = L::Set1(kBoxMax);
+	Float invX = L::Div(one, dx), invY = L::Div(one, dy), invZ = L::Div(one, dz);
+	Float ax = L::Mul(L::Sub(boxMin, ox), invX), bx = L::Mul(L::Sub(boxMax, ox), invX);
+	Float ay = L::Mul(L::Sub(boxMin, oy), invY), by = L::Mul(L::Sub(boxMax, oy), invY);
+	Float az = L::Mul(L::Sub(boxMin, oz), invZ), bz = L::Mul(L::Sub(boxMax, oz), invZ);
+	Float tmin = L::Max(L::Min(ax, bx), L::Max(L::Min(ay, by), L::Min(az, bz)));
+	Float tmax = L::Min(L::Max(ax, bx), L::Min(L::Max(ay, by), L::Max(az, bz)));
+
+	Float t0 = L::Max(tmin, zero);
+	Float t1 = L::Min(tmax, L::Load(sceneDistances));
+	Mask active = L::And(L::And(L::LessEqual(tmin, tmax), L::GreaterEqual(tmax, zero)), L::Less(t0, t1));
+
+	Float transparency = one;
+	Float r = zero, g = zero, b = zero;
+	// distances weighted by the transmittance lost at them
+	Float depthSum = zero;
+	if (L::Any(active))
+	{
+		// rays that are not marched stay at the camera, so their lookups remain in range
+		t0 = L::Select(active, t0, zero);
+		t1 = L::Select(active, t1, zero);
+
+		// Henyey-Greenstein, with pow(x, 1.5) as x * sqrt(x)
+		const float g2 = kPhaseG * kPhaseG;
+		Float cosTheta = L::Sub(zero, L::Add(L::Add(L::Mul(dx, L::Set1(frame.toLight.x)), L::Mul(dy, L::Set1(frame.toLight.y))), L::Mul(dz, L::Set1(frame.toLight.z))));
+		Float base = L::Sub(L::Set1(1.0f + g2), L::Mul(L::Set1(2.0f * kPhaseG), cosTheta));
+		Float scatter = L::Div(L::Set1((1.0f / (4.0f * XM_PI)) * (1.0f - g2) * frame.sigmaS), L::Mul(base, L::Sqrt(base)));
+
+		// with per-pixel jitter every lane hashes its own pixel; blue noise gives a ray one offset for all its steps
+		alignas(64) float rayJitter[W];
+		if (frame.blueNoise)
+		{
+			for (int i = 0; i < W; i++)
+				rayJitter[i] = Jitter(frame, x + i, y, 0);
+		}
+		auto jitter = [&](int n)
+		{
+			if (frame.blueNoise)
+				return L::Load(rayJitter);
+			if (!frame.pixelJitter)
+				return L::Set1(StepJitter(0, 0, n, frame.jitterOffset));
+			alignas(64) float laneJitter[W];
+			for (int i = 0; i < W; i++)
+				laneJitter[i] = StepJitter(x + i, y, n, frame.jitterOffset);
+			return L::Load(laneJitter);
+		};
+
+		if (frame.adaptive)
+		{
+			TracePacketAdaptive<L>(ro, directions, t0, t1, active, jitter(0), scatter, frame, transparency, r, g, b, depthSum, counts);
+		}
+		else
+		{
+			Float stride = L::Div(L::Sub(t1, t0), L::Set1(float(frame.maxSteps)));
+			const Float termination = L::Set1(frame.terminationThreshold);
+
+			alignas(64) float laneT0[W], laneT1[W], laneStride[W];
+			L::Store(laneT0, t0);
+			L::Store(laneT1, t1);
+			L::Store(laneStride, stride);
+
+			for (int n = 0; n < frame.maxSteps; n++)
+			{
+				Float t = L::Add(t0, L::Mul(stride, L::Add(L::Set1(float(n)), jitter(n))));
+				Float px = L::Add(ox, L::Mul(dx, t)), py = L::Add(oy, L::Mul(dy, t)), pz = L::Add(oz, L::Mul(dz, t));
+
+				Mask sampled = active;
+				if (m_skipEmpty)
+				{
+					sampled = L::And(active, Occupied<L>(px, py, pz, frame));
+					if (!L::Any(sampled))
+					{
+						// every ray is in empty space: jump to the first step at which any of them can reach an
+						// occupied macrocell, as Trace does for a single ray
+						alignas(64) float laneT[W];
+						L::Store(laneT, t);
+						uint32_t bits = L::Bits(active);
+						int next = frame.maxSteps;
+						for (int i = 0; i < W; i++)
+						{
+							if (!(bits & (1u << i)))
+								continue;
+							XMFLOAT3 p(ro.x + directions[i] * laneT[i], ro.y + directions[W + i] * laneT[i], ro.z + directions[2 * W + i] * laneT[i]);
+							XMFLOAT3 voxelDirection(directions[i] * frame.voxelScale.x, directions[W + i] * frame.voxelScale.y, directions[2 * W + i] * frame.voxelScale.z);
+							float skip = m_macrocells.SkipEmpty(ToVoxel(p, frame.voxelScale), voxelDirection, laneT1[i] - laneT[i]);
+							next = std::min(next, int(std::ceil((laneT[i] + skip - laneT0[i]) / laneStride[i] - 0.85f)));
+						}
+						n = std::max(n, next - 1);
+						continue;
+					}
+				}
+
+				Float density = EvalDensityPacket<L>(px, py, pz);
+				counts.view += SimdLanes::CountLanes(L::Bits(sampled));
+				Float before = transparency;
+				ShadePacket<L>(px, py, pz, density, stride, scatter, active, frame, transparency, r, g, b, counts);
+				depthSum = L::Add(depthSum, L::Mul(L::Sub(before, transparency), t));
+
+				active = L::And(active, L::GreaterEqual(transparency, termination));
+				if (!L::Any(active))
+					break;
+			}
+		}
+	}
+
+	L::Store(out, r);
+	L::Store(out + W, g);
+	L::Store(out + 2 * W, b);
+	L::Store(out + 3 * W, transparency);
+	Float opacity = L::Sub(one, transparency);
+	L::Store(out + 4 * W, L::Select(L::Greater(opacity, L::Set1(1e-4f)), L::Div(depthSum, L::Max(opacity, L::Set1(1e-4f))), L::Set1(std::numeric_limits<float>::max())));
+}
+
+template <class L>
+void CPUVolumeRenderer::TracePacketAdaptive(const XMFLOAT3& ro, const float* directions, typename L::Float t0, typename L::Float t1, typename L::Mask active, typename L::Float jitter,
+	typename L::Float scatter, const Frame& frame, typename L::Float& transparency, typename L::Float& r, typename L::Float& g, typename L::Float& b,
+	typename L::Float& depthSum, SampleCounts& counts) const
+{
+	typedef typename L::Float Float;
+	typedef typename L::Mask Mask;
+	const int W = L::kWidth;
+
+	const Float zero = L::Set1(0.0f), one = L::Set1(1.0f);
+	const Float ox = L::Set1(ro.x), oy = L::Set1(ro.y), oz = L::Set1(ro.z);
+	const Float dx = L::Load(directions), dy = L::Load(directions + W), dz = L::Load(directions + 2 * W);
+	const Float minScale = L::Set1(frame.minStepScale), maxScale = L::Set1(frame.maxStepScale);
+	const Float edge = L::Set1(frame.edgeThreshold), inverseEdge = L::Set1(1.0f / frame.edgeThreshold), inverseNear = L::Set1(1.0f / frame.nearDistance);
+	const Float termination = L::Set1(frame.terminationThreshold);
+	auto saturate = [&](Float x) { return L::Min(L::Max(x, zero), one); };
+
+	// the lanes follow Trace's adaptive march: a sample is shaded once the next one is accepted, and a sample
+	// across an edge after a longer than smallest step sends its lane back
+	Float stride = L::Div(L::Sub(t1, t0), L::Set1(float(frame.maxSteps)));
+	Float minStep = L::Mul(stride, minScale);
+	Float t = L::Add(t0, L::Mul(stride, jitter));
+	Float covered = t0;
+	Float pendingT = zero, pendingDensity = L::Set1(-1.0f);
+	Float refineUntil = zero;
+	// lanes stop marching at the end of their ray or once they become opaque; only the latter are done
+	Mask marching = L::And(active, L::Less(t, t1));
+	Mask opaque = L::Less(one, zero);
+
+	auto shadePending = [&](Mask lanes, Float weight)
+	{
+		Float qx = L::Add(ox, L::Mul(dx, pendingT)), qy = L::Add(oy, L::Mul(dy, pendingT)), qz = L::Add(oz, L::Mul(dz, pendingT));
+		Float before = transparency;
+		ShadePacket<L>(qx, qy, qz, pendingDensity, weight, scatter, lanes, frame, transparency, r, g, b, counts);
+		depthSum = L::Add(depthSum, L::Mul(L::Sub(before, transparency), pendingT));
+		Mask done = L::And(lanes, L::Less(transparency, termination));
+		opaque = L::Or(opaque, done);
+		marching = L::AndNot(marching, done);
+	};
+
+	int budget = 2 * (int(frame.maxSteps / frame.minStepScale) + 1);
+	while (budget > 0 && L::Any(marching))
+	{
+		Float px = L::Add(ox, L::Mul(dx, t)), py = L::Add(oy, L::Mul(dy, t)), pz = L::Add(oz, L::Mul(dz, t));
+		Mask hasPending = L::GreaterEqual(pendingDensity, zero);
+
+		Mask sampled = marching;
+		if (m_skipEmpty)
+		{
+			sampled = L::And(marching, Occupied<L>(px, py, pz, frame));
+			if (!L::Any(sampled))
+			{
+				// every ray is in empty space: each shades its pending sample up to here and jumps to its next
+				// occupied macrocell, where weighing starts again
+				shadePending(L::And(marching, hasPending), L::Sub(t, covered));
+
+				alignas(64) float laneT[W], laneT1[W];
+				L::Store(laneT, t);
+				L::Store(laneT1, t1);
+				uint32_t bits = L::Bits(marching);
+				for (int i = 0; i < W; i++)
+				{
+					if (!(bits & (1u << i)))
+						continue;
+					XMFLOAT3 p(ro.x + directions[i] * laneT[i], ro.y + directions[W + i] * laneT[i], ro.z + directions[2 * W + i] * laneT[i]);
+					XMFLOAT3 voxelDirection(directions[i] * frame.voxelScale.x, directions[W + i] * frame.voxelScale.y, directions[2 * W + i] * frame.voxelScale.z);
+					float skip = m_macrocells.SkipEmpty(ToVoxel(p, frame.voxelScale), voxelDirection, laneT1[i] - laneT[i]);
+					laneT[i] = std::max(laneT[i] + skip, std::nextafter(laneT[i], std::numeric_limits<float>::max()));
+				}
+				Float skipped = L::Load(laneT);
+				t = L::Select(marching, skipped, t);
+				covered = L::Select(marching, skipped, covered);
+				pendingDensity = L::Select(marching, L::Set1(-1.0f), pendingDensity);
+				marching = L::And(marching, L::Less(t, t1));
+				continue;
+			}
+		}
+
+		Float density = EvalDensityPacket<L>(px, py, pz);
+		counts.view += SimdLanes::CountLanes(L::Bits(sampled));
+		budget--;
+
+		Float change = L::Max(L::Sub(density, pendingDensity), L::Sub(pendingDensity, density));
+		change = L::Select(hasPending, change, zero);
+		Mask retreat = L::And(L::And(marching, hasPending), L::And(L::Greater(change, edge), L::Greater(L::Sub(t, pendingT), L::Mul(minStep, L::Set1(1.001f)))));
+		Mask accepted = L::AndNot(marching, retreat);
+
+		Mask shaded = L::And(accepted, hasPending);
+		if (L::Any(shaded))
+		{
+			shadePending(shaded, L::Sub(t, covered));
+			covered = L::Select(shaded, t, covered);
+			accepted = L::And(accepted, marching);
+		}
+
+		Float scale = L::Add(maxScale, L::Mul(L::Sub(minScale, maxScale), saturate(L::Mul(change, inverseEdge))));
+		scale = L::Mul(scale, L::Add(minScale, L::Mul(L::Sub(one, minScale), saturate(L::Mul(t, inverseNear)))));
+		scale = L::Select(L::Less(t, refineUntil), minScale, L::Min(L::Max(scale, minScale), maxScale));
+
+		pendingT = L::Select(accepted, t, pendingT);
+		pendingDensity = L::Select(accepted, density, pendingDensity);
+		refineUntil = L::Select(retreat, t, refineUntil);
+		t = L::Select(accepted, L::Add(t, L::Mul(stride, scale)), L::Select(retreat, L::Add(pendingT, minStep), t));
+		marching = L::And(marching, L::Less(t, t1));
+	}
+
+	// rays that reached their end, or ran out of samples, still owe the light of their last sample
+	Mask flush = L::AndNot(L::And(active, L::GreaterEqual(pendingDensity, zero)), opaque);
+	if (L::Any(flush))
+		shadePending(flush, L::Sub(t1, covered));
+}
+
+template <class L>
+void CPUVolumeRenderer::ShadePacket(typename L::Float px, typename L::Float py, typename L::Float pz, typename L::Float density, typename L::Float dt, typename L::Float scatter,
+	typename L::Mask active, const Frame& frame, typename L::Float& transparency, typename L::Float& r, typename L::Float& g, typename L::Float& b, SampleCounts& counts) const
+{
+	typedef typename L::Float Float;
+	typedef typename L::Mask Mask;
+
+	const Float zero = L::Set1(0.0f);
+	const Float sigmaT = L::Set1(-frame.sigmaT);
+
+	transparency = L::Select(active, L::Mul(transparency, SimdLanes::Exp<L>(L::Mul(L::Mul(dt, sigmaT), density))), transparency);
+
+	Float ambient = L::Select(active, L::Mul(L::Mul(density, dt), transparency), zero);
+	r = L::Add(r, L::Mul(L::Set1(frame.ambient.x), ambient));
+	g = L::Add(g, L::Mul(L::Set1(frame.ambient.y), ambient));
+	b = L::Add(b, L::Mul(L::Set1(frame.ambient.z), ambient));
+
+	Mask lit = L::And(active, L::Greater(density, zero));
+	if (!L::Any(lit))
+		return;
+
+	Float depth = zero;
+	if (m_useSunVolume)
+	{
+		depth = SampleSunDepthPacket<L>(px, py, pz);
+		counts.light += SimdLanes::CountLanes(L::Bits(lit));
+	}
+	else
+	{
+		// the light ray leaves from inside the box, so only its exit distance is needed
+		const Float boxMin = L::Set1(kBoxMin), boxMax = L::Set1(kBoxMax);
+		const Float lx = L::Set1(frame.toLight.x), ly = L::Set1(frame.toLight.y), lz = L::Set1(frame.toLight.z);
+		const Float invLx = L::Set1(1.0f / frame.toLight.x), invLy = L::Set1(1.0f / frame.toLight.y), invLz = L::Set1(1.0f / frame.toLight.z);
+		Float ex = L::Max(L::Mul(L::Sub(boxMin, px), invLx), L::Mul(L::Sub(boxMax, px), invLx));
+		Float ey = L::Max(L::Mul(L::Sub(boxMin, py), invLy), L::Mul(L::Sub(boxMax, py), invLy));
+		Float ez = L::Max(L::Mul(L::Sub(boxMin, pz), invLz), L::Mul(L::Sub(boxMax, pz), invLz));
+		Float lightStride = L::Mul(L::Min(ex, L::Min(ey, ez)), L::Set1(1.0f / frame.maxLightSteps));
+
+		for (int nl = 0; nl < frame.maxLightSteps; nl++)
+		{
+			Float tl = L::Mul(lightStride, L::Set1(nl + 0.5f));
+			Float qx = L::Add(px, L::Mul(lx, tl)), qy = L::Add(py, L::Mul(ly, tl)), qz = L::Add(pz, L::Mul(lz, tl));
+			Mask lightSampled = lit;
+			if (m_skipEmpty)
+			{
+				lightSampled = L::And(lit, Occupied<L>(qx, qy, qz, frame));
+				if (!L::Any(lightSampled))
+					continue;
+			}
+			depth = L::Add(depth, EvalDensityPacket<L>(qx, qy, qz));
+			counts.light += SimdLanes::CountLanes(L::Bits(lightSampled));
+		}
+		depth = L::Mul(depth, lightStride);
+	}
+
+	Float inScatter = L::Mul(SimdLanes::Exp<L>(L::Mul(depth, sigmaT)), L::Mul(L::Mul(scatter, transparency), L::Mul(dt, density)));
+	inScatter = L::Select(lit, inScatter, zero);
+	r = L::Add(r, L::Mul(L::Set1(frame.lightColor.x), inScatter));
+	g = L::Add(g, L::Mul(L::Set1(frame.lightColor.y), inScatter));
+	b = L::Add(b, L::Mul(L::Set1(frame.lightColor.z), inScatter));
+}
+
+template <class L>
+typename L::Float CPUVolumeRenderer::SampleSunDepthPacket(typename L::Float x, typename L::Float y, typename L::Float z) const
+{
+	typedef typename L::Float Float;
+
+	// SunTransmittanceVolume::SampleDepth on every lane
+	const int n = m_sunVolume.GetResolution();
+	const Float zero = L::Set1(0.0f), one = L::Set1(1.0f), last = L::Set1(float(n - 1)), lastCell = L::Set1(float(n - 2));
+	const Float boxMin = L::Set1(m_sunVolume.GetBoxMin()), scale = L::Set1((n - 1) / (m_sunVolume.GetBoxMax() - m_sunVolume.GetBoxMin()));
+	auto axis = [&](Float coordinate, Float& cell, Float& weight)
+	{
+		Float p = L::Min(L::Max(L::Mul(L::Sub(coordinate, boxMin), scale), zero), last);
+		cell = L::Min(L::Floor(p), lastCell);
+		weight = L::Sub(p, cell);
+	};
+	Float cx, fx, cy, fy, cz, fz;
+	axis(x, cx, fx);
+	axis(y, cy, fy);
+	axis(z, cz, fz);
+
+	const float* depths = m_sunVolume.GetDepths().data();
+	const Float rowSize = L::Set1(float(n));
+	auto lerpX = [&](Float yi, Float zi)
+	{
+		Float index = L::Add(L::Mul(L::Add(L::Mul(zi, rowSize), yi), rowSize), cx);
+		Float a = L::Gather(depths, L::ToInt(index));
+		Float b = L::Gather(depths, L::ToInt(L::Add(index, one)));
+		return L::Add(a, L::Mul(L::Sub(b, a), fx));
+	};
+	Float cy1 = L::Add(cy, one), cz1 = L::Add(cz, one);
+	Float c00 = lerpX(cy, cz), c10 = lerpX(cy1, cz), c01 = lerpX(cy, cz1), c11 = lerpX(cy1, cz1);
+	Float c0 = L::Add(c00, L::Mul(L::Sub(c10, c00), fy));
+	Float c1 = L::Add(c01, L::Mul(L::Sub(c11, c01), fy));
+	return L::Add(c0, L::Mul(L::Sub(c1, c0), fz));
+}
+
+template <class L>
+typename L::Mask CPUVolumeRenderer::Occupied(typename L::Float x, typename L::Float y, typename L::Float z, const Frame& frame) const
+{
+	typedef typename L::Float Float;
+
+	// MacrocellGrid::CellIndexAt on every lane, then a gather of the occupancy
+	const Float boxMin = L::Set1(kBoxMin), zero = L::Set1(0.0f);
+	const Float inverseCell = L::Set1(1.0f / MacrocellGrid::kCellSize);
+	const XMINT3 cells = m_macrocells.GetCellCount();
+	auto cell = [&](Float coordinate, float scale, int count)
+	{
+		Float c = L::Floor(L::Mul(L::Mul(L::Sub(coordinate, boxMin), L::Set1(scale)), inverseCell));
+		return L::Min(L::Max(c, zero), L::Set1(float(count - 1)));
+	};
+	Float cx = cell(x, frame.voxelScale.x, cells.x), cy = cell(y, frame.voxelScale.y, cells.y), cz = cell(z, frame.voxelScale.z, cells.z);
+	Float index = L::Add(L::Mul(L::Add(L::Mul(cz, L::Set1(float(cells.y))), cy), L::Set1(float(cells.x))), cx);
+	return L::Greater(L::Gather(m_macrocells.GetOccupancy().data(), L::ToInt(index)), zero);
+}
+
+template <class L>
+typename L::Float CPUVolumeRenderer::EvalDensityPacket(typename L::Float x, typename L::Float y, typename L::Float z) const
+{
+	typedef typename L::Float Float;
+
+	// EvalDensity on every lane; indices are built in float, which is exact for grids below 2^24 samples
+	const Float zero = L::Set1(0.0f), one = L::Set1(1.0f);
+	const Float scale = L::Set1(1.0f / (kBoxMax - kBoxMin)), boxMin = L::Set1(kBoxMin);
+	Float u = L::Mul(L::Sub(x, boxMin), scale), v = L::Mul(L::Sub(y, boxMin), scale), w = L::Mul(L::Sub(z, boxMin), scale);
+
+	auto axis = [&](Float coordinate, int interior, Float& lower, Float& upper, Float& weight)
+	{
+		Float p = L::Mul(coordinate, L::Set1(float(interior)));
+		Float cell = L::Floor(p);
+		weight = L::Sub(p, cell);
+		Float last = L::Set1(float(interior - 1));
+		lower = L::Add(L::Min(L::Max(cell, zero), last), one);
+		upper = L::Add(L::Min(L::Max(L::Add(cell, one), zero), last), one);
+	};
+
+	Float x0, x1, fx, y0, y1, fy, z0, z1, fz;
+	axis(u, m_densityResolution.x - 2, x0, x1, fx);
+	axis(v, m_densityResolution.y - 2, y0, y1, fy);
+	axis(w, m_densityResolution.z - 2, z0, z1, fz);
+
+	const float* density = m_density.data();
+	const Float rx = L::Set1(float(m_densityResolution.x)), ry = L::Set1(float(m_densityResolution.y));
+	auto lerpX = [&](Float yi, Float zi)
+	{
+		Float row = L::Mul(L::Add(L::Mul(zi, ry), yi), rx);
+		Float a = L::Gather(density, L::ToInt(L::Add(row, x0)));
+		Float b = L::Gather(density, L::ToInt(L::Add(row, x1)));
+		return L::Add(a, L::Mul(L::Sub(b, a), fx));
+	};
+	Float c00 = lerpX(y0, z0), c10 = lerpX(y1, z0), c01 = lerpX(y0, z1), c11 = lerpX(y1, z1);
+	Float c0 = L::Add(c00, L::Mul(L::Sub(c10, c00), fy));
+	Float c1 = L::Add(c01, L::Mul(L::Sub(c11, c01), fy));
+	Float value = L::Add(c0, L::Mul(L::Sub(c1, c0), fz));
+
+	// SampleNoise: saturated coordinates, so truncation is the floor
+	const int n = m_noiseResolution;
+	const Float noiseScale = L::Set1(float(n - 1)), noiseLast = L::Set1(float(n - 1)), noiseRow = L::Set1(float(n));
+	auto noiseAxis = [&](Float coordinate, Float& lower, Float& upper, Float& weight)
+	{
+		Float p = L::Mul(L::Min(L::Max(coordinate, zero), one), noiseScale);
+		lower = L::Floor(p);
+		weight = L::Sub(p, lower);
+		upper = L::Min(L::Add(lower, one), noiseLast);
+	};
+	Float nx0, nx1, nfx, ny0, ny1, nfy, nz0, nz1, nfz;
+	noiseAxis(u, nx0, nx1, nfx);
+	noiseAxis(v, ny0, ny1, nfy);
+	noiseAxis(w, nz0, nz1, nfz);
+
+	const float* noise = m_noise.data();
+	auto noiseX = [&](Float yi, Float zi)
+	{
+		Float row = L::Mul(L::Add(L::Mul(zi, noiseRow), yi), noiseRow);
+		Float a = L::Gather(noise, L::ToInt(L::Add(row, nx0)));
+		Float b = L::Gather(noise, L::ToInt(L::Add(row, nx1)));
+		return L::Add(a, L::Mul(L::Sub(b, a), nfx));
+	};
+	Float n00 = noiseX(ny0, nz0), n10 = noiseX(ny1, nz0), n01 = noiseX(ny0, nz1), n11 = noiseX(ny1, nz1);
+	Float n0 = L::Add(n00, L::Mul(L::Sub(n10, n00), nfy));
+	Float n1 = L::Add(n01, L::Mul(L::Sub(n11, n01), nfy));
+	Float noiseValue = L::Add(n0, L::Mul(L::Sub(n1, n0), nfz));
+
+	return L::Min(L::Max(L::Mul(value, noiseValue), zero), one);
+}
@@ -0,0 +1,1992 @@
+#include "CPUVolumeRenderer.h"
+#include "CPUVolumeCommon.h"
+#include "SimdLanes.h"
+#include "SpatiotemporalBlueNoise.h"
+#include "TemporalAccumulator.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <type_traits>
+
+using namespace CPUVolumeCommon;
+
+namespace
+{
+	const float kZFar = 100.0f;
+	const char kFrameMagic[4] = { 'C', 'V', 'F', '1' };
+
+	// every field of a frame in file order, for WriteFrame and ReadFrame alike; the arrays follow their sizes
+	template <class Frame, class Visit>
+	void VisitFrame(Frame& frame, Visit&& visit)
+	{
+		auto float3 = [&](auto& value) { visit(value.x); visit(value.y); visit(value.z); };
+		visit(frame.densityResolution.x);
+		visit(frame.densityResolution.y);
+		visit(frame.densityResolution.z);
+		visit(frame.sceneDepthWidth);
+		visit(frame.sceneDepthHeight);
+		visit(frame.width);
+		visit(frame.height);
+
+		float3(frame.camera.position);
+		visit(frame.camera.viewInv);
+		visit(frame.camera.projInv);
+
+		auto& settings = frame.settings;
+		float3(settings.ambientColor);
+		visit(settings.ambientIntensity);
+		float3(settings.sunColor);
+		visit(settings.sunIntensity);
+		float3(settings.sunDirection);
+		visit(settings.absorption);
+		visit(settings.scatter);
+		visit(settings.maxSteps);
+		visit(settings.maxLightSteps);
+		visit(settings.adaptive);
+		visit(settings.minStepScale);
+		visit(settings.maxStepScale);
+		visit(settings.edgeThreshold);
+		visit(settings.nearDistance);
+		visit(settings.terminationThreshold);
+		visit(settings.pixelJitter);
+		visit(settings.jitterOffset);
+		visit(settings.blueNoise);
+		visit(settings.frameIndex);
+	}
+
+	bool IntersectBox(const XMFLOAT3& ro, const XMFLOAT3& rd, float& t0, float& t1)
+	{
+		float invX = 1.0f / rd.x, invY = 1.0f / rd.y, invZ = 1.0f / rd.z;
+		float ax = (kBoxMin - ro.x) * invX, bx = (kBoxMax - ro.x) * invX;
+		float ay = (kBoxMin - ro.y) * invY, by = (kBoxMax - ro.y) * invY;
+		float az = (kBoxMin - ro.z) * invZ, bz = (kBoxMax - ro.z) * invZ;
+
+		float tmin = std::max(std::min(ax, bx), std::max(std::min(ay, by), std::min(az, bz)));
+		float tmax = std::min(std::max(ax, bx), std::min(std::max(ay, by), std::max(az, bz)));
+		if (tmin > tmax || tmax < 0.0f)
+			return false;
+
+		t0 = tmin < 0.0f ? 0.0f : tmin;
+		t1 = tmax;
+		return true;
+	}
+
+	void Hash33(int x, int y, int z, float out[3])
+	{
+		uint32_t n = (uint32_t(x) * kPrimes[0]) ^ (uint32_t(y) * kPrimes[1]) ^ (uint32_t(z) * kPrimes[2]);
+		for (int i = 0; i < 3; i++)
+		{
+			float f = float(n * kPrimes[i]) / 4294967295.0f;
+			out[i] = f - std::floor(f);
+		}
+	}
+
+	float Worley(float px, float py, float pz)
+	{
+		float cx = std::floor(px), cy = std::floor(py), cz = std::floor(pz);
+		float lx = px - cx, ly = py - cy, lz = pz - cz;
+
+		float minDist = 1e10f;
+		for (int x = -1; x <= 1; x++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				for (int z = -1; z <= 1; z++)
+				{
+					float point[3];
+					Hash33(int(cx + x), int(cy + y), int(cz + z), point);
+					float dx = x + point[0] - lx, dy = y + point[1] - ly, dz = z + point[2] - lz;
+					minDist = std::min(minDist, dx * dx + dy * dy + dz * dz);
+				}
+			}
+		}
+		return 1.0f - std::sqrt(minDist);
+	}
+
+	float WorleyFBm(float x, float y, float z)
+	{
+		const float lacunarity = 1.6f, gain = 0.6f;
+		const int octaves = 4;
+
+		float result = 0.0f, frequency = 0.07f, amplitude = 1.0f, maxAmplitude = 0.0f;
+		for (int i = 0; i < octaves; i++)
+		{
+			result += Worley(x * frequency, y * frequency, z * frequency) * amplitude;
+			maxAmplitude += amplitude;
+			frequency *= lacunarity;
+			amplitude *= gain;
+		}
+		result /= maxAmplitude;
+
+		// remapped around 0.8 like the shader
+		const float contrast = 0.4f, center = 0.8f;
+		return (center - contrast) + result * 2.0f * contrast;
+	}
+
+	// Henyey-Greenstein
+	float Phase(float g, float cosTheta)
+	{
+		return (1.0f / (4.0f * XM_PI)) * (1.0f - g * g) / std::pow(1.0f + g * g - 2.0f * g * cosTheta, 1.5f);
+	}
+
+	float Saturate(float x)
+	{
+		return std::min(std::max(x, 0.0f), 1.0f);
+	}
+
+	// FNV-1a over everything in the settings that changes the image, with the sun volume's use and resolution
+	uint64_t HashSettings(const CPUVolumeSettings& settings, bool sunVolume, int sunVolumeResolution)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		auto add = [&](const auto& value)
+		{
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+			for (size_t i = 0; i < sizeof(value); i++)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+		};
+		add(settings.ambientColor);
+		add(settings.ambientIntensity);
+		add(settings.sunColor);
+		add(settings.sunIntensity);
+		add(settings.sunDirection);
+		add(settings.absorption);
+		add(settings.scatter);
+		add(settings.maxSteps);
+		add(settings.maxLightSteps);
+		add(settings.adaptive);
+		add(settings.minStepScale);
+		add(settings.maxStepScale);
+		add(settings.edgeThreshold);
+		add(settings.nearDistance);
+		add(settings.terminationThreshold);
+		add(settings.pixelJitter);
+		add(settings.jitterOffset);
+		add(settings.blueNoise);
+		add(settings.frameIndex);
+		add(sunVolume);
+		add(sunVolumeResolution);
+		return hash;
+	}
+}
+
+CPUVolumeRenderer::CPUVolumeRenderer() :
+	m_densityResolution(0, 0, 0),
+	m_sunVolumeLight(0.0f, 0.0f, 0.0f),
+	m_froxelResolution(160, 90, 64)
+{
+	const float halfSize = (kBoxMax - kBoxMin) * 0.5f;
+	m_impostors.SetBounds(XMFLOAT3(kBoxMin + halfSize, kBoxMin + halfSize, kBoxMin + halfSize), halfSize * std::sqrt(3.0f));
+
+	if (IsPathSupported(CPUVolumePath::Avx512))
+		m_path = CPUVolumePath::Avx512;
+	else if (IsPathSupported(CPUVolumePath::Avx2))
+		m_path = CPUVolumePath::Avx2;
+}
+
+bool CPUVolumeRenderer::IsPathSupported(CPUVolumePath path)
+{
+	switch (path)
+	{
+	case CPUVolumePath::Avx2: return SimdLanes::Avx2::IsSupported();
+	case CPUVolumePath::Avx512: return SimdLanes::Avx512::IsSupported();
+	default: return true;
+	}
+}
+
+const char* CPUVolumeRenderer::GetPathName(CPUVolumePath path)
+{
+	switch (path)
+	{
+	case CPUVolumePath::Avx2: return "avx2";
+	case CPUVolumePath::Avx512: return "avx512";
+	default: return "scalar";
+	}
+}
+
+void CPUVolumeRenderer::SetDensity(const float* density, const XMINT3& resolution, ThreadPool* pool)
+{
+	m_density.assign(density, density + size_t(resolution.x) * resolution.y * resolution.z);
+	m_densityResolution = resolution;
+	if (m_macrocells.Update(density, resolution, pool) > 0)
+	{
+		m_sunVolumeDirty = true;
+		m_densityVersion++;
+	}
+}
+
+void CPUVolumeRenderer::SetNoise(const float* noise, int resolution)
+{
+	m_noise.assign(noise, noise + size_t(resolution) * resolution * resolution);
+	m_noiseResolution = resolution;
+	m_sunVolumeDirty = true;
+}
+
+void CPUVolumeRenderer::GenerateNoise(ThreadPool* pool)
+{
+	const int n = kNoiseResolution;
+	m_noise.resize(size_t(n) * n * n);
+	m_noiseResolution = n;
+	m_sunVolumeDirty = true;
+	ForEachSlice(pool, n, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; z++)
+		{
+			for (int y = 0; y < n; y++)
+			{
+				float* row = &m_noise[(size_t(z) * n + y) * n];
+				for (int x = 0; x < n; x++)
+					row[x] = WorleyFBm(float(x), float(y), float(z));
+			}
+		}
+	});
+}
+
+void CPUVolumeRenderer::SetSceneDepth(const float* depth, int width, int height)
+{
+	m_sceneDepth.assign(depth, depth + size_t(width) * height);
+	m_sceneDepthWidth = width;
+	m_sceneDepthHeight = height;
+}
+
+void CPUVolumeRenderer::ClearSceneDepth()
+{
+	m_sceneDepth.clear();
+	m_sceneDepthWidth = m_sceneDepthHeight = 0;
+}
+
+void CPUVolumeRenderer::Render(const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool, std::vector<float>* depth)
+{
+	m_stats = CPUVolumeStats();
+	m_stats.width = width;
+	m_stats.height = height;
+	m_stats.threads = pool ? pool->GetThreadCount() : 1;
+	m_stats.path = m_path;
+	m_stats.skipEmpty = m_skipEmpty;
+	m_stats.sunVolume = m_useSunVolume;
+	m_stats.adaptive = settings.adaptive;
+	m_stats.froxels = m_useFroxels;
+	m_stats.resolutionDivisor = m_resolutionDivisor;
+	m_stats.upsample = m_upsampleFilter;
+	if (width <= 0 || height <= 0)
+	{
+		image.clear();
+		if (depth)
+			depth->clear();
+		return;
+	}
+	image.assign(size_t(width) * height, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	if (depth)
+		depth->assign(size_t(width) * height, std::numeric_limits<float>::max());
+	if (m_density.empty())
+		return;
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	if (m_useImpostors && m_impostors.IsDistant(camera.position))
+	{
+		RenderImpostors(camera, settings, width, height, image, pool, depth);
+		return;
+	}
+	if (m_resolutionDivisor > 1)
+	{
+		RenderReduced(camera, settings, width, height, image, pool, depth);
+		return;
+	}
+
+	Frame frame = MakeFrame(settings);
+	if (m_useSunVolume)
+		m_stats.sunVolumeTime = UpdateSunVolume(frame.toLight, pool);
+
+	// the view matrix is affine, so the perspective divide can wait until after it
+	XMMATRIX clipToWorld = camera.projInv * camera.viewInv;
+
+	if (m_useFroxels)
+	{
+		RenderFroxels(camera, clipToWorld, frame, width, height, image, pool);
+		return;
+	}
+
+	int tilesX = (width + m_tileSize - 1) / m_tileSize;
+	int tilesY = (height + m_tileSize - 1) / m_tileSize;
+	m_stats.tiles = tilesX * tilesY;
+
+	float* depthData = depth ? depth->data() : nullptr;
+	std::atomic<uint64_t> viewSamples{ 0 }, lightSamples{ 0 };
+	auto start = std::chrono::high_resolution_clock::now();
+	ForEachSlice(pool, m_stats.tiles, [&](int begin, int end)
+	{
+		SampleCounts local;
+		for (int tile = begin; tile < end; tile++)
+		{
+			if (m_path == CPUVolumePath::Avx512)
+				RenderTilePackets<SimdLanes::Avx512>(tile, tilesX, camera, clipToWorld, frame, width, height, image.data(), depthData, local);
+			else if (m_path == CPUVolumePath::Avx2)
+				RenderTilePackets<SimdLanes::Avx2>(tile, tilesX, camera, clipToWorld, frame, width, height, image.data(), depthData, local);
+			else
+				RenderTile(tile, tilesX, camera, clipToWorld, frame, width, height, image.data(), depthData, local);
+		}
+		viewSamples += local.view;
+		lightSamples += local.light;
+	});
+	m_stats.renderTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	m_stats.viewSamples = viewSamples;
+	m_stats.samples = viewSamples + lightSamples;
+}
+
+void CPUVolumeRenderer::RenderFroxels(const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// the slices only need to span the box: from where it starts, or the camera inside it, to its farthest corner
+	const XMFLOAT3& eye = camera.position;
+	float dx = std::max(std::max(kBoxMin - eye.x, eye.x - kBoxMax), 0.0f);
+	float dy = std::max(std::max(kBoxMin - eye.y, eye.y - kBoxMax), 0.0f);
+	float dz = std::max(std::max(kBoxMin - eye.z, eye.z - kBoxMax), 0.0f);
+	float nearDistance = std::max(std::sqrt(dx * dx + dy * dy + dz * dz), 0.25f);
+	float fx = std::max(std::abs(kBoxMin - eye.x), std::abs(kBoxMax - eye.x));
+	float fy = std::max(std::abs(kBoxMin - eye.y), std::abs(kBoxMax - eye.y));
+	float fz = std::max(std::abs(kBoxMin - eye.z), std::abs(kBoxMax - eye.z));
+	float farDistance = std::sqrt(fx * fx + fy * fy + fz * fz);
+
+	m_froxels.Build(eye, clipToWorld, m_froxelResolution, nearDistance, farDistance, kBoxMin, kBoxMax,
+		[&](const XMFLOAT3& p, const XMFLOAT3& direction, uint64_t& samples) { return Medium(p, direction, frame, samples); }, pool);
+
+	ForEachSlice(pool, height, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			float v = (y + 0.5f) / height;
+			for (int x = 0; x < width; x++)
+			{
+				float u = (x + 0.5f) / width;
+				image[size_t(y) * width + x] = m_froxels.Sample(u, v, SceneDistance(u, v));
+			}
+		}
+	});
+
+	XMINT3 resolution = m_froxels.GetResolution();
+	m_stats.viewSamples = uint64_t(resolution.x) * resolution.y * resolution.z;
+	m_stats.samples = m_froxels.GetSampleCount();
+	m_stats.froxelTime = m_froxels.GetBuildTime();
+	m_stats.renderTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void CPUVolumeRenderer::RenderReduced(const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool, std::vector<float>* depth)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	const int divisor = m_resolutionDivisor;
+
+	// the scene depth at the frame's resolution, which the upsampler compares the low resolution depth with; it
+	// is only resampled when it was set at another resolution
+	const bool hasSceneDepth = !m_sceneDepth.empty();
+	std::vector<float> resampled;
+	const float* sceneDepth = FrameSceneDepth(width, height, resampled);
+	if (hasSceneDepth)
+		m_upsampler.DownsampleDepth(sceneDepth, width, height, divisor, pool);
+	int lowWidth = (width + divisor - 1) / divisor, lowHeight = (height + divisor - 1) / divisor;
+
+	// the low resolution frame marches against the downsampled depth in place of the scene's; swapping keeps
+	// the scene's samples where sceneDepth points
+	std::vector<float> fullDepth;
+	int fullWidth = m_sceneDepthWidth, fullHeight = m_sceneDepthHeight;
+	if (hasSceneDepth)
+	{
+		fullDepth.swap(m_sceneDepth);
+		m_sceneDepth = m_upsampler.GetLowDepth();
+		m_sceneDepthWidth = lowWidth;
+		m_sceneDepthHeight = lowHeight;
+	}
+	m_resolutionDivisor = 1;
+	Render(camera, settings, lowWidth, lowHeight, m_reducedImage, pool, depth ? &m_reducedDepth : nullptr);
+	m_resolutionDivisor = divisor;
+	if (hasSceneDepth)
+	{
+		m_sceneDepth.swap(fullDepth);
+		m_sceneDepthWidth = fullWidth;
+		m_sceneDepthHeight = fullHeight;
+	}
+
+	m_upsampler.Upsample(m_reducedImage, lowWidth, lowHeight, hasSceneDepth ? sceneDepth : nullptr, width, height, m_upsampleFilter, image, pool);
+	if (depth)
+	{
+		// the cloud depth of the texel each pixel falls in
+		depth->resize(size_t(width) * height);
+		for (int y = 0; y < height; y++)
+		{
+			int ly = std::min(y * lowHeight / height, lowHeight - 1);
+			for (int x = 0; x < width; x++)
+				(*depth)[size_t(y) * width + x] = m_reducedDepth[size_t(ly) * lowWidth + std::min(x * lowWidth / width, lowWidth - 1)];
+		}
+	}
+
+	m_stats.width = width;
+	m_stats.height = height;
+	m_stats.resolutionDivisor = divisor;
+	m_stats.upsample = m_upsampleFilter;
+	m_stats.upsampleTime = m_upsampler.GetUpsampleTime() + (hasSceneDepth ? m_upsampler.GetDownsampleTime() : 0.0);
+	m_stats.renderTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void CPUVolumeRenderer::RenderImpostors(const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool, std::vector<float>* depth)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	CPUVolumeStats stats = m_stats;
+
+	// the views are marched ray by ray at their own resolution and without the scene depth, which belongs to the
+	// camera; the cache hides what the scene covers when it resolves the frame
+	bool useFroxels = m_useFroxels;
+	int divisor = m_resolutionDivisor;
+	m_useImpostors = false;
+	m_useFroxels = false;
+	m_resolutionDivisor = 1;
+	std::vector<float> sceneDepth;
+	sceneDepth.swap(m_sceneDepth);
+
+	// a view outlives the frame and is refreshed over several, so its jitter must not move between frames; any
+	// other change of the settings makes the cache render its views again
+	CPUVolumeSettings viewSettings = settings;
+	viewSettings.jitterOffset = 0.0f;
+	viewSettings.frameIndex = 0;
+
+	uint64_t samples = 0, viewSamples = 0;
+	double viewTime = 0.0, sunVolumeTime = 0.0;
+	auto startRefresh = [&]() -> CloudImpostorCache::RenderView
+	{
+		// a refresh renders with a renderer of its own, set up like this one and given the density again when it
+		// changed since the last refresh, so this one goes on with the frames meanwhile
+		bool created = !m_refreshRenderer;
+		if (created)
+		{
+			m_refreshRenderer = std::make_unique<CPUVolumeRenderer>();
+			if (!m_noise.empty())
+				m_refreshRenderer->SetNoise(m_noise.data(), m_noiseResolution);
+		}
+		CPUVolumeRenderer* renderer = m_refreshRenderer.get();
+		renderer->m_path = m_path;
+		renderer->m_skipEmpty = m_skipEmpty;
+		renderer->m_useSunVolume = m_useSunVolume;
+		if (renderer->m_sunVolumeResolution != m_sunVolumeResolution)
+			renderer->SetSunVolumeResolution(m_sunVolumeResolution);
+		renderer->m_blueNoise = m_blueNoise;
+		renderer->m_tileSize = m_tileSize;
+
+		std::shared_ptr<const std::vector<float>> density;
+		if (created || m_refreshDensityVersion != m_densityVersion)
+		{
+			density = std::make_shared<const std::vector<float>>(m_density);
+			m_refreshDensityVersion = m_densityVersion;
+		}
+		const XMINT3 densityResolution = m_densityResolution;
+		ThreadPool* backgroundPool = m_backgroundPool;
+		return [renderer, density, densityResolution, viewSettings, backgroundPool](const XMFLOAT3& eye, const XMMATRIX& viewInv, const XMMATRIX& projInv,
+			int viewWidth, int viewHeight, std::vector<XMFLOAT4>& viewImage, std::vector<float>& viewDepth)
+		{
+			if (density)
+				renderer->SetDensity(density->data(), densityResolution, backgroundPool);
+			CPUVolumeCamera viewCamera = { eye, viewInv, projInv };
+			renderer->Render(viewCamera, viewSettings, viewWidth, viewHeight, viewImage, backgroundPool, &viewDepth);
+		};
+	};
+
+	// the views are compared with the macrocell means, which change when the density does
+	const std::vector<float>& means = m_macrocells.GetMeans();
+	m_impostors.Update(camera.position, HashSettings(viewSettings, m_useSunVolume, m_sunVolumeResolution), means.data(), means.size(), m_densityVersion,
+		[&](const XMFLOAT3& eye, const XMMATRIX& viewInv, const XMMATRIX& projInv, int viewWidth, int viewHeight, std::vector<XMFLOAT4>& viewImage, std::vector<float>& viewDepth)
+	{
+		CPUVolumeCamera viewCamera = { eye, viewInv, projInv };
+		Render(viewCamera, viewSettings, viewWidth, viewHeight, viewImage, pool, &viewDepth);
+		samples += m_stats.samples;
+		viewSamples += m_stats.viewSamples;
+		viewTime += m_stats.renderTime;
+		sunVolumeTime += m_stats.sunVolumeTime;
+	}, startRefresh);
+
+	m_sceneDepth.swap(sceneDepth);
+	m_useImpostors = true;
+	m_useFroxels = useFroxels;
+	m_resolutionDivisor = divisor;
+
+	std::vector<float> resampled;
+	m_impostors.Resolve(camera.position, camera.projInv * camera.viewInv, width, height, FrameSceneDepth(width, height, resampled), kZFar, image, depth, pool);
+
+	m_stats = stats;
+	m_stats.impostors = true;
+	// the frame is resolved from the views at full resolution, whatever the caller had set
+	m_stats.froxels = false;
+	m_stats.resolutionDivisor = 1;
+	m_stats.upsample = CPUVolumeStats().upsample;
+	m_stats.impostorRows = m_impostors.GetRenderedRows();
+	m_stats.impostorTime = viewTime;
+	m_stats.samples = samples;
+	m_stats.viewSamples = viewSamples;
+	m_stats.sunVolumeTime = sunVolumeTime;
+	m_stats.renderTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() - sunVolumeTime;
+}
+
+const float* CPUVolumeRenderer::FrameSceneDepth(int width, int height, std::vector<float>& resampled) const
+{
+	if (m_sceneDepth.empty())
+		return nullptr;
+	if (m_sceneDepthWidth == width && m_sceneDepthHeight == height)
+		return m_sceneDepth.data();
+
+	resampled.resize(size_t(width) * height);
+	for (int y = 0; y < height; y++)
+	{
+		float v = (y + 0.5f) / height;
+		for (int x = 0; x < width; x++)
+			resampled[size_t(y) * width + x] = SceneDistance((x + 0.5f) / width, v) / kZFar;
+	}
+	return resampled.data();
+}
+
+FroxelMedium CPUVolumeRenderer::Medium(const XMFLOAT3& p, const XMFLOAT3& direction, const Frame& frame, uint64_t& samples) const
+{
+	FroxelMedium medium;
+	if (m_skipEmpty)
+	{
+		XMFLOAT3 voxel = ToVoxel(p, frame.voxelScale);
+		if (!m_macrocells.IsOccupiedAt(voxel.x, voxel.y, voxel.z))
+			return medium;
+	}
+
+	float density = EvalDensity(p);
+	samples++;
+	if (density <= 0.0f)
+		return medium;
+
+	float depth;
+	if (m_useSunVolume)
+	{
+		depth = m_sunVolume.SampleDepth(p);
+		samples++;
+	}
+	else
+	{
+		depth = MarchLight(p, frame, frame.maxLightSteps, samples);
+	}
+
+	// the ambient and in-scattering terms of Trace, per unit length
+	float cosTheta = -(direction.x * frame.toLight.x + direction.y * frame.toLight.y + direction.z * frame.toLight.z);
+	float sun = std::exp(-depth * frame.sigmaT) * Phase(kPhaseG, cosTheta) * frame.sigmaS;
+	medium.extinction = frame.sigmaT * density;
+	medium.emission = XMFLOAT3(density * (frame.ambient.x + frame.lightColor.x * sun), density * (frame.ambient.y + frame.lightColor.y * sun), density * (frame.ambient.z + frame.lightColor.z * sun));
+	return medium;
+}
+
+CPUVolumeRenderer::Frame CPUVolumeRenderer::MakeFrame(const CPUVolumeSettings& settings) const
+{
+	Frame frame;
+	float ambientScale = settings.ambientIntensity * 0.5f;
+	frame.ambient = XMFLOAT3(settings.ambientColor.x * ambientScale, settings.ambientColor.y * ambientScale, settings.ambientColor.z * ambientScale);
+	frame.lightColor = XMFLOAT3(settings.sunColor.x * settings.sunIntensity, settings.sunColor.y * settings.sunIntensity, settings.sunColor.z * settings.sunIntensity);
+	XMStoreFloat3(&frame.toLight, -XMVector3Normalize(XMLoadFloat3(&settings.sunDirection)));
+	frame.sigmaS = settings.scatter;
+	frame.sigmaT = settings.absorption + settings.scatter;
+	frame.maxSteps = std::max(1, settings.maxSteps);
+	frame.maxLightSteps = std::max(1, settings.maxLightSteps);
+	frame.adaptive = settings.adaptive;
+	frame.minStepScale = std::max(0.05f, settings.minStepScale);
+	frame.maxStepScale = std::max(frame.minStepScale, settings.maxStepScale);
+	frame.edgeThreshold = std::max(1e-4f, settings.edgeThreshold);
+	frame.nearDistance = std::max(1e-4f, settings.nearDistance);
+	frame.terminationThreshold = settings.terminationThreshold;
+	frame.pixelJitter = settings.pixelJitter;
+	frame.jitterOffset = settings.jitterOffset;
+	frame.blueNoise = settings.blueNoise && m_blueNoise && !m_blueNoise->IsEmpty() ? m_blueNoise : nullptr;
+	frame.frameIndex = settings.frameIndex;
+	const float size = kBoxMax - kBoxMin;
+	frame.voxelScale = XMFLOAT3((m_densityResolution.x - 2) / size, (m_densityResolution.y - 2) / size, (m_densityResolution.z - 2) / size);
+	frame.toLightVoxel = XMFLOAT3(frame.toLight.x * frame.voxelScale.x, frame.toLight.y * frame.voxelScale.y, frame.toLight.z * frame.voxelScale.z);
+	return frame;
+}
+
+double CPUVolumeRenderer::UpdateSunVolume(const XMFLOAT3& toLight, ThreadPool* pool)
+{
+	bool sunMoved = m_sunVolumeLight.x != toLight.x || m_sunVolumeLight.y != toLight.y || m_sunVolumeLight.z != toLight.z;
+	if (!m_sunVolumeDirty && !sunMoved && m_sunVolume.GetResolution() == m_sunVolumeResolution)
+		return 0.0;
+
+	m_sunVolume.Build(m_sunVolumeResolution, kBoxMin, kBoxMax, toLight, [this](const XMFLOAT3& p) { return EvalDensity(p); }, pool);
+	m_sunVolumeLight = toLight;
+	m_sunVolumeDirty = false;
+	return m_sunVolume.GetBuildTime();
+}
+
+void CPUVolumeRenderer::RenderTile(int tile, int tilesX, const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame, int width, int height, XMFLOAT4* image, float* depth, SampleCounts& counts) const
+{
+	int x0 = (tile % tilesX) * m_tileSize, y0 = (tile / tilesX) * m_tileSize;
+	int x1 = std::min(x0 + m_tileSize, width), y1 = std::min(y0 + m_tileSize, height);
+
+	XMVECTOR origin = XMLoadFloat3(&camera.position);
+	for (int y = y0; y < y1; y++)
+	{
+		// pixel centres, like SV_POSITION
+		float v = (y + 0.5f) / height;
+		for (int x = x0; x < x1; x++)
+		{
+			float u = (x + 0.5f) / width;
+			XMVECTOR farPoint = XMVector3TransformCoord(XMVectorSet(u * 2.0f - 1.0f, (1.0f - v) * 2.0f - 1.0f, 1.0f, 1.0f), clipToWorld);
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Normalize(farPoint - origin));
+
+			float cloudDepth;
+			image[size_t(y) * width + x] = Trace(camera.position, direction, SceneDistance(u, v), x, y, frame, cloudDepth, counts);
+			if (depth)
+				depth[size_t(y) * width + x] = cloudDepth;
+		}
+	}
+}
+
+XMFLOAT4 CPUVolumeRenderer::Trace(const XMFLOAT3& ro, const XMFLOAT3& rd, float sceneDistance, int x, int y, const Frame& frame, float& depth, SampleCounts& counts) const
+{
+	depth = std::numeric_limits<float>::max();
+	float t0, t1;
+	if (!IntersectBox(ro, rd, t0, t1))
+		return XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	t1 = std::min(t1, sceneDistance);
+	if (t0 >= t1)
+		return XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	float cosTheta = -(rd.x * frame.toLight.x + rd.y * frame.toLight.y + rd.z * frame.toLight.z);
+	float scatter = Phase(kPhaseG, cosTheta) * frame.sigmaS;
+
+	float stride = (t1 - t0) / frame.maxSteps;
+	float transparency = 1.0f;
+	XMFLOAT3 result(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 voxelDirection(rd.x * frame.voxelScale.x, rd.y * frame.voxelScale.y, rd.z * frame.voxelScale.z);
+	// the cloud depth weighs every sample's distance by the transmittance it took away
+	float depthSum = 0.0f;
+	auto shadeAt = [&](float t, float density, float dt)
+	{
+		XMFLOAT3 p(ro.x + rd.x * t, ro.y + rd.y * t, ro.z + rd.z * t);
+		float before = transparency;
+		Shade(p, density, dt, scatter, frame, transparency, result, counts);
+		depthSum += (before - transparency) * t;
+	};
+	auto finish = [&]()
+	{
+		if (transparency < 1.0f - 1e-4f)
+			depth = depthSum / (1.0f - transparency);
+		return XMFLOAT4(result.x, result.y, result.z, transparency);
+	};
+
+	if (frame.adaptive)
+	{
+		// a sample weighs the ray from where the previous one stopped weighing to the next accepted sample, so
+		// it is shaded only once the next one is taken. A sample whose density differs from the pending one's by
+		// more than the edge threshold after a longer than smallest step is thrown away, and the ray goes back to
+		// cross the edge in smallest steps; a negative density means no sample is pending
+		const float minStep = stride * frame.minStepScale;
+		float t = t0 + stride * Jitter(frame, x, y, 0);
+		float covered = t0;
+		float pendingT = 0.0f, pendingDensity = -1.0f;
+		float refineUntil = 0.0f;
+		// an accepted sample moves at least the smallest step and at most every other sample is thrown away
+		int budget = 2 * (int(frame.maxSteps / frame.minStepScale) + 1);
+		while (budget > 0 && t < t1)
+		{
+			XMFLOAT3 p(ro.x + rd.x * t, ro.y + rd.y * t, ro.z + rd.z * t);
+
+			if (m_skipEmpty)
+			{
+				float skip = m_macrocells.SkipEmpty(ToVoxel(p, frame.voxelScale), voxelDirection, t1 - t);
+				if (skip > 0.0f)
+				{
+					// nothing is lost over empty space, so weighing starts again at the occupied macrocell
+					if (pendingDensity >= 0.0f)
+					{
+						shadeAt(pendingT, pendingDensity, t - covered);
+						if (transparency < frame.terminationThreshold)
+							return finish();
+					}
+					t = std::max(t + skip, std::nextafter(t, std::numeric_limits<float>::max()));
+					covered = t;
+					pendingDensity = -1.0f;
+					continue;
+				}
+			}
+
+			float density = EvalDensity(p);
+			counts.view++;
+			budget--;
+
+			float change = 0.0f;
+			if (pendingDensity >= 0.0f)
+			{
+				change = std::abs(density - pendingDensity);
+				if (change > frame.edgeThreshold && t - pendingT > minStep * 1.001f)
+				{
+					refineUntil = t;
+					t = pendingT + minStep;
+					continue;
+				}
+
+				shadeAt(pendingT, pendingDensity, t - covered);
+				if (transparency < frame.terminationThreshold)
+					return finish();
+				covered = t;
+			}
+			pendingT = t;
+			pendingDensity = density;
+
+			// large steps where the density changed little since the previous sample, small ones across edges, near
+			// the camera and up to where an edge was found
+			float scale = frame.maxStepScale + (frame.minStepScale - frame.maxStepScale) * Saturate(change / frame.edgeThreshold);
+			scale *= frame.minStepScale + (1.0f - frame.minStepScale) * Saturate(t / frame.nearDistance);
+			scale = t < refineUntil ? frame.minStepScale : std::min(std::max(scale, frame.minStepScale), frame.maxStepScale);
+			t += stride * scale;
+		}
+
+		if (pendingDensity >= 0.0f)
+			shadeAt(pendingT, pendingDensity, t1 - covered);
+		return finish();
+	}
+
+	for (int n = 0; n < frame.maxSteps; n++)
+	{
+		// the shader hashes the screen position in [0, 1), which truncates to zero, so unless it is hashed per pixel
+		// the jitter only varies per step
+		float t = t0 + stride * (n + Jitter(frame, x, y, n));
+		XMFLOAT3 p(ro.x + rd.x * t, ro.y + rd.y * t, ro.z + rd.z * t);
+
+		if (m_skipEmpty)
+		{
+			float skip = m_macrocells.SkipEmpty(ToVoxel(p, frame.voxelScale), voxelDirection, t1 - t);
+			if (skip > 0.0f)
+			{
+				// the jitter keeps every sample within [0.15, 0.85] of its step, so the steps before this one all
+				// land short of the next occupied macrocell
+				n = std::max(n, int(std::ceil((t + skip - t0) / stride - 0.85f)) - 1);
+				continue;
+			}
+		}
+
+		float density = EvalDensity(p);
+		counts.view++;
+		shadeAt(t, density, stride);
+
+		if (transparency < frame.terminationThreshold)
+			break;
+	}
+
+	return finish();
+}
+
+void CPUVolumeRenderer::Shade(const XMFLOAT3& p, float density, float dt, float scatter, const Frame& frame, float& transparency, XMFLOAT3& result, SampleCounts& counts) const
+{
+	transparency *= std::exp(-dt * frame.sigmaT * density);
+
+	float ambient = density * dt * transparency;
+	result.x += frame.ambient.x * ambient;
+	result.y += frame.ambient.y * ambient;
+	result.z += frame.ambient.z * ambient;
+
+	if (density <= 0.0f)
+		return;
+
+	float depth;
+	if (m_useSunVolume)
+	{
+		depth = m_sunVolume.SampleDepth(p);
+		counts.light++;
+	}
+	else
+	{
+		depth = MarchLight(p, frame, frame.maxLightSteps, counts.light);
+	}
+
+	float inScatter = std::exp(-depth * frame.sigmaT) * scatter * transparency * dt * density;
+	result.x += frame.lightColor.x * inScatter;
+	result.y += frame.lightColor.y * inScatter;
+	result.z += frame.lightColor.z * inScatter;
+}
+
+float CPUVolumeRenderer::MarchLight(const XMFLOAT3& p, const Frame& frame, int steps, uint64_t& samples) const
+{
+	float lightT0, lightT1;
+	if (!IntersectBox(p, frame.toLight, lightT0, lightT1))
+		return 0.0f;
+
+	float lightStride = lightT1 / steps;
+	float tau = 0.0f;
+	for (int nl = 0; nl < steps; nl++)
+	{
+		float tl = lightStride * (nl + 0.5f);
+		XMFLOAT3 q(p.x + frame.toLight.x * tl, p.y + frame.toLight.y * tl, p.z + frame.toLight.z * tl);
+		if (m_skipEmpty)
+		{
+			float skip = m_macrocells.SkipEmpty(ToVoxel(q, frame.voxelScale), frame.toLightVoxel, lightT1 - tl);
+			if (skip > 0.0f)
+			{
+				nl = std::max(nl, int(std::ceil((tl + skip) / lightStride - 0.5f)) - 1);
+				continue;
+			}
+		}
+		tau += EvalDensity(q);
+		samples++;
+	}
+	return tau * lightStride;
+}
+
+float CPUVolumeRenderer::EvalDensity(const XMFLOAT3& position) const
+{
+	// trilinear over the interior samples, which sit at integer voxel coordinates; the ghost layer is skipped
+	const int rx = m_densityResolution.x - 2, ry = m_densityResolution.y - 2, rz = m_densityResolution.z - 2;
+	const float size = kBoxMax - kBoxMin;
+	float u = (position.x - kBoxMin) / size, v = (position.y - kBoxMin) / size, w = (position.z - kBoxMin) / size;
+	float px = u * rx, py = v * ry, pz = w * rz;
+	int xi = int(std::floor(px)), yi = int(std::floor(py)), zi = int(std::floor(pz));
+
+	float value = 0.0f;
+	for (int i = 0; i < 2; i++)
+	{
+		float wx = 1.0f - std::abs(px - (xi + i));
+		int x = std::min(std::max(xi + i, 0), rx - 1) + 1;
+		for (int j = 0; j < 2; j++)
+		{
+			float wy = 1.0f - std::abs(py - (yi + j));
+			int y = std::min(std::max(yi + j, 0), ry - 1) + 1;
+			for (int k = 0; k < 2; k++)
+			{
+				float wz = 1.0f - std::abs(pz - (zi + k));
+				int z = std::min(std::max(zi + k, 0), rz - 1) + 1;
+				value += wx * wy * wz * m_density[(size_t(z) * m_densityResolution.y + y) * m_densityResolution.x + x];
+			}
+		}
+	}
+
+	return Saturate(value * SampleNoise(u, v, w));
+}
+
+float CPUVolumeRenderer::Jitter(const Frame& frame, int x, int y, int n)
+{
+	// blue noise moves the whole ray by one offset, which is what carries its distribution over to the error
+	if (frame.blueNoise)
+		return frame.blueNoise->Sample(x, y, frame.frameIndex) * 0.7f + 0.15f;
+	if (!frame.pixelJitter)
+		x = y = 0;
+	return StepJitter(x, y, n, frame.jitterOffset);
+}
+
+float CPUVolumeRenderer::SampleNoise(float u, float v, float w) const
+{
+	const int n = m_noiseResolution;
+	float px = Saturate(u) * (n - 1), py = Saturate(v) * (n - 1), pz = Saturate(w) * (n - 1);
+	int x = int(px), y = int(py), z = int(pz);
+	float fx = px - x, fy = py - y, fz = pz - z;
+	int x1 = std::min(x + 1, n - 1), y1 = std::min(y + 1, n - 1), z1 = std::min(z + 1, n - 1);
+
+	auto at = [&](int xi, int yi, int zi) { return m_noise[(size_t(zi) * n + yi) * n + xi]; };
+	float c00 = at(x, y, z) * (1.0f - fx) + at(x1, y, z) * fx;
+	float c10 = at(x, y1, z) * (1.0f - fx) + at(x1, y1, z) * fx;
+	float c01 = at(x, y, z1) * (1.0f - fx) + at(x1, y, z1) * fx;
+	float c11 = at(x, y1, z1) * (1.0f - fx) + at(x1, y1, z1) * fx;
+	float c0 = c00 * (1.0f - fy) + c10 * fy;
+	float c1 = c01 * (1.0f - fy) + c11 * fy;
+	return c0 * (1.0f - fz) + c1 * fz;
+}
+
+float CPUVolumeRenderer::SceneDistance(float u, float v) const
+{
+	if (m_sceneDepth.empty())
+		return std::numeric_limits<float>::max();
+
+	int x = std::min(int(u * m_sceneDepthWidth), m_sceneDepthWidth - 1);
+	int y = std::min(int(v * m_sceneDepthHeight), m_sceneDepthHeight - 1);
+	return m_sceneDepth[size_t(y) * m_sceneDepthWidth + x] * kZFar;
+}
+
+bool CPUVolumeRenderer::WritePFM(const std::string& filename, const std::vector<XMFLOAT4>& image, int width, int height)
+{
+	if (image.size() != size_t(width) * height)
+		return false;
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	// a negative scale marks little-endian data; rows run bottom to top
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	std::vector<float> row(size_t(width) * 3);
+	for (int y = height - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const XMFLOAT4& pixel = image[size_t(y) * width + x];
+			row[x * 3 + 0] = pixel.x;
+			row[x * 3 + 1] = pixel.y;
+			row[x * 3 + 2] = pixel.z;
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return bool(file);
+}
+
+bool CPUVolumeRenderer::WriteFrame(const std::string& filename, const CPUVolumeFrame& frame)
+{
+	const XMINT3& resolution = frame.densityResolution;
+	if (frame.density.size() != size_t(resolution.x) * resolution.y * resolution.z ||
+		frame.sceneDepth.size() != size_t(frame.sceneDepthWidth) * frame.sceneDepthHeight)
+		return false;
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	// ints and floats as 4 bytes, bools as 1, matrices as 16 floats row by row
+	auto write = [&](const auto& value)
+	{
+		using Type = std::decay_t<decltype(value)>;
+		if constexpr (std::is_same_v<Type, bool>)
+		{
+			uint8_t byte = value ? 1 : 0;
+			file.write(reinterpret_cast<const char*>(&byte), 1);
+		}
+		else if constexpr (std::is_same_v<Type, XMMATRIX>)
+		{
+			XMFLOAT4X4 matrix;
+			XMStoreFloat4x4(&matrix, value);
+			file.write(reinterpret_cast<const char*>(&matrix), sizeof(matrix));
+		}
+		else
+		{
+			static_assert(sizeof(Type) == 4, "frame fields are 4 bytes");
+			file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+	};
+	file.write(kFrameMagic, sizeof(kFrameMagic));
+	VisitFrame(frame, write);
+	file.write(reinterpret_cast<const char*>(frame.density.data()), frame.density.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(frame.sceneDepth.data()), frame.sceneDepth.size() * sizeof(float));
+	return bool(file);
+}
+
+bool CPUVolumeRenderer::ReadFrame(const std::string& filename, CPUVolumeFrame& frame)
+{
+	std::ifstream file(filename, std::ios::binary);
+	char magic[sizeof(kFrameMagic)];
+	if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, kFrameMagic, sizeof(magic)) != 0)
+		return false;
+
+	auto read = [&](auto& value)
+	{
+		using Type = std::decay_t<decltype(value)>;
+		if constexpr (std::is_same_v<Type, bool>)
+		{
+			uint8_t byte = 0;
+			file.read(reinterpret_cast<char*>(&byte), 1);
+			value = byte != 0;
+		}
+		else if constexpr (std::is_same_v<Type, XMMATRIX>)
+		{
+			XMFLOAT4X4 matrix;
+			file.read(reinterpret_cast<char*>(&matrix), sizeof(matrix));
+			value = XMLoadFloat4x4(&matrix);
+		}
+		else
+		{
+			static_assert(sizeof(Type) == 4, "frame fields are 4 bytes");
+			file.read(reinterpret_cast<char*>(&value), sizeof(value));
+		}
+	};
+	VisitFrame(frame, read);
+
+	const XMINT3& resolution = frame.densityResolution;
+	if (!file || resolution.x <= 0 || resolution.y <= 0 || resolution.z <= 0 || frame.width <= 0 || frame.height <= 0 ||
+		frame.sceneDepthWidth < 0 || frame.sceneDepthHeight < 0)
+		return false;
+
+	frame.density.resize(size_t(resolution.x) * resolution.y * resolution.z);
+	frame.sceneDepth.resize(size_t(frame.sceneDepthWidth) * frame.sceneDepthHeight);
+	file.read(reinterpret_cast<char*>(frame.density.data()), frame.density.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(frame.sceneDepth.data()), frame.sceneDepth.size() * sizeof(float));
+	return bool(file);
+}
+
+void CPUVolumeRenderer::WriteBenchmark(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	file << "path,skip_empty,sun_volume,width,height,tile_size,tiles,threads,samples,render_ms,megasamples_per_second,speedup,max_error,sun_volume_build_ms\n";
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	CPUVolumePath path = m_path;
+	bool skipEmpty = m_skipEmpty, useSunVolume = m_useSunVolume, useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	int tileSize = m_tileSize, divisor = m_resolutionDivisor;
+	std::vector<XMFLOAT4> reference, image;
+	m_useFroxels = false;
+	m_useImpostors = false;
+	m_resolutionDivisor = 1;
+
+	// best of a few runs, so a frame interrupted by the game's own work does not count
+	const int runs = 3;
+	auto measure = [&](int width, int height, ThreadPool* threads, std::vector<XMFLOAT4>& out)
+	{
+		CPUVolumeStats best;
+		for (int i = 0; i < runs; i++)
+		{
+			Render(camera, settings, width, height, out, threads);
+			if (i == 0 || m_stats.renderTime < best.renderTime)
+				best = m_stats;
+		}
+		return best;
+	};
+	// speedup over the scalar path on one thread without skipping, largest difference of any channel from its image
+	auto write = [&](const CPUVolumeStats& stats, double scalarTime, const std::vector<XMFLOAT4>& out)
+	{
+		float maxError = 0.0f;
+		for (size_t i = 0; i < out.size() && i < reference.size(); i++)
+		{
+			maxError = std::max(maxError, std::max(std::abs(out[i].x - reference[i].x), std::abs(out[i].y - reference[i].y)));
+			maxError = std::max(maxError, std::max(std::abs(out[i].z - reference[i].z), std::abs(out[i].w - reference[i].w)));
+		}
+		file << GetPathName(stats.path) << "," << stats.skipEmpty << "," << stats.sunVolume << "," << stats.width << "," << stats.height << "," << m_tileSize << "," << stats.tiles << "," << stats.threads << ","
+			<< stats.samples << "," << stats.renderTime << "," << stats.MegasamplesPerSecond() << ","
+			<< (stats.renderTime > 0.0 ? scalarTime / stats.renderTime : 0.0) << "," << maxError << ","
+			<< (stats.sunVolume ? m_sunVolume.GetBuildTime() : 0.0) << "\n";
+	};
+
+	const CPUVolumePath paths[] = { CPUVolumePath::Scalar, CPUVolumePath::Avx2, CPUVolumePath::Avx512 };
+	const int resolutions[][2] = { { 320, 180 }, { 640, 360 }, { 1280, 720 } };
+	for (const auto& resolution : resolutions)
+	{
+		m_tileSize = tileSize;
+		m_path = CPUVolumePath::Scalar;
+		m_skipEmpty = false;
+		m_useSunVolume = false;
+		CPUVolumeStats scalar = measure(resolution[0], resolution[1], nullptr, reference);
+		write(scalar, scalar.renderTime, reference);
+
+		// the sample counts with and without skipping give the samples saved on this frame
+		for (CPUVolumePath candidate : paths)
+		{
+			if (!IsPathSupported(candidate))
+				continue;
+			m_path = candidate;
+			for (int skip = 0; skip < 2; skip++)
+			{
+				m_skipEmpty = skip != 0;
+				if (candidate != CPUVolumePath::Scalar || m_skipEmpty)
+					write(measure(resolution[0], resolution[1], nullptr, image), scalar.renderTime, image);
+				if (pool)
+					write(measure(resolution[0], resolution[1], pool, image), scalar.renderTime, image);
+			}
+
+			// the sun volume is built by the first run and reused by the others, as between frames
+			m_useSunVolume = true;
+			write(measure(resolution[0], resolution[1], nullptr, image), scalar.renderTime, image);
+			if (pool)
+				write(measure(resolution[0], resolution[1], pool, image), scalar.renderTime, image);
+			m_useSunVolume = false;
+		}
+
+		// the tile size trades cache locality against how evenly the tiles spread over the threads
+		if (!pool)
+			continue;
+		m_path = path;
+		m_skipEmpty = skipEmpty;
+		m_useSunVolume = useSunVolume;
+		const int tileSizes[] = { 8, 32, 64 };
+		for (int size : tileSizes)
+		{
+			m_tileSize = size;
+			write(measure(resolution[0], resolution[1], pool, image), scalar.renderTime, image);
+		}
+	}
+
+	m_path = path;
+	m_skipEmpty = skipEmpty;
+	m_useSunVolume = useSunVolume;
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_tileSize = tileSize;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteSkipEmptyCheck(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	file << "case,path,jitter,sun_volume,count,differing,max_error,bit_exact\n";
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	CPUVolumePath path = m_path;
+	bool skipEmpty = m_skipEmpty, useSunVolume = m_useSunVolume, useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	int divisor = m_resolutionDivisor;
+	m_useFroxels = false;
+	m_useImpostors = false;
+	m_resolutionDivisor = 1;
+
+	auto write = [&](const char* name, const char* pathName, const char* jitter, bool sunVolume, size_t count, size_t differing, float maxError)
+	{
+		file << name << "," << pathName << "," << jitter << "," << sunVolume << "," << count << "," << differing << "," << maxError << "," << (differing == 0) << "\n";
+	};
+
+	// the grid Update kept against one built from scratch over the same samples
+	{
+		MacrocellGrid fresh;
+		fresh.Build(m_density.data(), m_densityResolution, pool);
+		XMINT3 cells = fresh.GetCellCount();
+		size_t count = size_t(cells.x) * cells.y * cells.z, differing = 0;
+		float maxError = 0.0f;
+		bool sameLayout = m_macrocells.GetCellCount().x == cells.x && m_macrocells.GetCellCount().y == cells.y && m_macrocells.GetCellCount().z == cells.z;
+		for (int z = 0; z < cells.z && sameLayout; z++)
+		{
+			for (int y = 0; y < cells.y; y++)
+			{
+				for (int x = 0; x < cells.x; x++)
+				{
+					float minimum = m_macrocells.GetMinimum(x, y, z), maximum = m_macrocells.GetMaximum(x, y, z);
+					if (minimum != fresh.GetMinimum(x, y, z) || maximum != fresh.GetMaximum(x, y, z))
+						differing++;
+					maxError = std::max(maxError, std::max(std::abs(minimum - fresh.GetMinimum(x, y, z)), std::abs(maximum - fresh.GetMaximum(x, y, z))));
+				}
+			}
+		}
+		write("macrocells", "", "", false, count, sameLayout ? differing : count, maxError);
+	}
+
+	// skipping only leaves out samples that would add nothing, so with even steps the images must match bit for bit
+	const int width = 320, height = 180;
+	const size_t pixels = size_t(width) * height;
+	std::vector<XMFLOAT4> reference, image;
+	CPUVolumeSettings even = settings;
+	even.adaptive = false;
+	const CPUVolumePath paths[] = { CPUVolumePath::Scalar, CPUVolumePath::Avx2, CPUVolumePath::Avx512 };
+	const char* jitters[] = { "step", "pixel", "blue_noise" };
+	for (CPUVolumePath candidate : paths)
+	{
+		if (!IsPathSupported(candidate))
+			continue;
+		m_path = candidate;
+		for (int jitter = 0; jitter < 3; jitter++)
+		{
+			if (jitter == 2 && (!m_blueNoise || m_blueNoise->IsEmpty()))
+				continue;
+			even.pixelJitter = jitter == 1;
+			even.blueNoise = jitter == 2;
+			for (int sunVolume = 0; sunVolume < 2; sunVolume++)
+			{
+				m_useSunVolume = sunVolume != 0;
+				m_skipEmpty = false;
+				Render(camera, even, width, height, reference, pool);
+				m_skipEmpty = true;
+				Render(camera, even, width, height, image, pool);
+
+				size_t differing = 0;
+				float maxError = 0.0f;
+				for (size_t i = 0; i < pixels; i++)
+				{
+					if (std::memcmp(&image[i], &reference[i], sizeof(XMFLOAT4)) != 0)
+						differing++;
+					maxError = std::max(maxError, std::max(std::abs(image[i].x - reference[i].x), std::abs(image[i].y - reference[i].y)));
+					maxError = std::max(maxError, std::max(std::abs(image[i].z - reference[i].z), std::abs(image[i].w - reference[i].w)));
+				}
+				write("image", GetPathName(candidate), jitters[jitter], m_useSunVolume, pixels, differing, maxError);
+			}
+		}
+	}
+
+	m_path = path;
+	m_skipEmpty = skipEmpty;
+	m_useSunVolume = useSunVolume;
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteAdaptiveComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	file << "march,min_step_scale,max_step_scale,edge_threshold,near_distance,termination_threshold,width,height,view_samples_per_pixel,samples,render_ms,speedup,"
+		<< "mean_error,max_error,fine_mean_error,fine_max_error\n";
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	const int width = 640, height = 360;
+	std::vector<XMFLOAT4> reference, fine, image;
+
+	// best of a few runs, as in WriteBenchmark
+	const int runs = 3;
+	auto measure = [&](const CPUVolumeSettings& candidate, std::vector<XMFLOAT4>& out)
+	{
+		CPUVolumeStats best;
+		for (int i = 0; i < runs; i++)
+		{
+			Render(camera, candidate, width, height, out, pool);
+			if (i == 0 || m_stats.renderTime < best.renderTime)
+				best = m_stats;
+		}
+		return best;
+	};
+	// mean and largest difference over every channel of every pixel
+	auto compare = [](const std::vector<XMFLOAT4>& out, const std::vector<XMFLOAT4>& against, double& mean, float& maximum)
+	{
+		double sum = 0.0;
+		maximum = 0.0f;
+		for (size_t i = 0; i < out.size() && i < against.size(); i++)
+		{
+			const float errors[4] = { std::abs(out[i].x - against[i].x), std::abs(out[i].y - against[i].y), std::abs(out[i].z - against[i].z), std::abs(out[i].w - against[i].w) };
+			for (float error : errors)
+			{
+				sum += error;
+				maximum = std::max(maximum, error);
+			}
+		}
+		mean = against.empty() ? 0.0 : sum / (4.0 * against.size());
+	};
+	// errors against the even march and against a march with eight times its steps, which tells whether a
+	// difference from the even march is a loss or the even march's own error
+	auto write = [&](const CPUVolumeSettings& candidate, const CPUVolumeStats& stats, double baseTime, const std::vector<XMFLOAT4>& out)
+	{
+		double mean, fineMean;
+		float maximum, fineMaximum;
+		compare(out, reference, mean, maximum);
+		compare(out, fine, fineMean, fineMaximum);
+		file << (candidate.adaptive ? "adaptive" : "even") << "," << candidate.minStepScale << "," << candidate.maxStepScale << "," << candidate.edgeThreshold << ","
+			<< candidate.nearDistance << "," << candidate.terminationThreshold << "," << stats.width << "," << stats.height << "," << stats.ViewSamplesPerPixel() << ","
+			<< stats.samples << "," << stats.renderTime << "," << (stats.renderTime > 0.0 ? baseTime / stats.renderTime : 0.0) << ","
+			<< mean << "," << maximum << "," << fineMean << "," << fineMaximum << "\n";
+	};
+
+	// the path, skipping and sun volume stay as set, so only the march differs from the baseline
+	bool useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	int divisor = m_resolutionDivisor;
+	m_useFroxels = false;
+	m_useImpostors = false;
+	m_resolutionDivisor = 1;
+	CPUVolumeSettings candidate = settings;
+	candidate.adaptive = false;
+	candidate.maxSteps = settings.maxSteps * 8;
+	Render(camera, candidate, width, height, fine, pool);
+	candidate.maxSteps = settings.maxSteps;
+	CPUVolumeStats base = measure(candidate, reference);
+	write(candidate, base, base.renderTime, reference);
+
+	candidate.adaptive = true;
+	const float maxScales[] = { 2.0f, 4.0f, 8.0f };
+	const float edgeThresholds[] = { 0.02f, 0.05f, 0.1f };
+	for (float maxScale : maxScales)
+	{
+		for (float edgeThreshold : edgeThresholds)
+		{
+			candidate.maxStepScale = maxScale;
+			candidate.edgeThreshold = edgeThreshold;
+			write(candidate, measure(candidate, image), base.renderTime, image);
+		}
+	}
+
+	// a looser termination threshold ends dense rays earlier at the cost of the light behind them
+	candidate.maxStepScale = settings.maxStepScale;
+	candidate.edgeThreshold = settings.edgeThreshold;
+	const float terminationThresholds[] = { 1e-2f, 5e-2f };
+	for (float threshold : terminationThresholds)
+	{
+		candidate.terminationThreshold = threshold;
+		write(candidate, measure(candidate, image), base.renderTime, image);
+	}
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteFroxelComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	file << "method,width,height,froxels_x,froxels_y,froxels_z,render_ms,froxel_build_ms,samples,speedup,mean_error,max_error\n";
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	bool useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	XMINT3 froxelResolution = m_froxelResolution;
+	int divisor = m_resolutionDivisor;
+	std::vector<XMFLOAT4> reference, image;
+	m_useImpostors = false;
+	m_resolutionDivisor = 1;
+
+	// best of a few runs, as in WriteBenchmark
+	const int runs = 3;
+	auto measure = [&](int width, int height, std::vector<XMFLOAT4>& out)
+	{
+		CPUVolumeStats best;
+		for (int i = 0; i < runs; i++)
+		{
+			Render(camera, settings, width, height, out, pool);
+			if (i == 0 || m_stats.renderTime < best.renderTime)
+				best = m_stats;
+		}
+		return best;
+	};
+	auto write = [&](const CPUVolumeStats& stats, double marchTime, const std::vector<XMFLOAT4>& out)
+	{
+		double sum = 0.0;
+		float maxError = 0.0f;
+		for (size_t i = 0; i < out.size() && i < reference.size(); i++)
+		{
+			const float errors[4] = { std::abs(out[i].x - reference[i].x), std::abs(out[i].y - reference[i].y), std::abs(out[i].z - reference[i].z), std::abs(out[i].w - reference[i].w) };
+			for (float error : errors)
+			{
+				sum += error;
+				maxError = std::max(maxError, error);
+			}
+		}
+		XMINT3 froxels = stats.froxels ? m_froxelResolution : XMINT3(0, 0, 0);
+		file << (stats.froxels ? "froxels" : "ray_march") << "," << stats.width << "," << stats.height << "," << froxels.x << "," << froxels.y << "," << froxels.z << ","
+			<< stats.renderTime << "," << stats.froxelTime << "," << stats.samples << "," << (stats.renderTime > 0.0 ? marchTime / stats.renderTime : 0.0) << ","
+			<< (reference.empty() ? 0.0 : sum / (4.0 * reference.size())) << "," << maxError << "\n";
+	};
+
+	// the ray march keeps the path, skipping and sun volume as set; the froxels share the skipping and sun volume
+	const int resolutions[][2] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+	const XMINT3 grids[] = { XMINT3(80, 45, 32), XMINT3(160, 90, 64), XMINT3(320, 180, 128) };
+	for (const auto& resolution : resolutions)
+	{
+		m_useFroxels = false;
+		CPUVolumeStats march = measure(resolution[0], resolution[1], reference);
+		write(march, march.renderTime, reference);
+
+		m_useFroxels = true;
+		for (const XMINT3& grid : grids)
+		{
+			m_froxelResolution = grid;
+			write(measure(resolution[0], resolution[1], image), march.renderTime, image);
+		}
+	}
+
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_froxelResolution = froxelResolution;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteTemporalComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	bool useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	int divisor = m_resolutionDivisor;
+	m_useFroxels = false;
+	m_useImpostors = false;
+	m_resolutionDivisor = 1;
+
+	// even steps, so that the step count is what sets the noise
+	CPUVolumeSettings jittered = settings;
+	jittered.adaptive = false;
+	jittered.pixelJitter = true;
+
+	const int width = 640, height = 360;
+	const int frames = 16;
+	// the camera turns about the volume's centre a little every frame and ends at the given view
+	auto orbit = [&](int frame)
+	{
+		CPUVolumeCamera moved = camera;
+		XMMATRIX rotation = XMMatrixRotationY((frame - (frames - 1)) * 0.003f);
+		moved.viewInv = camera.viewInv * rotation;
+		XMStoreFloat3(&moved.position, XMVector3TransformCoord(XMLoadFloat3(&camera.position), rotation));
+		return moved;
+	};
+
+	// few steps are biased as well as noisy, and accumulating only removes the noise, so every configuration runs a
+	// few times with the jitter shifted and its noise is the spread of a pixel across the runs; the error against
+	// a finely stepped frame is reported beside it
+	const int runs = 4;
+	auto runOffset = [](int run)
+	{
+		float offset = run * 0.7548777f;
+		return offset - std::floor(offset);
+	};
+
+	std::vector<XMFLOAT4> reference;
+	CPUVolumeSettings fine = settings;
+	fine.adaptive = false;
+	fine.maxSteps = 256;
+	Render(camera, fine, width, height, reference, pool);
+
+	struct Result
+	{
+		int steps = 0;
+		double samplesPerPixel = 0.0, renderTime = 0.0, accumulateTime = 0.0; // per frame
+		double error = 0.0, noise = 0.0;
+	};
+	auto measure = [&](const std::vector<std::vector<XMFLOAT4>>& images, Result& result)
+	{
+		const size_t pixels = reference.size();
+		double squaredError = 0.0, variance = 0.0;
+		for (size_t i = 0; i < pixels; i++)
+		{
+			const float* want = &reference[i].x;
+			for (int c = 0; c < 4; c++)
+			{
+				double sum = 0.0, squares = 0.0;
+				for (const std::vector<XMFLOAT4>& image : images)
+				{
+					double value = (&image[i].x)[c];
+					sum += value;
+					squares += value * value;
+					squaredError += (value - want[c]) * (value - want[c]);
+				}
+				double mean = sum / images.size();
+				variance += std::max(squares / images.size() - mean * mean, 0.0) * images.size() / (images.size() - 1);
+			}
+		}
+		result.error = std::sqrt(squaredError / (4.0 * pixels * images.size()));
+		result.noise = std::sqrt(variance / (4.0 * pixels));
+	};
+
+	file << "method,steps,frames,view_samples_per_pixel,render_ms,accumulate_ms,rmse,noise,equal_noise_steps,equal_noise_samples_per_pixel,sample_saving\n";
+
+	// single frames with the jitter hashed per pixel, which turns the banding of few steps into noise
+	const int singleSteps[] = { 4, 6, 8, 12, 16, 24, 32, 48, 64 };
+	std::vector<Result> singles;
+	std::vector<std::vector<XMFLOAT4>> images(runs);
+	for (int steps : singleSteps)
+	{
+		Result result;
+		result.steps = steps;
+		jittered.maxSteps = steps;
+		for (int run = 0; run < runs; run++)
+		{
+			jittered.jitterOffset = runOffset(run);
+			Render(camera, jittered, width, height, images[run], pool);
+			result.samplesPerPixel += m_stats.ViewSamplesPerPixel() / runs;
+			result.renderTime += m_stats.renderTime / runs;
+		}
+		measure(images, result);
+		singles.push_back(result);
+		file << "single," << steps << ",1," << result.samplesPerPixel << "," << result.renderTime << ",0," << result.error << "," << result.noise << ","
+			<< steps << "," << result.samplesPerPixel << ",0\n";
+	}
+
+	// noise falls about as a power of the step count, so the single frame with a given noise is found by
+	// interpolating in log-log between the two closest, or extrapolating from the last two
+	auto equalNoise = [&](double noise, double& steps, double& samplesPerPixel)
+	{
+		size_t i = 1;
+		while (i + 1 < singles.size() && singles[i].noise > noise)
+			i++;
+		const Result& a = singles[i - 1];
+		const Result& b = singles[i];
+		double f = (std::log(noise) - std::log(a.noise)) / (std::log(b.noise) - std::log(a.noise));
+		steps = std::exp(std::log(double(a.steps)) + (std::log(double(b.steps)) - std::log(double(a.steps))) * f);
+		samplesPerPixel = std::exp(std::log(a.samplesPerPixel) + (std::log(b.samplesPerPixel) - std::log(a.samplesPerPixel)) * f);
+	};
+
+	// the same jitter over the frames of the orbit, rotated every frame and accumulated
+	const int temporalSteps[] = { 2, 4, 8 };
+	TemporalAccumulator accumulator;
+	std::vector<XMFLOAT4> image;
+	std::vector<float> depth;
+	for (int steps : temporalSteps)
+	{
+		Result result;
+		result.steps = steps;
+		jittered.maxSteps = steps;
+		for (int run = 0; run < runs; run++)
+		{
+			accumulator.Reset();
+			for (int f = 0; f < frames; f++)
+			{
+				CPUVolumeCamera moved = orbit(f);
+				float offset = accumulator.GetJitterOffset() + runOffset(run);
+				jittered.jitterOffset = offset - std::floor(offset);
+				Render(moved, jittered, width, height, image, pool, &depth);
+				accumulator.Accumulate(moved, image, depth, width, height, pool);
+				result.samplesPerPixel += m_stats.ViewSamplesPerPixel() / (runs * frames);
+				result.renderTime += m_stats.renderTime / (runs * frames);
+				result.accumulateTime += accumulator.GetAccumulateTime() / (runs * frames);
+			}
+			images[run] = accumulator.GetResult();
+		}
+		measure(images, result);
+
+		double equalSteps = 0.0, equalSamples = 0.0;
+		if (singles.size() > 1 && result.noise > 0.0)
+			equalNoise(result.noise, equalSteps, equalSamples);
+		file << "temporal," << steps << "," << frames << "," << result.samplesPerPixel << "," << result.renderTime << "," << result.accumulateTime << ","
+			<< result.error << "," << result.noise << "," << equalSteps << "," << equalSamples << "," << (equalSamples > 0.0 ? 1.0 - result.samplesPerPixel / equalSamples : 0.0) << "\n";
+	}
+
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteUpsampleComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	file << "divisor,filter,width,height,render_ms,upsample_ms,speedup,view_samples_per_pixel,mean_error,max_error,edge_pixels,edge_mean_error\n";
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	bool useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	int divisor = m_resolutionDivisor;
+	UpsampleFilter filter = m_upsampleFilter;
+	std::vector<XMFLOAT4> reference, image;
+	m_useFroxels = false;
+	m_useImpostors = false;
+
+	// best of a few runs, as in WriteBenchmark
+	const int runs = 3;
+	auto measure = [&](int width, int height, std::vector<XMFLOAT4>& out)
+	{
+		CPUVolumeStats best;
+		for (int i = 0; i < runs; i++)
+		{
+			Render(camera, settings, width, height, out, pool);
+			if (i == 0 || m_stats.renderTime < best.renderTime)
+				best = m_stats;
+		}
+		return best;
+	};
+
+	const int resolutions[][2] = { { 1280, 720 }, { 1920, 1080 } };
+	for (const auto& resolution : resolutions)
+	{
+		const int width = resolution[0], height = resolution[1];
+
+		// pixels next to a depth discontinuity, where upsampling without the depth bleeds across silhouettes
+		std::vector<uint8_t> edges(size_t(width) * height, 0);
+		int edgeCount = 0;
+		if (!m_sceneDepth.empty())
+		{
+			const float threshold = m_upsampler.GetDepthThreshold();
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					float centre = SceneDistance((x + 0.5f) / width, (y + 0.5f) / height);
+					float nearest = centre, farthest = centre;
+					for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ny++)
+					{
+						for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); nx++)
+						{
+							float d = SceneDistance((nx + 0.5f) / width, (ny + 0.5f) / height);
+							nearest = std::min(nearest, d);
+							farthest = std::max(farthest, d);
+						}
+					}
+					if (farthest - nearest > threshold * nearest)
+					{
+						edges[size_t(y) * width + x] = 1;
+						edgeCount++;
+					}
+				}
+			}
+		}
+
+		auto write = [&](const CPUVolumeStats& stats, double fullTime, const std::vector<XMFLOAT4>& out)
+		{
+			double sum = 0.0, edgeSum = 0.0;
+			float maxError = 0.0f;
+			for (size_t i = 0; i < out.size() && i < reference.size(); i++)
+			{
+				const float errors[4] = { std::abs(out[i].x - reference[i].x), std::abs(out[i].y - reference[i].y), std::abs(out[i].z - reference[i].z), std::abs(out[i].w - reference[i].w) };
+				for (float error : errors)
+				{
+					sum += error;
+					maxError = std::max(maxError, error);
+					if (edges[i])
+						edgeSum += error;
+				}
+			}
+			file << stats.resolutionDivisor << "," << (stats.resolutionDivisor > 1 ? DepthAwareUpsampler::GetFilterName(stats.upsample) : "none") << ","
+				<< width << "," << height << "," << stats.renderTime << "," << stats.upsampleTime << "," << (stats.renderTime > 0.0 ? fullTime / stats.renderTime : 0.0) << ","
+				<< stats.ViewSamplesPerPixel() << "," << (reference.empty() ? 0.0 : sum / (4.0 * reference.size())) << "," << maxError << ","
+				<< edgeCount << "," << (edgeCount > 0 ? edgeSum / (4.0 * edgeCount) : 0.0) << "\n";
+		};
+
+		m_resolutionDivisor = 1;
+		CPUVolumeStats full = measure(width, height, reference);
+		write(full, full.renderTime, reference);
+
+		const UpsampleFilter filters[] = { UpsampleFilter::Bilinear, UpsampleFilter::NearestDepth, UpsampleFilter::JointBilateral };
+		for (int reduced : { 2, 4 })
+		{
+			m_resolutionDivisor = reduced;
+			for (UpsampleFilter upsample : filters)
+			{
+				m_upsampleFilter = upsample;
+				write(measure(width, height, image), full.renderTime, image);
+			}
+		}
+	}
+
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_resolutionDivisor = divisor;
+	m_upsampleFilter = filter;
+}
+
+void CPUVolumeRenderer::WriteBlueNoiseComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty() || !m_blueNoise || m_blueNoise->IsEmpty())
+		return;
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	bool useFroxels = m_useFroxels, useImpostors = m_useImpostors;
+	int divisor = m_resolutionDivisor;
+	m_useFroxels = false;
+	m_useImpostors = false;
+	m_resolutionDivisor = 1;
+
+	const int width = 640, height = 360;
+	const size_t pixels = size_t(width) * height;
+	const int frames = 8;
+
+	std::vector<XMFLOAT4> reference;
+	CPUVolumeSettings fine = settings;
+	fine.adaptive = false;
+	fine.blueNoise = false;
+	fine.maxSteps = 256;
+	Render(camera, fine, width, height, reference, pool);
+
+	auto rmse = [&](const std::vector<XMFLOAT4>& image, const std::vector<XMFLOAT4>& from)
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < pixels; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				double d = (&image[i].x)[c] - (&from[i].x)[c];
+				sum += d * d;
+			}
+		}
+		return std::sqrt(sum / (4.0 * pixels));
+	};
+
+	// the eye averages neighbouring pixels, so the noise that shows is what is left of it after a small blur:
+	// noise in high frequencies, as blue noise leaves it, mostly averages away, white noise does not
+	const int radius = 4;
+	float kernel[2 * radius + 1], kernelSum = 0.0f;
+	for (int i = -radius; i <= radius; i++)
+	{
+		kernel[i + radius] = std::exp(-float(i * i) / (2.0f * 1.5f * 1.5f));
+		kernelSum += kernel[i + radius];
+	}
+	for (float& k : kernel)
+		k /= kernelSum;
+	std::vector<XMFLOAT4> blurred(pixels), blurredTwice(pixels);
+	auto blurredRms = [&](const std::vector<XMFLOAT4>& image)
+	{
+		auto blur = [&](const std::vector<XMFLOAT4>& from, std::vector<XMFLOAT4>& to, int stepX, int stepY)
+		{
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					XMFLOAT4 sum(0.0f, 0.0f, 0.0f, 0.0f);
+					for (int i = -radius; i <= radius; i++)
+					{
+						int sx = std::min(std::max(x + i * stepX, 0), width - 1), sy = std::min(std::max(y + i * stepY, 0), height - 1);
+						const XMFLOAT4& e = from[size_t(sy) * width + sx];
+						float k = kernel[i + radius];
+						sum = XMFLOAT4(sum.x + e.x * k, sum.y + e.y * k, sum.z + e.z * k, sum.w + e.w * k);
+					}
+					to[size_t(y) * width + x] = sum;
+				}
+			}
+		};
+		blur(image, blurred, 1, 0);
+		blur(blurred, blurredTwice, 0, 1);
+		double sum = 0.0;
+		for (const XMFLOAT4& e : blurredTwice)
+			sum += double(e.x) * e.x + double(e.y) * e.y + double(e.z) * e.z + double(e.w) * e.w;
+		return std::sqrt(sum / (4.0 * pixels));
+	};
+
+	// few steps are biased as well as noisy, and the jitter only shapes the noise, so each configuration renders a
+	// few consecutive frames and its noise is how far the frames spread around their average: the white noise
+	// jitter rotated by the accumulator's sequence, the blue noise through its slices
+	struct Result
+	{
+		int steps = 0;
+		double samplesPerPixel = 0.0, renderTime = 0.0; // per frame
+		double error = 0.0, noise = 0.0, perceivedNoise = 0.0;
+	};
+	std::vector<std::vector<XMFLOAT4>> images(frames);
+	std::vector<XMFLOAT4> average(pixels), deviation(pixels);
+	auto measure = [&](bool blueNoise, int steps)
+	{
+		CPUVolumeSettings jittered = settings;
+		jittered.adaptive = false;
+		jittered.maxSteps = steps;
+		jittered.pixelJitter = !blueNoise;
+		jittered.blueNoise = blueNoise;
+
+		Result result;
+		result.steps = steps;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			float offset = frame * 0.618034f;
+			jittered.jitterOffset = offset - std::floor(offset);
+			jittered.frameIndex = frame;
+			Render(camera, jittered, width, height, images[frame], pool);
+			result.samplesPerPixel += m_stats.ViewSamplesPerPixel() / frames;
+			result.renderTime += m_stats.renderTime / frames;
+			result.error += rmse(images[frame], reference) / frames;
+		}
+
+		std::fill(average.begin(), average.end(), XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+		for (const std::vector<XMFLOAT4>& image : images)
+		{
+			for (size_t i = 0; i < pixels; i++)
+				average[i] = XMFLOAT4(average[i].x + image[i].x / frames, average[i].y + image[i].y / frames, average[i].z + image[i].z / frames, average[i].w + image[i].w / frames);
+		}
+		// the spread of frames around an average of few of them is short by a factor of (frames - 1) / frames
+		const double correction = std::sqrt(double(frames) / (frames - 1));
+		for (const std::vector<XMFLOAT4>& image : images)
+		{
+			result.noise += rmse(image, average) * correction / frames;
+			for (size_t i = 0; i < pixels; i++)
+				deviation[i] = XMFLOAT4(image[i].x - average[i].x, image[i].y - average[i].y, image[i].z - average[i].z, image[i].w - average[i].w);
+			result.perceivedNoise += blurredRms(deviation) * correction / frames;
+		}
+		return result;
+	};
+
+	const int stepCounts[] = { 4, 6, 8, 12, 16, 24, 32, 48 };
+	std::vector<Result> white, blue;
+	for (int steps : stepCounts)
+	{
+		white.push_back(measure(false, steps));
+		blue.push_back(measure(true, steps));
+	}
+
+	// noise falls about as a power of the step count, so the white noise step count with a given perceived noise
+	// is interpolated in log-log between the two closest, or extrapolated from the last two
+	auto equalWhiteSteps = [&](double noise)
+	{
+		size_t i = 1;
+		while (i + 1 < white.size() && white[i].perceivedNoise > noise)
+			i++;
+		const Result& a = white[i - 1];
+		const Result& b = white[i];
+		if (a.perceivedNoise <= 0.0 || b.perceivedNoise <= 0.0 || a.perceivedNoise == b.perceivedNoise || noise <= 0.0)
+			return double(b.steps);
+		double f = (std::log(noise) - std::log(a.perceivedNoise)) / (std::log(b.perceivedNoise) - std::log(a.perceivedNoise));
+		return std::exp(std::log(double(a.steps)) + (std::log(double(b.steps)) - std::log(double(a.steps))) * f);
+	};
+
+	file << "jitter,steps,view_samples_per_pixel,render_ms,rmse,noise,perceived_noise,equal_perceived_white_steps\n";
+	for (const Result& result : white)
+	{
+		file << "white," << result.steps << "," << result.samplesPerPixel << "," << result.renderTime << "," << result.error << "," << result.noise << ","
+			<< result.perceivedNoise << "," << result.steps << "\n";
+	}
+	for (const Result& result : blue)
+	{
+		file << "blue," << result.steps << "," << result.samplesPerPixel << "," << result.renderTime << "," << result.error << "," << result.noise << ","
+			<< result.perceivedNoise << "," << equalWhiteSteps(result.perceivedNoise) << "\n";
+	}
+
+	m_useFroxels = useFroxels;
+	m_useImpostors = useImpostors;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteImpostorComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+
+	bool useImpostors = m_useImpostors, useFroxels = m_useFroxels;
+	int divisor = m_resolutionDivisor;
+	m_useFroxels = false;
+	m_resolutionDivisor = 1;
+	// the runs start from empty caches; the game's is put back afterwards
+	CloudImpostorCache impostors = m_impostors;
+	std::vector<float> density = m_density;
+	const XMINT3 densityResolution = m_densityResolution;
+
+	// the camera looks at the volume from the direction it is in now, moved out to where the cache takes over if
+	// it is closer, and circles it a quarter of a degree a frame, so a view drifts past the angle threshold
+	// every few frames; the density changes every few frames as the simulation would
+	const float halfSize = (kBoxMax - kBoxMin) * 0.5f;
+	const XMVECTOR centre = XMVectorSet(kBoxMin + halfSize, kBoxMin + halfSize, kBoxMin + halfSize, 0.0f);
+	const float radius = halfSize * std::sqrt(3.0f);
+	XMVECTOR offset = XMLoadFloat3(&camera.position) - centre;
+	float distance = XMVectorGetX(XMVector3Length(offset));
+	if (distance < 1e-3f)
+		offset = XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f);
+	distance = std::max(distance, (m_impostors.GetMinDistance() + 0.25f) * radius);
+	const XMVECTOR start = centre + XMVector3Normalize(offset) * distance;
+
+	const int width = 640, height = 360;
+	const int frames = 48, densityInterval = 12;
+	auto orbit = [&](int frame)
+	{
+		CPUVolumeCamera moved = camera;
+		XMVECTOR eye = centre + XMVector3Transform(start - centre, XMMatrixRotationY(XMConvertToRadians(frame * 0.25f)));
+		XMVECTOR up = std::abs(XMVectorGetY(XMVector3Normalize(eye - centre))) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		moved.viewInv = XMMatrixInverse(nullptr, XMMatrixLookAtLH(eye, centre, up));
+		XMStoreFloat3(&moved.position, eye);
+		return moved;
+	};
+	std::vector<float> changed(density.size());
+	auto simulate = [&](int frame)
+	{
+		float scale = 1.0f + 0.03f * (frame / densityInterval);
+		for (size_t i = 0; i < density.size(); i++)
+			changed[i] = density[i] * scale;
+		SetDensity(changed.data(), densityResolution, pool);
+	};
+
+	file << "resolution,frame,march_ms,cache_ms,speedup,view_rows,view_built,angle_error_deg,density_error,rmse\n";
+
+	const int resolutions[] = { 64, 128, 256 };
+	std::vector<XMFLOAT4> marched, cached;
+	for (int resolution : resolutions)
+	{
+		m_impostors.SetLayout(resolution, impostors.GetViewCount());
+
+		double marchTime = 0.0, cacheTime = 0.0, rows = 0.0, angleError = 0.0, densityError = 0.0, error = 0.0;
+		int builds = 0;
+		for (int f = 0; f < frames; f++)
+		{
+			if (f % densityInterval == 0)
+				simulate(f);
+			CPUVolumeCamera moved = orbit(f);
+
+			m_useImpostors = false;
+			Render(moved, settings, width, height, marched, pool);
+			double march = m_stats.renderTime;
+			m_useImpostors = true;
+			Render(moved, settings, width, height, cached, pool);
+			double cache = m_stats.renderTime;
+
+			double squaredError = 0.0;
+			for (size_t i = 0; i < marched.size(); i++)
+			{
+				const float* a = &marched[i].x;
+				const float* b = &cached[i].x;
+				for (int c = 0; c < 4; c++)
+					squaredError += (a[c] - b[c]) * (a[c] - b[c]);
+			}
+			double rmse = std::sqrt(squaredError / (4.0 * marched.size()));
+
+			marchTime += march / frames;
+			cacheTime += cache / frames;
+			rows += double(m_stats.impostorRows) / frames;
+			angleError += m_impostors.GetAngleError() / frames;
+			densityError += m_impostors.GetDensityError() / frames;
+			error += rmse / frames;
+			builds += m_impostors.GetBuiltView() ? 1 : 0;
+			file << resolution << "," << f << "," << march << "," << cache << "," << (cache > 0.0 ? march / cache : 0.0) << "," << m_stats.impostorRows << ","
+				<< (m_impostors.GetBuiltView() ? 1 : 0) << "," << m_impostors.GetAngleError() << "," << m_impostors.GetDensityError() << "," << rmse << "\n";
+		}
+		file << resolution << ",mean," << marchTime << "," << cacheTime << "," << (cacheTime > 0.0 ? marchTime / cacheTime : 0.0) << "," << rows << ","
+			<< builds << "," << angleError << "," << densityError << "," << error << "\n";
+	}
+
+	SetDensity(density.data(), densityResolution, pool);
+	m_impostors = impostors;
+	m_useImpostors = useImpostors;
+	m_useFroxels = useFroxels;
+	m_resolutionDivisor = divisor;
+}
+
+void CPUVolumeRenderer::WriteSunVolumeComparison(const std::string& filename, const CPUVolumeSettings& settings, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file || m_density.empty())
+		return;
+
+	if (m_noise.empty())
+		GenerateNoise(pool);
+	Frame frame = MakeFrame(settings);
+	UpdateSunVolume(frame.toLight, pool);
+
+	// random points with density, the only ones the view march lights
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> coordinate(kBoxMin, kBoxMax);
+	std::vector<XMFLOAT3> points;
+	for (int attempt = 0; attempt < 1000000 && points.size() < 4096; attempt++)
+	{
+		XMFLOAT3 p(coordinate(random), coordinate(random), coordinate(random));
+		if (EvalDensity(p) > 0.0f)
+			points.push_back(p);
+	}
+	if (points.empty())
+		return;
+
+	auto elapsed = [](std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	// transmittance, which is what the depth ends up scaling the in-scattering by
+	const int referenceSteps = 256;
+	std::vector<float> reference(points.size()), march(points.size()), volume(points.size());
+	uint64_t samples = 0;
+	for (size_t i = 0; i < points.size(); i++)
+		reference[i] = std::exp(-frame.sigmaT * MarchLight(points[i], frame, referenceSteps, samples));
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < points.size(); i++)
+		march[i] = std::exp(-frame.sigmaT * MarchLight(points[i], frame, frame.maxLightSteps, samples));
+	double marchTime = elapsed(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < points.size(); i++)
+		volume[i] = std::exp(-frame.sigmaT * m_sunVolume.SampleDepth(points[i]));
+	double volumeTime = elapsed(start);
+
+	file << "method,compared_to,points,mean_abs_error,max_abs_error,ns_per_lookup,build_ms\n";
+	auto write = [&](const std::string& method, const char* comparedTo, const std::vector<float>& values, const std::vector<float>& against, double time, double buildTime)
+	{
+		double sum = 0.0, maximum = 0.0;
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			double error = std::abs(values[i] - against[i]);
+			sum += error;
+			maximum = std::max(maximum, error);
+		}
+		file << method << "," << comparedTo << "," << values.size() << "," << sum / values.size() << "," << maximum << ","
+			<< time * 1e6 / values.size() << "," << buildTime << "\n";
+	};
+	std::string marchName = "light_march_" + std::to_string(frame.maxLightSteps);
+	write(marchName, "march_256", march, reference, marchTime, 0.0);
+	write("sun_volume", "march_256", volume, reference, volumeTime, m_sunVolume.GetBuildTime());
+	write("sun_volume", marchName.c_str(), volume, march, volumeTime, m_sunVolume.GetBuildTime());
+}
@@ -0,0 +1,336 @@
+#pragma once
+// CPUVolumeRenderer
+// Multithreaded CPU port of the cloud ray march in volume_ps.hlsl, for reference frames and for profiling the
+// march away from the GPU. Output is linear HDR radiance in rgb and the view transmittance in alpha.
+
+#include <DirectXMath.h>
+#include "CloudImpostorCache.h"
+#include "DepthAwareUpsampler.h"
+#include "FroxelGrid.h"
+#include "MacrocellGrid.h"
+#include "SunTransmittanceVolume.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+class SpatiotemporalBlueNoise;
+class ThreadPool;
+
+enum class CPUVolumePath
+{
+	Scalar,
+	Avx2,
+	Avx512,
+};
+
+struct CPUVolumeCamera
+{
+	XMFLOAT3 position;
+	XMMATRIX viewInv;
+	XMMATRIX projInv;
+};
+
+// the LightBuffer and VolumeBuffer constants of volume_ps.hlsl
+struct CPUVolumeSettings
+{
+	XMFLOAT3 ambientColor = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float ambientIntensity = 1.0f;
+	XMFLOAT3 sunColor = XMFLOAT3(1.0f, 1.0f, 1.0f);
+	float sunIntensity = 1.0f;
+	XMFLOAT3 sunDirection = XMFLOAT3(0.0f, -1.0f, 0.0f);
+	float absorption = 0.7f;
+	float scatter = 3.5f;
+	int maxSteps = 24;
+	int maxLightSteps = 6;
+	// each sample sets the length of the step after it from the density change since the previous sample and the
+	// distance to the camera, as the shader's adaptive branch does; a sample landing across an edge after a long
+	// step is dropped and the edge crossed again in the smallest steps
+	bool adaptive = false;
+	float minStepScale = 0.5f; // multiples of the even step, (t1 - t0) / maxSteps
+	float maxStepScale = 2.0f;
+	float edgeThreshold = 0.05f; // density change between samples at which steps are smallest
+	float nearDistance = 4.0f; // steps shrink toward the smallest within this distance of the camera
+	float terminationThreshold = 1e-3f; // transmittance at which a ray stops
+	bool pixelJitter = false; // hash the step jitter per pixel as well as per step, for temporal accumulation
+	float jitterOffset = 0.0f; // added to the jitter and wrapped, to move the samples between frames
+	// offset each ray by the blue noise set with SetBlueNoise, picked by its pixel and frameIndex, instead of
+	// hashing every step; overrides the two above
+	bool blueNoise = false;
+	int frameIndex = 0; // the blue noise slice
+};
+
+struct CPUVolumeStats
+{
+	int width = 0, height = 0;
+	int tiles = 0, threads = 1;
+	CPUVolumePath path = CPUVolumePath::Scalar;
+	bool skipEmpty = false;
+	bool sunVolume = false;
+	bool adaptive = false;
+	bool froxels = false;
+	int resolutionDivisor = 1;
+	UpsampleFilter upsample = UpsampleFilter::Bilinear;
+	uint64_t samples = 0; // density evaluations along view and light rays, and sun volume fetches
+	uint64_t viewSamples = 0; // density evaluations along view rays, or froxels evaluated
+	double renderTime = 0.0; // ms
+	double sunVolumeTime = 0.0; // ms spent rebuilding the sun volume before the frame, not part of renderTime
+	double froxelTime = 0.0; // ms spent building the froxel grid, part of renderTime
+	double upsampleTime = 0.0; // ms spent downsampling the scene depth and upsampling the frame, part of renderTime
+	bool impostors = false; // looked up in the impostor cache
+	int impostorRows = 0; // rows of impostor views rendered for the frame, background refreshes not included
+	double impostorTime = 0.0; // ms spent rendering impostor views, part of renderTime
+
+	double MegasamplesPerSecond() const { return renderTime > 0.0 ? samples / (renderTime * 1000.0) : 0.0; };
+	double ViewSamplesPerPixel() const { return width > 0 && height > 0 ? double(viewSamples) / (double(width) * height) : 0.0; };
+};
+
+// what Game hands the renderer for one frame, saved with WriteFrame so the frame can be rendered again on a
+// machine without a GPU by the cpu_volume_render tool
+struct CPUVolumeFrame
+{
+	std::vector<float> density;
+	XMINT3 densityResolution = XMINT3(0, 0, 0);
+	std::vector<float> sceneDepth; // empty without a scene depth
+	int sceneDepthWidth = 0, sceneDepthHeight = 0;
+	CPUVolumeCamera camera;
+	CPUVolumeSettings settings;
+	int width = 0, height = 0;
+};
+
+class CPUVolumeRenderer
+{
+public:
+	static constexpr int kNoiseResolution = 128;
+
+	CPUVolumeRenderer();
+
+	// density holds resolution samples with one ghost layer on every face, x fastest, as FluidSimEffect reads it back;
+	// the macrocells whose samples changed are updated on the pool, which may be null
+	void SetDensity(const float* density, const XMINT3& resolution, ThreadPool* pool);
+	bool HasDensity() const { return !m_density.empty(); };
+
+	// the noise the density is modulated with; GenerateNoise computes the same field as worley_cs.hlsl and is
+	// run by Render when no noise was set
+	void SetNoise(const float* noise, int resolution);
+	void GenerateNoise(ThreadPool* pool);
+
+	// linear depth as a fraction of the far plane, like the main scene's depth target, so rays stop at the
+	// terrain as the shader's do; without it every ray runs to the far side of the volume
+	void SetSceneDepth(const float* depth, int width, int height);
+	void ClearSceneDepth();
+
+	static bool IsPathSupported(CPUVolumePath path);
+	static const char* GetPathName(CPUVolumePath path);
+	// Avx2 and Avx512 trace the rows of a tile as packets of 8 or 16 rays, with a lane mask for rays that missed
+	// the box or became opaque. An unsupported path falls back to the scalar one
+	void SetPath(CPUVolumePath path) { m_path = IsPathSupported(path) ? path : CPUVolumePath::Scalar; };
+	CPUVolumePath GetPath() const { return m_path; };
+
+	// the view march jumps over empty macrocells and the light march leaves out their samples; with even steps
+	// the image does not change, with adaptive steps it moves where the samples fall
+	void SetSkipEmpty(bool skipEmpty) { m_skipEmpty = skipEmpty; };
+	bool GetSkipEmpty() const { return m_skipEmpty; };
+	const MacrocellGrid& GetMacrocells() const { return m_macrocells; };
+
+	// replaces the light march with one fetch, rebuilt before a frame when the density or the sun direction changed
+	void SetUseSunVolume(bool useSunVolume) { m_useSunVolume = useSunVolume; };
+	bool GetUseSunVolume() const { return m_useSunVolume; };
+	void SetSunVolumeResolution(int resolution) { m_sunVolumeResolution = std::max(2, resolution); m_sunVolumeDirty = true; };
+	const SunTransmittanceVolume& GetSunVolume() const { return m_sunVolume; };
+
+	// integrates the light into a camera-aligned grid and looks every pixel up at its scene depth instead of marching it
+	void SetUseFroxels(bool useFroxels) { m_useFroxels = useFroxels; };
+	bool GetUseFroxels() const { return m_useFroxels; };
+	void SetFroxelResolution(const XMINT3& resolution) { m_froxelResolution = resolution; };
+	XMINT3 GetFroxelResolution() const { return m_froxelResolution; };
+	const FroxelGrid& GetFroxels() const { return m_froxels; };
+
+	// 2 or 4 march every second or fourth pixel along each axis against the downsampled scene depth, and the
+	// upsampler brings the result back to full resolution
+	void SetResolutionDivisor(int divisor) { m_resolutionDivisor = std::min(std::max(divisor, 1), 8); };
+	int GetResolutionDivisor() const { return m_resolutionDivisor; };
+	void SetUpsampleFilter(UpsampleFilter filter) { m_upsampleFilter = filter; };
+	UpsampleFilter GetUpsampleFilter() const { return m_upsampleFilter; };
+	DepthAwareUpsampler& GetUpsampler() { return m_upsampler; };
+
+	// cameras the cache finds distant get their frame from a few views rendered by this renderer, reused while they
+	// stay close to the camera, the settings and the density, and rendered again once they drift
+	void SetUseImpostors(bool useImpostors) { m_useImpostors = useImpostors; };
+	bool GetUseImpostors() const { return m_useImpostors; };
+	CloudImpostorCache& GetImpostors() { return m_impostors; };
+	// the pool the impostor views are refreshed on in the background; may be null, leaving each refresh to one thread
+	void SetBackgroundThreadPool(ThreadPool* pool) { m_backgroundPool = pool; };
+
+	// the noise for CPUVolumeSettings::blueNoise; must outlive the renderer's use of it, and may be null
+	void SetBlueNoise(const SpatiotemporalBlueNoise* blueNoise) { m_blueNoise = blueNoise; };
+
+	// tiles small enough for their rays to stay in cache together; the pool's threads claim them one at a time
+	void SetTileSize(int tileSize) { m_tileSize = std::max(1, tileSize); };
+	int GetTileSize() const { return m_tileSize; };
+
+	// pool may be null, in which case every tile is rendered on the calling thread. depth, if given, receives the
+	// distance along each pixel's ray to the cloud, averaged over where the ray lost its transmittance, or the
+	// largest float where it saw no cloud; froxel frames report no cloud
+	void Render(const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool, std::vector<float>* depth = nullptr);
+	const CPUVolumeStats& GetStats() const { return m_stats; };
+
+	// rgb as a little-endian PFM, the format most HDR viewers open
+	static bool WritePFM(const std::string& filename, const std::vector<XMFLOAT4>& image, int width, int height);
+	// a little-endian binary file, field by field, so it reads back the same whatever compiler wrote it
+	static bool WriteFrame(const std::string& filename, const CPUVolumeFrame& frame);
+	static bool ReadFrame(const std::string& filename, CPUVolumeFrame& frame);
+
+	// renders the view at a few resolutions with every supported path, with and without empty-space skipping, on
+	// one thread and on the pool, and with a few tile sizes; the error of each run is measured against the scalar
+	// image without skipping. Writes a CSV file
+	void WriteBenchmark(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// renders the view with every supported path and jitter, with the light march and the sun volume, once with
+	// empty-space skipping and once without, and compares the images bit for bit, as even steps must give the same
+	// image either way; also compares the macrocells Update kept with a grid built from scratch. Writes a CSV file
+	void WriteSkipEmptyCheck(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// renders the view with even steps and with adaptive steps over a range of step scales and edge thresholds;
+	// reports the view samples per pixel, the time and the error of each against the even march. Writes a CSV file
+	void WriteAdaptiveComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// renders the view at a few resolutions by ray marching and through froxel grids of a few sizes, and writes the
+	// time and the error of each froxel image against the ray march at its resolution to a CSV file
+	void WriteFroxelComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// single frames with per-pixel jitter over a range of step counts, and a slowly orbiting camera accumulated
+	// over frames by a TemporalAccumulator at a few low step counts, all against a finely stepped frame; reports the
+	// error of each and the step count a single frame needs for the noise of the accumulated one. Writes a CSV file
+	void WriteTemporalComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// renders the view at full resolution and at a half and a quarter of it with every upsample filter, and writes
+	// the time and the error of each against the full resolution frame, over all pixels and along depth edges, to
+	// a CSV file
+	void WriteUpsampleComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// a few frames over a range of step counts with white noise jitter and with the blue noise: the error against a
+	// finely stepped frame, the noise as the spread of the frames around their average, the same after a blur the
+	// size of what the eye averages over, and the white noise step count whose blurred noise matches the blue
+	// noise's. Needs SetBlueNoise; writes a CSV file
+	void WriteBlueNoiseComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// a distant camera orbiting the volume while the density changes every few frames, each frame marched and taken
+	// from impostor caches of a few view resolutions: the time of both, the impostor rows rendered, the errors of
+	// the view used and the error of the frame against the marched one. Writes a CSV file
+	void WriteImpostorComparison(const std::string& filename, const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, ThreadPool* pool);
+	// sun transmittance at random points with density, from the light march and from the sun volume, against a
+	// finely stepped march; writes a CSV file
+	void WriteSunVolumeComparison(const std::string& filename, const CPUVolumeSettings& settings, ThreadPool* pool);
+
+private:
+	// per-frame constants shared by every ray
+	struct Frame
+	{
+		XMFLOAT3 ambient;
+		XMFLOAT3 lightColor;
+		XMFLOAT3 toLight;
+		XMFLOAT3 voxelScale; // world to voxel units
+		XMFLOAT3 toLightVoxel;
+		float sigmaS, sigmaT;
+		int maxSteps, maxLightSteps;
+		bool adaptive;
+		float minStepScale, maxStepScale;
+		float edgeThreshold, nearDistance;
+		float terminationThreshold;
+		bool pixelJitter;
+		float jitterOffset;
+		const SpatiotemporalBlueNoise* blueNoise; // null without blue noise
+		int frameIndex;
+	};
+	struct SampleCounts
+	{
+		uint64_t view = 0, light = 0;
+	};
+
+	// depth may be null
+	void RenderTile(int tile, int tilesX, const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame, int width, int height, XMFLOAT4* image, float* depth, SampleCounts& counts) const;
+	// the packet march, in CPUVolumePackets.h, instantiated for each width in a source built for its instruction set
+	template <class Lanes>
+	void RenderTilePackets(int tile, int tilesX, const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame, int width, int height, XMFLOAT4* image, float* depth, SampleCounts& counts) const;
+	// the rays of pixels x to x + width - 1 of row y
+	template <class Lanes>
+	void TracePacket(const XMFLOAT3& origin, const float* directions, const float* sceneDistances, int x, int y, const Frame& frame, float* out, SampleCounts& counts) const;
+	// the adaptive march of TracePacket's rays; every lane keeps its own distance and step
+	template <class Lanes>
+	void TracePacketAdaptive(const XMFLOAT3& origin, const float* directions, typename Lanes::Float t0, typename Lanes::Float t1, typename Lanes::Mask active, typename Lanes::Float jitter,
+		typename Lanes::Float scatter, const Frame& frame, typename Lanes::Float& transparency, typename Lanes::Float& r, typename Lanes::Float& g, typename Lanes::Float& b,
+		typename Lanes::Float& depthSum, SampleCounts& counts) const;
+	// attenuates the lanes' view rays over a step of length dt and adds the ambient and in-scattered light of their samples
+	template <class Lanes>
+	void ShadePacket(typename Lanes::Float x, typename Lanes::Float y, typename Lanes::Float z, typename Lanes::Float density, typename Lanes::Float dt, typename Lanes::Float scatter,
+		typename Lanes::Mask active, const Frame& frame, typename Lanes::Float& transparency, typename Lanes::Float& r, typename Lanes::Float& g, typename Lanes::Float& b, SampleCounts& counts) const;
+	template <class Lanes>
+	typename Lanes::Mask Occupied(typename Lanes::Float x, typename Lanes::Float y, typename Lanes::Float z, const Frame& frame) const;
+	template <class Lanes>
+	typename Lanes::Float SampleSunDepthPacket(typename Lanes::Float x, typename Lanes::Float y, typename Lanes::Float z) const;
+	template <class Lanes>
+	typename Lanes::Float EvalDensityPacket(typename Lanes::Float x, typename Lanes::Float y, typename Lanes::Float z) const;
+
+	// the offset of step n of pixel (x, y)'s ray within its step
+	static float Jitter(const Frame& frame, int x, int y, int n);
+	// x and y are the pixel, for the jitter
+	XMFLOAT4 Trace(const XMFLOAT3& origin, const XMFLOAT3& direction, float sceneDistance, int x, int y, const Frame& frame, float& depth, SampleCounts& counts) const;
+	void Shade(const XMFLOAT3& position, float density, float dt, float scatter, const Frame& frame, float& transparency, XMFLOAT3& result, SampleCounts& counts) const;
+	float EvalDensity(const XMFLOAT3& position) const;
+	float SampleNoise(float u, float v, float w) const;
+	float SceneDistance(float u, float v) const;
+	Frame MakeFrame(const CPUVolumeSettings& settings) const;
+	// density integrated toward the light from a position to the box exit, sampled at the midpoints of steps
+	// steps like the shader's light march
+	float MarchLight(const XMFLOAT3& position, const Frame& frame, int steps, uint64_t& samples) const;
+	// extinction and light scattered toward the camera at a position, for the froxel grid
+	FroxelMedium Medium(const XMFLOAT3& position, const XMFLOAT3& direction, const Frame& frame, uint64_t& samples) const;
+	void RenderFroxels(const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool);
+	void RenderReduced(const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool, std::vector<float>* depth);
+	void RenderImpostors(const CPUVolumeCamera& camera, const CPUVolumeSettings& settings, int width, int height, std::vector<XMFLOAT4>& image, ThreadPool* pool, std::vector<float>* depth);
+	// the scene depth at a frame's resolution: the one set if it matches, else resampled into resampled; null
+	// without a scene depth
+	const float* FrameSceneDepth(int width, int height, std::vector<float>& resampled) const;
+	// rebuilds the sun volume if the density or the light changed, returns the time spent in ms
+	double UpdateSunVolume(const XMFLOAT3& toLight, ThreadPool* pool);
+
+	std::vector<float> m_density;
+	XMINT3 m_densityResolution;
+	uint64_t m_densityVersion = 0; // counts the SetDensity calls that changed the density
+	MacrocellGrid m_macrocells;
+	bool m_skipEmpty = true;
+
+	SunTransmittanceVolume m_sunVolume;
+	bool m_useSunVolume = true;
+	bool m_sunVolumeDirty = true;
+	XMFLOAT3 m_sunVolumeLight; // light direction of the last build
+	int m_sunVolumeResolution = 65;
+
+	FroxelGrid m_froxels;
+	bool m_useFroxels = false;
+	XMINT3 m_froxelResolution;
+
+	std::vector<float> m_noise;
+	int m_noiseResolution = 0;
+
+	std::vector<float> m_sceneDepth;
+	int m_sceneDepthWidth = 0, m_sceneDepthHeight = 0;
+
+	int m_resolutionDivisor = 1;
+	UpsampleFilter m_upsampleFilter = UpsampleFilter::NearestDepth;
+	DepthAwareUpsampler m_upsampler;
+	std::vector<XMFLOAT4> m_reducedImage;
+	std::vector<float> m_reducedDepth;
+
+	// renders the impostor refreshes on their background jobs, with the density as of the last refresh started;
+	// declared before m_impostors, which waits for a running job when it is destroyed
+	std::unique_ptr<CPUVolumeRenderer> m_refreshRenderer;
+	uint64_t m_refreshDensityVersion = 0;
+	ThreadPool* m_backgroundPool = nullptr;
+	CloudImpostorCache m_impostors;
+	bool m_useImpostors = false;
+
+	const SpatiotemporalBlueNoise* m_blueNoise = nullptr;
+
+	int m_tileSize = 16;
+	CPUVolumePath m_path = CPUVolumePath::Scalar;
+
+	CPUVolumeStats m_stats;
+};
@@ -0,0 +1,14 @@
+#include "CPUVolumeRenderer.h"
+#include "CPUVolumeCommon.h"
+#include "SimdLanes.h"
+#include <algorithm>
+#include <limits>
+
+using namespace CPUVolumeCommon;
+
+SIMD_LANES_BEGIN_AVX512
+#include "CPUVolumePackets.h"
+
+template void CPUVolumeRenderer::RenderTilePackets<SimdLanes::Avx512>(int tile, int tilesX, const CPUVolumeCamera& camera, const XMMATRIX& clipToWorld, const Frame& frame,
+	int width, int height, XMFLOAT4* image, float* depth, SampleCounts& counts) const;
+SIMD_LANES_END
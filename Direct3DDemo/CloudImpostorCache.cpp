@@ -0,0 +1,352 @@
+#include "CloudImpostorCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	// times a pixel's ray is moved from the plane to the cloud depth it finds there and looked up again, which
+	// takes out most of the parallax of clouds in front of or behind the plane
+	const int kParallaxSteps = 2;
+}
+
+CloudImpostorCache::CloudImpostorCache() :
+	m_centre(0.0f, 0.0f, 0.0f)
+{
+	SetLayout(128, 8);
+}
+
+void CloudImpostorCache::SetBounds(const XMFLOAT3& centre, float radius)
+{
+	m_centre = centre;
+	m_radius = std::max(radius, 1e-3f);
+	Reset();
+}
+
+void CloudImpostorCache::SetLayout(int resolution, int views)
+{
+	m_resolution = std::max(resolution, 2);
+	views = std::max(views, 1);
+	m_columns = int(std::ceil(std::sqrt(float(views))));
+	m_rows = (views + m_columns - 1) / m_columns;
+	m_views.assign(views, View());
+	Reset();
+}
+
+void CloudImpostorCache::Reset()
+{
+	// a running refresh renders with what the caller set up for it, which may change once the views are forgotten
+	if (m_refreshJob.valid())
+		m_refreshJob.wait();
+	m_refreshJob = std::shared_future<Texels>();
+	for (View& view : m_views)
+		view = View();
+	m_atlas.assign(size_t(GetAtlasWidth()) * GetAtlasHeight(), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	m_atlasDepth.assign(m_atlas.size(), std::numeric_limits<float>::max());
+	m_refreshSlot = -1;
+	m_refreshView = View();
+	m_current = -1;
+}
+
+bool CloudImpostorCache::IsDistant(const XMFLOAT3& eye) const
+{
+	XMVECTOR offset = XMLoadFloat3(&eye) - XMLoadFloat3(&m_centre);
+	return XMVectorGetX(XMVector3Length(offset)) >= m_minDistance * m_radius;
+}
+
+int CloudImpostorCache::GetValidCount() const
+{
+	return int(std::count_if(m_views.begin(), m_views.end(), [](const View& view) { return view.valid; }));
+}
+
+CloudImpostorCache::View CloudImpostorCache::MakeView(const XMFLOAT3& eye) const
+{
+	View view;
+	view.eye = eye;
+	XMVECTOR e = XMLoadFloat3(&eye), c = XMLoadFloat3(&m_centre);
+	view.distance = std::max(XMVectorGetX(XMVector3Length(e - c)), m_radius * 1.01f);
+	XMStoreFloat3(&view.direction, XMVector3Normalize(e - c));
+
+	XMVECTOR up = std::abs(view.direction.y) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+	XMMATRIX viewMatrix = XMMatrixLookAtLH(e, c, up);
+	// the frustum touches the bounding sphere, with a texel to spare so the border texels stay clear of it
+	float fov = 2.0f * std::asin(m_radius / view.distance) * (1.0f + 2.0f / m_resolution);
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(std::min(fov, XM_PI * 0.99f), 1.0f, (view.distance - m_radius) * 0.5f, view.distance + m_radius);
+
+	XMStoreFloat4x4(&view.viewInv, XMMatrixInverse(nullptr, viewMatrix));
+	XMStoreFloat4x4(&view.projInv, XMMatrixInverse(nullptr, proj));
+	XMStoreFloat4x4(&view.viewProj, viewMatrix * proj);
+	return view;
+}
+
+float CloudImpostorCache::DensityError(View& view, const float* density, size_t count, uint64_t densityVersion)
+{
+	if (view.densityVersion == densityVersion)
+		return view.densityError;
+
+	float largest = 0.0f;
+	if (view.density.size() != count)
+		largest = std::numeric_limits<float>::max();
+	for (size_t i = 0; i < count && i < view.density.size(); i++)
+		largest = std::max(largest, std::abs(view.density[i] - density[i]));
+	view.densityVersion = densityVersion;
+	view.densityError = largest;
+	return largest;
+}
+
+void CloudImpostorCache::RenderWhole(const View& view, int resolution, const RenderView& render, std::vector<XMFLOAT4>& image, std::vector<float>& depth)
+{
+	render(view.eye, XMLoadFloat4x4(&view.viewInv), XMLoadFloat4x4(&view.projInv), resolution, resolution, image, depth);
+
+	const size_t texels = size_t(resolution) * resolution;
+	if (image.size() != texels || depth.size() != texels)
+	{
+		image.assign(texels, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+		depth.assign(texels, std::numeric_limits<float>::max());
+	}
+}
+
+void CloudImpostorCache::Store(int slot, const std::vector<XMFLOAT4>& image, const std::vector<float>& depth)
+{
+	const int atlasWidth = GetAtlasWidth();
+	const int sx = (slot % m_columns) * m_resolution, sy = (slot / m_columns) * m_resolution;
+	for (int y = 0; y < m_resolution; y++)
+	{
+		size_t from = size_t(y) * m_resolution, to = size_t(sy + y) * atlasWidth + sx;
+		std::copy_n(image.begin() + from, m_resolution, m_atlas.begin() + to);
+		std::copy_n(depth.begin() + from, m_resolution, m_atlasDepth.begin() + to);
+	}
+}
+
+void CloudImpostorCache::Update(const XMFLOAT3& eye, uint64_t settings, const float* density, size_t count, uint64_t densityVersion, const RenderView& render,
+	const StartRefresh& refresh)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	m_frame++;
+	m_built = false;
+	m_renderedRows = 0;
+	// a refresh under settings that have since changed would only produce another stale view
+	if (m_refreshSlot >= 0 && m_refreshView.settings != settings)
+		m_refreshSlot = -1;
+
+	// a finished refresh replaces its slot's view before the views are measured
+	if (m_refreshJob.valid() && m_refreshJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		const Texels& texels = m_refreshJob.get();
+		if (m_refreshSlot >= 0)
+		{
+			Store(m_refreshSlot, texels.image, texels.depth);
+			m_refreshView.valid = true;
+			m_refreshView.lastUsed = m_views[m_refreshSlot].lastUsed;
+			m_views[m_refreshSlot] = std::move(m_refreshView);
+			m_refreshView = View();
+			m_refreshSlot = -1;
+		}
+		m_refreshTime = texels.time;
+		m_refreshJob = std::shared_future<Texels>();
+	}
+
+	XMVECTOR offset = XMLoadFloat3(&eye) - XMLoadFloat3(&m_centre);
+	const float distance = XMVectorGetX(XMVector3Length(offset));
+	XMVECTOR direction = XMVector3Normalize(offset);
+
+	// the errors of a view against the camera, and the largest of them in units of their thresholds
+	auto measure = [&](View& view, float& angle, float& densityError)
+	{
+		float cosine = XMVectorGetX(XMVector3Dot(direction, XMLoadFloat3(&view.direction)));
+		angle = XMConvertToDegrees(std::acos(std::min(std::max(cosine, -1.0f), 1.0f)));
+		densityError = DensityError(view, density, count, densityVersion);
+		float distanceError = std::abs(distance / view.distance - 1.0f);
+		return std::max(std::max(angle / m_angleThreshold, distanceError / m_distanceThreshold), densityError / m_densityThreshold);
+	};
+
+	int best = -1;
+	float bestScore = std::numeric_limits<float>::max();
+	for (int i = 0; i < int(m_views.size()); i++)
+	{
+		if (!m_views[i].valid || m_views[i].settings != settings)
+			continue;
+		float angle, densityError;
+		float score = measure(m_views[i], angle, densityError);
+		if (score <= 1.0f && score < bestScore)
+		{
+			best = i;
+			bestScore = score;
+			m_angleError = angle;
+			m_densityError = densityError;
+		}
+	}
+
+	if (best < 0)
+	{
+		// nothing to show the frame from: a view for the camera is rendered whole, into a free slot, one rendered
+		// with other settings or over the least recently used view, and any refresh in progress is dropped as it may
+		// have been for that slot
+		int slot = 0;
+		for (int i = 0; i < int(m_views.size()); i++)
+		{
+			if (!m_views[i].valid || m_views[i].settings != settings)
+			{
+				slot = i;
+				break;
+			}
+			if (m_views[i].lastUsed < m_views[slot].lastUsed)
+				slot = i;
+		}
+		m_refreshSlot = -1;
+
+		View view = MakeView(eye);
+		view.settings = settings;
+		view.density.assign(density, density + count);
+		view.densityVersion = densityVersion;
+		RenderWhole(view, m_resolution, render, m_stagingImage, m_stagingDepth);
+		m_renderedRows += m_resolution;
+		Store(slot, m_stagingImage, m_stagingDepth);
+		view.valid = true;
+		m_views[slot] = std::move(view);
+		best = slot;
+		m_angleError = 0.0f;
+		m_densityError = 0.0f;
+		m_built = true;
+	}
+	else if (m_refreshSlot < 0 && !m_refreshJob.valid() && bestScore > 0.5f)
+	{
+		View view = MakeView(eye);
+		const int resolution = m_resolution;
+		RenderView job = refresh();
+		m_refreshJob = std::async(std::launch::async, [view, resolution, job]()
+		{
+			auto jobStart = std::chrono::high_resolution_clock::now();
+			Texels texels;
+			RenderWhole(view, resolution, job, texels.image, texels.depth);
+			texels.time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - jobStart).count();
+			return texels;
+		}).share();
+
+		m_refreshSlot = best;
+		m_refreshView = std::move(view);
+		m_refreshView.settings = settings;
+		m_refreshView.density.assign(density, density + count);
+		m_refreshView.densityVersion = densityVersion;
+	}
+
+	m_current = best;
+	m_views[best].lastUsed = m_frame;
+	m_updateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void CloudImpostorCache::Resolve(const XMFLOAT3& eye, const XMMATRIX& clipToWorld, int width, int height, const float* sceneDepth, float zFar,
+	std::vector<XMFLOAT4>& image, std::vector<float>* depth, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	m_resolveTime = 0.0;
+	image.assign(size_t(width) * height, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	if (depth)
+		depth->assign(image.size(), std::numeric_limits<float>::max());
+	if (m_current < 0 || !m_views[m_current].valid)
+		return;
+
+	const View& view = m_views[m_current];
+	const XMMATRIX viewProj = XMLoadFloat4x4(&view.viewProj);
+	const XMVECTOR origin = XMLoadFloat3(&eye), viewEye = XMLoadFloat3(&view.eye);
+	const XMVECTOR normal = XMLoadFloat3(&view.direction), centre = XMLoadFloat3(&m_centre);
+	const int resolution = m_resolution, atlasWidth = GetAtlasWidth();
+	const int sx = (m_current % m_columns) * resolution, sy = (m_current / m_columns) * resolution;
+	const float noCloud = std::numeric_limits<float>::max();
+
+	// the far point before the perspective divide is linear in the clip position, and so are the ray direction
+	// before it is normalised and that direction in the view's clip space, so pixels step both by constant
+	// vectors; the ray's point at s directions from the camera is at clip position eyeClip + s * directionClip
+	auto direction = [&](const XMVECTOR& farPoint) { return XMVectorSetW(farPoint - origin * XMVectorSplatW(farPoint), 0.0f); };
+	const XMVECTOR corner = direction(XMVector4Transform(XMVectorSet(-1.0f, 1.0f, 1.0f, 1.0f), clipToWorld));
+	const XMVECTOR acrossX = direction(XMVector4Transform(XMVectorSet(2.0f / width, 0.0f, 0.0f, 0.0f), clipToWorld));
+	const XMVECTOR downY = direction(XMVector4Transform(XMVectorSet(0.0f, -2.0f / height, 0.0f, 0.0f), clipToWorld));
+	const XMVECTOR cornerClip = XMVector4Transform(corner, viewProj);
+	const XMVECTOR acrossXClip = XMVector4Transform(acrossX, viewProj), downYClip = XMVector4Transform(downY, viewProj);
+	const XMVECTOR eyeClip = XMVector4Transform(XMVectorSetW(origin, 1.0f), viewProj);
+	const XMVECTOR toCentre = centre - origin;
+	const float centreDistanceSq = XMVectorGetX(XMVector3Dot(toCentre, toCentre)), radiusSq = m_radius * m_radius;
+
+	ForEachSlice(pool, height, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			XMVECTOR rowStart = corner + downY * (y + 0.5f), rowStartClip = cornerClip + downYClip * (y + 0.5f);
+			for (int x = 0; x < width; x++)
+			{
+				XMVECTOR rd = rowStart + acrossX * (x + 0.5f);
+				// most of a distant camera's rays pass the bounding sphere by
+				float along = XMVectorGetX(XMVector3Dot(toCentre, rd)), lengthSq = XMVectorGetX(XMVector3Dot(rd, rd));
+				if (along <= 0.0f || centreDistanceSq * lengthSq - along * along > radiusSq * lengthSq)
+					continue;
+				// rays away from the view's side of the plane never reach it
+				float facing = XMVectorGetX(XMVector3Dot(rd, normal));
+				if (facing >= 0.0f)
+					continue;
+				XMVECTOR rdClip = rowStartClip + acrossXClip * (x + 0.5f);
+
+				// the ray meets the plane through point, facing the view's eye, where the view is looked up; the
+				// cloud depth found there moves the plane to the cloud and the ray is looked up again
+				XMVECTOR point = centre;
+				XMFLOAT4 colour;
+				float texelDepth = noCloud, hitS = 0.0f;
+				bool inside = false;
+				for (int step = 0; step <= kParallaxSteps; step++)
+				{
+					float s = XMVectorGetX(XMVector3Dot(point - origin, normal)) / facing;
+					if (s <= 0.0f)
+						break;
+					XMFLOAT4 clip;
+					XMStoreFloat4(&clip, eyeClip + rdClip * s);
+					float px = (clip.x / clip.w * 0.5f + 0.5f) * resolution - 0.5f, py = (0.5f - clip.y / clip.w * 0.5f) * resolution - 0.5f;
+					if (px < -0.5f || py < -0.5f || px > resolution - 0.5f || py > resolution - 0.5f)
+						break;
+
+					px = std::min(std::max(px, 0.0f), float(resolution - 1));
+					py = std::min(std::max(py, 0.0f), float(resolution - 1));
+					int tx = std::min(int(px), resolution - 2), ty = std::min(int(py), resolution - 2);
+					float fx = px - tx, fy = py - ty;
+					size_t row0 = size_t(sy + ty) * atlasWidth + sx + tx, row1 = row0 + atlasWidth;
+					const XMFLOAT4* texels[4] = { &m_atlas[row0], &m_atlas[row0 + 1], &m_atlas[row1], &m_atlas[row1 + 1] };
+					float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+					colour = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+					for (int i = 0; i < 4; i++)
+					{
+						colour.x += texels[i]->x * weights[i];
+						colour.y += texels[i]->y * weights[i];
+						colour.z += texels[i]->z * weights[i];
+						colour.w += texels[i]->w * weights[i];
+					}
+					// depths of cloud and sky do not blend, so the nearest texel's is taken
+					texelDepth = m_atlasDepth[(fy < 0.5f ? row0 : row1) + (fx < 0.5f ? 0 : 1)];
+					hitS = s;
+					inside = true;
+					if (texelDepth == noCloud)
+						break;
+					point = viewEye + XMVector3Normalize(origin + rd * s - viewEye) * texelDepth;
+				}
+				if (!inside)
+					continue;
+
+				size_t pixel = size_t(y) * width + x;
+				float cloudDistance = noCloud;
+				if (texelDepth != noCloud)
+				{
+					XMVECTOR cloud = viewEye + XMVector3Normalize(origin + rd * hitS - viewEye) * texelDepth;
+					cloudDistance = XMVectorGetX(XMVector3Length(cloud - origin));
+					// the scene in front of the cloud hides it, as it ends the shader's march before it
+					if (sceneDepth && sceneDepth[pixel] * zFar < cloudDistance)
+						continue;
+				}
+				image[pixel] = colour;
+				if (depth)
+					(*depth)[pixel] = cloudDistance;
+			}
+		}
+	});
+
+	m_resolveTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,158 @@
+#pragma once
+// CloudImpostorCache
+// Impostors of the cloud volume for cameras far outside it. From a distance the volume covers few pixels and
+// changes little from one frame to the next, yet a frame still marches a ray through it per pixel; instead a few
+// views of it are kept in an atlas, each rendered by the caller from where the camera was when the view was made,
+// looking at the centre of the volume's bounding sphere through a square frustum that just holds it, as colour
+// and transmittance with each texel's cloud depth. A frame intersects every pixel's ray with the plane through
+// the centre facing the view's eye and looks the view up where its eye sees that point: exact from the view's own
+// eye, and off by the parallax of the cloud's depth around the plane as the camera moves away from it. A pixel
+// whose scene depth is in front of the texel's cloud sees none of it.
+// A view is used while it was rendered with the current settings and the angle between its direction and the
+// camera's as seen from the centre, the ratio of their distances from it and the largest change of a coarse copy of
+// the density since the view was rendered stay within thresholds, the view with the least error of those that do
+// being picked. A view keeps only that coarse copy, and measures it again only when the density's version changes.
+// Once the picked view is past half of any threshold it is rendered again for the current camera on a background
+// job, and replaces the old view on the first Update after the job finishes, so frames go on from the old view
+// instead of stalling on the one the view expires. Only when no view is usable at all is one rendered whole, into a
+// free slot or the least recently used one, before the frame is resolved.
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+class CloudImpostorCache
+{
+public:
+	// renders a width x height view from eye through viewInv and projInv into image and depth, as
+	// CPUVolumeRenderer::Render does without a scene depth
+	using RenderView = std::function<void(const XMFLOAT3& eye, const XMMATRIX& viewInv, const XMMATRIX& projInv, int width, int height,
+		std::vector<XMFLOAT4>& image, std::vector<float>& depth)>;
+	// called on the thread calling Update when a view is due to be rendered again; returns what renders it on a
+	// background thread while frames go on, which must share nothing with Update's render or the caller's frames
+	using StartRefresh = std::function<RenderView()>;
+
+	CloudImpostorCache();
+
+	// the sphere around the volume that every view holds
+	void SetBounds(const XMFLOAT3& centre, float radius);
+	// texels along each side of a view and the views the atlas holds; forgets every view
+	void SetLayout(int resolution, int views);
+	int GetResolution() const { return m_resolution; };
+	int GetViewCount() const { return int(m_views.size()); };
+	// forgets every view
+	void Reset();
+
+	// distance from the centre, in bounding radii, from which IsDistant holds
+	void SetMinDistance(float radii) { m_minDistance = std::max(radii, 1.1f); };
+	float GetMinDistance() const { return m_minDistance; };
+	bool IsDistant(const XMFLOAT3& eye) const;
+	void SetAngleThreshold(float degrees) { m_angleThreshold = std::max(degrees, 0.01f); };
+	float GetAngleThreshold() const { return m_angleThreshold; };
+	// largest relative difference between the camera's distance from the centre and a view's
+	void SetDistanceThreshold(float ratio) { m_distanceThreshold = std::max(ratio, 1e-3f); };
+	float GetDistanceThreshold() const { return m_distanceThreshold; };
+	// largest change of a value of the coarse density
+	void SetDensityThreshold(float change) { m_densityThreshold = std::max(change, 1e-4f); };
+	float GetDensityThreshold() const { return m_densityThreshold; };
+
+	// picks the view for a camera at eye, rendering one first if none is usable and starting a refresh of the picked
+	// one if it is due; settings identifies what render and refresh render with, views rendered with other settings
+	// being unusable. density holds count values of a coarse copy of the density the views are compared with, such
+	// as macrocell means, and densityVersion changes whenever they do
+	void Update(const XMFLOAT3& eye, uint64_t settings, const float* density, size_t count, uint64_t densityVersion, const RenderView& render,
+		const StartRefresh& refresh);
+	// the frame from the view Update picked, through clipToWorld as in CPUVolumeRenderer. sceneDepth, if given,
+	// holds width x height linear depths scaled by zFar to distances along the rays, and depth receives each
+	// pixel's cloud depth like Render's. pool may be null
+	void Resolve(const XMFLOAT3& eye, const XMMATRIX& clipToWorld, int width, int height, const float* sceneDepth, float zFar,
+		std::vector<XMFLOAT4>& image, std::vector<float>* depth, ThreadPool* pool);
+
+	// every view's colour and transmittance, and cloud depth, in square slots of resolution texels side by side
+	const std::vector<XMFLOAT4>& GetAtlas() const { return m_atlas; };
+	const std::vector<float>& GetAtlasDepth() const { return m_atlasDepth; };
+	int GetAtlasWidth() const { return m_columns * m_resolution; };
+	int GetAtlasHeight() const { return m_rows * m_resolution; };
+
+	// of the last Update: the view picked, -1 before the first, and its errors against the camera
+	int GetCurrentView() const { return m_current; };
+	float GetAngleError() const { return m_angleError; }; // degrees
+	float GetDensityError() const { return m_densityError; };
+	int GetValidCount() const;
+	bool GetBuiltView() const { return m_built; }; // a view was rendered whole for want of a usable one
+	int GetRenderedRows() const { return m_renderedRows; }; // view rows rendered on the calling thread
+	bool IsRefreshing() const { return m_refreshSlot >= 0; };
+	double GetRefreshTime() const { return m_refreshTime; }; // ms the last finished refresh took on its job
+	double GetUpdateTime() const { return m_updateTime; }; // ms
+	double GetResolveTime() const { return m_resolveTime; }; // ms
+
+private:
+	struct View
+	{
+		bool valid = false;
+		XMFLOAT3 eye;
+		XMFLOAT3 direction; // unit, from the centre toward the eye
+		float distance = 0.0f;
+		XMFLOAT4X4 viewInv, projInv;
+		XMFLOAT4X4 viewProj; // world to the view's clip space
+		uint64_t settings = 0; // what it was rendered with
+		std::vector<float> density; // the coarse density it was rendered from
+		uint64_t densityVersion = 0; // of the density densityError was measured against
+		float densityError = 0.0f;
+		uint64_t lastUsed = 0;
+	};
+
+	// a view from eye; its settings and density are left to the caller
+	View MakeView(const XMFLOAT3& eye) const;
+	// largest difference between a view's density and the current one, measured again only for a new version
+	static float DensityError(View& view, const float* density, size_t count, uint64_t densityVersion);
+	// a view's texels as a refresh job rendered them
+	struct Texels
+	{
+		std::vector<XMFLOAT4> image;
+		std::vector<float> depth;
+		double time = 0.0; // ms
+	};
+
+	// renders a whole view of resolution x resolution texels into image and depth
+	static void RenderWhole(const View& view, int resolution, const RenderView& render, std::vector<XMFLOAT4>& image, std::vector<float>& depth);
+	// copies a whole view's texels into its slot
+	void Store(int slot, const std::vector<XMFLOAT4>& image, const std::vector<float>& depth);
+
+	XMFLOAT3 m_centre;
+	float m_radius = 1.0f;
+	int m_resolution = 0;
+	int m_columns = 0, m_rows = 0;
+	std::vector<View> m_views;
+	std::vector<XMFLOAT4> m_atlas;
+	std::vector<float> m_atlasDepth;
+
+	float m_minDistance = 1.5f;
+	float m_angleThreshold = 2.0f;
+	float m_distanceThreshold = 0.05f;
+	float m_densityThreshold = 0.05f;
+
+	// the refresh in progress: the slot it replaces and the view m_refreshJob renders. A dropped refresh leaves its
+	// job to run out, and no other starts before it has
+	int m_refreshSlot = -1;
+	View m_refreshView;
+	std::shared_future<Texels> m_refreshJob;
+	double m_refreshTime = 0.0;
+	std::vector<XMFLOAT4> m_stagingImage;
+	std::vector<float> m_stagingDepth;
+
+	uint64_t m_frame = 0;
+	int m_current = -1;
+	float m_angleError = 0.0f, m_densityError = 0.0f;
+	bool m_built = false;
+	int m_renderedRows = 0;
+	double m_updateTime = 0.0;
+	double m_resolveTime = 0.0;
+};
@@ -28,12 +28,47 @@ struct VolumeBufferType
 	DirectX::XMMATRIX mainCameraProjInv;
 	float absorption;
 	float scatter;
+	float maxSteps;
+	float maxLightSteps;
+	float adaptive; // 0 marches in maxSteps even steps, 1 adapts the step to the density
+	float minStepScale;
+	float maxStepScale;
+	float edgeThreshold;
+	float nearDistance;
+	float terminationThreshold;
+	float blueNoise; // 1 offsets each ray by the blue noise texture instead of hashing every step
+	float frameIndex; // the blue noise slice
+	float skipEmpty; // 1 jumps the view and light marches over macrocells without density
+	float padding[3];
+};
+
+struct GodRaysBufferType
+{
+	float sampleCount;
+	float blueNoise; // 1 offsets each pixel's samples by the blue noise texture
+	float frameIndex;
+	float padding;
 };
 
 struct FluidBufferType
 {
 	float deltaTime;
 	float elapsedTime;
+	float densityWeight;
+	float thermalBuoyancy;
+};
+
+struct ForceFieldBufferType
+{
+	float elapsedTime;
+	int sliceStart;
+	int sliceCount;
+};
+
+struct DiagnosticsBufferType
+{
+	int stage;
+	float activeThreshold;
 };
 
 struct FractalNoiseBufferType
@@ -52,9 +87,21 @@ struct SDFBufferType
 	float maxY;
 };
 
+static const int kMaxSceneSDFObjects = 8; // MAX_SCENE_OBJECTS in scene_sdf_cs.hlsl
+
+struct SceneSDFObjectType
+{
+	DirectX::XMMATRIX sdfTransformInv;
+	float uniformScale;
+	float padding[3];
+};
+
 struct SolidMaskBufferType
 {
 	DirectX::XMMATRIX simulationTransform;
-	DirectX::XMMATRIX sdfTransformInv0;
-	float uniformScale0;
+	SceneSDFObjectType objects[kMaxSceneSDFObjects];
+	int objectCount;
+	DirectX::XMINT3 brickOffset;
+	float distanceScale;
+	float padding[3];
 };
\ No newline at end of file
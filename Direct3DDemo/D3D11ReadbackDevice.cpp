@@ -0,0 +1,116 @@
+#include "pch.h"
+#include "D3D11ReadbackDevice.h"
+
+using Microsoft::WRL::ComPtr;
+
+D3D11ReadbackDevice::D3D11ReadbackDevice(ID3D11Device* device, const std::vector<ID3D11Resource*>& sources, int slotCount)
+{
+	device->GetImmediateContext(m_deviceContext.GetAddressOf());
+
+	for (ID3D11Resource* source : sources)
+		m_sources.push_back(source);
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_EVENT;
+
+	m_slots.resize(slotCount);
+	for (Slot& slot : m_slots)
+	{
+		DX::ThrowIfFailed(device->CreateQuery(&queryDesc, slot.query.GetAddressOf()));
+		for (ID3D11Resource* source : sources)
+			slot.staging.push_back(CreateStaging(device, source));
+	}
+}
+
+void D3D11ReadbackDevice::Copy(int slot)
+{
+	for (size_t i = 0; i < m_sources.size(); i++)
+		m_deviceContext->CopyResource(m_slots[slot].staging[i].Get(), m_sources[i].Get());
+
+	m_deviceContext->End(m_slots[slot].query.Get());
+}
+
+bool D3D11ReadbackDevice::IsComplete(int slot)
+{
+	BOOL done = FALSE;
+	return m_deviceContext->GetData(m_slots[slot].query.Get(), &done, sizeof(done), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK && done;
+}
+
+bool D3D11ReadbackDevice::Map(int slot, std::vector<ReadbackView>& views)
+{
+	views.resize(m_sources.size());
+	for (size_t i = 0; i < m_sources.size(); i++)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		HRESULT hr = m_deviceContext->Map(m_slots[slot].staging[i].Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+		if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+		{
+			for (size_t j = 0; j < i; j++)
+				m_deviceContext->Unmap(m_slots[slot].staging[j].Get(), 0);
+			return false;
+		}
+		DX::ThrowIfFailed(hr);
+
+		views[i] = { mapped.pData, mapped.RowPitch, mapped.DepthPitch };
+	}
+	return true;
+}
+
+void D3D11ReadbackDevice::Unmap(int slot)
+{
+	for (auto& staging : m_slots[slot].staging)
+		m_deviceContext->Unmap(staging.Get(), 0);
+}
+
+ComPtr<ID3D11Resource> D3D11ReadbackDevice::CreateStaging(ID3D11Device* device, ID3D11Resource* source)
+{
+	D3D11_RESOURCE_DIMENSION dimension;
+	source->GetType(&dimension);
+
+	ComPtr<ID3D11Resource> staging;
+	switch (dimension)
+	{
+	case D3D11_RESOURCE_DIMENSION_BUFFER:
+	{
+		ComPtr<ID3D11Buffer> buffer;
+		D3D11_BUFFER_DESC desc;
+		static_cast<ID3D11Buffer*>(source)->GetDesc(&desc);
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags &= D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		DX::ThrowIfFailed(device->CreateBuffer(&desc, nullptr, buffer.GetAddressOf()));
+		staging = buffer;
+		break;
+	}
+	case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+	{
+		ComPtr<ID3D11Texture2D> texture;
+		D3D11_TEXTURE2D_DESC desc;
+		static_cast<ID3D11Texture2D*>(source)->GetDesc(&desc);
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+		DX::ThrowIfFailed(device->CreateTexture2D(&desc, nullptr, texture.GetAddressOf()));
+		staging = texture;
+		break;
+	}
+	case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+	{
+		ComPtr<ID3D11Texture3D> texture;
+		D3D11_TEXTURE3D_DESC desc;
+		static_cast<ID3D11Texture3D*>(source)->GetDesc(&desc);
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+		DX::ThrowIfFailed(device->CreateTexture3D(&desc, nullptr, texture.GetAddressOf()));
+		staging = texture;
+		break;
+	}
+	default:
+		throw std::invalid_argument("D3D11ReadbackDevice: unsupported resource dimension");
+	}
+	return staging;
+}
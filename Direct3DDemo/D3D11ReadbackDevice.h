@@ -0,0 +1,34 @@
+#pragma once
+// D3D11ReadbackDevice
+// IReadbackDevice over D3D11 staging resources. Every slot holds one staging copy of each source and an
+// event query issued after the copies; completion is polled with DONOTFLUSH and the staging resources are
+// mapped with D3D11_MAP_FLAG_DO_NOT_WAIT, so neither call can stall on the GPU.
+
+#include "pch.h"
+#include "ReadbackDevice.h"
+
+class D3D11ReadbackDevice : public IReadbackDevice
+{
+public:
+	// buffers, 2D and 3D textures are supported; only the first subresource is read back
+	D3D11ReadbackDevice(ID3D11Device* device, const std::vector<ID3D11Resource*>& sources, int slotCount);
+
+	int GetSlotCount() const override { return int(m_slots.size()); };
+	void Copy(int slot) override;
+	bool IsComplete(int slot) override;
+	bool Map(int slot, std::vector<ReadbackView>& views) override;
+	void Unmap(int slot) override;
+
+private:
+	struct Slot
+	{
+		std::vector<Microsoft::WRL::ComPtr<ID3D11Resource>> staging;
+		Microsoft::WRL::ComPtr<ID3D11Query> query;
+	};
+
+	static Microsoft::WRL::ComPtr<ID3D11Resource> CreateStaging(ID3D11Device* device, ID3D11Resource* source);
+
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_deviceContext;
+	std::vector<Microsoft::WRL::ComPtr<ID3D11Resource>> m_sources;
+	std::vector<Slot> m_slots;
+};
@@ -0,0 +1,169 @@
+#include "DepthAwareUpsampler.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+const char* DepthAwareUpsampler::GetFilterName(UpsampleFilter filter)
+{
+	switch (filter)
+	{
+	case UpsampleFilter::NearestDepth: return "nearest_depth";
+	case UpsampleFilter::JointBilateral: return "joint_bilateral";
+	default: return "bilinear";
+	}
+}
+
+void DepthAwareUpsampler::DownsampleDepth(const float* depth, int width, int height, int divisor, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	divisor = std::max(1, divisor);
+	m_lowWidth = (width + divisor - 1) / divisor;
+	m_lowHeight = (height + divisor - 1) / divisor;
+	m_lowDepth.resize(size_t(m_lowWidth) * m_lowHeight);
+
+	ForEachSlice(pool, m_lowHeight, [&](int begin, int end)
+	{
+		for (int ly = begin; ly < end; ly++)
+		{
+			int y0 = ly * divisor, y1 = std::min(y0 + divisor, height);
+			for (int lx = 0; lx < m_lowWidth; lx++)
+			{
+				int x0 = lx * divisor, x1 = std::min(x0 + divisor, width);
+				float nearest = depth[size_t(y0) * width + x0], farthest = nearest;
+				for (int y = y0; y < y1; y++)
+				{
+					const float* row = &depth[size_t(y) * width];
+					for (int x = x0; x < x1; x++)
+					{
+						nearest = std::min(nearest, row[x]);
+						farthest = std::max(farthest, row[x]);
+					}
+				}
+				m_lowDepth[size_t(ly) * m_lowWidth + lx] = (lx + ly) & 1 ? farthest : nearest;
+			}
+		}
+	});
+
+	m_downsampleTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void DepthAwareUpsampler::Upsample(const std::vector<XMFLOAT4>& low, int lowWidth, int lowHeight, const float* depth, int width, int height, UpsampleFilter filter,
+	std::vector<XMFLOAT4>& image, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	image.resize(size_t(width) * height);
+	if (!depth || m_lowDepth.size() != size_t(lowWidth) * lowHeight)
+		filter = UpsampleFilter::Bilinear;
+
+	// the low resolution rays go through the centres of their texels in screen space, as the full resolution ones
+	const float scaleX = float(lowWidth) / width, scaleY = float(lowHeight) / height;
+	// every row has the same columns
+	std::vector<int> columns(width);
+	std::vector<float> columnWeights(width);
+	for (int x = 0; x < width; x++)
+	{
+		float px = std::min(std::max((x + 0.5f) * scaleX - 0.5f, 0.0f), float(lowWidth - 1));
+		columns[x] = std::min(int(px), std::max(lowWidth - 2, 0));
+		columnWeights[x] = px - columns[x];
+	}
+
+	ForEachSlice(pool, height, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			float py = std::min(std::max((y + 0.5f) * scaleY - 0.5f, 0.0f), float(lowHeight - 1));
+			int ty0 = std::min(int(py), std::max(lowHeight - 2, 0)), ty1 = std::min(ty0 + 1, lowHeight - 1);
+			float fy = py - ty0;
+			for (int x = 0; x < width; x++)
+			{
+				int tx0 = columns[x], tx1 = std::min(tx0 + 1, lowWidth - 1);
+				float fx = columnWeights[x];
+
+				const size_t texels[4] = { size_t(ty0) * lowWidth + tx0, size_t(ty0) * lowWidth + tx1, size_t(ty1) * lowWidth + tx0, size_t(ty1) * lowWidth + tx1 };
+
+				// any normalised weights give a footprint of equal texels back unchanged, which covers the sky
+				// and the inside of opaque clouds
+				const XMFLOAT4& first = low[texels[0]];
+				bool uniform = true;
+				for (int i = 1; i < 4 && uniform; i++)
+					uniform = std::memcmp(&low[texels[i]], &first, sizeof(XMFLOAT4)) == 0;
+				if (uniform)
+				{
+					image[size_t(y) * width + x] = first;
+					continue;
+				}
+
+				float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+				if (filter != UpsampleFilter::Bilinear)
+				{
+					float pixelDepth = depth[size_t(y) * width + x];
+					float tolerance = std::max(pixelDepth * m_depthThreshold, 1e-6f);
+					int closest = 0;
+					float closestDifference = std::numeric_limits<float>::max(), largestDifference = 0.0f;
+					float differences[4];
+					for (int i = 0; i < 4; i++)
+					{
+						differences[i] = std::abs(m_lowDepth[texels[i]] - pixelDepth);
+						largestDifference = std::max(largestDifference, differences[i]);
+						if (differences[i] < closestDifference)
+						{
+							closestDifference = differences[i];
+							closest = i;
+						}
+					}
+
+					if (filter == UpsampleFilter::NearestDepth)
+					{
+						// bilinear where the footprint is all one surface, the closest texel across an edge
+						if (largestDifference > tolerance)
+						{
+							for (int i = 0; i < 4; i++)
+								weights[i] = i == closest ? 1.0f : 0.0f;
+						}
+					}
+					else
+					{
+						float sum = 0.0f;
+						for (int i = 0; i < 4; i++)
+						{
+							float r = differences[i] / tolerance;
+							weights[i] /= 1.0f + r * r;
+							sum += weights[i];
+						}
+						// no texel on the pixel's surface: the closest one is still the best guess
+						if (sum < 1e-6f)
+						{
+							for (int i = 0; i < 4; i++)
+								weights[i] = i == closest ? 1.0f : 0.0f;
+						}
+						else
+						{
+							for (int i = 0; i < 4; i++)
+								weights[i] /= sum;
+						}
+					}
+				}
+
+				XMFLOAT4 result(0.0f, 0.0f, 0.0f, 0.0f);
+				for (int i = 0; i < 4; i++)
+				{
+					const XMFLOAT4& c = low[texels[i]];
+					result.x += c.x * weights[i];
+					result.y += c.y * weights[i];
+					result.z += c.z * weights[i];
+					result.w += c.w * weights[i];
+				}
+				image[size_t(y) * width + x] = result;
+			}
+		}
+	});
+
+	m_upsampleTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
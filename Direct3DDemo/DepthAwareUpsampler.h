@@ -0,0 +1,60 @@
+#pragma once
+// DepthAwareUpsampler
+// Kernels for rendering the clouds at a fraction of the screen resolution. The linear scene depth is
+// downsampled to one texel per divisor x divisor block of pixels, the clouds are marched against that depth at
+// the low resolution, and the result is upsampled back using the full resolution depth so terrain edges stay
+// sharp: a plain bilinear upsample blends cloud marched to the sky into terrain pixels and the other way round,
+// which shows as a halo along every silhouette in front of the clouds.
+// The depth is downsampled in a checkerboard, nearest and farthest depth of the block on alternate texels, so
+// around an edge the footprint of an upsampled pixel holds texels of both surfaces. NearestDepth keeps the
+// bilinear result where the footprint's depths all agree with the pixel's and otherwise takes the texel whose
+// depth is closest to it; JointBilateral weighs the bilinear weights by 1 / (1 + r^2), r being the texel's
+// depth difference in units of the threshold.
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+enum class UpsampleFilter
+{
+	Bilinear,
+	NearestDepth,
+	JointBilateral,
+};
+
+class DepthAwareUpsampler
+{
+public:
+	static const char* GetFilterName(UpsampleFilter filter);
+
+	// depth holds width x height linear depths; the result has ceil(width / divisor) x ceil(height / divisor)
+	// texels. pool may be null
+	void DownsampleDepth(const float* depth, int width, int height, int divisor, ThreadPool* pool);
+	const std::vector<float>& GetLowDepth() const { return m_lowDepth; };
+	int GetLowWidth() const { return m_lowWidth; };
+	int GetLowHeight() const { return m_lowHeight; };
+
+	// low holds a lowWidth x lowHeight frame rendered over the depth of the last DownsampleDepth, and depth the
+	// full resolution depth that was downsampled; without a depth every filter is bilinear. pool may be null
+	void Upsample(const std::vector<XMFLOAT4>& low, int lowWidth, int lowHeight, const float* depth, int width, int height, UpsampleFilter filter,
+		std::vector<XMFLOAT4>& image, ThreadPool* pool);
+
+	// difference between depths, relative to the pixel's, beyond which they belong to different surfaces
+	void SetDepthThreshold(float threshold) { m_depthThreshold = std::max(threshold, 1e-4f); };
+	float GetDepthThreshold() const { return m_depthThreshold; };
+
+	double GetDownsampleTime() const { return m_downsampleTime; }; // ms
+	double GetUpsampleTime() const { return m_upsampleTime; }; // ms
+
+private:
+	std::vector<float> m_lowDepth;
+	int m_lowWidth = 0, m_lowHeight = 0;
+	float m_depthThreshold = 0.1f;
+
+	double m_downsampleTime = 0.0;
+	double m_upsampleTime = 0.0;
+};
@@ -2,6 +2,13 @@
 #include "pch.h"
 #include "ReadData.h"
 #include "ConstantBuffer.hpp"
+#include "ReadbackRing.h"
+#include "D3D11ReadbackDevice.h"
+#include "TerrainSDFGenerator.h"
+#include "HeightfieldQuadtree.h"
+#include <DirectXCollision.h>
+#include <chrono>
+#include <future>
 
 using namespace DirectX;
 
@@ -20,26 +27,93 @@ namespace CustomEffects
 			CreateComputeShader(device, csPath, sdfCsPath, bufferDimensions);
 		}
 
-		void Compute(ID3D11DeviceContext* deviceContext, int x, int y, int z)
+		// reruns only the stages whose inputs changed since the last call: the heightfield and normals when a
+		// noise parameter changed, then the vertical SDF or a Euclidean rebuild. Returns true when the SDF
+		// texture was rewritten here; Euclidean results arrive later through PollExactSDF
+		bool Compute(ID3D11DeviceContext* deviceContext, int x, int y, int z)
 		{
-			SetConstantBuffers(deviceContext);
-			SetResourceViews(deviceContext);
+			if (m_displacementDirty)
+			{
+				SetConstantBuffers(deviceContext);
+				SetResourceViews(deviceContext);
+
+				deviceContext->CSSetShader(m_cs.Get(), nullptr, 0);
+				deviceContext->Dispatch(x, y, z);
+
+				Unbind(deviceContext, 2);
+
+				m_displacementDirty = false;
+				m_verticalSDFDirty = true;
+				m_exactSDFRequested = true;
+				m_heightsRequested = true;
+			}
+
+			// the heightfield goes to the CPU for the height quadtree and, with the Euclidean field on, to the
+			// rebuild of the tiles that really changed
+			if (m_heightsRequested || (m_exactSDF && m_exactSDFRequested))
+				m_heightReadback->Request();
+			m_heightsRequested = false;
+			m_exactSDFRequested = false;
+
+			// the vertical field only stands in until the first Euclidean one arrives; after that the old
+			// Euclidean field stays in place until its replacement is ready
+			bool sdfChanged = false;
+			if (m_verticalSDFDirty && (!m_exactSDF || !m_exactSDFUploaded))
+			{
+				SetSDFConstantBuffers(deviceContext);
+				SetSDFResourceViews(deviceContext);
+
+				deviceContext->CSSetShader(m_sdfCs.Get(), nullptr, 0);
+				deviceContext->Dispatch(16, 16, 16); // for 64x64x64 field
+
+				Unbind(deviceContext, 1);
+				sdfChanged = true;
+			}
+			m_verticalSDFDirty = false;
+			return sdfChanged;
+		}
 
-			deviceContext->CSSetShader(m_cs.Get(), nullptr, 0);
-			deviceContext->Dispatch(x, y, z);
+		// collects the heightfield readback, rebuilds the height quadtree from it and hands it to a background
+		// rebuild of the Euclidean field; when a rebuild finishes, uploads the voxels it changed in one go and returns true with their
+		// bounds in the SDF's unit cube
+		bool PollExactSDF(ID3D11DeviceContext* deviceContext, BoundingBox& changedRegion)
+		{
+			m_heightReadback->Poll();
 
-			Unbind(deviceContext, 2);
+			bool uploaded = false;
+			if (m_exactSDFJob.valid() && m_exactSDFJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				uploaded = FinishExactSDFJob(deviceContext, changedRegion);
 
-			// sdf
-			SetSDFConstantBuffers(deviceContext);
-			SetSDFResourceViews(deviceContext);
+			// heights that arrived while a job was running are merged into the next one
+			if (m_exactSDF && !m_exactSDFJob.valid() && m_hasPendingHeights)
+				StartExactSDFJob();
 
-			deviceContext->CSSetShader(m_sdfCs.Get(), nullptr, 0);
-			deviceContext->Dispatch(16, 16, 16); // for 64x64x64 field
+			return uploaded;
+		}
 
-			Unbind(deviceContext, 1);
+		// times the Euclidean build up to 512^3 on a job of its own, as a 512^3 build needs about 1.5 GB and takes
+		// seconds; the threaded runs use the background pool, so a rebuild started meanwhile waits for them
+		void WriteSDFBenchmark(const std::string& filename)
+		{
+			if (IsSDFBenchmarkRunning())
+				return;
+
+			TerrainSDFGenerator generator = m_sdfGenerator;
+			ThreadPool* pool = m_backgroundPool;
+			m_sdfBenchmarkJob = std::async(std::launch::async, [=]()
+			{
+				generator.WriteBenchmark(filename, { 64, 128, 256, 512 }, pool);
+			});
+		}
+		bool IsSDFBenchmarkRunning() const
+		{
+			return m_sdfBenchmarkJob.valid() && m_sdfBenchmarkJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
 		}
 
+		// max-mip quadtree over the heights of the last readback, placed with the terrain transform
+		const HeightfieldQuadtree& GetHeightQuadtree() const { return m_heightQuadtree; };
+		XMMATRIX GetTerrainTransform() const { return m_heightQuadtree.GetTransform(); };
+
 		Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> GetDisplacementSrv() const { return m_displacementSRV; };
 		Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> GetNormalSrv() const { return m_normalSRV; };
 		Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> GetSDFSrv() const { return m_sdfSRV; };
@@ -50,13 +124,37 @@ namespace CustomEffects
 		float GetGain() const { return m_gain; };
 		XMFLOAT3 GetOffset() const { return m_offset; };
 		int GetOctaves() const { return m_octaves; };
-
-		void SetFrequency(float frequency) { m_frequency = frequency; };
-		void SetAmplitude(float amplitude) { m_amplitude = amplitude; };
-		void SetLacunarity(float lacunarity) { m_lacunarity = lacunarity; };
-		void SetGain(float gain) { m_gain = gain; };
-		void SetOffset(const XMFLOAT3 offset) { m_offset = offset; };
-		void SetOctaves(int octaves) { m_octaves = octaves; };
+		bool GetExactSDF() const { return m_exactSDF; };
+		bool HasHeightfield() const { return m_sdfGenerator.HasHeightfield(); };
+
+		// parameters that change the heightfield mark it for the next Compute
+		void SetFrequency(float frequency) { m_displacementDirty |= frequency != m_frequency; m_frequency = frequency; };
+		void SetAmplitude(float amplitude) { m_displacementDirty |= amplitude != m_amplitude; m_amplitude = amplitude; };
+		void SetLacunarity(float lacunarity) { m_displacementDirty |= lacunarity != m_lacunarity; m_lacunarity = lacunarity; };
+		void SetGain(float gain) { m_displacementDirty |= gain != m_gain; m_gain = gain; };
+		void SetOffset(const XMFLOAT3 offset)
+		{
+			m_displacementDirty |= offset.x != m_offset.x || offset.y != m_offset.y || offset.z != m_offset.z;
+			m_offset = offset;
+		}
+		void SetOctaves(int octaves) { m_displacementDirty |= octaves != m_octaves; m_octaves = octaves; };
+		void SetExactSDF(bool exact)
+		{
+			if (exact == m_exactSDF)
+				return;
+
+			// switching on needs a full Euclidean build over the vertical field, switching off brings the
+			// vertical field back
+			m_exactSDF = exact;
+			m_exactSDFRequested = exact;
+			m_verticalSDFDirty = !exact;
+			m_exactSDFUploaded = false;
+		}
+		void SetThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; };
+		// the pool the Euclidean rebuild runs its parallel passes on, from a thread of its own; null runs them serially
+		void SetBackgroundThreadPool(ThreadPool* threadPool) { m_backgroundPool = threadPool; };
+		// maps (u, height, v) of the heightfield to world space, the world matrix the terrain is drawn with
+		void SetTerrainTransform(const XMMATRIX& transform) { m_heightQuadtree.SetTransform(transform); };
 
 		float EstimateMax()
 		{
@@ -71,6 +169,15 @@ namespace CustomEffects
 		}
 
 	private:
+		using SurfacePoint = TerrainSDFGenerator::SurfacePoint;
+
+		struct ExactSDFJob
+		{
+			std::vector<float> heights, sdf;
+			std::vector<SurfacePoint> closest;
+			TerrainSDFGenerator::VoxelBox box;
+		};
+
 		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cs, m_sdfCs;
 
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_displacementBuffer, m_normalBuffer, m_sdfBuffer;
@@ -89,6 +196,96 @@ namespace CustomEffects
 		XMFLOAT3 m_offset{ 2, 180, 0 };
 		int m_octaves = 8;
 
+		// stages waiting for the next Compute
+		bool m_displacementDirty = true, m_verticalSDFDirty = true, m_exactSDFRequested = true, m_heightsRequested = true;
+
+		int m_sdfResolution = 64;
+		int m_heightfieldWidth, m_heightfieldDepth;
+		bool m_exactSDF = true;
+		std::unique_ptr<ReadbackRing> m_heightReadback;
+		ThreadPool* m_threadPool = nullptr;
+		ThreadPool* m_backgroundPool = nullptr;
+		HeightfieldQuadtree m_heightQuadtree;
+
+		// the Euclidean field as uploaded, with the heights and closest surface points it was built from;
+		// a background job works on copies and its result replaces these when it is uploaded
+		TerrainSDFGenerator m_sdfGenerator;
+		std::vector<float> m_exactSDFData;
+		std::vector<SurfacePoint> m_exactSDFClosest;
+		bool m_exactSDFUploaded = false;
+		std::vector<float> m_pendingHeights;
+		bool m_hasPendingHeights = false;
+		std::future<ExactSDFJob> m_exactSDFJob;
+		std::future<void> m_sdfBenchmarkJob;
+		static const int kHeightTileSize = 8; // heightfield samples per terrain_cs thread group side
+
+		void StartExactSDFJob()
+		{
+			// the uploaded field is only a valid starting point while the texture still holds it
+			bool full = !m_exactSDFUploaded || m_exactSDFData.empty();
+			TerrainSDFGenerator previous = m_sdfGenerator;
+			std::vector<float> sdf = m_exactSDFData;
+			std::vector<SurfacePoint> closest = m_exactSDFClosest;
+			std::vector<float> heights;
+			heights.swap(m_pendingHeights);
+			m_hasPendingHeights = false;
+
+			int width = m_heightfieldWidth, depth = m_heightfieldDepth, resolution = m_sdfResolution;
+			// a pool of its own, as the frame's ParallelFor calls on m_threadPool would wait for the job's to finish
+			ThreadPool* pool = m_backgroundPool;
+			m_exactSDFJob = std::async(std::launch::async, [=]() mutable
+			{
+				ExactSDFJob job;
+				TerrainSDFGenerator generator;
+				generator.SetHeightfield(heights.data(), width, depth);
+
+				if (full)
+				{
+					generator.Generate(resolution, sdf, pool, &closest);
+					job.box = { 0, 0, 0, resolution, resolution, resolution };
+				}
+				else
+				{
+					job.box = generator.Update(resolution, generator.FindChangedTiles(previous.GetHeights(), kHeightTileSize), sdf, closest, pool);
+				}
+
+				job.heights = std::move(heights);
+				job.sdf = std::move(sdf);
+				job.closest = std::move(closest);
+				return job;
+			});
+		}
+		bool FinishExactSDFJob(ID3D11DeviceContext* deviceContext, BoundingBox& changedRegion)
+		{
+			ExactSDFJob job = m_exactSDFJob.get();
+
+			// a job that finished after the Euclidean field was switched off is dropped
+			if (!m_exactSDF)
+				return false;
+
+			m_sdfGenerator.SetHeightfield(job.heights.data(), m_heightfieldWidth, m_heightfieldDepth);
+			m_exactSDFData.swap(job.sdf);
+			m_exactSDFClosest.swap(job.closest);
+
+			// the field is always complete, so it can be uploaded whole when the texture holds something else
+			int n = m_sdfResolution;
+			TerrainSDFGenerator::VoxelBox box = m_exactSDFUploaded ? job.box : TerrainSDFGenerator::VoxelBox{ 0, 0, 0, n, n, n };
+			m_exactSDFUploaded = true;
+			if (box.IsEmpty())
+				return false;
+
+			D3D11_BOX region = { UINT(box.x0), UINT(box.y0), UINT(box.z0), UINT(box.x1), UINT(box.y1), UINT(box.z1) };
+			UINT rowPitch = n * sizeof(float);
+			const float* first = &m_exactSDFData[(size_t(box.z0) * n + box.y0) * n + box.x0];
+			deviceContext->UpdateSubresource(m_sdfTexture.Get(), 0, &region, first, rowPitch, rowPitch * n);
+
+			// grown by a voxel since the neighbouring samples blend the changed ones in
+			XMFLOAT3 minCorner(float(box.x0 - 1) / n, float(box.y0 - 1) / n, float(box.z0 - 1) / n);
+			XMFLOAT3 maxCorner(float(box.x1 + 1) / n, float(box.y1 + 1) / n, float(box.z1 + 1) / n);
+			BoundingBox::CreateFromPoints(changedRegion, XMLoadFloat3(&minCorner), XMLoadFloat3(&maxCorner));
+			return true;
+		}
+
 		void CreateComputeShader(ID3D11Device* device, const std::wstring& filepath, const std::wstring& sdfFilepath, const XMFLOAT3& bufferDimensions)
 		{
 			auto csBlob = DX::ReadData(filepath.c_str());
@@ -137,6 +334,19 @@ namespace CustomEffects
 			/*uavDesc.Buffer.NumElements = (sdfDimension) * (sdfDimension) * (sdfDimension);
 			device->CreateUnorderedAccessView(m_sdfBuffer.Get(), &uavDesc, m_sdfUAV.GetAddressOf());*/
 
+			// two slots are plenty, the heightfield only changes when the terrain is regenerated
+			m_heightfieldWidth = int(bufferDimensions.x);
+			m_heightfieldDepth = int(bufferDimensions.y);
+			std::unique_ptr<IReadbackDevice> readbackDevice(new D3D11ReadbackDevice(device, { m_displacementBuffer.Get() }, 2));
+			m_heightReadback = std::make_unique<ReadbackRing>(std::move(readbackDevice));
+			m_heightReadback->SetCallback([this](uint64_t, const std::vector<ReadbackView>& views)
+			{
+				const float* heights = reinterpret_cast<const float*>(views[0].data);
+				m_pendingHeights.assign(heights, heights + size_t(m_heightfieldWidth) * m_heightfieldDepth);
+				m_hasPendingHeights = true;
+				m_heightQuadtree.Build(heights, m_heightfieldWidth, m_heightfieldDepth, m_threadPool);
+			});
+
 
 			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
 			srvDesc.Format = DXGI_FORMAT_UNKNOWN;
@@ -150,7 +360,7 @@ namespace CustomEffects
 			device->CreateShaderResourceView(m_sdfBuffer.Get(), &srvDesc, m_sdfSRV.GetAddressOf());*/
 
 
-			int sdfDimension = 64;
+			int sdfDimension = m_sdfResolution;
 			D3D11_TEXTURE3D_DESC texDesc;
 			texDesc.Width = sdfDimension;
 			texDesc.Height = sdfDimension;
@@ -2,111 +2,7 @@
 #include "FPCamera.h"
 
 
-static float SampleSDF_CPU(float* sdf, XMFLOAT3 sdfUV, XMINT3 resolution)
-{
-	// sdfUV is in [0,1]^3
-	XMFLOAT3 pos {
-		sdfUV.x * (resolution.x - 1),
-		sdfUV.y * (resolution.y - 1),
-		sdfUV.z * (resolution.z - 1)
-	};
-
-	XMINT3 p0 {
-		(int)floor(pos.x),
-		(int)floor(pos.y),
-		(int)floor(pos.z)
-	};
-	XMINT3 p1 {
-		std::min(p0.x + 1, resolution.x - 1),
-		std::min(p0.y + 1, resolution.y - 1),
-		std::min(p0.z + 1, resolution.z - 1)
-	};
-
-	XMFLOAT3 f {
-		pos.x - p0.x,
-		pos.y - p0.y,
-		pos.z - p0.z
-	};
-
-	auto idx = [&](int x, int y, int z) {
-		return (z * resolution.y * resolution.x) + (y * resolution.x) + x;
-		};
-
-	float v000 = sdf[idx(p0.x, p0.y, p0.z)];
-	float v100 = sdf[idx(p1.x, p0.y, p0.z)];
-	float v010 = sdf[idx(p0.x, p1.y, p0.z)];
-	float v110 = sdf[idx(p1.x, p1.y, p0.z)];
-	float v001 = sdf[idx(p0.x, p0.y, p1.z)];
-	float v101 = sdf[idx(p1.x, p0.y, p1.z)];
-	float v011 = sdf[idx(p0.x, p1.y, p1.z)];
-	float v111 = sdf[idx(p1.x, p1.y, p1.z)];
-
-	float v00 = v000 * (1 - f.x) + v100 * f.x;
-	float v10 = v010 * (1 - f.x) + v110 * f.x;
-	float v01 = v001 * (1 - f.x) + v101 * f.x;
-	float v11 = v011 * (1 - f.x) + v111 * f.x;
-
-	float v0 = v00 * (1 - f.y) + v10 * f.y;
-	float v1 = v01 * (1 - f.y) + v11 * f.y;
-
-	return v0 * (1 - f.z) + v1 * f.z;
-}
-static XMFLOAT3 SampleSDFGradient_CPU(XMFLOAT3* sdfGradient, XMFLOAT3 sdfUV, XMINT3 resolution)
-{
-	XMFLOAT3 pos{
-		sdfUV.x * (resolution.x - 1),
-		sdfUV.y * (resolution.y - 1),
-		sdfUV.z * (resolution.z - 1)
-	};
-
-	XMINT3 p0{
-		(int)floor(pos.x),
-		(int)floor(pos.y),
-		(int)floor(pos.z)
-	};
-	XMINT3 p1{
-		std::min(p0.x + 1, resolution.x - 1),
-		std::min(p0.y + 1, resolution.y - 1),
-		std::min(p0.z + 1, resolution.z - 1)
-	};
-
-	XMFLOAT3 f{
-		pos.x - p0.x,
-		pos.y - p0.y,
-		pos.z - p0.z
-	};
-
-	auto idx = [&](int x, int y, int z) {
-		return (z * resolution.y * resolution.x) + (y * resolution.x) + x;
-		};
-
-	// Load all 8 corners
-	XMVECTOR g000 = XMLoadFloat3(&sdfGradient[idx(p0.x, p0.y, p0.z)]);
-	XMVECTOR g100 = XMLoadFloat3(&sdfGradient[idx(p1.x, p0.y, p0.z)]);
-	XMVECTOR g010 = XMLoadFloat3(&sdfGradient[idx(p0.x, p1.y, p0.z)]);
-	XMVECTOR g110 = XMLoadFloat3(&sdfGradient[idx(p1.x, p1.y, p0.z)]);
-	XMVECTOR g001 = XMLoadFloat3(&sdfGradient[idx(p0.x, p0.y, p1.z)]);
-	XMVECTOR g101 = XMLoadFloat3(&sdfGradient[idx(p1.x, p0.y, p1.z)]);
-	XMVECTOR g011 = XMLoadFloat3(&sdfGradient[idx(p0.x, p1.y, p1.z)]);
-	XMVECTOR g111 = XMLoadFloat3(&sdfGradient[idx(p1.x, p1.y, p1.z)]);
-
-	// Interpolate
-	XMVECTOR g00 = XMVectorLerp(g000, g100, f.x);
-	XMVECTOR g10 = XMVectorLerp(g010, g110, f.x);
-	XMVECTOR g01 = XMVectorLerp(g001, g101, f.x);
-	XMVECTOR g11 = XMVectorLerp(g011, g111, f.x);
-
-	XMVECTOR g0 = XMVectorLerp(g00, g10, f.y);
-	XMVECTOR g1 = XMVectorLerp(g01, g11, f.y);
-
-	XMVECTOR result = XMVectorLerp(g0, g1, f.z);
-
-	XMFLOAT3 out;
-	XMStoreFloat3(&out, result);
-	return out;
-}
-
-void FPCamera::Update(float dt, const Keyboard::State& kb, const Mouse::State& mouse, float* sdf, XMFLOAT3* sdfGradient)
+void FPCamera::Update(float dt, const Keyboard::State& kb, const Mouse::State& mouse, const SDFField* sdf)
 {
 	m_frameTime = dt;
 
@@ -134,17 +30,14 @@ void FPCamera::Update(float dt, const Keyboard::State& kb, const Mouse::State& m
 
 
 	//--- COLLISION CHECK
-	if (m_playerControls)
+	if (m_playerControls && sdf && !sdf->IsEmpty())
 	{
-		XMMATRIX sdfTransform = XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -8, -8);
-		XMMATRIX sdfTransformInv = XMMatrixInverse(nullptr, sdfTransform);
 		XMVECTOR wp = XMLoadFloat3(&newPosition);
 
-		XMFLOAT3 sdfSpace;
-		XMStoreFloat3(&sdfSpace, XMVector3Transform(wp, sdfTransformInv));
+		XMFLOAT3 sdfSpace = sdf->ToFieldSpace(newPosition);
 
 
-		XMFLOAT3 grad = SampleSDFGradient_CPU(sdfGradient, sdfSpace, XMINT3(66, 66, 66));
+		XMFLOAT3 grad = sdf->Gradient(newPosition);
 		XMVECTOR normal = XMVector3Normalize(XMLoadFloat3(&grad));
 
 		float slopeCos = XMVectorGetX(XMVector3Dot(normal, XMVectorSet(0, 1, 0, 0))); // cos(theta)
@@ -153,7 +46,7 @@ void FPCamera::Update(float dt, const Keyboard::State& kb, const Mouse::State& m
 
 		if (sdfSpace.x >= 0 && sdfSpace.y >= 0 && sdfSpace.z >= 0 && slopeCos >= minAllowedCos) // inside simulation bounds, check collisions
 		{
-			float val = SampleSDF_CPU(sdf, sdfSpace, XMINT3(66, 66, 66));
+			float val = sdf->Distance(newPosition);
 
 			/*if (val < 0.35)
 			{
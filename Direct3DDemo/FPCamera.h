@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Camera.h"
+#include "SDFField.h"
 #include "SimpleMath.h"
 
 using namespace DirectX;
@@ -11,7 +12,7 @@ class FPCamera : public Camera
 public:
 	FPCamera() : Camera() {};
 
-	void Update(float dt, const Keyboard::State& kb, const Mouse::State& mouse, float* sdf = nullptr, XMFLOAT3* sdfGradient = nullptr);
+	void Update(float dt, const Keyboard::State& kb, const Mouse::State& mouse, const SDFField* sdf = nullptr);
 
 	bool GetPlayerControls() const { return m_playerControls; };
 	void SetPlayerControls(bool enableControls);
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+
+// per-step solver health record, filled from the GPU reductions a couple of frames after the step ran
+struct FluidDiagnostics
+{
+	uint64_t step = 0;
+	float deltaTime = 0.0f;
+
+	// divergence of the velocity field, before and after the pressure projection
+	float maxDivergencePre = 0.0f;
+	float l2DivergencePre = 0.0f;
+	float maxDivergencePost = 0.0f;
+	float l2DivergencePost = 0.0f;
+
+	// mass drift shows up as a change of totalDensity between consecutive records
+	float totalDensity = 0.0f;
+	float maxDensity = 0.0f;
+	float densityChange = 0.0f;
+
+	float kineticEnergy = 0.0f;
+	float maxVelocity = 0.0f;
+	float cflNumber = 0.0f; // max velocity * dt, in cells
+
+	uint32_t activeCells = 0;
+	uint32_t totalCells = 0;
+};
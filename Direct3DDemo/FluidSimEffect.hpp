@@ -2,6 +2,12 @@
 #include "pch.h"
 #include "ReadData.h"
 #include "ConstantBuffer.hpp"
+#include "FluidDiagnostics.h"
+#include "GpuTimer.h"
+#include "ReadbackRing.h"
+#include "D3D11ReadbackDevice.h"
+#include <DirectXCollision.h>
+#include <functional>
 //#include "Perlin.h"
 #include "Simplex.h"
 
@@ -9,14 +15,26 @@ using namespace DirectX;
 
 namespace CustomEffects
 {
+	// bricks per LOD tier (updated every step, every 2nd, every 4th) and the advection time attributed to each
+	struct FluidLodStats
+	{
+		int bricks[3] = {};
+		float time[3] = {};
+	};
+
 	class FluidSimEffect
 	{
 	public:
+		// density, temperature, vapour, condensate; must match SCALAR_FIELD_COUNT in fluid_advect_cs.hlsl
+		static constexpr int kScalarFieldCount = 4;
+
 		explicit FluidSimEffect(ID3D11Device* device, ID3D11DeviceContext* deviceContext, const XMFLOAT3& bufferDimensions)
 		{
 			m_bufferDimensions = bufferDimensions;
 
 			m_fluidBuffer = std::make_unique<ConstantBuffer<FluidBufferType>>();
+			m_forceFieldBuffer = std::make_unique<ConstantBuffer<ForceFieldBufferType>>();
+			m_diagnosticsBuffer = std::make_unique<ConstantBuffer<DiagnosticsBufferType>>();
 
 			m_states = std::make_unique<CommonStates>(device);
 
@@ -25,6 +43,7 @@ namespace CustomEffects
 
 			CreateComputeShader(device, L"res/shaders/perlin_cs.cso", m_perlinNoiseCs.GetAddressOf());
 
+			CreateComputeShader(device, L"res/shaders/fluid_force_cs.cso", m_forceFieldCs.GetAddressOf());
 			CreateComputeShader(device, L"res/shaders/fluid_bounds_cs.cso", m_boundsCs.GetAddressOf());
 			CreateComputeShader(device, L"res/shaders/fluid_advect_staggered_cs.cso", m_advectStaggeredCs.GetAddressOf());
 			CreateComputeShader(device, L"res/shaders/fluid_advect_cs.cso", m_advectCs.GetAddressOf());
@@ -34,6 +53,9 @@ namespace CustomEffects
 			CreateComputeShader(device, L"res/shaders/fluid_jacobi_poisson_cs.cso", m_poissonCs.GetAddressOf());
 			CreateComputeShader(device, L"res/shaders/fluid_gradient_cs.cso", m_gradientCs.GetAddressOf());
 			CreateComputeShader(device, L"res/shaders/fluid_diffuse_cs.cso", m_diffuseCs.GetAddressOf());
+			CreateComputeShader(device, L"res/shaders/fluid_diagnostics_cs.cso", m_diagnosticsCs.GetAddressOf());
+			CreateComputeShader(device, L"res/shaders/fluid_diagnostics_reduce_cs.cso", m_diagnosticsReduceCs.GetAddressOf());
+			CreateComputeShader(device, L"res/shaders/fluid_macrocell_cs.cso", m_macrocellCs.GetAddressOf());
 
 			CreateResourceViews(device);
 
@@ -55,12 +77,20 @@ namespace CustomEffects
 
 		void Compute(ID3D11DeviceContext* deviceContext, int x, int y, int z)
 		{
+			//--- external forces cache (wind + curl noise)
+			UpdateForceField(deviceContext);
+
+			//--- per-brick update schedule for the advection passes
+			UpdateBrickSteps(deviceContext);
+
 			//--- velocity advection
+			BeginTimer(deviceContext, "Advect Velocity");
 			SetConstantBuffers(deviceContext);
 			SetStaggeredAdvectionResourceViews(deviceContext);
 			deviceContext->CSSetShader(m_advectStaggeredCs.Get(), nullptr, 0);
 			deviceContext->Dispatch(x + 1, y + 1, z + 1);
-			Unbind(deviceContext, 6);
+			Unbind(deviceContext, 7);
+			EndTimer(deviceContext, "Advect Velocity");
 
 			//--- boundary conditions
 			SetConstantBuffers(deviceContext);
@@ -72,26 +102,29 @@ namespace CustomEffects
 			m_velocityBufferIndex = 1 - m_velocityBufferIndex;
 
 			//--- vorticity confinement
-			// velocity curl calculation
-			SetCurlResourceViews(deviceContext);
-			deviceContext->CSSetShader(m_curlCs.Get(), nullptr, 0);
-			deviceContext->Dispatch(x, y, z);
-			Unbind(deviceContext, 3);
+			if (m_vorticityEnabled)
+			{
+				// velocity curl calculation
+				SetCurlResourceViews(deviceContext);
+				deviceContext->CSSetShader(m_curlCs.Get(), nullptr, 0);
+				deviceContext->Dispatch(x, y, z);
+				Unbind(deviceContext, 3);
 
-			// confinement force application
-			SetVorticityResourceViews(deviceContext);
-			deviceContext->CSSetShader(m_vorticityCs.Get(), nullptr, 0);
-			deviceContext->Dispatch(x, y, z);
-			Unbind(deviceContext, 4);
+				// confinement force application
+				SetVorticityResourceViews(deviceContext);
+				deviceContext->CSSetShader(m_vorticityCs.Get(), nullptr, 0);
+				deviceContext->Dispatch(x, y, z);
+				Unbind(deviceContext, 4);
 
-			//--- boundary conditions
-			SetConstantBuffers(deviceContext);
-			SetBoundsResourceViews(deviceContext);
-			deviceContext->CSSetShader(m_boundsCs.Get(), nullptr, 0);
-			deviceContext->Dispatch(x + 1, y + 1, z + 1);
-			Unbind(deviceContext, 3);
-			// swap velocity
-			m_velocityBufferIndex = 1 - m_velocityBufferIndex;
+				//--- boundary conditions
+				SetConstantBuffers(deviceContext);
+				SetBoundsResourceViews(deviceContext);
+				deviceContext->CSSetShader(m_boundsCs.Get(), nullptr, 0);
+				deviceContext->Dispatch(x + 1, y + 1, z + 1);
+				Unbind(deviceContext, 3);
+				// swap velocity
+				m_velocityBufferIndex = 1 - m_velocityBufferIndex;
+			}
 
 
 			//--- velocity divergence calculation
@@ -100,8 +133,11 @@ namespace CustomEffects
 			deviceContext->Dispatch(x + 1, y + 1, z + 1);
 			Unbind(deviceContext, 3);
 
+			if (m_diagnosticsEnabled)
+				ReduceDiagnostics(deviceContext, 0, x, y, z);
+
 			//--- poisson equation with jacobi
-			for (int i = 0; i < 70; i++)
+			for (int i = 0; i < m_pressureIterations; i++)
 			{
 				SetPoissonResourceViews(deviceContext);
 				deviceContext->CSSetShader(m_poissonCs.Get(), nullptr, 0);
@@ -135,8 +171,8 @@ namespace CustomEffects
 
 			//--- density diffusion
 			//deviceContext->CopyResource(
-			//	reinterpret_cast<ID3D11Resource*>(m_densityBuffer[(m_densityBufferIndex + 1) % 3].Get()),
-			//	reinterpret_cast<ID3D11Resource*>(m_densityBuffer[m_densityBufferIndex].Get())
+			//	reinterpret_cast<ID3D11Resource*>(m_scalarBuffer[(m_densityBufferIndex + 1) % 3].Get()),
+			//	reinterpret_cast<ID3D11Resource*>(m_scalarBuffer[m_densityBufferIndex].Get())
 			//);
 			//int numJacobiIterations = 20;
 			//for (int i = 0; i < numJacobiIterations; i++)
@@ -154,13 +190,252 @@ namespace CustomEffects
 
 			//--- density advection
 			// semi-lagrangian for first pass
+			BeginTimer(deviceContext, "Advect Scalars");
 			SetConstantBuffers(deviceContext);
 			SetAdvectionResourceViews(deviceContext);
 			deviceContext->CSSetShader(m_advectCs.Get(), nullptr, 0);
 			deviceContext->Dispatch(x + 1, y + 1, z + 1);
-			Unbind(deviceContext, 7);
+			Unbind(deviceContext, 8);
+			EndTimer(deviceContext, "Advect Scalars");
 			// swap density
 			m_densityBufferIndex = (m_densityBufferIndex + 1) % 3;
+
+			//--- macrocells of the new density for the volume's empty-space skipping
+			BeginTimer(deviceContext, "Macrocells");
+			BuildMacrocells(deviceContext);
+			EndTimer(deviceContext, "Macrocells");
+
+			//--- diagnostics (skipped entirely when disabled)
+			if (m_diagnosticsEnabled)
+			{
+				// divergence is recomputed on the projected field; the buffer is not read again this step
+				SetDivergenceResourceViews(deviceContext);
+				deviceContext->CSSetShader(m_divergenceCs.Get(), nullptr, 0);
+				deviceContext->Dispatch(x + 1, y + 1, z + 1);
+				Unbind(deviceContext, 3);
+
+				ReduceDiagnostics(deviceContext, 1, x, y, z);
+				ResolveDiagnostics(deviceContext);
+			}
+			m_stepIndex++;
+		}
+		// assigns every brick (one 4^3 thread group of the advection passes) an update period from the camera:
+		// visible bricks within m_lodNearDistance every step, visible bricks within m_lodFarDistance every 2nd step,
+		// everything else every 4th. Neighbouring bricks are kept within one tier of each other.
+		void UpdateLod(const XMFLOAT3& cameraPosition, const DirectX::BoundingFrustum& frustum)
+		{
+			if (!m_lodEnabled)
+				return;
+
+			int bricks = m_brickGridSize * m_brickGridSize * m_brickGridSize;
+			XMFLOAT3 gridSize(m_bufferDimensions.x + 2, m_bufferDimensions.y + 2, m_bufferDimensions.z + 2);
+			XMVECTOR camera = XMLoadFloat3(&cameraPosition);
+
+			std::vector<int> periods(bricks);
+			for (int bz = 0; bz < m_brickGridSize; bz++)
+			{
+				for (int by = 0; by < m_brickGridSize; by++)
+				{
+					for (int bx = 0; bx < m_brickGridSize; bx++)
+					{
+						// brick extent in normalized grid space, the last brick only partially covers the grid
+						XMVECTOR lo = XMVectorSet(bx * 4 / gridSize.x, by * 4 / gridSize.y, bz * 4 / gridSize.z, 0);
+						XMVECTOR hi = XMVectorSet(std::min((bx + 1) * 4.0f, gridSize.x) / gridSize.x, std::min((by + 1) * 4.0f, gridSize.y) / gridSize.y, std::min((bz + 1) * 4.0f, gridSize.z) / gridSize.z, 0);
+
+						BoundingBox localBox, worldBox;
+						BoundingBox::CreateFromPoints(localBox, lo, hi);
+						localBox.Transform(worldBox, m_simulationTransform);
+
+						XMVECTOR center = XMLoadFloat3(&worldBox.Center);
+						XMVECTOR extents = XMLoadFloat3(&worldBox.Extents);
+						XMVECTOR closest = XMVectorClamp(camera, center - extents, center + extents);
+						float distance = XMVectorGetX(XMVector3Length(camera - closest));
+
+						int period = 4;
+						if (frustum.Contains(worldBox) != DISJOINT)
+							period = distance < m_lodNearDistance ? 1 : distance < m_lodFarDistance ? 2 : 4;
+						else if (distance < m_lodNearDistance)
+							period = 2;
+
+						periods[BrickIndex(bx, by, bz)] = period;
+					}
+				}
+			}
+
+			// boundary consistency: a brick updates at least half as often as its fastest face neighbour,
+			// so tiers only ever meet their adjacent tier and no brick reads a neighbour more than one tier stale
+			const int offsets[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+			for (int bz = 0; bz < m_brickGridSize; bz++)
+			{
+				for (int by = 0; by < m_brickGridSize; by++)
+				{
+					for (int bx = 0; bx < m_brickGridSize; bx++)
+					{
+						int period = periods[BrickIndex(bx, by, bz)];
+						for (const auto& offset : offsets)
+						{
+							int nx = bx + offset[0], ny = by + offset[1], nz = bz + offset[2];
+							if (nx < 0 || ny < 0 || nz < 0 || nx >= m_brickGridSize || ny >= m_brickGridSize || nz >= m_brickGridSize)
+								continue;
+							period = std::min(period, 2 * periods[BrickIndex(nx, ny, nz)]);
+						}
+						m_brickPeriods[BrickIndex(bx, by, bz)] = period;
+					}
+				}
+			}
+		}
+		void UpdateBrickSteps(ID3D11DeviceContext* deviceContext)
+		{
+			int bricks = m_brickGridSize * m_brickGridSize * m_brickGridSize;
+			if (!m_lodEnabled)
+			{
+				// every brick every step; only re-uploaded when LOD is switched off
+				if (m_brickStepsLod)
+				{
+					std::vector<float> steps(bricks, 1.0f);
+					deviceContext->UpdateSubresource(m_brickStepsBuffer.Get(), 0, nullptr, steps.data(), 0, 0);
+					m_brickStepsLod = false;
+					std::fill(m_brickTime.begin(), m_brickTime.end(), 0.0f);
+				}
+				return;
+			}
+			m_brickStepsLod = true;
+
+			// a brick updates on steps that are multiples of its period and integrates all the time since its own
+			// last update, so a brick that changes tier neither gains nor loses time
+			const int tierPeriods[3] = { 1, 2, 4 };
+			std::vector<float> steps(bricks);
+			int bricksPerTier[3] = {};
+			for (int i = 0; i < bricks; i++)
+			{
+				int tier = m_brickPeriods[i] == 1 ? 0 : m_brickPeriods[i] == 2 ? 1 : 2;
+				bricksPerTier[tier]++;
+
+				m_brickTime[i] += m_deltaTime;
+				steps[i] = 0.0f;
+				if (m_stepIndex % m_brickPeriods[i] == 0)
+				{
+					steps[i] = m_deltaTime > 0.0f ? m_brickTime[i] / m_deltaTime : 1.0f;
+					m_brickTime[i] = 0.0f;
+				}
+			}
+			deviceContext->UpdateSubresource(m_brickStepsBuffer.Get(), 0, nullptr, steps.data(), 0, 0);
+
+			// the measured advection time is split across tiers by their share of brick updates, averaged over
+			// the 4-step cycle (skipped bricks only copy through and are not counted)
+			float advectionTime = m_gpuTimer ? m_gpuTimer->GetTime("Advect Velocity") + m_gpuTimer->GetTime("Advect Scalars") : 0.0f;
+			float updates[3], totalUpdates = 0.0f;
+			for (int t = 0; t < 3; t++)
+			{
+				updates[t] = float(bricksPerTier[t]) / tierPeriods[t];
+				totalUpdates += updates[t];
+			}
+			for (int t = 0; t < 3; t++)
+			{
+				m_lodStats.bricks[t] = bricksPerTier[t];
+				m_lodStats.time[t] = totalUpdates > 0.0f ? advectionTime * updates[t] / totalUpdates : 0.0f;
+			}
+		}
+		void ReduceDiagnostics(ID3D11DeviceContext* deviceContext, int stage, int x, int y, int z)
+		{
+			m_diagnosticsBuffer->Apply(deviceContext, { stage, m_activeCellThreshold });
+			deviceContext->CSSetConstantBuffers(0, 1, m_diagnosticsBuffer->GetAddressOf());
+
+			int velocityIndex = m_velocityBufferIndex;
+			ID3D11ShaderResourceView* srvs[] = { m_velocityXSRV[velocityIndex].Get(), m_velocityYSRV[velocityIndex].Get(), m_velocityZSRV[velocityIndex].Get(), m_divergenceSRV.Get(), m_densitySRV[m_densityBufferIndex].Get() };
+			deviceContext->CSSetUnorderedAccessViews(0, 1, m_diagnosticsPartialUAV.GetAddressOf(), nullptr);
+			deviceContext->CSSetShaderResources(0, 5, srvs);
+
+			// interior cells only, so no extra group for the ghost layer
+			deviceContext->CSSetShader(m_diagnosticsCs.Get(), nullptr, 0);
+			deviceContext->Dispatch(x, y, z);
+			Unbind(deviceContext, 5);
+		}
+		void ResolveDiagnostics(ID3D11DeviceContext* deviceContext)
+		{
+			// both stages' partials are folded into one small result buffer, one group per stage
+			deviceContext->CSSetUnorderedAccessViews(0, 1, m_diagnosticsResultUAV.GetAddressOf(), nullptr);
+			deviceContext->CSSetShaderResources(0, 1, m_diagnosticsPartialSRV.GetAddressOf());
+			deviceContext->CSSetShader(m_diagnosticsReduceCs.Get(), nullptr, 0);
+			deviceContext->Dispatch(2, 1, 1);
+			Unbind(deviceContext, 1);
+
+			// the ring is read back a few frames late so the CPU never waits on the GPU
+			PollDiagnostics(deviceContext);
+
+			DiagnosticsReadback& slot = m_diagnosticsReadback[m_diagnosticsReadbackHead];
+			if (slot.pending)
+				m_diagnosticsDropped++;
+
+			deviceContext->CopyResource(slot.staging.Get(), m_diagnosticsResultBuffer.Get());
+			slot.pending = true;
+			slot.step = m_stepIndex;
+			slot.deltaTime = m_deltaTime;
+			m_diagnosticsReadbackHead = (m_diagnosticsReadbackHead + 1) % kDiagnosticsReadbackLatency;
+		}
+		void PollDiagnostics(ID3D11DeviceContext* deviceContext)
+		{
+			// oldest first, stop at the first copy the GPU has not finished yet
+			for (int i = 0; i < kDiagnosticsReadbackLatency; i++)
+			{
+				DiagnosticsReadback& slot = m_diagnosticsReadback[(m_diagnosticsReadbackHead + i) % kDiagnosticsReadbackLatency];
+				if (!slot.pending)
+					continue;
+
+				D3D11_MAPPED_SUBRESOURCE mapped;
+				HRESULT hr = deviceContext->Map(slot.staging.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+				if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+					break;
+				DX::ThrowIfFailed(hr);
+
+				float values[2 * kDiagnosticsValueCount];
+				memcpy(values, mapped.pData, sizeof(values));
+				deviceContext->Unmap(slot.staging.Get(), 0);
+				slot.pending = false;
+
+				StoreDiagnostics(slot, values);
+			}
+		}
+
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetDensitySrv() const { return m_densitySRV[m_densityBufferIndex]; };
+
+		// snapshots the current density; the CPU copy arrives through PollDensityReadback a few frames later,
+		// requests made while every slot is busy are merged
+		void RequestDensityReadback(ID3D11DeviceContext* deviceContext)
+		{
+			// density is the first scalar field, so it is the start of the buffer
+			UINT densityBytes = sizeof(float) * UINT((m_bufferDimensions.x + 2) * (m_bufferDimensions.y + 2) * (m_bufferDimensions.z + 2));
+			D3D11_BOX box = { 0, 0, 0, densityBytes, 1, 1 };
+			deviceContext->CopySubresourceRegion(m_densitySnapshotBuffer.Get(), 0, 0, 0, 0, m_scalarBuffer[m_densityBufferIndex].Get(), 0, &box);
+			m_densityReadback->Request();
+		}
+		void PollDensityReadback() { m_densityReadback->Poll(); };
+		// (simRes + 2)^3 samples with the ghost cells, x fastest; the version counts delivered readbacks
+		const std::vector<float>& GetCPUDensity() const { return m_cpuDensity; };
+		uint64_t GetCPUDensityVersion() const { return m_cpuDensityVersion; };
+		XMINT3 GetDensityResolution() const { return XMINT3(int(m_bufferDimensions.x) + 2, int(m_bufferDimensions.y) + 2, int(m_bufferDimensions.z) + 2); };
+		void UpdateForceField(ID3D11DeviceContext* deviceContext)
+		{
+			// the forces vary on time scales of hundreds of steps, so only a slab of the cache is refreshed per step
+			// and the whole field is rebuilt every m_forceUpdateInterval steps (first call rebuilds everything)
+			int sliceCount = m_forceFieldValid ? (m_forceFieldResolution + m_forceUpdateInterval - 1) / m_forceUpdateInterval : m_forceFieldResolution;
+			int sliceStart = m_forceFieldValid ? m_forceFieldSlice : 0;
+
+			m_forceFieldBuffer->Apply(deviceContext, { m_elapsedTime, sliceStart, sliceCount });
+			deviceContext->CSSetConstantBuffers(0, 1, m_forceFieldBuffer->GetAddressOf());
+
+			deviceContext->CSSetUnorderedAccessViews(0, 1, m_forceFieldUAV.GetAddressOf(), nullptr);
+			deviceContext->CSSetShaderResources(0, 1, m_perlinNoiseSRV.GetAddressOf());
+			auto sampler = m_states->LinearWrap();
+			deviceContext->CSSetSamplers(0, 1, &sampler);
+
+			int groups = (m_forceFieldResolution + 3) / 4;
+			deviceContext->CSSetShader(m_forceFieldCs.Get(), nullptr, 0);
+			deviceContext->Dispatch(groups, groups, (sliceCount + 3) / 4);
+			Unbind(deviceContext, 1);
+
+			m_forceFieldSlice = (sliceStart + sliceCount) % m_forceFieldResolution;
+			m_forceFieldValid = true;
 		}
 		void Unbind(ID3D11DeviceContext* deviceContext, UINT count)
 		{
@@ -174,55 +449,165 @@ namespace CustomEffects
 			deviceContext->CSSetShader(nullptr, nullptr, 0);
 		}
 
-		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetDensitySrv() const { return m_densitySRV[m_densityBufferIndex]; };
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> GetDensityUav() const { return m_densityUAV[1 - m_densityBufferIndex]; };
 
-		void SwapDensityBuffers() { m_densityBufferIndex = (m_densityBufferIndex + 1) % 3; };
+		void SwapDensityBuffers() { m_densityBufferIndex = (m_densityBufferIndex + 1) % 3; m_macrocellsDirty = true; };
+
+		// min and max density of every 4^3 macrocell, one advection brick, as float2 (min, max), x fastest; rebuilt
+		// after every density advection, and by UpdateMacrocells when the density was swapped in from outside
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetMacrocellSrv() const { return m_macrocellSRV; };
+		void UpdateMacrocells(ID3D11DeviceContext* deviceContext)
+		{
+			if (m_macrocellsDirty)
+				BuildMacrocells(deviceContext);
+		}
+		int GetForceUpdateInterval() const { return m_forceUpdateInterval; };
+
+		float GetDensityWeight() const { return m_densityWeight; };
+		bool GetDiagnosticsEnabled() const { return m_diagnosticsEnabled; };
+		bool GetLodEnabled() const { return m_lodEnabled; };
+		float GetLodNearDistance() const { return m_lodNearDistance; };
+		float GetLodFarDistance() const { return m_lodFarDistance; };
+		const FluidLodStats& GetLodStats() const { return m_lodStats; };
+		int GetPressureIterations() const { return m_pressureIterations; };
+		bool GetVorticityEnabled() const { return m_vorticityEnabled; };
+		const FluidDiagnostics& GetDiagnostics() const { return m_diagnostics; };
+		// records lost because their staging slot was reused before the GPU finished the copy
+		uint64_t GetDiagnosticsDropped() const { return m_diagnosticsDropped; };
+		float GetThermalBuoyancy() const { return m_thermalBuoyancy; };
+
+		void SetForceUpdateInterval(int steps) { m_forceUpdateInterval = std::max(1, steps); };
+		void SetDensityWeight(float weight) { m_densityWeight = weight; };
+		void SetThermalBuoyancy(float buoyancy) { m_thermalBuoyancy = buoyancy; };
+		void SetDiagnosticsEnabled(bool enabled)
+		{
+			// copies still in flight when the stage is switched off are abandoned, so no stale record turns up
+			// after it is switched back on and the density change restarts from the next record
+			if (m_diagnosticsEnabled && !enabled)
+			{
+				for (DiagnosticsReadback& slot : m_diagnosticsReadback)
+					slot.pending = false;
+				m_diagnosticsReadbackHead = 0;
+				m_diagnosticsValid = false;
+			}
+			m_diagnosticsEnabled = enabled;
+		};
+		void SetLodEnabled(bool enabled) { m_lodEnabled = enabled; };
+		void SetLodDistances(float nearDistance, float farDistance) { m_lodNearDistance = nearDistance; m_lodFarDistance = std::max(nearDistance, farDistance); };
+		// maps the unit cube of the grid (ghost cells included) to world space
+		void SetSimulationTransform(const XMMATRIX& transform) { m_simulationTransform = transform; };
+		// optional, used to time the advection passes
+		void SetGpuTimer(GpuTimer* timer) { m_gpuTimer = timer; };
+		void SetPressureIterations(int iterations) { m_pressureIterations = std::max(1, iterations); };
+		void SetVorticityEnabled(bool enabled) { m_vorticityEnabled = enabled; };
+		// called with every record once its readback completes, for telemetry consumers
+		void SetDiagnosticsCallback(std::function<void(const FluidDiagnostics&)> callback) { m_diagnosticsCallback = callback; };
 		void SetDeltaTime(float dt) { m_deltaTime = dt; };
 		void SetElapsedTime(float t) { m_elapsedTime = t; };
 		void SetSurfaceSRV(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_surfaceSRV = srv; };
 		void SetSDFSRV(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_sdfSRV = srv; };
-		void SetSDFGradientSRV(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_sdfGradientSRV = srv; };
 
 	private:
-		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_perlinNoiseCs;
+		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_perlinNoiseCs, m_forceFieldCs;
+		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_diagnosticsCs, m_diagnosticsReduceCs;
+		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_macrocellCs;
 		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_boundsCs, m_advectStaggeredCs, m_advectCs, m_curlCs, m_vorticityCs, m_divergenceCs, m_poissonCs, m_gradientCs, m_diffuseCs;
 
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_perlinNoiseBuffer;
 		Microsoft::WRL::ComPtr<ID3D11Texture3D> m_perlinNoiseTexture;
+		Microsoft::WRL::ComPtr<ID3D11Texture3D> m_forceFieldTexture;
 
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_velocityXBuffer[2], m_velocityYBuffer[2], m_velocityZBuffer[2];
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_curlBuffer;
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_divergenceBuffer;
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_pressureBuffer[2];
-		Microsoft::WRL::ComPtr<ID3D11Buffer> m_densityBuffer[3];
+		// scalar fields (density, temperature, vapour, condensate) stored field-major in one buffer
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_scalarBuffer[3];
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_diagnosticsPartialBuffer, m_diagnosticsResultBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_brickStepsBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_macrocellBuffer;
+		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_macrocellUAV;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_macrocellSRV;
+		int m_macrocellCount = 8; // per axis
+		bool m_macrocellsDirty = true;
+		// the density buffer rotates, so readbacks copy from a fixed snapshot of it
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_densitySnapshotBuffer;
 
 
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_perlinNoiseUAV;
+		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_forceFieldUAV;
 
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_velocityXUAV[2], m_velocityYUAV[2], m_velocityZUAV[2];
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_curlUAV;
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_divergenceUAV;
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_pressureUAV[2];
-		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_densityUAV[3];
+		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_scalarUAV[3], m_densityUAV[3];
+		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_diagnosticsPartialUAV, m_diagnosticsResultUAV;
 
 
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_perlinNoiseSRV;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_forceFieldSRV;
 
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_velocityXSRV[2], m_velocityYSRV[2], m_velocityZSRV[2];
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_curlSRV;
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_divergenceSRV;
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_pressureSRV[2];
-		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_densitySRV[3];
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_scalarSRV[3], m_densitySRV[3];
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_diagnosticsPartialSRV;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_brickStepsSRV;
 
 		int m_velocityBufferIndex = 0, m_densityBufferIndex = 0, m_pressureBufferIndex = 0;
 
 		std::unique_ptr<ConstantBuffer<FluidBufferType>> m_fluidBuffer;
+		std::unique_ptr<ConstantBuffer<ForceFieldBufferType>> m_forceFieldBuffer;
+		std::unique_ptr<ConstantBuffer<DiagnosticsBufferType>> m_diagnosticsBuffer;
+
+		// force cache spans the (simRes + 2)^3 grid at half resolution
+		int m_forceFieldResolution = 18;
+		int m_forceUpdateInterval = 4, m_forceFieldSlice = 0;
+		bool m_forceFieldValid = false;
+
+		// diagnostics: values per stage must match DIAGNOSTICS_VALUE_COUNT, partials per stage match DIAGNOSTICS_PARTIAL_COUNT
+		static constexpr int kDiagnosticsValueCount = 7;
+		static constexpr int kDiagnosticsPartialCount = 512;
+		static constexpr int kDiagnosticsReadbackLatency = 3;
+		struct DiagnosticsReadback
+		{
+			Microsoft::WRL::ComPtr<ID3D11Buffer> staging;
+			bool pending = false;
+			uint64_t step = 0;
+			float deltaTime = 0.0f;
+		};
+		DiagnosticsReadback m_diagnosticsReadback[kDiagnosticsReadbackLatency];
+		int m_diagnosticsReadbackHead = 0;
+		uint64_t m_stepIndex = 0, m_diagnosticsDropped = 0;
+		bool m_diagnosticsEnabled = false, m_diagnosticsValid = false;
+		float m_activeCellThreshold = 1e-3f;
+		FluidDiagnostics m_diagnostics;
+		std::function<void(const FluidDiagnostics&)> m_diagnosticsCallback;
+
+		static constexpr int kDensityReadbackSlots = 3;
+		std::unique_ptr<ReadbackRing> m_densityReadback;
+		std::vector<float> m_cpuDensity;
+		uint64_t m_cpuDensityVersion = 0;
+
+		// brick LOD: one brick per thread group of the (x + 1)^3 advection dispatch
+		int m_brickGridSize = 9;
+		std::vector<int> m_brickPeriods;
+		bool m_lodEnabled = false, m_brickStepsLod = true;
+		float m_lodNearDistance = 8.0f, m_lodFarDistance = 20.0f;
+		std::vector<float> m_brickTime; // time since each brick last advected
+		FluidLodStats m_lodStats;
+		XMMATRIX m_simulationTransform = XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -8, -8);
+		GpuTimer* m_gpuTimer = nullptr;
 
 		XMFLOAT3 m_bufferDimensions;
 		float m_deltaTime, m_elapsedTime;
+		float m_densityWeight = 13.0f, m_thermalBuoyancy = 15.0f;
+		int m_pressureIterations = 70;
+		bool m_vorticityEnabled = true;
 
-		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_surfaceSRV, m_sdfSRV, m_sdfGradientSRV;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_surfaceSRV, m_sdfSRV;
 
 		std::unique_ptr<DirectX::CommonStates> m_states;
 
@@ -263,6 +648,21 @@ namespace CustomEffects
 			DX::ThrowIfFailed(device->CreateShaderResourceView(m_perlinNoiseTexture.Get(), &noiseSrvDesc, m_perlinNoiseSRV.GetAddressOf()));
 
 
+			//--- FORCE FIELD CACHE
+			texDesc.Width = m_forceFieldResolution;
+			texDesc.Height = m_forceFieldResolution;
+			texDesc.Depth = m_forceFieldResolution;
+			texDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+			DX::ThrowIfFailed(device->CreateTexture3D(&texDesc, nullptr, m_forceFieldTexture.GetAddressOf()));
+
+			noiseUavDesc.Format = texDesc.Format;
+			noiseUavDesc.Texture3D.WSize = m_forceFieldResolution;
+			DX::ThrowIfFailed(device->CreateUnorderedAccessView(m_forceFieldTexture.Get(), &noiseUavDesc, m_forceFieldUAV.GetAddressOf()));
+
+			noiseSrvDesc.Format = texDesc.Format;
+			DX::ThrowIfFailed(device->CreateShaderResourceView(m_forceFieldTexture.Get(), &noiseSrvDesc, m_forceFieldSRV.GetAddressOf()));
+
+
 			//--- SIM BUFFERS
 			D3D11_BUFFER_DESC bufferDesc;
 			bufferDesc.Usage = D3D11_USAGE_DEFAULT;
@@ -292,10 +692,23 @@ namespace CustomEffects
 			{
 				DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_pressureBuffer[i].GetAddressOf()));
 			}
+			bufferDesc.ByteWidth *= kScalarFieldCount;
 			for (int i = 0; i < 3; i++)
 			{
-				DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_densityBuffer[i].GetAddressOf()));
+				DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_scalarBuffer[i].GetAddressOf()));
 			}
+			bufferDesc.ByteWidth /= kScalarFieldCount;
+			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_densitySnapshotBuffer.GetAddressOf()));
+
+			std::vector<ID3D11Resource*> readbackSources = { m_densitySnapshotBuffer.Get() };
+			std::unique_ptr<IReadbackDevice> readbackDevice(new D3D11ReadbackDevice(device, readbackSources, kDensityReadbackSlots));
+			m_densityReadback = std::make_unique<ReadbackRing>(std::move(readbackDevice));
+			m_densityReadback->SetCallback([this](uint64_t, const std::vector<ReadbackView>& views)
+			{
+				const float* density = reinterpret_cast<const float*>(views[0].data);
+				m_cpuDensity.assign(density, density + size_t((m_bufferDimensions.x + 2) * (m_bufferDimensions.y + 2) * (m_bufferDimensions.z + 2)));
+				m_cpuDensityVersion++;
+			});
 			//bufferDesc.ByteWidth = sizeof(float) * (m_bufferDimensions.x) * (m_bufferDimensions.y) * (m_bufferDimensions.z);
 			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_divergenceBuffer.GetAddressOf()));
 
@@ -303,6 +716,37 @@ namespace CustomEffects
 			bufferDesc.StructureByteStride = 3 * sizeof(float);
 			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_curlBuffer.GetAddressOf()));
 
+			bufferDesc.ByteWidth = sizeof(float) * 2 * kDiagnosticsPartialCount * kDiagnosticsValueCount;
+			bufferDesc.StructureByteStride = sizeof(float);
+			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_diagnosticsPartialBuffer.GetAddressOf()));
+			bufferDesc.ByteWidth = sizeof(float) * 2 * kDiagnosticsValueCount;
+			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_diagnosticsResultBuffer.GetAddressOf()));
+
+			D3D11_BUFFER_DESC stagingDesc = bufferDesc;
+			stagingDesc.Usage = D3D11_USAGE_STAGING;
+			stagingDesc.BindFlags = 0;
+			stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			for (int i = 0; i < kDiagnosticsReadbackLatency; i++)
+			{
+				DX::ThrowIfFailed(device->CreateBuffer(&stagingDesc, nullptr, m_diagnosticsReadback[i].staging.GetAddressOf()));
+			}
+
+			// per-brick step counts for the advection passes, rewritten from the CPU every step while LOD is on
+			m_brickGridSize = int(m_bufferDimensions.x) / 4 + 1;
+			m_brickPeriods.assign(m_brickGridSize * m_brickGridSize * m_brickGridSize, 1);
+			m_brickTime.assign(m_brickPeriods.size(), 0.0f);
+			bufferDesc.ByteWidth = sizeof(float) * UINT(m_brickPeriods.size());
+			bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_brickStepsBuffer.GetAddressOf()));
+
+			// min and max density per macrocell, written by fluid_macrocell_cs and read by the volume shader
+			m_macrocellCount = int(m_bufferDimensions.x) / 4;
+			UINT macrocells = UINT(m_macrocellCount * m_macrocellCount * m_macrocellCount);
+			bufferDesc.ByteWidth = 2 * sizeof(float) * macrocells;
+			bufferDesc.StructureByteStride = 2 * sizeof(float);
+			bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_macrocellBuffer.GetAddressOf()));
+
 			//--- UAV'S
 			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
 			uavDesc.Format = DXGI_FORMAT_UNKNOWN;
@@ -329,15 +773,29 @@ namespace CustomEffects
 			{
 				device->CreateUnorderedAccessView(m_pressureBuffer[i].Get(), &uavDesc, m_pressureUAV[i].GetAddressOf());
 			}
+			// density views cover field 0 only, so the diffusion pass and the renderer see a plain density grid
+			for (int i = 0; i < 3; i++)
+			{
+				device->CreateUnorderedAccessView(m_scalarBuffer[i].Get(), &uavDesc, m_densityUAV[i].GetAddressOf());
+			}
+			uavDesc.Buffer.NumElements *= kScalarFieldCount;
 			for (int i = 0; i < 3; i++)
 			{
-				device->CreateUnorderedAccessView(m_densityBuffer[i].Get(), &uavDesc, m_densityUAV[i].GetAddressOf());
+				device->CreateUnorderedAccessView(m_scalarBuffer[i].Get(), &uavDesc, m_scalarUAV[i].GetAddressOf());
 			}
+			uavDesc.Buffer.NumElements /= kScalarFieldCount;
 			device->CreateUnorderedAccessView(m_divergenceBuffer.Get(), &uavDesc, m_divergenceUAV.GetAddressOf());
 			
 			uavDesc.Buffer.NumElements = (m_bufferDimensions.x) * (m_bufferDimensions.y) * (m_bufferDimensions.z);
 			device->CreateUnorderedAccessView(m_curlBuffer.Get(), &uavDesc, m_curlUAV.GetAddressOf());
 
+			uavDesc.Buffer.NumElements = 2 * kDiagnosticsPartialCount * kDiagnosticsValueCount;
+			device->CreateUnorderedAccessView(m_diagnosticsPartialBuffer.Get(), &uavDesc, m_diagnosticsPartialUAV.GetAddressOf());
+			uavDesc.Buffer.NumElements = 2 * kDiagnosticsValueCount;
+			device->CreateUnorderedAccessView(m_diagnosticsResultBuffer.Get(), &uavDesc, m_diagnosticsResultUAV.GetAddressOf());
+			uavDesc.Buffer.NumElements = macrocells;
+			device->CreateUnorderedAccessView(m_macrocellBuffer.Get(), &uavDesc, m_macrocellUAV.GetAddressOf());
+
 			//--- SRV
 			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
 			srvDesc.Format = DXGI_FORMAT_UNKNOWN;
@@ -366,21 +824,38 @@ namespace CustomEffects
 			}
 			for (int i = 0; i < 3; i++)
 			{
-				device->CreateShaderResourceView(m_densityBuffer[i].Get(), &srvDesc, m_densitySRV[i].GetAddressOf());
+				device->CreateShaderResourceView(m_scalarBuffer[i].Get(), &srvDesc, m_densitySRV[i].GetAddressOf());
+			}
+			srvDesc.Buffer.NumElements *= kScalarFieldCount;
+			for (int i = 0; i < 3; i++)
+			{
+				device->CreateShaderResourceView(m_scalarBuffer[i].Get(), &srvDesc, m_scalarSRV[i].GetAddressOf());
 			}
+			srvDesc.Buffer.NumElements /= kScalarFieldCount;
 			device->CreateShaderResourceView(m_divergenceBuffer.Get(), &srvDesc, m_divergenceSRV.GetAddressOf());
 			
 			srvDesc.Buffer.NumElements = (m_bufferDimensions.x) * (m_bufferDimensions.y) * (m_bufferDimensions.z);
 			device->CreateShaderResourceView(m_curlBuffer.Get(), &srvDesc, m_curlSRV.GetAddressOf());
+
+			srvDesc.Buffer.NumElements = 2 * kDiagnosticsPartialCount * kDiagnosticsValueCount;
+			device->CreateShaderResourceView(m_diagnosticsPartialBuffer.Get(), &srvDesc, m_diagnosticsPartialSRV.GetAddressOf());
+
+			srvDesc.Buffer.NumElements = UINT(m_brickPeriods.size());
+			device->CreateShaderResourceView(m_brickStepsBuffer.Get(), &srvDesc, m_brickStepsSRV.GetAddressOf());
+
+			srvDesc.Buffer.NumElements = macrocells;
+			device->CreateShaderResourceView(m_macrocellBuffer.Get(), &srvDesc, m_macrocellSRV.GetAddressOf());
 		}
 		void CreateConstantBuffers(ID3D11Device* device) 
 		{
 			m_fluidBuffer->Initialize(device);
+			m_forceFieldBuffer->Initialize(device);
+			m_diagnosticsBuffer->Initialize(device);
 		};
 		void SetConstantBuffers(ID3D11DeviceContext* deviceContext)
 		{
 			// set
-			m_fluidBuffer->Apply(deviceContext, { m_deltaTime, m_elapsedTime});
+			m_fluidBuffer->Apply(deviceContext, { m_deltaTime, m_elapsedTime, m_densityWeight, m_thermalBuoyancy });
 			// bind
 			deviceContext->CSSetConstantBuffers(0, 1, m_fluidBuffer->GetAddressOf());
 		}
@@ -395,13 +870,13 @@ namespace CustomEffects
 			int writeIndex = 1 - m_velocityBufferIndex;
 			
 			ID3D11UnorderedAccessView* uavs[] = { m_velocityXUAV[writeIndex].Get(), m_velocityYUAV[writeIndex].Get(), m_velocityZUAV[writeIndex].Get() };
-			ID3D11ShaderResourceView* srvs[] = { m_velocityXSRV[readIndex].Get(), m_velocityYSRV[readIndex].Get(), m_velocityZSRV[readIndex].Get(), m_sdfSRV.Get(), m_perlinNoiseSRV.Get(), m_densitySRV[m_densityBufferIndex].Get()};
+			ID3D11ShaderResourceView* srvs[] = { m_velocityXSRV[readIndex].Get(), m_velocityYSRV[readIndex].Get(), m_velocityZSRV[readIndex].Get(), m_sdfSRV.Get(), m_forceFieldSRV.Get(), m_scalarSRV[m_densityBufferIndex].Get(), m_brickStepsSRV.Get()};
 			
 			deviceContext->CSSetUnorderedAccessViews(0, 3, uavs, nullptr);
-			deviceContext->CSSetShaderResources(0, 6, srvs);
+			deviceContext->CSSetShaderResources(0, 7, srvs);
 
-			ID3D11SamplerState* states[] = {m_states->LinearClamp(), m_states->LinearWrap()};
-			deviceContext->CSSetSamplers(0, 2, states);
+			auto sampler = m_states->LinearClamp();
+			deviceContext->CSSetSamplers(0, 1, &sampler);
 		}
 		void SetDiffusionResourceViews(ID3D11DeviceContext* deviceContext, int readIndex, int writeIndex)
 		{
@@ -423,10 +898,10 @@ namespace CustomEffects
 			int readIndex1 = m_densityBufferIndex;
 			int writeIndex1 = (m_densityBufferIndex + 1) % 3;
 
-			deviceContext->CSSetUnorderedAccessViews(0, 1, m_densityUAV[writeIndex1].GetAddressOf(), nullptr);
+			deviceContext->CSSetUnorderedAccessViews(0, 1, m_scalarUAV[writeIndex1].GetAddressOf(), nullptr);
 
-			ID3D11ShaderResourceView* srvs[] = { m_velocityXSRV[readIndex0].Get(), m_velocityYSRV[readIndex0].Get(), m_velocityZSRV[readIndex0].Get(), m_densitySRV[readIndex1].Get(), m_sdfSRV.Get(), m_surfaceSRV.Get(), m_perlinNoiseSRV.Get()};
-			deviceContext->CSSetShaderResources(0, 7, srvs);
+			ID3D11ShaderResourceView* srvs[] = { m_velocityXSRV[readIndex0].Get(), m_velocityYSRV[readIndex0].Get(), m_velocityZSRV[readIndex0].Get(), m_scalarSRV[readIndex1].Get(), m_sdfSRV.Get(), m_surfaceSRV.Get(), m_perlinNoiseSRV.Get(), m_brickStepsSRV.Get()};
+			deviceContext->CSSetShaderResources(0, 8, srvs);
 
 
 			ID3D11SamplerState* states[] = { m_states->LinearClamp(), m_states->LinearWrap() };
@@ -506,6 +981,59 @@ namespace CustomEffects
 			auto sampler = m_states->LinearClamp();
 			deviceContext->CSSetSamplers(0, 1, &sampler);
 		}
+		void StoreDiagnostics(const DiagnosticsReadback& slot, const float* values)
+		{
+			// slot layout per stage: max |div|, sum div^2, sum density, max density, kinetic energy, max speed^2, active cells
+			const float* pre = values;
+			const float* post = values + kDiagnosticsValueCount;
+
+			FluidDiagnostics record;
+			record.step = slot.step;
+			record.deltaTime = slot.deltaTime;
+			record.maxDivergencePre = pre[0];
+			record.l2DivergencePre = std::sqrt(pre[1]);
+			record.maxDivergencePost = post[0];
+			record.l2DivergencePost = std::sqrt(post[1]);
+			record.totalDensity = post[2];
+			record.maxDensity = post[3];
+			// only against the previous step's record; a dropped record leaves a gap the change would span
+			bool consecutive = m_diagnosticsValid && record.step == m_diagnostics.step + 1;
+			record.densityChange = consecutive ? record.totalDensity - m_diagnostics.totalDensity : 0.0f;
+			record.kineticEnergy = post[4];
+			record.maxVelocity = std::sqrt(post[5]);
+			record.cflNumber = record.maxVelocity * record.deltaTime;
+			record.activeCells = static_cast<uint32_t>(post[6]);
+			record.totalCells = static_cast<uint32_t>(m_bufferDimensions.x * m_bufferDimensions.y * m_bufferDimensions.z);
+
+			m_diagnostics = record;
+			m_diagnosticsValid = true;
+			if (m_diagnosticsCallback)
+				m_diagnosticsCallback(m_diagnostics);
+		}
+		void BuildMacrocells(ID3D11DeviceContext* deviceContext)
+		{
+			deviceContext->CSSetUnorderedAccessViews(0, 1, m_macrocellUAV.GetAddressOf(), nullptr);
+			deviceContext->CSSetShaderResources(0, 1, m_densitySRV[m_densityBufferIndex].GetAddressOf());
+			deviceContext->CSSetShader(m_macrocellCs.Get(), nullptr, 0);
+			int groups = (m_macrocellCount + 3) / 4;
+			deviceContext->Dispatch(groups, groups, groups);
+			Unbind(deviceContext, 1);
+			m_macrocellsDirty = false;
+		}
+		int BrickIndex(int bx, int by, int bz) const
+		{
+			return (bz * m_brickGridSize + by) * m_brickGridSize + bx;
+		}
+		void BeginTimer(ID3D11DeviceContext* deviceContext, const std::string& name)
+		{
+			if (m_gpuTimer)
+				m_gpuTimer->Begin(deviceContext, name);
+		}
+		void EndTimer(ID3D11DeviceContext* deviceContext, const std::string& name)
+		{
+			if (m_gpuTimer)
+				m_gpuTimer->End(deviceContext, name);
+		}
 		void InitializeBuffers(ID3D11DeviceContext* deviceContext)
 		{
 			// zero-initialize the buffers before simulation starts
@@ -517,7 +1045,8 @@ namespace CustomEffects
 			deviceContext->UpdateSubresource(m_velocityXBuffer[m_velocityBufferIndex].Get(), 0, nullptr, zeroVelocityX.data(), 0, 0);
 			deviceContext->UpdateSubresource(m_velocityYBuffer[m_velocityBufferIndex].Get(), 0, nullptr, zeroVelocityY.data(), 0, 0);
 			deviceContext->UpdateSubresource(m_velocityZBuffer[m_velocityBufferIndex].Get(), 0, nullptr, zeroVelocityZ.data(), 0, 0);
-			deviceContext->UpdateSubresource(m_densityBuffer[m_densityBufferIndex].Get(), 0, nullptr, zeroScalar.data(), 0, 0);
+			std::vector<float> zeroScalarFields(zeroScalar.size() * kScalarFieldCount, 0.0f);
+			deviceContext->UpdateSubresource(m_scalarBuffer[m_densityBufferIndex].Get(), 0, nullptr, zeroScalarFields.data(), 0, 0);
 			deviceContext->UpdateSubresource(m_pressureBuffer[m_pressureBufferIndex].Get(), 0, nullptr, zeroScalar.data(), 0, 0);
 		}
 	};
@@ -0,0 +1,130 @@
+#include "FroxelGrid.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+FroxelGrid::FroxelGrid() :
+	m_resolution(0, 0, 0)
+{
+}
+
+void FroxelGrid::Build(const XMFLOAT3& origin, const XMMATRIX& clipToWorld, const XMINT3& resolution, float nearDistance, float farDistance, float boxMin, float boxMax,
+	const std::function<FroxelMedium(const XMFLOAT3&, const XMFLOAT3&, uint64_t&)>& medium, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	m_resolution = XMINT3(std::max(1, resolution.x), std::max(1, resolution.y), std::max(1, resolution.z));
+	m_near = std::max(1e-3f, nearDistance);
+	m_far = std::max(m_near * 1.001f, farDistance);
+	m_logRatio = std::log(m_far / m_near);
+	m_froxels.resize(size_t(m_resolution.x) * m_resolution.y * m_resolution.z);
+
+	const int width = m_resolution.x, height = m_resolution.y, depth = m_resolution.z;
+	std::vector<float> distances(depth + 1);
+	for (int z = 0; z <= depth; z++)
+		distances[z] = SliceDistance(z);
+
+	XMVECTOR eye = XMLoadFloat3(&origin);
+	std::atomic<uint64_t> samples{ 0 };
+	ForEachSlice(pool, height, [&](int begin, int end)
+	{
+		uint64_t local = 0;
+		for (int y = begin; y < end; y++)
+		{
+			float v = (y + 0.5f) / height;
+			for (int x = 0; x < width; x++)
+			{
+				float u = (x + 0.5f) / width;
+				XMVECTOR farPoint = XMVector3TransformCoord(XMVectorSet(u * 2.0f - 1.0f, (1.0f - v) * 2.0f - 1.0f, 1.0f, 1.0f), clipToWorld);
+				XMFLOAT3 direction;
+				XMStoreFloat3(&direction, XMVector3Normalize(farPoint - eye));
+
+				// the part of the ray inside the box
+				const float o[3] = { origin.x, origin.y, origin.z }, d[3] = { direction.x, direction.y, direction.z };
+				float enter = 0.0f, exit = std::numeric_limits<float>::max();
+				for (int axis = 0; axis < 3; axis++)
+				{
+					float inverse = 1.0f / d[axis];
+					float a = (boxMin - o[axis]) * inverse, b = (boxMax - o[axis]) * inverse;
+					enter = std::max(enter, std::min(a, b));
+					exit = std::min(exit, std::max(a, b));
+				}
+
+				float transmittance = 1.0f;
+				XMFLOAT3 light(0.0f, 0.0f, 0.0f);
+				XMFLOAT4* column = &m_froxels[Index(x, y, 0)];
+				for (int z = 0; z < depth; z++)
+				{
+					float t = 0.5f * (distances[z] + distances[z + 1]);
+					float length = distances[z + 1] - distances[z];
+					if (t < enter || t > exit)
+					{
+						column[z] = XMFLOAT4(light.x, light.y, light.z, transmittance);
+						continue;
+					}
+					XMFLOAT3 p(origin.x + direction.x * t, origin.y + direction.y * t, origin.z + direction.z * t);
+					FroxelMedium m = medium(p, direction, local);
+					if (m.extinction <= 0.0f && m.emission.x <= 0.0f && m.emission.y <= 0.0f && m.emission.z <= 0.0f)
+					{
+						column[z] = XMFLOAT4(light.x, light.y, light.z, transmittance);
+						continue;
+					}
+
+					// light scattered within the slice, attenuated by the part of the slice in front of it
+					float sliceTransmittance = std::exp(-m.extinction * length);
+					float weight = m.extinction > 1e-6f ? (1.0f - sliceTransmittance) / m.extinction : length;
+					light.x += transmittance * m.emission.x * weight;
+					light.y += transmittance * m.emission.y * weight;
+					light.z += transmittance * m.emission.z * weight;
+					transmittance *= sliceTransmittance;
+
+					column[z] = XMFLOAT4(light.x, light.y, light.z, transmittance);
+				}
+			}
+		}
+		samples += local;
+	});
+	m_samples = samples;
+
+	m_buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+float FroxelGrid::SliceDistance(int slice) const
+{
+	return m_near * std::exp(m_logRatio * slice / m_resolution.z);
+}
+
+XMFLOAT4 FroxelGrid::Sample(float u, float v, float distance) const
+{
+	if (m_froxels.empty() || distance <= m_near)
+		return XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	const int width = m_resolution.x, height = m_resolution.y, depth = m_resolution.z;
+
+	// boundary s is the far side of slice s - 1; boundary 0, at the near distance, has nothing in front of it
+	float s = distance >= m_far ? float(depth) : std::log(distance / m_near) / m_logRatio * depth;
+	int s0 = std::min(int(s), depth - 1);
+	float fs = s - s0;
+
+	float px = std::min(std::max(u * width - 0.5f, 0.0f), float(width - 1));
+	float py = std::min(std::max(v * height - 0.5f, 0.0f), float(height - 1));
+	int x0 = std::min(int(px), std::max(width - 2, 0)), y0 = std::min(int(py), std::max(height - 2, 0));
+	int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+	float fx = px - x0, fy = py - y0;
+
+	auto column = [&](int x, int y)
+	{
+		const XMFLOAT4* c = &m_froxels[Index(x, y, 0)];
+		XMFLOAT4 a = s0 > 0 ? c[s0 - 1] : XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+		const XMFLOAT4& b = c[s0];
+		return XMFLOAT4(a.x + (b.x - a.x) * fs, a.y + (b.y - a.y) * fs, a.z + (b.z - a.z) * fs, a.w + (b.w - a.w) * fs);
+	};
+	auto lerp = [](const XMFLOAT4& a, const XMFLOAT4& b, float f)
+	{
+		return XMFLOAT4(a.x + (b.x - a.x) * f, a.y + (b.y - a.y) * f, a.z + (b.z - a.z) * f, a.w + (b.w - a.w) * f);
+	};
+	return lerp(lerp(column(x0, y0), column(x1, y0), fx), lerp(column(x0, y1), column(x1, y1), fx), fy);
+}
@@ -0,0 +1,63 @@
+#pragma once
+// FroxelGrid
+// Camera-aligned grid of frustum voxels holding the cloud's in-scattered light and transmittance integrated
+// front to back, so a pixel's cloud colour is one lookup at its scene depth instead of a ray march. Every
+// column of froxels follows the ray through the centre of its cell of a width x height grid over the screen,
+// and the depth slices are spread exponentially over [near, far] along that ray, finer close to the camera
+// where a froxel covers less of the volume. Each froxel inside the box the medium lives in evaluates it once,
+// at its centre, and the slice is integrated analytically for that constant medium, which keeps the result
+// energy conserving however thick far slices get. A froxel stores the light and transmittance accumulated
+// from the camera to the far side of its slice. Columns are independent, so they are built in parallel; the
+// build cost depends on the grid, not on the screen resolution.
+
+#include <DirectXMath.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+// the medium at a point, as seen along a view direction
+struct FroxelMedium
+{
+	float extinction = 0.0f; // per unit length
+	XMFLOAT3 emission = XMFLOAT3(0.0f, 0.0f, 0.0f); // light scattered toward the camera per unit length
+};
+
+class FroxelGrid
+{
+public:
+	FroxelGrid();
+
+	// clipToWorld takes clip positions to world positions before the perspective divide, as in
+	// CPUVolumeRenderer; medium is called with a world position inside [boxMin, boxMax]^3 and the unit direction
+	// from the camera, and adds the density evaluations it made to samples. pool may be null
+	void Build(const XMFLOAT3& origin, const XMMATRIX& clipToWorld, const XMINT3& resolution, float nearDistance, float farDistance, float boxMin, float boxMax,
+		const std::function<FroxelMedium(const XMFLOAT3&, const XMFLOAT3&, uint64_t&)>& medium, ThreadPool* pool);
+	bool IsEmpty() const { return m_froxels.empty(); };
+
+	// light in rgb and transmittance in alpha in front of a distance along the ray through screen position
+	// (u, v) in [0, 1], interpolated between columns and slices
+	XMFLOAT4 Sample(float u, float v, float distance) const;
+
+	XMINT3 GetResolution() const { return m_resolution; };
+	float GetNearDistance() const { return m_near; };
+	float GetFarDistance() const { return m_far; };
+	// distance along a column's ray to the near side of a slice, depth for the far side of the last one
+	float SliceDistance(int slice) const;
+	uint64_t GetSampleCount() const { return m_samples; };
+	double GetBuildTime() const { return m_buildTime; }; // ms
+
+private:
+	// the slices of a column are stored together
+	size_t Index(int x, int y, int z) const { return (size_t(y) * m_resolution.x + x) * m_resolution.z + z; };
+
+	XMINT3 m_resolution;
+	float m_near = 0.0f, m_far = 0.0f;
+	float m_logRatio = 0.0f; // log(far / near)
+	std::vector<XMFLOAT4> m_froxels;
+	uint64_t m_samples = 0;
+	double m_buildTime = 0.0;
+};
@@ -9,6 +9,9 @@
 #include "imgui_impl_win32.h"
 #include "imgui_impl_dx11.h"
 
+#include <cstring>
+#include <limits>
+
 extern void ExitGame() noexcept;
 
 using namespace DirectX;
@@ -19,6 +22,35 @@ namespace
 {
     constexpr UINT MSAA_COUNT = 4;
     constexpr UINT MSAA_QUALITY = 0;
+
+    // blocking copy of a single-channel float texture, for the CPU renderer's occasional reference frames
+    std::vector<float> ReadFloatTexture(ID3D11Device* device, ID3D11DeviceContext* context, ID3D11ShaderResourceView* srv, int& width, int& height)
+    {
+        ComPtr<ID3D11Resource> resource;
+        srv->GetResource(resource.GetAddressOf());
+        ComPtr<ID3D11Texture2D> texture;
+        DX::ThrowIfFailed(resource.As(&texture));
+
+        D3D11_TEXTURE2D_DESC desc;
+        texture->GetDesc(&desc);
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.BindFlags = 0;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        desc.MiscFlags = 0;
+        ComPtr<ID3D11Texture2D> staging;
+        DX::ThrowIfFailed(device->CreateTexture2D(&desc, nullptr, staging.GetAddressOf()));
+        context->CopyResource(staging.Get(), texture.Get());
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        DX::ThrowIfFailed(context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped));
+        width = static_cast<int>(desc.Width);
+        height = static_cast<int>(desc.Height);
+        std::vector<float> values(size_t(width) * height);
+        for (int y = 0; y < height; y++)
+            memcpy(&values[size_t(y) * width], static_cast<const uint8_t*>(mapped.pData) + size_t(y) * mapped.RowPitch, width * sizeof(float));
+        context->Unmap(staging.Get(), 0);
+        return values;
+    }
 }
 
 Game::Game() noexcept(false)
@@ -108,7 +140,144 @@ void Game::Update(DX::StepTimer const& timer)
     auto mouse = m_mouse->GetState();
     m_mouse->SetMode(mouse.leftButton ? Mouse::MODE_RELATIVE : Mouse::MODE_ABSOLUTE);
 
-    m_camera->Update(m_timer.GetElapsedSeconds(), kb, mouse, sceneSDF_effect->GetCPUSdf().data(), sceneSDF_effect->GetCPUSdfGradient().data());
+    // the Euclidean terrain field lands a few frames after the terrain is generated, the scene field is rebuilt
+    // over the part of it that changed
+    BoundingBox terrainSDFChange;
+    if (displacement_effect->PollExactSDF(m_deviceResources->GetD3DDeviceContext(), terrainSDFChange))
+    {
+        m_deviceResources->PIXBeginEvent(L"Compute Scene SDF");
+        sceneSDF_effect->InvalidateSceneObjectRegion(m_terrainSDFObject, terrainSDFChange);
+        sceneSDF_effect->Compute(m_deviceResources->GetD3DDeviceContext(), 16, 16, 16);
+        m_deviceResources->PIXEndEvent();
+    }
+    sceneSDF_effect->PollReadback();
+
+    // the blue noise lands a few seconds into the first run and right away on later ones, from its cache file;
+    // the marches hash their jitter until then
+    if (m_blueNoiseJob.valid() && m_blueNoiseJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        m_blueNoise = m_blueNoiseJob.get();
+        m_cpuVolume->SetBlueNoise(m_blueNoise.get());
+        CreateBlueNoiseTexture();
+    }
+
+    if (m_isosurfaceEnabled)
+    {
+        // both fields carry one ghost layer; the density readback is requested every frame and merged by the ring
+        m_isosurface->SetIsoValue(m_isosurfaceLevel, m_isosurfaceSource == 1);
+        if (m_isosurfaceSource == 0)
+        {
+            fluid_effect->RequestDensityReadback(m_deviceResources->GetD3DDeviceContext());
+            fluid_effect->PollDensityReadback();
+            if (fluid_effect->GetCPUDensityVersion() != m_isosurfaceDensityVersion)
+            {
+                m_isosurfaceDensityVersion = fluid_effect->GetCPUDensityVersion();
+                m_isosurface->Update(fluid_effect->GetCPUDensity().data(), fluid_effect->GetDensityResolution(), 1, m_threadPool.get());
+            }
+        }
+        else if (!sceneSDF_effect->GetCPUField().IsEmpty())
+        {
+            const SDFField& field = sceneSDF_effect->GetCPUField();
+            m_isosurface->Update(field.GetDistances().data(), field.GetResolution(), 1, m_threadPool.get());
+        }
+    }
+    if (m_cpuVolumeRequest != 0)
+    {
+        fluid_effect->RequestDensityReadback(m_deviceResources->GetD3DDeviceContext());
+        fluid_effect->PollDensityReadback();
+        if (fluid_effect->GetCPUDensityVersion() != m_cpuVolumeDensityVersion)
+        {
+            auto size = m_deviceResources->GetOutputSize();
+            CPUVolumeCamera camera;
+            camera.position = m_camera->GetPosition();
+            camera.viewInv = XMMatrixInverse(nullptr, m_camera->GetViewMatrix());
+            camera.projInv = XMMatrixInverse(nullptr, m_proj);
+
+            CPUVolumeSettings settings;
+            settings.ambientColor = m_ambient->GetColor();
+            settings.ambientIntensity = m_ambient->GetIntensity();
+            settings.sunColor = m_sun->GetColor();
+            settings.sunIntensity = m_sun->GetIntensity();
+            settings.sunDirection = m_sun->GetDirection();
+            settings.absorption = volume_effect->GetAbsorptionCoeff();
+            settings.scatter = volume_effect->GetScatterCoeff();
+            settings.maxSteps = volume_effect->GetMaxSteps();
+            settings.maxLightSteps = volume_effect->GetMaxLightSteps();
+            settings.adaptive = volume_effect->GetAdaptiveSteps();
+            settings.minStepScale = volume_effect->GetMinStepScale();
+            settings.maxStepScale = volume_effect->GetMaxStepScale();
+            settings.edgeThreshold = volume_effect->GetEdgeThreshold();
+            settings.nearDistance = volume_effect->GetNearDistance();
+            settings.terminationThreshold = volume_effect->GetTerminationThreshold();
+            settings.blueNoise = volume_effect->GetBlueNoise() && m_blueNoise;
+            settings.frameIndex = GetBlueNoiseFrame();
+
+            m_cpuVolume->SetDensity(fluid_effect->GetCPUDensity().data(), fluid_effect->GetDensityResolution(), m_threadPool.get());
+            // the last frame's linear depth, so the CPU rays stop at the terrain like the shader's
+            int depthWidth = 0, depthHeight = 0;
+            std::vector<float> sceneDepth = ReadFloatTexture(m_deviceResources->GetD3DDevice(), m_deviceResources->GetD3DDeviceContext(),
+                m_mainSceneRT->GetLinearDepthShaderResourceView(), depthWidth, depthHeight);
+            m_cpuVolume->SetSceneDepth(sceneDepth.data(), depthWidth, depthHeight);
+            if (m_cpuVolumeRequest == 1)
+            {
+                std::vector<XMFLOAT4> image;
+                m_cpuVolume->Render(camera, settings, size.right, size.bottom, image, m_threadPool.get());
+                CPUVolumeRenderer::WritePFM("cpu_volume.pfm", image, size.right, size.bottom);
+            }
+            else if (m_cpuVolumeRequest == 2)
+            {
+                m_cpuVolume->WriteBenchmark("cpu_volume_benchmark.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 3)
+            {
+                m_cpuVolume->WriteSunVolumeComparison("sun_volume_comparison.csv", settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 4)
+            {
+                m_cpuVolume->WriteAdaptiveComparison("adaptive_steps_comparison.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 5)
+            {
+                m_cpuVolume->WriteFroxelComparison("froxel_comparison.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 6)
+            {
+                m_cpuVolume->WriteTemporalComparison("temporal_accumulation_comparison.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 7)
+            {
+                m_cpuVolume->WriteUpsampleComparison("cloud_upsample_comparison.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 8)
+            {
+                m_cpuVolume->WriteBlueNoiseComparison("blue_noise_comparison.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 9)
+            {
+                m_cpuVolume->WriteImpostorComparison("impostor_cache_comparison.csv", camera, settings, m_threadPool.get());
+            }
+            else if (m_cpuVolumeRequest == 11)
+            {
+                CPUVolumeFrame frame;
+                frame.density = fluid_effect->GetCPUDensity();
+                frame.densityResolution = fluid_effect->GetDensityResolution();
+                frame.sceneDepth = std::move(sceneDepth);
+                frame.sceneDepthWidth = depthWidth;
+                frame.sceneDepthHeight = depthHeight;
+                frame.camera = camera;
+                frame.settings = settings;
+                frame.width = size.right;
+                frame.height = size.bottom;
+                CPUVolumeRenderer::WriteFrame("cloud_frame.cvf", frame);
+            }
+            else
+            {
+                m_cpuVolume->WriteSkipEmptyCheck("skip_empty_check.csv", camera, settings, m_threadPool.get());
+            }
+            m_cpuVolumeRequest = 0;
+        }
+    }
+    m_camera->Update(m_timer.GetElapsedSeconds(), kb, mouse, &sceneSDF_effect->GetCPUField());
 
     ImGui_ImplDX11_NewFrame();
     ImGui_ImplWin32_NewFrame();
@@ -136,11 +305,56 @@ void Game::Render()
     auto height = static_cast<float>(size.bottom);
 
 
-    m_deviceResources->PIXBeginEvent(L"Simulate Clouds");
-    fluid_effect->SetDeltaTime(m_timer.GetElapsedSeconds());
-    fluid_effect->SetElapsedTime(m_timer.GetTotalSeconds());
-    fluid_effect->Compute(context, 8, 8, 8);
-    m_deviceResources->PIXEndEvent();
+    m_gpuTimer->BeginFrame(context);
+
+    // the autotuner only drives the knobs while it is on or calibrating; the user's values are kept
+    // aside when it takes over and handed back when it stops
+    bool autotune = m_autotuner->GetEnabled() || m_autotuner->IsCalibrating();
+    if (autotune && !m_autotuneActive)
+    {
+        m_userQuality.pressureIterations = fluid_effect->GetPressureIterations();
+        m_userQuality.vorticity = fluid_effect->GetVorticityEnabled();
+        m_userQuality.maxSteps = volume_effect->GetMaxSteps();
+        m_userQuality.maxLightSteps = volume_effect->GetMaxLightSteps();
+    }
+    else if (!autotune && m_autotuneActive)
+    {
+        fluid_effect->SetPressureIterations(m_userQuality.pressureIterations);
+        fluid_effect->SetVorticityEnabled(m_userQuality.vorticity);
+        volume_effect->SetMaxSteps(m_userQuality.maxSteps);
+        volume_effect->SetMaxLightSteps(m_userQuality.maxLightSteps);
+    }
+    m_autotuneActive = autotune;
+
+    const QualitySettings& quality = autotune ? m_autotuner->GetSettings() : m_userQuality;
+    if (autotune)
+    {
+        fluid_effect->SetPressureIterations(quality.pressureIterations);
+        fluid_effect->SetVorticityEnabled(quality.vorticity);
+        volume_effect->SetMaxSteps(quality.maxSteps);
+        volume_effect->SetMaxLightSteps(quality.maxLightSteps);
+    }
+
+    m_simAccumulatedTime += float(m_timer.GetElapsedSeconds());
+    if (++m_simFrameCount >= quality.simInterval)
+    {
+        m_deviceResources->PIXBeginEvent(L"Simulate Clouds");
+        m_gpuTimer->Begin(context, "Simulate");
+
+        // world-space view frustum for the per-brick level of detail
+        BoundingFrustum frustum(m_proj);
+        frustum.Transform(frustum, XMMatrixInverse(nullptr, m_view));
+        fluid_effect->UpdateLod(m_camera->GetPosition(), frustum);
+
+        fluid_effect->SetDeltaTime(m_simAccumulatedTime);
+        fluid_effect->SetElapsedTime(m_timer.GetTotalSeconds());
+        fluid_effect->Compute(context, 8, 8, 8);
+        m_gpuTimer->End(context, "Simulate");
+        m_deviceResources->PIXEndEvent();
+
+        m_simFrameCount = 0;
+        m_simAccumulatedTime = 0.0f;
+    }
 
     m_mainSceneRT->SetRenderTarget(context);
 
@@ -163,7 +377,7 @@ void Game::Render()
     context->OMSetDepthStencilState(m_states->DepthDefault(), 0);
     context->RSSetState(wireframeMode ? m_states->Wireframe() : m_states->CullCounterClockwise());
 
-    terrain_effect->SetWorld(XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -4, -8));
+    terrain_effect->SetWorld(displacement_effect->GetTerrainTransform());
     terrain_effect->SetView(m_view);
     terrain_effect->SetAmbientColor(m_ambient->GetColor());
     terrain_effect->SetAmbientIntensity(m_ambient->GetIntensity());
@@ -180,7 +394,11 @@ void Game::Render()
     m_deviceResources->PIXEndEvent();
     
 
+    // density swapped in outside the advection, as the scene SDF's, has no macrocells yet
+    fluid_effect->UpdateMacrocells(context);
+
     m_deviceResources->PIXBeginEvent(L"Render Volume");
+    m_gpuTimer->Begin(context, "Volume");
 
     m_volumetricSceneRT->SetRenderTarget(context, Colors::Black);
     ID3D11RenderTargetView* rtvs[] = { m_volumetricSceneRT->GetRenderTargetView(), m_mainSceneRT->GetOcclusionRenderTargetView() };
@@ -200,13 +418,16 @@ void Game::Render()
     volume_effect->SetSunDirection(m_sun->GetDirection());
     volume_effect->SetCameraPosition(m_camera->GetPosition());
     volume_effect->SetDensityMapSrv(fluid_effect->GetDensitySrv());
+    volume_effect->SetMacrocellSrv(fluid_effect->GetMacrocellSrv());
     volume_effect->SetSceneColorSrv(m_mainSceneRT->GetShaderResourceView());
     volume_effect->SetSceneDepthSrv(m_mainSceneRT->GetLinearDepthShaderResourceView());
+    volume_effect->SetFrameIndex(GetBlueNoiseFrame());
     volume_effect->Apply(context);
 
     volumeBound_mesh->Draw(context);
     volume_effect->Unbind(context);
-    
+
+    m_gpuTimer->End(context, "Volume");
     m_deviceResources->PIXEndEvent();
 
     // don't want wireframe of postprocessing orthomesh volume
@@ -239,6 +460,7 @@ void Game::Render()
     godRays_effect->SetSceneProjectionMatrix(m_proj);
     godRays_effect->SetColorSrv(m_postprocess0RT->GetShaderResourceView());
     godRays_effect->SetOcclusionSrv(m_mainSceneRT->GetOcclusionShaderResourceView());
+    godRays_effect->SetFrameIndex(GetBlueNoiseFrame());
     godRays_effect->SetWorld(XMMatrixScaling(width, height, 1)* XMMatrixTranslation(-width / 2, -height / 2, 0));
     godRays_effect->Apply(context);
     postprocess_mesh->Draw(context);
@@ -262,6 +484,9 @@ void Game::Render()
 
     this->ImGui(wireframeMode);
 
+    m_gpuTimer->EndFrame(context);
+    m_autotuner->Update(m_gpuTimer->GetFrameTime(), m_gpuTimer->GetTime("Simulate"), m_gpuTimer->GetTime("Volume"));
+
     // Show the new frame.
     m_deviceResources->Present();
 }
@@ -379,7 +604,8 @@ void Game::CreateDeviceDependentResources()
 
 
     displacement_effect = std::make_unique<CustomEffects::DisplacementEffect>(device, L"res/shaders/terrain_cs.cso", L"res/shaders/terrain_sdf_cs.cso", XMFLOAT3(136, 136, 1));
-    sceneSDF_effect = std::make_unique<CustomEffects::SDFEffect>(device, L"res/shaders/scene_sdf_cs.cso", L"res/shaders/scene_sdf_gradient_cs.cso", XMFLOAT3(64, 64, 64));
+    displacement_effect->SetTerrainTransform(XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -4, -8));
+    sceneSDF_effect = std::make_unique<CustomEffects::SDFEffect>(device, L"res/shaders/scene_sdf_cs.cso", XMFLOAT3(64, 64, 64));
     fluid_effect = std::make_unique<CustomEffects::FluidSimEffect>(device, deviceContext, XMFLOAT3(32, 32, 32));
     volume_effect = std::make_unique<CustomEffects::VolumetricEffect<VertexPosNormalTex>>(device, L"res/shaders/base_vs.cso", L"res/shaders/volume_ps.cso");
     base_effect = std::make_unique<CustomEffects::BaseEffect<VertexPosNormalTex>>(device, L"res/shaders/base_vs.cso", L"res/shaders/skybox_ps.cso");
@@ -392,6 +618,38 @@ void Game::CreateDeviceDependentResources()
     skybox_mesh = std::make_unique<SphereMesh<VertexPosNormalTex>>(device);
     postprocess_mesh = std::make_unique<OrthoMesh<VertexPosNormalTex>>(device);
 
+    m_gpuTimer = std::make_unique<GpuTimer>(device);
+    if (!m_autotuner)
+        m_autotuner = std::make_unique<QualityAutotuner>();
+    if (!m_threadPool)
+        m_threadPool = std::make_unique<ThreadPool>();
+    if (!m_backgroundPool)
+        m_backgroundPool = std::make_unique<ThreadPool>(std::max(1, int(std::thread::hardware_concurrency()) / 2));
+    if (!m_isosurface)
+        m_isosurface = std::make_unique<MarchingCubes>();
+    if (!m_cpuVolume)
+        m_cpuVolume = std::make_unique<CPUVolumeRenderer>();
+    if (!m_blueNoise && !m_blueNoiseJob.valid())
+    {
+        // generated in seconds on the first run and read back from its cache file next to the textures on later
+        // ones, in the background either way; Update picks it up
+        ThreadPool* pool = m_backgroundPool.get();
+        m_blueNoiseJob = std::async(std::launch::async, [pool]()
+        {
+            auto blueNoise = std::make_unique<SpatiotemporalBlueNoise>();
+            blueNoise->LoadOrGenerate("res/textures", BlueNoiseParameters(), pool);
+            return blueNoise;
+        });
+    }
+    if (m_blueNoise)
+        CreateBlueNoiseTexture();
+    displacement_effect->SetThreadPool(m_threadPool.get());
+    displacement_effect->SetBackgroundThreadPool(m_backgroundPool.get());
+    m_cpuVolume->SetBackgroundThreadPool(m_backgroundPool.get());
+    sceneSDF_effect->SetThreadPool(m_threadPool.get());
+    fluid_effect->SetGpuTimer(m_gpuTimer.get());
+    fluid_effect->SetSimulationTransform(XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -8, -8));
+
 
     terrain_effect->SetAlbedoTextureSrv(m_textureManager->Get(L"ground"));
     terrain_effect->SetAlbedoTextureSrv(m_textureManager->Get(L"rock"), 1);
@@ -407,13 +665,12 @@ void Game::CreateDeviceDependentResources()
 
     m_deviceResources->PIXBeginEvent(L"Compute Scene SDF");
     sceneSDF_effect->SetSimulationTransform(XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -8, -8));
-    sceneSDF_effect->AddSceneObject(device, displacement_effect->GetSDFSrv(), XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -12, -8), 16);
+    m_terrainSDFObject = sceneSDF_effect->AddSceneObject(device, displacement_effect->GetSDFSrv(), XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -12, -8), 16);
     sceneSDF_effect->Compute(deviceContext, 16, 16, 16);
     m_deviceResources->PIXEndEvent();
     fluid_effect->SwapDensityBuffers();
 
     fluid_effect->SetSDFSRV(sceneSDF_effect->GetSrv());
-    fluid_effect->SetSDFGradientSRV(sceneSDF_effect->GetGradientSrv());
 
     m_deviceResources->PIXBeginEvent(L"Compute Worley");
     volume_effect->Compute(deviceContext);
@@ -423,6 +680,50 @@ void Game::CreateDeviceDependentResources()
     fluid_effect->ComputeNoise(deviceContext);
 }
 
+// an R8_UNORM texture array with one slice of the blue noise per frame
+void Game::CreateBlueNoiseTexture()
+{
+    const BlueNoiseParameters& parameters = m_blueNoise->GetParameters();
+    const int size = parameters.size, slices = parameters.slices;
+
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = size;
+    textureDesc.Height = size;
+    textureDesc.MipLevels = 1;
+    textureDesc.ArraySize = slices;
+    textureDesc.Format = DXGI_FORMAT_R8_UNORM;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    std::vector<D3D11_SUBRESOURCE_DATA> initialData(slices);
+    for (int slice = 0; slice < slices; slice++)
+    {
+        initialData[slice].pSysMem = &m_blueNoise->GetValues()[size_t(slice) * size * size];
+        initialData[slice].SysMemPitch = size;
+        initialData[slice].SysMemSlicePitch = size * size;
+    }
+    auto device = m_deviceResources->GetD3DDevice();
+    DX::ThrowIfFailed(device->CreateTexture2D(&textureDesc, initialData.data(), m_blueNoiseTexture.ReleaseAndGetAddressOf()));
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = textureDesc.Format;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    srvDesc.Texture2DArray.MostDetailedMip = 0;
+    srvDesc.Texture2DArray.MipLevels = 1;
+    srvDesc.Texture2DArray.FirstArraySlice = 0;
+    srvDesc.Texture2DArray.ArraySize = slices;
+    DX::ThrowIfFailed(device->CreateShaderResourceView(m_blueNoiseTexture.Get(), &srvDesc, m_blueNoiseSrv.ReleaseAndGetAddressOf()));
+
+    volume_effect->SetBlueNoiseSrv(m_blueNoiseSrv);
+    godRays_effect->SetBlueNoiseSrv(m_blueNoiseSrv);
+}
+
+int Game::GetBlueNoiseFrame() const
+{
+    return m_blueNoise ? int(m_timer.GetFrameCount() % m_blueNoise->GetParameters().slices) : 0;
+}
+
 // Allocate all memory resources that change on a window SizeChanged event.
 void Game::CreateWindowSizeDependentResources()
 {
@@ -549,26 +850,189 @@ void Game::ImGui(bool& wireframeMode)
         ImGui::SliderFloat2("Offset", &offset.x, -1000, 1000);
         displacement_effect->SetOffset(offset);
 
-        if (ImGui::Button("Update Buffers"))
+        bool exactSDF = displacement_effect->GetExactSDF();
+        bool exactSDFChanged = ImGui::Checkbox("Euclidean SDF", &exactSDF);
+        displacement_effect->SetExactSDF(exactSDF);
+
+        if (displacement_effect->IsSDFBenchmarkRunning())
+            ImGui::Text("Benchmarking SDF...");
+        else if (displacement_effect->HasHeightfield() && ImGui::Button("Benchmark SDF"))
+            displacement_effect->WriteSDFBenchmark("terrain_sdf_benchmark.csv");
+
+        const HeightfieldQuadtree& heightQuadtree = displacement_effect->GetHeightQuadtree();
+        if (!heightQuadtree.IsEmpty())
         {
+            XMFLOAT3 cameraPosition = m_camera->GetPosition();
+            float ground;
+            heightQuadtree.Heights(&cameraPosition, &ground, 1);
+            if (ground > -std::numeric_limits<float>::max())
+                ImGui::Text("Height quadtree: %d levels, camera %.2f above ground", heightQuadtree.GetLevelCount(), cameraPosition.y - ground);
+            else
+                ImGui::Text("Height quadtree: %d levels, camera off the terrain", heightQuadtree.GetLevelCount());
+
+            if (ImGui::Button("Benchmark height queries"))
+                heightQuadtree.WriteBenchmark("heightfield_query_benchmark.csv");
+        }
+
+        if (ImGui::Button("Update Buffers") || exactSDFChanged)
+        {
+            // unchanged parameters skip the heightfield pass; a Euclidean field is rebuilt in the background
+            // and reaches the scene through PollExactSDF
             m_deviceResources->PIXBeginEvent(L"Compute Terrain Displacement");
-            displacement_effect->Compute(m_deviceResources->GetD3DDeviceContext(), 17, 17, 1);
+            bool terrainSDFChanged = displacement_effect->Compute(m_deviceResources->GetD3DDeviceContext(), 17, 17, 1);
             m_deviceResources->PIXEndEvent();
 
             fluid_effect->SetSurfaceSRV(displacement_effect->GetDisplacementSrv());
 
-            m_deviceResources->PIXBeginEvent(L"Compute Solid Mask");
-            sceneSDF_effect->SetSimulationTransform(XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -8, -8));
-            sceneSDF_effect->AddSceneObject(m_deviceResources->GetD3DDevice(), displacement_effect->GetSDFSrv(), XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -12, -8), 16);
-            sceneSDF_effect->Compute(m_deviceResources->GetD3DDeviceContext(), 16, 16, 16);
-            m_deviceResources->PIXEndEvent();
+            if (terrainSDFChanged)
+            {
+                m_deviceResources->PIXBeginEvent(L"Compute Solid Mask");
+                sceneSDF_effect->SetSimulationTransform(XMMatrixScaling(16, 16, 16) * XMMatrixTranslation(-8, -8, -8));
+                sceneSDF_effect->InvalidateSceneObject(m_terrainSDFObject);
+                sceneSDF_effect->Compute(m_deviceResources->GetD3DDeviceContext(), 16, 16, 16);
+                m_deviceResources->PIXEndEvent();
+            }
             fluid_effect->SwapDensityBuffers();
 
             fluid_effect->SetSDFSRV(sceneSDF_effect->GetSrv());
-            fluid_effect->SetSDFGradientSRV(sceneSDF_effect->GetGradientSrv());
         }
     }
 
+    if (ImGui::CollapsingHeader("Fluid Params"))
+    {
+        float thermalBuoyancy = fluid_effect->GetThermalBuoyancy();
+        ImGui::SliderFloat("Thermal buoyancy", &thermalBuoyancy, 0.0f, 40.0f);
+        fluid_effect->SetThermalBuoyancy(thermalBuoyancy);
+
+        float densityWeight = fluid_effect->GetDensityWeight();
+        ImGui::SliderFloat("Density weight", &densityWeight, 0.0f, 40.0f);
+        fluid_effect->SetDensityWeight(densityWeight);
+
+        bool lod = fluid_effect->GetLodEnabled();
+        ImGui::Checkbox("Level of detail", &lod);
+        fluid_effect->SetLodEnabled(lod);
+
+        if (lod)
+        {
+            float nearDistance = fluid_effect->GetLodNearDistance();
+            float farDistance = fluid_effect->GetLodFarDistance();
+            ImGui::SliderFloat("LOD near", &nearDistance, 0.0f, 40.0f);
+            ImGui::SliderFloat("LOD far", &farDistance, 0.0f, 60.0f);
+            fluid_effect->SetLodDistances(nearDistance, farDistance);
+
+            const CustomEffects::FluidLodStats& lodStats = fluid_effect->GetLodStats();
+            ImGui::Text("Every step: %d bricks, %.3f ms", lodStats.bricks[0], lodStats.time[0]);
+            ImGui::Text("Every 2nd: %d bricks, %.3f ms", lodStats.bricks[1], lodStats.time[1]);
+            ImGui::Text("Every 4th: %d bricks, %.3f ms", lodStats.bricks[2], lodStats.time[2]);
+        }
+
+        bool diagnostics = fluid_effect->GetDiagnosticsEnabled();
+        ImGui::Checkbox("Diagnostics", &diagnostics);
+        fluid_effect->SetDiagnosticsEnabled(diagnostics);
+
+        if (diagnostics)
+        {
+            const FluidDiagnostics& stats = fluid_effect->GetDiagnostics();
+            ImGui::Text("Step: %llu", static_cast<unsigned long long>(stats.step));
+            ImGui::Text("Divergence max/L2 pre: %.4f / %.4f", stats.maxDivergencePre, stats.l2DivergencePre);
+            ImGui::Text("Divergence max/L2 post: %.4f / %.4f", stats.maxDivergencePost, stats.l2DivergencePost);
+            ImGui::Text("Density total/max: %.2f / %.3f (%+.3f)", stats.totalDensity, stats.maxDensity, stats.densityChange);
+            ImGui::Text("Kinetic energy: %.2f", stats.kineticEnergy);
+            ImGui::Text("Max velocity: %.3f, CFL: %.3f", stats.maxVelocity, stats.cflNumber);
+            ImGui::Text("Active cells: %u / %u", stats.activeCells, stats.totalCells);
+            ImGui::Text("Dropped records: %llu", static_cast<unsigned long long>(fluid_effect->GetDiagnosticsDropped()));
+        }
+
+        ImGui::Checkbox("Isosurface", &m_isosurfaceEnabled);
+        if (m_isosurfaceEnabled)
+        {
+            ImGui::RadioButton("Density", &m_isosurfaceSource, 0);
+            ImGui::SameLine();
+            ImGui::RadioButton("Scene SDF", &m_isosurfaceSource, 1);
+            ImGui::SliderFloat("Iso value", &m_isosurfaceLevel, -1.0f, 2.0f);
+
+            const MarchingCubesStats& stats = m_isosurface->GetStats();
+            ImGui::Text("%zu triangles, %zu vertices", stats.triangleCount, stats.vertexCount);
+            ImGui::Text("Bricks extracted: %d / %d in %.2f ms, weld %.2f ms", stats.bricksExtracted, stats.bricksTotal, stats.extractTime, stats.weldTime);
+            ImGui::Text("%.2f M triangles/s, %.1f MB per M triangles", stats.TrianglesPerSecond() * 1e-6, stats.BytesPerMillionTriangles() / (1024.0 * 1024.0));
+
+            if (ImGui::Button("Benchmark marching cubes"))
+            {
+                if (m_isosurfaceSource == 0 && !fluid_effect->GetCPUDensity().empty())
+                    MarchingCubes::WriteBenchmark("marching_cubes_benchmark.csv", fluid_effect->GetCPUDensity().data(), fluid_effect->GetDensityResolution(), 1, m_isosurfaceLevel, false, m_threadPool.get());
+                else if (m_isosurfaceSource == 1 && !sceneSDF_effect->GetCPUField().IsEmpty())
+                    MarchingCubes::WriteBenchmark("marching_cubes_benchmark.csv", sceneSDF_effect->GetCPUField().GetDistances().data(), sceneSDF_effect->GetCPUField().GetResolution(), 1, m_isosurfaceLevel, true, m_threadPool.get());
+            }
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Quality"))
+    {
+        ImGui::Text("GPU frame: %.2f ms (sim %.2f ms, volume %.2f ms)", m_gpuTimer->GetFrameTime(), m_gpuTimer->GetTime("Simulate"), m_gpuTimer->GetTime("Volume"));
+
+        bool autotune = m_autotuner->GetEnabled();
+        ImGui::Checkbox("Autotune", &autotune);
+        m_autotuner->SetEnabled(autotune);
+
+        float budget = m_autotuner->GetBudget();
+        ImGui::SliderFloat("Budget (ms)", &budget, 2.0f, 33.0f);
+        m_autotuner->SetBudget(budget);
+
+        int level = m_autotuner->GetLevel();
+        if (ImGui::SliderInt("Quality level", &level, 0, m_autotuner->GetLevelCount() - 1))
+            m_autotuner->SetLevel(level);
+
+        const QualitySettings& quality = m_autotuner->GetSettings();
+        ImGui::Text("Pressure iterations: %d, vorticity: %s", quality.pressureIterations, quality.vorticity ? "on" : "off");
+        ImGui::Text("Raymarch steps: %d, light steps: %d", quality.maxSteps, quality.maxLightSteps);
+        ImGui::Text("Simulation interval: %d", quality.simInterval);
+
+        if (m_autotuner->IsCalibrating())
+            ImGui::Text("Calibrating...");
+        else if (ImGui::Button("Calibrate"))
+            m_autotuner->StartCalibration("quality_calibration.csv");
+    }
+
+    if (ImGui::CollapsingHeader("Obstacles"))
+    {
+        if (!m_meshObstacle)
+        {
+            if (ImGui::Button("Add torus obstacle"))
+            {
+                GeometricPrimitive::VertexCollection vertices;
+                GeometricPrimitive::IndexCollection indices;
+                GeometricPrimitive::CreateTorus(vertices, indices, 1.0f, 0.333f, 64);
+
+                m_meshObstacle = std::make_unique<MeshSDFObject>();
+                m_meshObstacle->AddGeometry(vertices, indices);
+                m_meshObstacle->Build(m_deviceResources->GetD3DDevice(), 64, m_threadPool.get());
+
+                // torus scaled to 6 world units, centred in the simulation volume
+                float worldScale = 6.0f;
+                XMMATRIX transform = m_meshObstacle->GetUnitTransform() * XMMatrixScaling(worldScale, worldScale, worldScale);
+                sceneSDF_effect->AddSceneObject(m_deviceResources->GetD3DDevice(), m_meshObstacle->GetSrv(), transform, m_meshObstacle->GetDistanceScale() * worldScale);
+
+                m_deviceResources->PIXBeginEvent(L"Compute Scene SDF");
+                sceneSDF_effect->Compute(m_deviceResources->GetD3DDeviceContext(), 16, 16, 16);
+                m_deviceResources->PIXEndEvent();
+            }
+        }
+        else
+        {
+            ImGui::Text("Torus: %d triangles, voxelized in %.1f ms", int(m_meshObstacle->GetTriangleCount()), m_meshObstacle->GetBuildTime());
+        }
+
+        CustomEffects::SDFMemoryUsage memory = sceneSDF_effect->GetMemoryUsage();
+        CustomEffects::SDFMemoryUsage uncompressed = sceneSDF_effect->GetUncompressedMemoryUsage();
+        size_t total = memory.gpu + memory.staging + memory.cpu;
+        size_t uncompressedTotal = uncompressed.gpu + uncompressed.staging + uncompressed.cpu;
+        ImGui::Text("Scene SDF: %zu KB (GPU %zu, staging %zu, CPU %zu)", total / 1024, memory.gpu / 1024, memory.staging / 1024, memory.cpu / 1024);
+        ImGui::Text("Saved %zu KB against float SDF + gradient", (uncompressedTotal - total) / 1024);
+
+        if (!sceneSDF_effect->GetCPUPyramid().IsEmpty() && ImGui::Button("Benchmark SDF pyramid"))
+            sceneSDF_effect->GetCPUPyramid().WriteBenchmark("sdf_pyramid_benchmark.csv", sceneSDF_effect->GetCPUField());
+    }
+
     if (ImGui::CollapsingHeader("Volume Params"))
     {
         float absorptionCoeff = volume_effect->GetAbsorptionCoeff();
@@ -578,6 +1042,176 @@ void Game::ImGui(bool& wireframeMode)
         float scatterCoeff = volume_effect->GetScatterCoeff();
         ImGui::SliderFloat("Scatter", &scatterCoeff, 0.05f, 2.0f);
         volume_effect->SetScatterCoeff(scatterCoeff);
+
+        // while the autotuner runs it owns the step counts
+        if (!m_autotuneActive)
+        {
+            int maxSteps = volume_effect->GetMaxSteps();
+            ImGui::SliderInt("Raymarch steps", &maxSteps, 8, 256);
+            volume_effect->SetMaxSteps(maxSteps);
+
+            int maxLightSteps = volume_effect->GetMaxLightSteps();
+            ImGui::SliderInt("Light steps", &maxLightSteps, 1, 32);
+            volume_effect->SetMaxLightSteps(maxLightSteps);
+        }
+
+        bool adaptiveSteps = volume_effect->GetAdaptiveSteps();
+        ImGui::Checkbox("Adaptive steps", &adaptiveSteps);
+        volume_effect->SetAdaptiveSteps(adaptiveSteps);
+        if (adaptiveSteps)
+        {
+            float stepScales[2] = { volume_effect->GetMinStepScale(), volume_effect->GetMaxStepScale() };
+            ImGui::SliderFloat2("Step scales", stepScales, 0.1f, 8.0f);
+            volume_effect->SetStepScales(stepScales[0], stepScales[1]);
+
+            float edgeThreshold = volume_effect->GetEdgeThreshold();
+            ImGui::SliderFloat("Edge threshold", &edgeThreshold, 0.005f, 0.5f);
+            volume_effect->SetEdgeThreshold(edgeThreshold);
+
+            float nearDistance = volume_effect->GetNearDistance();
+            ImGui::SliderFloat("Near distance", &nearDistance, 0.1f, 20.0f);
+            volume_effect->SetNearDistance(nearDistance);
+        }
+        float terminationThreshold = volume_effect->GetTerminationThreshold();
+        ImGui::SliderFloat("Termination threshold", &terminationThreshold, 0.0f, 0.1f, "%.4f");
+        volume_effect->SetTerminationThreshold(terminationThreshold);
+        bool gpuSkipEmpty = volume_effect->GetSkipEmpty();
+        ImGui::Checkbox("GPU skip empty macrocells", &gpuSkipEmpty);
+        volume_effect->SetSkipEmpty(gpuSkipEmpty);
+
+        bool blueNoise = volume_effect->GetBlueNoise();
+        ImGui::Checkbox("Blue noise jitter", &blueNoise);
+        volume_effect->SetBlueNoise(blueNoise);
+        bool godRaysBlueNoise = godRays_effect->GetBlueNoise();
+        ImGui::SameLine();
+        ImGui::Checkbox("God rays blue noise", &godRaysBlueNoise);
+        godRays_effect->SetBlueNoise(godRaysBlueNoise);
+        int godRaysSamples = godRays_effect->GetSampleCount();
+        ImGui::SliderInt("God ray samples", &godRaysSamples, 8, 128);
+        godRays_effect->SetSampleCount(godRaysSamples);
+        if (m_blueNoise)
+            ImGui::Text("Blue noise %dx%dx%d, %s", m_blueNoise->GetParameters().size, m_blueNoise->GetParameters().size, m_blueNoise->GetParameters().slices,
+                m_blueNoise->GetLoadedFromCache() ? "loaded from cache" : "generated");
+        else
+            ImGui::Text("Blue noise generating, hashed jitter until it is ready");
+
+        const CPUVolumePath cpuPaths[] = { CPUVolumePath::Scalar, CPUVolumePath::Avx2, CPUVolumePath::Avx512 };
+        for (CPUVolumePath path : cpuPaths)
+        {
+            if (!CPUVolumeRenderer::IsPathSupported(path))
+                continue;
+            if (path != CPUVolumePath::Scalar)
+                ImGui::SameLine();
+            if (ImGui::RadioButton(CPUVolumeRenderer::GetPathName(path), m_cpuVolume->GetPath() == path))
+                m_cpuVolume->SetPath(path);
+        }
+
+        bool skipEmpty = m_cpuVolume->GetSkipEmpty();
+        ImGui::Checkbox("Skip empty macrocells", &skipEmpty);
+        m_cpuVolume->SetSkipEmpty(skipEmpty);
+        const MacrocellGrid& macrocells = m_cpuVolume->GetMacrocells();
+        if (!macrocells.IsEmpty())
+        {
+            XMINT3 cells = macrocells.GetCellCount();
+            ImGui::Text("Macrocells: %d of %d occupied, %d updated in %.2f ms", macrocells.GetOccupiedCount(), cells.x * cells.y * cells.z, macrocells.GetLastUpdatedCount(), macrocells.GetLastUpdateTime());
+        }
+        bool useSunVolume = m_cpuVolume->GetUseSunVolume();
+        ImGui::Checkbox("Sun transmittance volume", &useSunVolume);
+        m_cpuVolume->SetUseSunVolume(useSunVolume);
+        if (!m_cpuVolume->GetSunVolume().IsEmpty())
+            ImGui::Text("Sun volume: %d^3, built in %.1f ms", m_cpuVolume->GetSunVolume().GetResolution(), m_cpuVolume->GetSunVolume().GetBuildTime());
+        bool useFroxels = m_cpuVolume->GetUseFroxels();
+        ImGui::Checkbox("Froxel grid", &useFroxels);
+        m_cpuVolume->SetUseFroxels(useFroxels);
+        if (useFroxels)
+        {
+            XMINT3 froxelResolution = m_cpuVolume->GetFroxelResolution();
+            ImGui::SliderInt3("Froxels", &froxelResolution.x, 8, 256);
+            m_cpuVolume->SetFroxelResolution(froxelResolution);
+        }
+        int resolutionDivisor = m_cpuVolume->GetResolutionDivisor();
+        ImGui::RadioButton("Full resolution", &resolutionDivisor, 1);
+        ImGui::SameLine();
+        ImGui::RadioButton("Half", &resolutionDivisor, 2);
+        ImGui::SameLine();
+        ImGui::RadioButton("Quarter", &resolutionDivisor, 4);
+        m_cpuVolume->SetResolutionDivisor(resolutionDivisor);
+        if (resolutionDivisor > 1)
+        {
+            const UpsampleFilter filters[] = { UpsampleFilter::Bilinear, UpsampleFilter::NearestDepth, UpsampleFilter::JointBilateral };
+            for (UpsampleFilter filter : filters)
+            {
+                if (filter != UpsampleFilter::Bilinear)
+                    ImGui::SameLine();
+                if (ImGui::RadioButton(DepthAwareUpsampler::GetFilterName(filter), m_cpuVolume->GetUpsampleFilter() == filter))
+                    m_cpuVolume->SetUpsampleFilter(filter);
+            }
+        }
+        bool useImpostors = m_cpuVolume->GetUseImpostors();
+        ImGui::Checkbox("Impostors for distant views", &useImpostors);
+        m_cpuVolume->SetUseImpostors(useImpostors);
+        if (useImpostors)
+        {
+            CloudImpostorCache& impostors = m_cpuVolume->GetImpostors();
+            float angleThreshold = impostors.GetAngleThreshold();
+            ImGui::SliderFloat("Impostor angle threshold", &angleThreshold, 0.25f, 10.0f, "%.2f deg");
+            impostors.SetAngleThreshold(angleThreshold);
+            float densityThreshold = impostors.GetDensityThreshold();
+            ImGui::SliderFloat("Impostor density threshold", &densityThreshold, 0.005f, 0.5f, "%.3f");
+            impostors.SetDensityThreshold(densityThreshold);
+            ImGui::Text("Impostors: %d of %d views, %dx%d texels", impostors.GetValidCount(), impostors.GetViewCount(), impostors.GetResolution(), impostors.GetResolution());
+            if (impostors.IsRefreshing())
+                ImGui::Text("Refreshing a view in the background");
+            else if (impostors.GetRefreshTime() > 0.0)
+                ImGui::Text("Last view refreshed in %.1f ms in the background", impostors.GetRefreshTime());
+        }
+
+        // the density is read back first, so the frame is written once the next readback completes
+        if (m_cpuVolumeRequest == 0)
+        {
+            if (ImGui::Button("CPU render (cpu_volume.pfm)"))
+                m_cpuVolumeRequest = 1;
+            ImGui::SameLine();
+            if (ImGui::Button("Benchmark CPU renderer"))
+                m_cpuVolumeRequest = 2;
+            if (ImGui::Button("Compare sun volume with light march"))
+                m_cpuVolumeRequest = 3;
+            if (ImGui::Button("Compare adaptive steps with even steps"))
+                m_cpuVolumeRequest = 4;
+            if (ImGui::Button("Compare froxels with ray march"))
+                m_cpuVolumeRequest = 5;
+            if (ImGui::Button("Compare temporal accumulation with single frames"))
+                m_cpuVolumeRequest = 6;
+            if (ImGui::Button("Compare reduced resolution with full"))
+                m_cpuVolumeRequest = 7;
+            if (ImGui::Button("Compare blue noise with white noise jitter"))
+                m_cpuVolumeRequest = 8;
+            if (ImGui::Button("Compare impostor cache with ray march"))
+                m_cpuVolumeRequest = 9;
+            if (ImGui::Button("Check empty-space skipping against the plain march"))
+                m_cpuVolumeRequest = 10;
+            if (ImGui::Button("Save frame for cpu_volume_render"))
+                m_cpuVolumeRequest = 11;
+            if (m_cpuVolumeRequest != 0)
+                m_cpuVolumeDensityVersion = fluid_effect->GetCPUDensityVersion();
+        }
+        else
+        {
+            ImGui::Text("Waiting for the density readback...");
+        }
+        const CPUVolumeStats& cpuStats = m_cpuVolume->GetStats();
+        if (cpuStats.width > 0)
+        {
+            ImGui::Text("CPU %s %dx%d: %.1f ms, %.1f Msamples/s on %d threads", CPUVolumeRenderer::GetPathName(cpuStats.path), cpuStats.width, cpuStats.height, cpuStats.renderTime, cpuStats.MegasamplesPerSecond(), cpuStats.threads);
+            if (cpuStats.froxels)
+                ImGui::Text("%.2f froxels per pixel, grid built in %.1f ms", cpuStats.ViewSamplesPerPixel(), cpuStats.froxelTime);
+            else
+                ImGui::Text("%.2f view samples per pixel, %s steps", cpuStats.ViewSamplesPerPixel(), cpuStats.adaptive ? "adaptive" : "even");
+            if (cpuStats.resolutionDivisor > 1)
+                ImGui::Text("1/%d resolution, %s upsample in %.1f ms", cpuStats.resolutionDivisor, DepthAwareUpsampler::GetFilterName(cpuStats.upsample), cpuStats.upsampleTime);
+            if (cpuStats.impostors)
+                ImGui::Text("From impostors, %d view rows rendered in %.1f ms", cpuStats.impostorRows, cpuStats.impostorTime);
+        }
     }
 
     if (ImGui::CollapsingHeader("Light Params"))
@@ -635,6 +1269,7 @@ void Game::OnDeviceLost()
     volumeBound_mesh.reset();
     skybox_mesh.reset();
     postprocess_mesh.reset();
+    m_gpuTimer.reset();
 }
 
 void Game::OnDeviceRestored()
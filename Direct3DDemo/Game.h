@@ -24,6 +24,14 @@
 #include "OrthoMesh.hpp"
 #include "FPCamera.h"
 #include "Light.h"
+#include "GpuTimer.h"
+#include "QualityAutotuner.h"
+#include "ThreadPool.h"
+#include "MeshSDFObject.h"
+#include "MarchingCubes.h"
+#include "CPUVolumeRenderer.h"
+#include "SpatiotemporalBlueNoise.h"
+#include <future>
 
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
@@ -75,6 +83,10 @@ private:
 
     void CreateDeviceDependentResources();
     void CreateWindowSizeDependentResources();
+    // the blue noise's texture, handed to the effects
+    void CreateBlueNoiseTexture();
+    // the blue noise slice of the frame, 0 until the noise is ready
+    int GetBlueNoiseFrame() const;
 
     void ImGui(bool& wireframeMode);
 
@@ -103,6 +115,11 @@ private:
     Matrix m_proj;
 
 
+    // declared ahead of the effects so they outlive the background jobs the effects run on them; jobs that span
+    // frames use their own pool, whose ParallelFor calls then never wait on the frame's
+    std::unique_ptr<ThreadPool> m_threadPool;
+    std::unique_ptr<ThreadPool> m_backgroundPool;
+
     std::unique_ptr<CustomEffects::DisplacementEffect> displacement_effect;
     std::unique_ptr<CustomEffects::SDFEffect> sceneSDF_effect;
     std::unique_ptr<CustomEffects::FluidSimEffect> fluid_effect;
@@ -118,6 +135,37 @@ private:
     std::unique_ptr<OrthoMesh<VertexPosNormalTex>> postprocess_mesh;
     std::unique_ptr<SphereMesh<VertexPosNormalTex>> skybox_mesh;
 
+    std::unique_ptr<GpuTimer> m_gpuTimer;
+    std::unique_ptr<QualityAutotuner> m_autotuner;
+    int m_terrainSDFObject;
+    std::unique_ptr<MeshSDFObject> m_meshObstacle;
+    // isosurface of the cloud density (source 0) or the scene SDF (source 1), re-extracted where the field changed
+    std::unique_ptr<MarchingCubes> m_isosurface;
+    bool m_isosurfaceEnabled = false;
+    int m_isosurfaceSource = 0;
+    float m_isosurfaceLevel = 0.1f;
+    uint64_t m_isosurfaceDensityVersion = 0;
+
+    // CPU reference frames of the clouds: 1 writes an image, 2 a benchmark, 3 the sun volume comparison, 4 the
+    // adaptive step comparison, 5 the froxel comparison, 6 the temporal accumulation comparison, 7 the reduced
+    // resolution comparison, 8 the blue noise comparison, 9 the impostor cache comparison, 10 the empty-space
+    // skipping check, 11 saves the frame for rendering without a GPU, once a fresh density readback lands
+    std::unique_ptr<CPUVolumeRenderer> m_cpuVolume;
+    // jitter for the cloud and god ray marches on the GPU and the CPU, a slice per frame; null until the background
+    // job loading or generating it finishes
+    std::unique_ptr<SpatiotemporalBlueNoise> m_blueNoise;
+    std::future<std::unique_ptr<SpatiotemporalBlueNoise>> m_blueNoiseJob;
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> m_blueNoiseTexture;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_blueNoiseSrv;
+    int m_cpuVolumeRequest = 0;
+    uint64_t m_cpuVolumeDensityVersion = 0;
+    // the knobs as the user left them, restored when the autotuner is switched off
+    QualitySettings m_userQuality = { 0, false, 0, 0, 1 };
+    bool m_autotuneActive = false;
+    // simulation runs once every QualitySettings::simInterval frames with the accumulated time
+    int m_simFrameCount = 0;
+    float m_simAccumulatedTime = 0.0f;
+
     std::unique_ptr<TextureManager> m_textureManager;
     std::unique_ptr<DX::RenderTexture> m_mainSceneRT;
     std::unique_ptr<DX::RenderTexture> m_volumetricSceneRT;
@@ -11,6 +11,7 @@ namespace CustomEffects
 		{
 			m_cameraBuffer = std::make_unique<ConstantBuffer<CameraBufferType>>();
 			m_sceneMatrixBuffer = std::make_unique<ConstantBuffer<MatrixBufferType>>();
+			m_godRaysBuffer = std::make_unique<ConstantBuffer<GodRaysBufferType>>();
 			m_states = std::make_unique<CommonStates>(device);
 
 			CreateConstantBuffers(device);
@@ -24,8 +25,8 @@ namespace CustomEffects
 		void Unbind(ID3D11DeviceContext* deviceContext)
 		{
 			// unbind srvs for writing again
-			ID3D11ShaderResourceView* nullSRV[] = { NULL, NULL };
-			deviceContext->PSSetShaderResources(0, 2, nullSRV);
+			ID3D11ShaderResourceView* nullSRV[] = { NULL, NULL, NULL };
+			deviceContext->PSSetShaderResources(0, 3, nullSRV);
 		}
 
 		void SetCameraPosition(const XMFLOAT3& cameraPos) { m_cameraPos = cameraPos; }
@@ -33,6 +34,15 @@ namespace CustomEffects
 		void SetSceneProjectionMatrix(const XMMATRIX& proj) { m_sceneProj = proj; }
 		void SetColorSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_colorSRV = srv; }
 		void SetOcclusionSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_occlusionSRV = srv; }
+		void SetBlueNoiseSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_blueNoiseSRV = srv; }
+		int GetSampleCount() const { return m_sampleCount; }
+		bool GetBlueNoise() const { return m_blueNoise; }
+		// samples toward the sun; the decay and weight per sample are scaled to keep the falloff of 80 samples
+		void SetSampleCount(int count) { m_sampleCount = std::max(1, count); }
+		// starts every pixel's samples a blue noise fraction of a sample toward the sun, a slice per frame; off by
+		// default, and unjittered until the texture is set
+		void SetBlueNoise(bool blueNoise) { m_blueNoise = blueNoise; }
+		void SetFrameIndex(int frameIndex) { m_frameIndex = std::max(0, frameIndex); }
 
 	protected:
 		virtual void CreateConstantBuffers(ID3D11Device* device) override
@@ -40,6 +50,7 @@ namespace CustomEffects
 			// create constant buffers for this shader's specific stuff
 			m_cameraBuffer->Initialize(device);
 			m_sceneMatrixBuffer->Initialize(device);
+			m_godRaysBuffer->Initialize(device);
 		}
 		virtual void SetConstantBuffers(ID3D11DeviceContext* deviceContext) override
 		{
@@ -57,8 +68,13 @@ namespace CustomEffects
 			// bind
 			deviceContext->VSSetConstantBuffers(3, 1, m_sceneMatrixBuffer->GetAddressOf());
 
-			ID3D11ShaderResourceView* srvs[] = { m_colorSRV.Get(), m_occlusionSRV.Get() };
-			deviceContext->PSSetShaderResources(0, 2, srvs);
+			// set
+			m_godRaysBuffer->Apply(deviceContext, { float(m_sampleCount), m_blueNoise && m_blueNoiseSRV ? 1.0f : 0.0f, float(m_frameIndex) });
+			// bind
+			deviceContext->PSSetConstantBuffers(1, 1, m_godRaysBuffer->GetAddressOf());
+
+			ID3D11ShaderResourceView* srvs[] = { m_colorSRV.Get(), m_occlusionSRV.Get(), m_blueNoiseSRV.Get() };
+			deviceContext->PSSetShaderResources(0, 3, srvs);
 
 			auto sampler = m_states->LinearClamp();
 			deviceContext->PSSetSamplers(0, 1, &sampler);
@@ -67,12 +83,17 @@ namespace CustomEffects
 	private:
 		XMFLOAT3 m_cameraPos;
 		XMMATRIX m_sceneView, m_sceneProj;
+		int m_sampleCount = 80;
+		bool m_blueNoise = false;
+		int m_frameIndex = 0;
 
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_colorSRV;
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_occlusionSRV;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_blueNoiseSRV;
 
 		std::unique_ptr<ConstantBuffer<CameraBufferType>> m_cameraBuffer;
 		std::unique_ptr<ConstantBuffer<MatrixBufferType>> m_sceneMatrixBuffer;
+		std::unique_ptr<ConstantBuffer<GodRaysBufferType>> m_godRaysBuffer;
 
 		std::unique_ptr<DirectX::CommonStates> m_states;
 	};
@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer(ID3D11Device* device) : m_device(device)
+{
+	D3D11_QUERY_DESC desc = {};
+	desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	for (int i = 0; i < kFrameLatency; i++)
+	{
+		DX::ThrowIfFailed(device->CreateQuery(&desc, m_disjoint[i].GetAddressOf()));
+		CreateTimestamp(m_frameBegin[i].GetAddressOf());
+		CreateTimestamp(m_frameEnd[i].GetAddressOf());
+	}
+}
+
+void GpuTimer::BeginFrame(ID3D11DeviceContext* deviceContext)
+{
+	// the slot about to be reused was issued kFrameLatency frames ago, collect it first
+	if (m_frameIssued[m_slot])
+		Resolve(deviceContext, m_slot);
+
+	for (auto& scope : m_scopes)
+		scope.second.issued[m_slot] = false;
+
+	deviceContext->Begin(m_disjoint[m_slot].Get());
+	deviceContext->End(m_frameBegin[m_slot].Get());
+}
+
+void GpuTimer::EndFrame(ID3D11DeviceContext* deviceContext)
+{
+	deviceContext->End(m_frameEnd[m_slot].Get());
+	deviceContext->End(m_disjoint[m_slot].Get());
+	m_frameIssued[m_slot] = true;
+
+	m_slot = (m_slot + 1) % kFrameLatency;
+}
+
+void GpuTimer::Begin(ID3D11DeviceContext* deviceContext, const std::string& name)
+{
+	Scope& scope = m_scopes[name];
+	if (!scope.begin[m_slot])
+	{
+		for (int i = 0; i < kFrameLatency; i++)
+		{
+			CreateTimestamp(scope.begin[i].GetAddressOf());
+			CreateTimestamp(scope.end[i].GetAddressOf());
+		}
+	}
+	deviceContext->End(scope.begin[m_slot].Get());
+}
+
+void GpuTimer::End(ID3D11DeviceContext* deviceContext, const std::string& name)
+{
+	auto it = m_scopes.find(name);
+	if (it == m_scopes.end())
+		return;
+
+	deviceContext->End(it->second.end[m_slot].Get());
+	it->second.issued[m_slot] = true;
+}
+
+float GpuTimer::GetTime(const std::string& name) const
+{
+	auto it = m_scopes.find(name);
+	return it != m_scopes.end() ? it->second.time : 0.0f;
+}
+
+void GpuTimer::CreateTimestamp(ID3D11Query** query)
+{
+	D3D11_QUERY_DESC desc = {};
+	desc.Query = D3D11_QUERY_TIMESTAMP;
+	DX::ThrowIfFailed(m_device->CreateQuery(&desc, query));
+}
+
+void GpuTimer::Resolve(ID3D11DeviceContext* deviceContext, int slot)
+{
+	m_frameIssued[slot] = false;
+
+	// results that are still not ready after kFrameLatency frames are dropped rather than waited on
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	if (deviceContext->GetData(m_disjoint[slot].Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+		return;
+	if (disjoint.Disjoint)
+		return;
+
+	auto elapsed = [&](ID3D11Query* begin, ID3D11Query* end, float& ms)
+	{
+		UINT64 t0, t1;
+		if (deviceContext->GetData(begin, &t0, sizeof(t0), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			deviceContext->GetData(end, &t1, sizeof(t1), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			return false;
+
+		ms = float(double(t1 - t0) / double(disjoint.Frequency) * 1000.0);
+		return true;
+	};
+
+	float ms;
+	if (elapsed(m_frameBegin[slot].Get(), m_frameEnd[slot].Get(), ms))
+		Accumulate(m_frameTime, m_hasFrameTime, ms);
+
+	for (auto& it : m_scopes)
+	{
+		Scope& scope = it.second;
+		if (scope.issued[slot] && elapsed(scope.begin[slot].Get(), scope.end[slot].Get(), ms))
+			Accumulate(scope.time, scope.hasTime, ms);
+	}
+}
+
+void GpuTimer::Accumulate(float& time, bool& hasTime, float sample)
+{
+	time = hasTime ? time + (sample - time) * m_smoothing : sample;
+	hasTime = true;
+}
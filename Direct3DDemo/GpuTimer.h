@@ -0,0 +1,51 @@
+#pragma once
+// GpuTimer
+// Named GPU timestamp scopes, read back a few frames late so the CPU never waits on the queries.
+// Results are smoothed and reported in milliseconds.
+
+#include "pch.h"
+#include <string>
+#include <map>
+
+class GpuTimer
+{
+public:
+	GpuTimer(ID3D11Device* device);
+
+	void BeginFrame(ID3D11DeviceContext* deviceContext);
+	void EndFrame(ID3D11DeviceContext* deviceContext);
+
+	void Begin(ID3D11DeviceContext* deviceContext, const std::string& name);
+	void End(ID3D11DeviceContext* deviceContext, const std::string& name);
+
+	// smoothed time of a scope, 0 until the first result arrives
+	float GetTime(const std::string& name) const;
+	float GetFrameTime() const { return m_frameTime; };
+
+private:
+	static const int kFrameLatency = 4;
+
+	struct Scope
+	{
+		Microsoft::WRL::ComPtr<ID3D11Query> begin[kFrameLatency], end[kFrameLatency];
+		bool issued[kFrameLatency] = {};
+		float time = 0.0f;
+		bool hasTime = false;
+	};
+
+	void CreateTimestamp(ID3D11Query** query);
+	void Resolve(ID3D11DeviceContext* deviceContext, int slot);
+	void Accumulate(float& time, bool& hasTime, float sample);
+
+	Microsoft::WRL::ComPtr<ID3D11Device> m_device;
+	Microsoft::WRL::ComPtr<ID3D11Query> m_disjoint[kFrameLatency];
+	Microsoft::WRL::ComPtr<ID3D11Query> m_frameBegin[kFrameLatency], m_frameEnd[kFrameLatency];
+	bool m_frameIssued[kFrameLatency] = {};
+
+	std::map<std::string, Scope> m_scopes;
+
+	int m_slot = 0;
+	float m_frameTime = 0.0f;
+	bool m_hasFrameTime = false;
+	float m_smoothing = 0.1f;
+};
@@ -0,0 +1,417 @@
+#include "pch.h"
+#include "HeightfieldQuadtree.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+
+namespace
+{
+	// cell of a coordinate on a segment heading in direction d; the bias puts points on a cell boundary, or a
+	// rounding error short of it, into the cell the segment is about to enter
+	int CellAlong(float p, float d)
+	{
+		const float bias = 1e-4f;
+		return int(std::floor(p + (d > 0.0f ? bias : (d < 0.0f ? -bias : 0.0f))));
+	}
+}
+
+HeightfieldQuadtree::HeightfieldQuadtree() :
+	m_transform(XMMatrixIdentity()),
+	m_transformInv(XMMatrixIdentity())
+{
+}
+
+void HeightfieldQuadtree::Build(const float* heights, int width, int depth, ThreadPool* pool)
+{
+	m_levels.clear();
+	if (width < 2 || depth < 2)
+	{
+		m_heights.clear();
+		return;
+	}
+
+	m_heights.assign(heights, heights + size_t(width) * depth);
+	m_width = width;
+	m_depth = depth;
+
+	Level cells;
+	cells.width = width - 1;
+	cells.depth = depth - 1;
+	cells.maximum.resize(size_t(cells.width) * cells.depth);
+	ForEachSlice(pool, cells.depth, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; z++)
+		{
+			const float* row0 = &m_heights[size_t(z) * width];
+			const float* row1 = row0 + width;
+			for (int x = 0; x < cells.width; x++)
+				cells.maximum[size_t(z) * cells.width + x] = std::max(std::max(row0[x], row0[x + 1]), std::max(row1[x], row1[x + 1]));
+		}
+	});
+	m_levels.push_back(std::move(cells));
+
+	while (m_levels.back().width > 1 || m_levels.back().depth > 1)
+	{
+		const Level& fine = m_levels.back();
+		Level coarse;
+		coarse.width = (fine.width + 1) / 2;
+		coarse.depth = (fine.depth + 1) / 2;
+		coarse.maximum.resize(size_t(coarse.width) * coarse.depth);
+		ForEachSlice(pool, coarse.depth, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; z++)
+			{
+				for (int x = 0; x < coarse.width; x++)
+				{
+					float hi = -std::numeric_limits<float>::max();
+					for (int cz = 2 * z; cz < std::min(2 * z + 2, fine.depth); cz++)
+						for (int cx = 2 * x; cx < std::min(2 * x + 2, fine.width); cx++)
+							hi = std::max(hi, fine.maximum[size_t(cz) * fine.width + cx]);
+					coarse.maximum[size_t(z) * coarse.width + x] = hi;
+				}
+			}
+		});
+		m_levels.push_back(std::move(coarse));
+	}
+}
+
+void HeightfieldQuadtree::SetTransform(const XMMATRIX& transform)
+{
+	m_transform = transform;
+	m_transformInv = XMMatrixInverse(nullptr, transform);
+}
+
+void HeightfieldQuadtree::ToLocal(const XMFLOAT3& a, const XMFLOAT3& b, XMFLOAT3& origin, XMFLOAT3& delta) const
+{
+	XMVECTOR cellScale = XMVectorSet(float(m_width - 1), 1.0f, float(m_depth - 1), 0.0f);
+	XMVECTOR localA = XMVector3Transform(XMLoadFloat3(&a), m_transformInv) * cellScale;
+	XMVECTOR localB = XMVector3Transform(XMLoadFloat3(&b), m_transformInv) * cellScale;
+	XMStoreFloat3(&origin, localA);
+	XMStoreFloat3(&delta, localB - localA);
+}
+
+HeightfieldHit HeightfieldQuadtree::IntersectSegment(const XMFLOAT3& a, const XMFLOAT3& b) const
+{
+	if (m_levels.empty())
+		return { false, 0.0f, a, XMFLOAT3(0, 1, 0) };
+
+	XMFLOAT3 origin, delta;
+	ToLocal(a, b, origin, delta);
+	return MakeHit(IntersectLocal(origin, delta), origin, delta, 1.0f);
+}
+
+HeightfieldHit HeightfieldQuadtree::IntersectRay(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const
+{
+	XMFLOAT3 end;
+	XMStoreFloat3(&end, XMLoadFloat3(&origin) + XMLoadFloat3(&direction) * maxDistance);
+	if (m_levels.empty())
+		return { false, 0.0f, origin, XMFLOAT3(0, 1, 0) };
+
+	XMFLOAT3 localOrigin, delta;
+	ToLocal(origin, end, localOrigin, delta);
+	return MakeHit(IntersectLocal(localOrigin, delta), localOrigin, delta, maxDistance);
+}
+
+HeightfieldHit HeightfieldQuadtree::MakeHit(float t, const XMFLOAT3& origin, const XMFLOAT3& delta, float scale) const
+{
+	HeightfieldHit hit = { t >= 0.0f, std::max(t, 0.0f) * scale, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 1, 0) };
+	if (!hit.hit)
+		return hit;
+
+	float x = origin.x + delta.x * t, y = origin.y + delta.y * t, z = origin.z + delta.z * t;
+	XMVECTOR local = XMVectorSet(x / (m_width - 1), y, z / (m_depth - 1), 1.0f);
+	XMStoreFloat3(&hit.position, XMVector3Transform(local, m_transform));
+
+	// slopes of the bilinear patch under the hit, per unit of u and v
+	int x0 = std::max(0, std::min(int(x), m_width - 2)), z0 = std::max(0, std::min(int(z), m_depth - 2));
+	float fx = std::max(0.0f, std::min(x - x0, 1.0f)), fz = std::max(0.0f, std::min(z - z0, 1.0f));
+	const float* row0 = &m_heights[size_t(z0) * m_width + x0];
+	const float* row1 = row0 + m_width;
+	float dhdx = (row0[1] - row0[0]) * (1.0f - fz) + (row1[1] - row1[0]) * fz;
+	float dhdz = (row1[0] - row0[0]) * (1.0f - fx) + (row1[1] - row0[1]) * fx;
+	XMVECTOR normal = XMVectorSet(-dhdx * (m_width - 1), 1.0f, -dhdz * (m_depth - 1), 0.0f);
+	XMStoreFloat3(&hit.normal, XMVector3Normalize(XMVector3TransformNormal(normal, XMMatrixTranspose(m_transformInv))));
+	return hit;
+}
+
+bool HeightfieldQuadtree::ClipToFootprint(const XMFLOAT3& origin, const XMFLOAT3& delta, float& t0, float& t1) const
+{
+	t0 = 0.0f;
+	t1 = 1.0f;
+	const float o[2] = { origin.x, origin.z }, d[2] = { delta.x, delta.z };
+	const float extent[2] = { float(m_width - 1), float(m_depth - 1) };
+	for (int axis = 0; axis < 2; axis++)
+	{
+		if (d[axis] == 0.0f)
+		{
+			if (o[axis] < 0.0f || o[axis] > extent[axis])
+				return false;
+			continue;
+		}
+		float ta = -o[axis] / d[axis], tb = (extent[axis] - o[axis]) / d[axis];
+		t0 = std::max(t0, std::min(ta, tb));
+		t1 = std::min(t1, std::max(ta, tb));
+	}
+	return t0 <= t1;
+}
+
+float HeightfieldQuadtree::IntersectLocal(const XMFLOAT3& origin, const XMFLOAT3& delta) const
+{
+	float t0, t1;
+	if (!ClipToFootprint(origin, delta, t0, t1))
+		return -1.0f;
+
+	int top = int(m_levels.size()) - 1, level = top;
+	float t = t0;
+	// the segment crosses at most width + depth cell boundaries, and every move to the next node is followed by
+	// at most one descent per level; the bound only guards against t failing to advance through rounding
+	const int maxIterations = (top + 2) * 2 * (m_levels[0].width + m_levels[0].depth + 2);
+	for (int iteration = 0; iteration < maxIterations; iteration++)
+	{
+		const Level& node = m_levels[level];
+		int size = 1 << level;
+
+		int cx = std::max(0, std::min(CellAlong(origin.x + delta.x * t, delta.x), m_levels[0].width - 1));
+		int cz = std::max(0, std::min(CellAlong(origin.z + delta.z * t, delta.z), m_levels[0].depth - 1));
+		int nx = cx >> level, nz = cz >> level;
+
+		float tExit = t1;
+		if (delta.x > 0.0f)
+			tExit = std::min(tExit, (float((nx + 1) * size) - origin.x) / delta.x);
+		else if (delta.x < 0.0f)
+			tExit = std::min(tExit, (float(nx * size) - origin.x) / delta.x);
+		if (delta.z > 0.0f)
+			tExit = std::min(tExit, (float((nz + 1) * size) - origin.z) / delta.z);
+		else if (delta.z < 0.0f)
+			tExit = std::min(tExit, (float(nz * size) - origin.z) / delta.z);
+		tExit = std::max(tExit, t);
+
+		// the segment is straight, so its lowest point over the node is at one of the ends
+		float lowest = std::min(origin.y + delta.y * t, origin.y + delta.y * tExit);
+		if (lowest > node.maximum[size_t(nz) * node.width + nx])
+		{
+			if (tExit >= t1)
+				return -1.0f;
+			t = tExit;
+			level = std::min(level + 1, top);
+			continue;
+		}
+
+		if (level > 0)
+		{
+			level--;
+			continue;
+		}
+
+		float hit = IntersectCell(cx, cz, origin, delta, t, tExit);
+		if (hit >= 0.0f)
+			return hit;
+		if (tExit >= t1)
+			return -1.0f;
+		t = tExit;
+		level = std::min(1, top);
+	}
+	return -1.0f;
+}
+
+float HeightfieldQuadtree::IntersectCell(int x, int z, const XMFLOAT3& origin, const XMFLOAT3& delta, float t0, float t1) const
+{
+	const float* row0 = &m_heights[size_t(z) * m_width + x];
+	const float* row1 = row0 + m_width;
+	float h00 = row0[0], h10 = row0[1], h01 = row1[0], h11 = row1[1];
+	float a = h10 - h00, b = h01 - h00, c = h00 - h10 - h01 + h11;
+
+	// height above the patch along the segment is a quadratic in t
+	float ax = origin.x - x, bx = delta.x;
+	float az = origin.z - z, bz = delta.z;
+	float c0 = origin.y - (h00 + a * ax + b * az + c * ax * az);
+	float c1 = delta.y - (a * bx + b * bz + c * (ax * bz + az * bx));
+	float c2 = -c * bx * bz;
+	auto above = [&](float t) { return c0 + (c1 + c2 * t) * t; };
+
+	if (above(t0) <= 0.0f)
+		return t0;
+
+	float roots[2];
+	int rootCount = 0;
+	if (std::abs(c2) < 1e-12f)
+	{
+		if (c1 != 0.0f)
+			roots[rootCount++] = -c0 / c1;
+	}
+	else
+	{
+		float discriminant = c1 * c1 - 4.0f * c2 * c0;
+		if (discriminant >= 0.0f)
+		{
+			float q = -0.5f * (c1 + (c1 < 0.0f ? -1.0f : 1.0f) * std::sqrt(discriminant));
+			roots[rootCount++] = q / c2;
+			if (q != 0.0f)
+				roots[rootCount++] = c0 / q;
+			if (rootCount == 2 && roots[1] < roots[0])
+				std::swap(roots[0], roots[1]);
+		}
+	}
+	for (int i = 0; i < rootCount; i++)
+	{
+		if (roots[i] > t0 && roots[i] <= t1)
+			return roots[i];
+	}
+
+	// a crossing the roots missed by rounding
+	return above(t1) <= 0.0f ? t1 : -1.0f;
+}
+
+float HeightfieldQuadtree::SampleLocal(float x, float z) const
+{
+	x = std::max(0.0f, std::min(x, float(m_width - 1)));
+	z = std::max(0.0f, std::min(z, float(m_depth - 1)));
+	int x0 = std::min(int(x), m_width - 2), z0 = std::min(int(z), m_depth - 2);
+	float fx = x - x0, fz = z - z0;
+
+	const float* row0 = &m_heights[size_t(z0) * m_width + x0];
+	const float* row1 = row0 + m_width;
+	float h0 = row0[0] + (row0[1] - row0[0]) * fx;
+	float h1 = row1[0] + (row1[1] - row1[0]) * fx;
+	return h0 + (h1 - h0) * fz;
+}
+
+void HeightfieldQuadtree::Heights(const XMFLOAT3* positions, float* heights, size_t count) const
+{
+	XMVECTOR cellScale = XMVectorSet(float(m_width - 1), 0.0f, float(m_depth - 1), 0.0f);
+	for (size_t i = 0; i < count; i++)
+	{
+		XMVECTOR cell = XMVector3Transform(XMLoadFloat3(&positions[i]), m_transformInv) * cellScale;
+		float x = XMVectorGetX(cell), z = XMVectorGetZ(cell);
+		// y is free, so only x and z decide whether the position is over the terrain
+		if (m_levels.empty() || !(x >= 0.0f && x <= float(m_width - 1) && z >= 0.0f && z <= float(m_depth - 1)))
+		{
+			heights[i] = -std::numeric_limits<float>::max();
+			continue;
+		}
+
+		XMVECTOR local = XMVectorSet(x / (m_width - 1), SampleLocal(x, z), z / (m_depth - 1), 1.0f);
+		heights[i] = XMVectorGetY(XMVector3Transform(local, m_transform));
+	}
+}
+
+float HeightfieldQuadtree::IntersectBruteForce(const XMFLOAT3& origin, const XMFLOAT3& delta, float step) const
+{
+	float t0, t1;
+	if (!ClipToFootprint(origin, delta, t0, t1))
+		return -1.0f;
+
+	auto above = [&](float t) { return origin.y + delta.y * t - SampleLocal(origin.x + delta.x * t, origin.z + delta.z * t); };
+	if (above(t0) <= 0.0f)
+		return t0;
+
+	// steps of the given length in cells, then bisection between the last point above and the first below
+	float length = std::sqrt(delta.x * delta.x + delta.z * delta.z) * (t1 - t0);
+	int steps = std::max(1, int(std::ceil(length / step)));
+	float previous = t0;
+	for (int i = 1; i <= steps; i++)
+	{
+		float t = t0 + (t1 - t0) * i / steps;
+		if (above(t) <= 0.0f)
+		{
+			float lo = previous, hi = t;
+			for (int k = 0; k < 24; k++)
+			{
+				float mid = 0.5f * (lo + hi);
+				(above(mid) <= 0.0f ? hi : lo) = mid;
+			}
+			return hi;
+		}
+		previous = t;
+	}
+	return -1.0f;
+}
+
+void HeightfieldQuadtree::WriteBenchmark(const std::string& filename) const
+{
+	std::ofstream file(filename);
+	if (!file || m_levels.empty())
+		return;
+
+	file << "query,count,brute_ms,quadtree_ms,brute_qps,quadtree_qps,speedup,hits,mismatches\n";
+
+	auto range = std::minmax_element(m_heights.begin(), m_heights.end());
+	float lowest = *range.first, highest = *range.second, span = std::max(highest - lowest, 1e-3f);
+	float width = float(m_width - 1), depth = float(m_depth - 1);
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	auto randomPoint = [&](float height) { return XMFLOAT3(unit(random) * width, height, unit(random) * depth); };
+
+	auto elapsed = [](std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	// segments in cell coordinates: picking rays from above, grazing line-of-sight checks, camera-ground probes
+	// and short segments skimming the surface
+	const int count = 20000;
+	const char* queries[] = { "pick", "line_of_sight", "ground", "short" };
+	for (int query = 0; query < 4; query++)
+	{
+		std::vector<XMFLOAT3> origins(count), deltas(count);
+		for (int i = 0; i < count; i++)
+		{
+			XMFLOAT3 a, b;
+			if (query == 0)
+			{
+				a = randomPoint(highest + span);
+				b = randomPoint(lowest - 0.1f * span);
+			}
+			else if (query == 1)
+			{
+				a = randomPoint(0.0f);
+				b = randomPoint(0.0f);
+				a.y = SampleLocal(a.x, a.z) + 0.05f * span;
+				b.y = SampleLocal(b.x, b.z) + 0.05f * span;
+			}
+			else if (query == 2)
+			{
+				a = randomPoint(highest + 0.1f * span);
+				b = XMFLOAT3(a.x, lowest - 0.1f * span, a.z);
+			}
+			else
+			{
+				a = randomPoint(0.0f);
+				a.y = SampleLocal(a.x, a.z) + 0.02f * span;
+				float angle = unit(random) * XM_2PI;
+				b = XMFLOAT3(a.x + 4.0f * std::cos(angle), a.y - 0.04f * span * unit(random), a.z + 4.0f * std::sin(angle));
+			}
+			origins[i] = a;
+			deltas[i] = XMFLOAT3(b.x - a.x, b.y - a.y, b.z - a.z);
+		}
+
+		std::vector<float> brute(count), tree(count);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i++)
+			brute[i] = IntersectBruteForce(origins[i], deltas[i], 0.25f);
+		double bruteTime = elapsed(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i++)
+			tree[i] = IntersectLocal(origins[i], deltas[i]);
+		double treeTime = elapsed(start);
+
+		// stepping can jump over features thinner than its step, so it is the one expected to disagree
+		int hits = 0, mismatches = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const XMFLOAT3& d = deltas[i];
+			float length = std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+			hits += tree[i] >= 0.0f;
+			if ((brute[i] >= 0.0f) != (tree[i] >= 0.0f) || (tree[i] >= 0.0f && std::abs(brute[i] - tree[i]) * length > 0.05f))
+				mismatches++;
+		}
+
+		file << queries[query] << "," << count << "," << bruteTime << "," << treeTime << ","
+			<< count * 1000.0 / bruteTime << "," << count * 1000.0 / treeTime << "," << bruteTime / treeTime << ","
+			<< hits << "," << mismatches << "\n";
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+// HeightfieldQuadtree
+// Max-mip quadtree over a heightfield for picking, line-of-sight and ground queries without the 3D SDF.
+// Level 0 holds the highest corner of every cell, which bounds the bilinear surface over the cell; each
+// coarser level halves the resolution and keeps the highest of its up to four children.
+// Segments are traversed top-down: a node the segment passes entirely above is stepped over in one go and
+// the traversal climbs back up a level, otherwise it descends, and cells that are reached are intersected
+// exactly with the bilinear patch. The transform maps (u, height, v), u and v in [0, 1], to world space and
+// may scale and translate; heights are measured along its y axis.
+
+#include "pch.h"
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+struct HeightfieldHit
+{
+	bool hit;
+	float t; // fraction of the segment, or distance along the ray
+	XMFLOAT3 position;
+	XMFLOAT3 normal;
+};
+
+class HeightfieldQuadtree
+{
+public:
+	HeightfieldQuadtree();
+
+	// heights are indexed z * width + x, like TerrainSDFGenerator; pool may be null
+	void Build(const float* heights, int width, int depth, ThreadPool* pool);
+	bool IsEmpty() const { return m_levels.empty(); };
+
+	void SetTransform(const XMMATRIX& transform);
+	XMMATRIX GetTransform() const { return m_transform; };
+
+	// first point of the segment at or below the surface; a segment starting below it hits at t = 0
+	HeightfieldHit IntersectSegment(const XMFLOAT3& a, const XMFLOAT3& b) const;
+	// direction is normalized
+	HeightfieldHit IntersectRay(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const;
+	bool LineOfSight(const XMFLOAT3& a, const XMFLOAT3& b) const { return !IntersectSegment(a, b).hit; };
+
+	// world height of the surface below each position, -std::numeric_limits<float>::max() outside the heightfield
+	void Heights(const XMFLOAT3* positions, float* heights, size_t count) const;
+
+	int GetLevelCount() const { return int(m_levels.size()); };
+
+	// times segment and ray queries against brute-force stepping along them, writes a CSV file
+	void WriteBenchmark(const std::string& filename) const;
+
+private:
+	struct Level
+	{
+		int width, depth; // nodes
+		std::vector<float> maximum;
+	};
+
+	// in cell coordinates: x and z in [0, width - 1] and [0, depth - 1], y in height units; returns the
+	// fraction of the segment at the first hit, or a negative value
+	float IntersectLocal(const XMFLOAT3& origin, const XMFLOAT3& delta) const;
+	// the part [t0, t1] of the segment over the heightfield's footprint
+	bool ClipToFootprint(const XMFLOAT3& origin, const XMFLOAT3& delta, float& t0, float& t1) const;
+	float IntersectCell(int x, int z, const XMFLOAT3& origin, const XMFLOAT3& delta, float t0, float t1) const;
+	float IntersectBruteForce(const XMFLOAT3& origin, const XMFLOAT3& delta, float step) const;
+	float SampleLocal(float x, float z) const;
+	HeightfieldHit MakeHit(float t, const XMFLOAT3& origin, const XMFLOAT3& delta, float scale) const;
+
+	void ToLocal(const XMFLOAT3& a, const XMFLOAT3& b, XMFLOAT3& origin, XMFLOAT3& delta) const;
+
+	std::vector<float> m_heights;
+	int m_width = 0, m_depth = 0;
+	std::vector<Level> m_levels;
+	XMMATRIX m_transform, m_transformInv;
+};
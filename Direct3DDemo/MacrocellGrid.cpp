@@ -0,0 +1,194 @@
+#include "MacrocellGrid.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+MacrocellGrid::MacrocellGrid() :
+	m_resolution(0, 0, 0),
+	m_interior(0, 0, 0),
+	m_cellCount(0, 0, 0)
+{
+}
+
+void MacrocellGrid::Build(const float* density, const XMINT3& resolution, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	m_resolution = resolution;
+	m_interior = XMINT3(resolution.x - 2, resolution.y - 2, resolution.z - 2);
+	m_cellCount = XMINT3((m_interior.x + kCellSize - 1) / kCellSize, (m_interior.y + kCellSize - 1) / kCellSize, (m_interior.z + kCellSize - 1) / kCellSize);
+	int cells = m_cellCount.x * m_cellCount.y * m_cellCount.z;
+	m_minimum.resize(cells);
+	m_maximum.resize(cells);
+	m_mean.resize(cells);
+	m_occupancy.resize(cells);
+	m_previous.assign(density, density + size_t(resolution.x) * resolution.y * resolution.z);
+
+	ForEachSlice(pool, cells, [&](int begin, int end)
+	{
+		for (int cell = begin; cell < end; cell++)
+			UpdateCell(density, cell);
+	});
+
+	m_occupiedCount = 0;
+	for (float occupied : m_occupancy)
+		m_occupiedCount += occupied > 0.0f;
+	m_lastUpdated = cells;
+	m_lastUpdateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int MacrocellGrid::Update(const float* density, const XMINT3& resolution, ThreadPool* pool)
+{
+	if (m_previous.empty() || resolution.x != m_resolution.x || resolution.y != m_resolution.y || resolution.z != m_resolution.z)
+	{
+		Build(density, resolution, pool);
+		return m_lastUpdated;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int cells = int(m_maximum.size());
+	std::vector<uint8_t> updated(cells, 0);
+	ForEachSlice(pool, cells, [&](int begin, int end)
+	{
+		for (int cell = begin; cell < end; cell++)
+		{
+			if (!CellChanged(density, cell))
+				continue;
+			UpdateCell(density, cell);
+			updated[cell] = 1;
+		}
+	});
+	std::copy(density, density + m_previous.size(), m_previous.begin());
+
+	m_lastUpdated = 0;
+	m_occupiedCount = 0;
+	for (int cell = 0; cell < cells; cell++)
+	{
+		m_lastUpdated += updated[cell];
+		m_occupiedCount += m_occupancy[cell] > 0.0f;
+	}
+	m_lastUpdateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return m_lastUpdated;
+}
+
+void MacrocellGrid::SampleRange(int cell, int& x0, int& x1, int& y0, int& y1, int& z0, int& z1) const
+{
+	int cx = cell % m_cellCount.x, cy = (cell / m_cellCount.x) % m_cellCount.y, cz = cell / (m_cellCount.x * m_cellCount.y);
+
+	// positions in [c * size, (c + 1) * size) interpolate interior samples c * size to (c + 1) * size, clamped
+	// to the interior; the ghost layer shifts them by one
+	x0 = cx * kCellSize + 1;
+	x1 = std::min((cx + 1) * kCellSize, m_interior.x - 1) + 1;
+	y0 = cy * kCellSize + 1;
+	y1 = std::min((cy + 1) * kCellSize, m_interior.y - 1) + 1;
+	z0 = cz * kCellSize + 1;
+	z1 = std::min((cz + 1) * kCellSize, m_interior.z - 1) + 1;
+}
+
+void MacrocellGrid::UpdateCell(const float* density, int cell)
+{
+	int x0, x1, y0, y1, z0, z1;
+	SampleRange(cell, x0, x1, y0, y1, z0, z1);
+
+	float lowest = std::numeric_limits<float>::max(), highest = -std::numeric_limits<float>::max(), sum = 0.0f;
+	for (int z = z0; z <= z1; z++)
+	{
+		for (int y = y0; y <= y1; y++)
+		{
+			const float* row = density + SampleIndex(0, y, z);
+			for (int x = x0; x <= x1; x++)
+			{
+				lowest = std::min(lowest, row[x]);
+				highest = std::max(highest, row[x]);
+				sum += row[x];
+			}
+		}
+	}
+	m_minimum[cell] = lowest;
+	m_maximum[cell] = highest;
+	m_mean[cell] = sum / float((x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1));
+	m_occupancy[cell] = highest > 0.0f ? 1.0f : 0.0f;
+}
+
+bool MacrocellGrid::CellChanged(const float* density, int cell) const
+{
+	int x0, x1, y0, y1, z0, z1;
+	SampleRange(cell, x0, x1, y0, y1, z0, z1);
+
+	size_t rowBytes = sizeof(float) * (x1 - x0 + 1);
+	for (int z = z0; z <= z1; z++)
+	{
+		for (int y = y0; y <= y1; y++)
+		{
+			size_t row = SampleIndex(x0, y, z);
+			if (std::memcmp(density + row, m_previous.data() + row, rowBytes) != 0)
+				return true;
+		}
+	}
+	return false;
+}
+
+int MacrocellGrid::CellIndexAt(float x, float y, float z) const
+{
+	int cx = std::min(std::max(int(std::floor(x / kCellSize)), 0), m_cellCount.x - 1);
+	int cy = std::min(std::max(int(std::floor(y / kCellSize)), 0), m_cellCount.y - 1);
+	int cz = std::min(std::max(int(std::floor(z / kCellSize)), 0), m_cellCount.z - 1);
+	return CellIndex(cx, cy, cz);
+}
+
+float MacrocellGrid::SkipEmpty(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const
+{
+	int cell = CellIndexAt(origin.x, origin.y, origin.z);
+	if (m_occupancy[cell] > 0.0f)
+		return 0.0f;
+
+	const float o[3] = { origin.x, origin.y, origin.z };
+	const float d[3] = { direction.x, direction.y, direction.z };
+	const int count[3] = { m_cellCount.x, m_cellCount.y, m_cellCount.z };
+	int c[3] = { cell % m_cellCount.x, (cell / m_cellCount.x) % m_cellCount.y, cell / (m_cellCount.x * m_cellCount.y) };
+
+	// distance to the next macrocell boundary on each axis and between boundaries
+	int step[3];
+	float next[3], delta[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (d[axis] > 0.0f)
+		{
+			step[axis] = 1;
+			next[axis] = ((c[axis] + 1) * kCellSize - o[axis]) / d[axis];
+			delta[axis] = kCellSize / d[axis];
+		}
+		else if (d[axis] < 0.0f)
+		{
+			step[axis] = -1;
+			next[axis] = (c[axis] * kCellSize - o[axis]) / d[axis];
+			delta[axis] = -kCellSize / d[axis];
+		}
+		else
+		{
+			step[axis] = 0;
+			next[axis] = delta[axis] = std::numeric_limits<float>::max();
+		}
+	}
+
+	for (;;)
+	{
+		int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+		float t = std::max(next[axis], 0.0f);
+		if (t >= maxDistance)
+			return maxDistance;
+
+		// leaving the grid means leaving the volume, where nothing is sampled
+		c[axis] += step[axis];
+		if (c[axis] < 0 || c[axis] >= count[axis])
+			return maxDistance;
+		if (m_occupancy[CellIndex(c[0], c[1], c[2])] > 0.0f)
+			return t;
+		next[axis] += delta[axis];
+	}
+}
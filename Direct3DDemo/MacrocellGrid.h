@@ -0,0 +1,72 @@
+#pragma once
+// MacrocellGrid
+// Coarse min/max grid over a density volume with one ghost layer per face, for skipping empty space in ray
+// marches. Every macrocell covers kCellSize^3 voxels, one advection brick of the fluid, and keeps the lowest
+// and highest sample that trilinear interpolation reads anywhere inside it, so a macrocell whose maximum is
+// not positive interpolates to zero everywhere, and their mean. Positions are in voxel coordinates: 0 to the interior
+// resolution across the volume, the space volume_ps.hlsl's eval_density interpolates in.
+// Update() keeps a copy of the samples and only recomputes the macrocells whose samples changed.
+
+#include <DirectXMath.h>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+class MacrocellGrid
+{
+public:
+	static constexpr int kCellSize = 4;
+
+	MacrocellGrid();
+
+	// density holds resolution samples, x fastest, the outer layer on every face being ghost cells; pool may be null
+	void Build(const float* density, const XMINT3& resolution, ThreadPool* pool);
+	// recomputes the macrocells whose samples differ from the previous call, falls back to Build when the layout
+	// changed; returns the number of macrocells recomputed
+	int Update(const float* density, const XMINT3& resolution, ThreadPool* pool);
+	bool IsEmpty() const { return m_maximum.empty(); };
+
+	XMINT3 GetCellCount() const { return m_cellCount; };
+	int GetOccupiedCount() const { return m_occupiedCount; };
+	int GetLastUpdatedCount() const { return m_lastUpdated; };
+	double GetLastUpdateTime() const { return m_lastUpdateTime; }; // ms
+
+	float GetMinimum(int x, int y, int z) const { return m_minimum[CellIndex(x, y, z)]; };
+	float GetMaximum(int x, int y, int z) const { return m_maximum[CellIndex(x, y, z)]; };
+	// 1 for macrocells with density, 0 for empty ones, laid out like CellIndexAt for gathers
+	const std::vector<float>& GetOccupancy() const { return m_occupancy; };
+	// the mean of the samples of each macrocell, laid out like GetOccupancy: the density at a 64th of its size
+	const std::vector<float>& GetMeans() const { return m_mean; };
+
+	// macrocell of a voxel position, clamped to the grid like the interpolation clamps its samples
+	int CellIndexAt(float x, float y, float z) const;
+	bool IsOccupiedAt(float x, float y, float z) const { return m_occupancy[CellIndexAt(x, y, z)] > 0.0f; };
+
+	// distance along the ray (direction in voxel units per unit of distance) to the first occupied macrocell,
+	// walking the grid with a 3D DDA; 0 when the origin's macrocell is occupied, maxDistance when none is
+	// reached before it
+	float SkipEmpty(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const;
+
+private:
+	void UpdateCell(const float* density, int cell);
+	bool CellChanged(const float* density, int cell) const;
+	void SampleRange(int cell, int& x0, int& x1, int& y0, int& y1, int& z0, int& z1) const;
+
+	int CellIndex(int x, int y, int z) const { return (z * m_cellCount.y + y) * m_cellCount.x + x; };
+	size_t SampleIndex(int x, int y, int z) const { return (size_t(z) * m_resolution.y + y) * m_resolution.x + x; };
+
+	XMINT3 m_resolution;
+	XMINT3 m_interior;
+	XMINT3 m_cellCount;
+
+	std::vector<float> m_minimum, m_maximum;
+	std::vector<float> m_mean;
+	std::vector<float> m_occupancy;
+	std::vector<float> m_previous;
+
+	int m_occupiedCount = 0;
+	int m_lastUpdated = 0;
+	double m_lastUpdateTime = 0.0;
+};
@@ -0,0 +1,483 @@
+#include "pch.h"
+#include "MarchingCubes.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+namespace
+{
+	// corner c sits at (c & 1, (c >> 1) & 1, (c >> 2) & 1); edge e runs along axis e / 4 from its origin corner
+	const int kEdgeOrigins[12] = { 0, 2, 4, 6, 0, 1, 4, 5, 0, 1, 2, 3 };
+
+	int EdgeBetween(int a, int b)
+	{
+		int origin = std::min(a, b);
+		int axis = (a ^ b) == 1 ? 0 : ((a ^ b) == 2 ? 1 : 2);
+		for (int k = 0; k < 4; k++)
+		{
+			if (kEdgeOrigins[axis * 4 + k] == origin)
+				return axis * 4 + k;
+		}
+		return -1;
+	}
+
+	struct CubeCase
+	{
+		uint16_t edgeMask;
+		uint8_t triangleCount;
+		uint8_t edges[3 * 12];
+	};
+
+	// traces the contour of every case over the six faces. Walking a face counter-clockwise seen from outside,
+	// each crossing from outside to inside is joined to the next crossing, which leaves every inside corner
+	// cut off on its own on ambiguous faces; the loops come out counter-clockwise around the outward normal
+	struct CaseTable
+	{
+		CubeCase cases[256];
+
+		CaseTable()
+		{
+			for (int mask = 0; mask < 256; mask++)
+			{
+				CubeCase& cube = cases[mask];
+				cube.edgeMask = 0;
+				cube.triangleCount = 0;
+
+				int next[12];
+				std::fill(next, next + 12, -1);
+				for (int axis = 0; axis < 3; axis++)
+				{
+					int u = (axis + 1) % 3, v = (axis + 2) % 3;
+					for (int side = 0; side < 2; side++)
+					{
+						const int order[2][4][2] = { { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 0 } }, { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } } };
+						int corners[4];
+						for (int i = 0; i < 4; i++)
+							corners[i] = (side << axis) | (order[side][i][0] << u) | (order[side][i][1] << v);
+
+						int crossings[4], entering[4], count = 0;
+						for (int i = 0; i < 4; i++)
+						{
+							int a = corners[i], b = corners[(i + 1) % 4];
+							bool insideA = (mask >> a) & 1, insideB = (mask >> b) & 1;
+							if (insideA == insideB)
+								continue;
+							crossings[count] = EdgeBetween(a, b);
+							entering[count] = insideB;
+							count++;
+						}
+						for (int i = 0; i < count; i++)
+						{
+							if (entering[i])
+								next[crossings[i]] = crossings[(i + 1) % count];
+						}
+					}
+				}
+
+				bool visited[12] = {};
+				for (int start = 0; start < 12; start++)
+				{
+					if (next[start] < 0 || visited[start])
+						continue;
+
+					int loop[12], length = 0;
+					for (int edge = start; !visited[edge]; edge = next[edge])
+					{
+						visited[edge] = true;
+						loop[length++] = edge;
+						cube.edgeMask |= uint16_t(1 << edge);
+					}
+					for (int i = 1; i + 1 < length; i++)
+					{
+						uint8_t* triangle = cube.edges + 3 * cube.triangleCount++;
+						triangle[0] = uint8_t(loop[0]);
+						triangle[1] = uint8_t(loop[i]);
+						triangle[2] = uint8_t(loop[i + 1]);
+					}
+				}
+			}
+		}
+	};
+
+	const CaseTable& GetCaseTable()
+	{
+		static const CaseTable table;
+		return table;
+	}
+
+	uint32_t HashEdge(uint32_t key)
+	{
+		uint32_t h = key * 0x9E3779B1u;
+		return h ^ (h >> 16);
+	}
+}
+
+MarchingCubes::MarchingCubes() :
+	m_resolution(0, 0, 0),
+	m_cellCount(0, 0, 0),
+	m_brickCount(0, 0, 0)
+{
+}
+
+void MarchingCubes::SetIsoValue(float isoValue, bool insideBelow)
+{
+	// the bricks were classified against the old value, so the next Update has to redo all of them
+	if (isoValue != m_isoValue || insideBelow != m_insideBelow)
+		m_previous.clear();
+
+	m_isoValue = isoValue;
+	m_insideBelow = insideBelow;
+}
+
+void MarchingCubes::Reset(const XMINT3& resolution, int ghostCells)
+{
+	m_resolution = resolution;
+	m_ghostCells = ghostCells;
+	m_cellCount = XMINT3(std::max(0, resolution.x - 1 - 2 * ghostCells), std::max(0, resolution.y - 1 - 2 * ghostCells), std::max(0, resolution.z - 1 - 2 * ghostCells));
+	m_brickCount = XMINT3((m_cellCount.x + kBrickSize - 1) / kBrickSize, (m_cellCount.y + kBrickSize - 1) / kBrickSize, (m_cellCount.z + kBrickSize - 1) / kBrickSize);
+	// bricks are cleared as they are extracted, keeping their storage from the last extraction
+	m_bricks.resize(size_t(m_brickCount.x) * m_brickCount.y * m_brickCount.z);
+}
+
+void MarchingCubes::Extract(const float* values, const XMINT3& resolution, int ghostCells, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	Reset(resolution, ghostCells);
+
+	int brickCount = int(m_bricks.size());
+	ForEachSlice(pool, brickCount, [&](int begin, int end)
+	{
+		for (int brick = begin; brick < end; brick++)
+			ExtractBrick(values, brick, m_bricks[brick]);
+	});
+	m_previous.assign(values, values + SampleIndex(0, 0, resolution.z));
+
+	m_stats.bricksExtracted = brickCount;
+	m_stats.trianglesExtracted = 0;
+	for (const Brick& brick : m_bricks)
+		m_stats.trianglesExtracted += brick.indices.size() / 3;
+	m_stats.extractTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	Weld();
+}
+
+void MarchingCubes::Update(const float* values, const XMINT3& resolution, int ghostCells, ThreadPool* pool)
+{
+	if (m_previous.empty() || resolution.x != m_resolution.x || resolution.y != m_resolution.y || resolution.z != m_resolution.z || ghostCells != m_ghostCells)
+	{
+		Extract(values, resolution, ghostCells, pool);
+		return;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int brickCount = int(m_bricks.size());
+	std::vector<uint8_t> extracted(brickCount, 0);
+	ForEachSlice(pool, brickCount, [&](int begin, int end)
+	{
+		for (int brick = begin; brick < end; brick++)
+		{
+			if (!BrickChanged(values, brick))
+				continue;
+			ExtractBrick(values, brick, m_bricks[brick]);
+			extracted[brick] = 1;
+		}
+	});
+	std::copy(values, values + m_previous.size(), m_previous.begin());
+
+	m_stats.bricksExtracted = 0;
+	m_stats.trianglesExtracted = 0;
+	for (int brick = 0; brick < brickCount; brick++)
+	{
+		if (!extracted[brick])
+			continue;
+		m_stats.bricksExtracted++;
+		m_stats.trianglesExtracted += m_bricks[brick].indices.size() / 3;
+	}
+	m_stats.extractTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// untouched bricks keep their triangles, but welding is cheap next to extraction so the mesh is rebuilt
+	if (m_stats.bricksExtracted > 0)
+		Weld();
+	else
+		m_stats.weldTime = 0.0;
+}
+
+bool MarchingCubes::BrickChanged(const float* values, int brick) const
+{
+	int bx = brick % m_brickCount.x, by = (brick / m_brickCount.x) % m_brickCount.y, bz = brick / (m_brickCount.x * m_brickCount.y);
+
+	// the cells read one sample past their far corner, the normals one more on either side
+	int x0 = std::max(0, m_ghostCells + bx * kBrickSize - 1), x1 = std::min(m_resolution.x - 1, m_ghostCells + std::min((bx + 1) * kBrickSize, m_cellCount.x) + 1);
+	int y0 = std::max(0, m_ghostCells + by * kBrickSize - 1), y1 = std::min(m_resolution.y - 1, m_ghostCells + std::min((by + 1) * kBrickSize, m_cellCount.y) + 1);
+	int z0 = std::max(0, m_ghostCells + bz * kBrickSize - 1), z1 = std::min(m_resolution.z - 1, m_ghostCells + std::min((bz + 1) * kBrickSize, m_cellCount.z) + 1);
+
+	size_t rowBytes = sizeof(float) * (x1 - x0 + 1);
+	for (int z = z0; z <= z1; z++)
+	{
+		for (int y = y0; y <= y1; y++)
+		{
+			size_t row = SampleIndex(x0, y, z);
+			if (std::memcmp(values + row, m_previous.data() + row, rowBytes) != 0)
+				return true;
+		}
+	}
+	return false;
+}
+
+XMFLOAT3 MarchingCubes::SampleGradient(const float* values, int x, int y, int z) const
+{
+	// central differences inside the interior, one-sided at its faces so the ghost layer is never read
+	int lo = m_ghostCells;
+	XMINT3 hi(m_resolution.x - 1 - m_ghostCells, m_resolution.y - 1 - m_ghostCells, m_resolution.z - 1 - m_ghostCells);
+
+	int xm = std::max(lo, x - 1), xp = std::min(hi.x, x + 1);
+	int ym = std::max(lo, y - 1), yp = std::min(hi.y, y + 1);
+	int zm = std::max(lo, z - 1), zp = std::min(hi.z, z + 1);
+
+	// per unit cube rather than per sample, so anisotropic grids get correct normals
+	XMFLOAT3 gradient;
+	gradient.x = xp > xm ? (values[SampleIndex(xp, y, z)] - values[SampleIndex(xm, y, z)]) / (xp - xm) * (m_resolution.x - 1) : 0.0f;
+	gradient.y = yp > ym ? (values[SampleIndex(x, yp, z)] - values[SampleIndex(x, ym, z)]) / (yp - ym) * (m_resolution.y - 1) : 0.0f;
+	gradient.z = zp > zm ? (values[SampleIndex(x, y, zp)] - values[SampleIndex(x, y, zm)]) / (zp - zm) * (m_resolution.z - 1) : 0.0f;
+	return gradient;
+}
+
+void MarchingCubes::ExtractBrick(const float* values, int brick, Brick& out) const
+{
+	const CaseTable& table = GetCaseTable();
+
+	out.vertices.clear();
+	out.edges.clear();
+	out.indices.clear();
+
+	int bx = brick % m_brickCount.x, by = (brick / m_brickCount.x) % m_brickCount.y, bz = brick / (m_brickCount.x * m_brickCount.y);
+	XMINT3 cellMin(m_ghostCells + bx * kBrickSize, m_ghostCells + by * kBrickSize, m_ghostCells + bz * kBrickSize);
+	XMINT3 cellEnd(m_ghostCells + std::min((bx + 1) * kBrickSize, m_cellCount.x), m_ghostCells + std::min((by + 1) * kBrickSize, m_cellCount.y), m_ghostCells + std::min((bz + 1) * kBrickSize, m_cellCount.z));
+
+	// brick-local weld table; edge origins span (kBrickSize + 1)^3 samples, three axes each
+	const int kLocalSlots = 512;
+	uint32_t localKeys[kLocalSlots], localVertices[kLocalSlots];
+	std::fill(localKeys, localKeys + kLocalSlots, 0u);
+
+	float isoValue = m_isoValue;
+	bool insideBelow = m_insideBelow;
+
+	// a brick whose samples all lie on one side of the iso value holds no surface; most of a cloud or a
+	// scene is like that, and this pass is much cheaper than classifying every cube
+	int insideCount = 0, sampleCount = 0;
+	for (int z = cellMin.z; z <= cellEnd.z; z++)
+	{
+		for (int y = cellMin.y; y <= cellEnd.y; y++)
+		{
+			const float* row = values + SampleIndex(0, y, z);
+			for (int x = cellMin.x; x <= cellEnd.x; x++)
+				insideCount += insideBelow ? row[x] < isoValue : row[x] > isoValue;
+			sampleCount += cellEnd.x - cellMin.x + 1;
+		}
+	}
+	if (insideCount == 0 || insideCount == sampleCount)
+		return;
+
+	XMFLOAT3 scale(1.0f / (m_resolution.x - 1), 1.0f / (m_resolution.y - 1), 1.0f / (m_resolution.z - 1));
+	float outward = insideBelow ? 1.0f : -1.0f;
+
+	for (int z = cellMin.z; z < cellEnd.z; z++)
+	{
+		for (int y = cellMin.y; y < cellEnd.y; y++)
+		{
+			// the four sample rows around the cells of this row, corner c reads rows[c >> 1]
+			const float* rows[4] = { values + SampleIndex(0, y, z), values + SampleIndex(0, y + 1, z), values + SampleIndex(0, y, z + 1), values + SampleIndex(0, y + 1, z + 1) };
+
+			for (int x = cellMin.x; x < cellEnd.x; x++)
+			{
+				float corners[8];
+				int mask = 0;
+				for (int c = 0; c < 8; c++)
+				{
+					corners[c] = rows[c >> 1][x + (c & 1)];
+					bool inside = insideBelow ? corners[c] < isoValue : corners[c] > isoValue;
+					mask |= int(inside) << c;
+				}
+
+				const CubeCase& cube = table.cases[mask];
+				if (cube.triangleCount == 0)
+					continue;
+
+				uint32_t cubeVertices[12];
+				for (int edge = 0; edge < 12; edge++)
+				{
+					if (!(cube.edgeMask & (1 << edge)))
+						continue;
+
+					int axis = edge / 4, origin = kEdgeOrigins[edge];
+					int sx = x + (origin & 1), sy = y + ((origin >> 1) & 1), sz = z + ((origin >> 2) & 1);
+					uint32_t key = uint32_t(SampleIndex(sx, sy, sz) * 3 + axis);
+
+					uint32_t slot = HashEdge(key) & (kLocalSlots - 1);
+					while (localKeys[slot] != 0 && localKeys[slot] != key + 1)
+						slot = (slot + 1) & (kLocalSlots - 1);
+					if (localKeys[slot] == 0)
+					{
+						int ex = sx + (axis == 0), ey = sy + (axis == 1), ez = sz + (axis == 2);
+						float v0 = corners[origin], v1 = corners[origin | (1 << axis)];
+						float t = std::min(std::max((isoValue - v0) / (v1 - v0), 0.0f), 1.0f);
+
+						XMFLOAT3 g0 = SampleGradient(values, sx, sy, sz);
+						XMFLOAT3 g1 = SampleGradient(values, ex, ey, ez);
+						XMFLOAT3 normal(g0.x + (g1.x - g0.x) * t, g0.y + (g1.y - g0.y) * t, g0.z + (g1.z - g0.z) * t);
+						float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+						float normalScale = length > 0.0f ? outward / length : 0.0f;
+
+						MarchingCubesVertex vertex;
+						vertex.position = XMFLOAT3((sx + t * (axis == 0)) * scale.x, (sy + t * (axis == 1)) * scale.y, (sz + t * (axis == 2)) * scale.z);
+						vertex.normal = XMFLOAT3(normal.x * normalScale, normal.y * normalScale, normal.z * normalScale);
+
+						localKeys[slot] = key + 1;
+						localVertices[slot] = uint32_t(out.vertices.size());
+						out.vertices.push_back(vertex);
+						out.edges.push_back(key);
+					}
+					cubeVertices[edge] = localVertices[slot];
+				}
+
+				for (int i = 0; i < 3 * cube.triangleCount; i++)
+					out.indices.push_back(cubeVertices[cube.edges[i]]);
+			}
+		}
+	}
+}
+
+void MarchingCubes::Weld()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	size_t vertexCount = 0, indexCount = 0;
+	for (const Brick& brick : m_bricks)
+	{
+		vertexCount += brick.vertices.size();
+		indexCount += brick.indices.size();
+	}
+
+	// only edges on brick faces are shared, so the welded mesh is at most vertexCount long
+	uint32_t capacity = 16;
+	while (capacity < 2 * vertexCount)
+		capacity *= 2;
+	m_weldTable.assign(2 * size_t(capacity), 0);
+
+	m_vertices.clear();
+	m_vertices.reserve(vertexCount);
+	m_indices.clear();
+	m_indices.reserve(indexCount);
+
+	std::vector<uint32_t> remap;
+	for (const Brick& brick : m_bricks)
+	{
+		remap.resize(brick.vertices.size());
+		for (size_t i = 0; i < brick.vertices.size(); i++)
+		{
+			uint32_t key = brick.edges[i];
+			uint32_t slot = HashEdge(key) & (capacity - 1);
+			while (m_weldTable[2 * slot] != 0 && m_weldTable[2 * slot] != key + 1)
+				slot = (slot + 1) & (capacity - 1);
+
+			if (m_weldTable[2 * slot] == 0)
+			{
+				m_weldTable[2 * slot] = key + 1;
+				m_weldTable[2 * slot + 1] = uint32_t(m_vertices.size());
+				m_vertices.push_back(brick.vertices[i]);
+			}
+			remap[i] = m_weldTable[2 * slot + 1];
+		}
+
+		for (uint32_t index : brick.indices)
+			m_indices.push_back(remap[index]);
+	}
+
+	m_stats.weldTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	m_stats.bricksTotal = int(m_bricks.size());
+	m_stats.vertexCount = m_vertices.size();
+	m_stats.triangleCount = m_indices.size() / 3;
+	m_stats.memoryBytes = GetMemoryUsage();
+}
+
+size_t MarchingCubes::GetMemoryUsage() const
+{
+	size_t bytes = m_vertices.capacity() * sizeof(MarchingCubesVertex) + m_indices.capacity() * sizeof(uint32_t);
+	bytes += m_weldTable.capacity() * sizeof(uint32_t) + m_previous.capacity() * sizeof(float);
+	bytes += m_bricks.capacity() * sizeof(Brick);
+	for (const Brick& brick : m_bricks)
+		bytes += brick.vertices.capacity() * sizeof(MarchingCubesVertex) + (brick.edges.capacity() + brick.indices.capacity()) * sizeof(uint32_t);
+	return bytes;
+}
+
+void MarchingCubes::WriteBenchmark(const std::string& filename, const float* values, const XMINT3& resolution, int ghostCells, float isoValue, bool insideBelow, ThreadPool* pool)
+{
+	std::ofstream file(filename);
+	if (!file)
+		return;
+
+	file << "mode,threads,bricks_extracted,bricks_total,triangles_extracted,triangles,vertices,extract_ms,weld_ms,triangles_per_second,memory_bytes,bytes_per_million_triangles\n";
+
+	auto write = [&](const char* mode, int threads, const MarchingCubesStats& stats, double extractTime, double weldTime, double trianglesPerSecond)
+	{
+		file << mode << "," << threads << "," << stats.bricksExtracted << "," << stats.bricksTotal << "," << stats.trianglesExtracted << ","
+			<< stats.triangleCount << "," << stats.vertexCount << "," << extractTime << "," << weldTime << "," << trianglesPerSecond << ","
+			<< stats.memoryBytes << "," << stats.BytesPerMillionTriangles() << "\n";
+	};
+
+	// averages over a few runs; throughput is taken over the summed times so one slow run cannot skew it
+	const int runs = 8;
+	auto measure = [&](const char* mode, int threads, const std::function<void(MarchingCubes&, int)>& run, MarchingCubes& mesh)
+	{
+		double extractTime = 0.0, weldTime = 0.0;
+		size_t triangles = 0;
+		for (int i = 0; i < runs; i++)
+		{
+			run(mesh, i);
+			extractTime += mesh.GetStats().extractTime;
+			weldTime += mesh.GetStats().weldTime;
+			triangles += mesh.GetStats().trianglesExtracted;
+		}
+		double total = extractTime + weldTime;
+		write(mode, threads, mesh.GetStats(), extractTime / runs, weldTime / runs, total > 0.0 ? triangles * 1000.0 / total : 0.0);
+	};
+
+	MarchingCubes serial;
+	serial.SetIsoValue(isoValue, insideBelow);
+	measure("full", 1, [&](MarchingCubes& mesh, int) { mesh.Extract(values, resolution, ghostCells, nullptr); }, serial);
+
+	if (pool)
+	{
+		MarchingCubes parallel;
+		parallel.SetIsoValue(isoValue, insideBelow);
+		measure("full", pool->GetThreadCount(), [&](MarchingCubes& mesh, int) { mesh.Extract(values, resolution, ghostCells, pool); }, parallel);
+	}
+
+	// incremental: a blob the size of a couple of bricks is mirrored across the iso value at the centre of the
+	// grid on every other run, so each run re-extracts the bricks around it
+	size_t sampleCount = size_t(resolution.x) * resolution.y * resolution.z;
+	std::vector<float> original(values, values + sampleCount), edited = original;
+	int radius = kBrickSize;
+	XMINT3 centre(resolution.x / 2, resolution.y / 2, resolution.z / 2);
+	for (int z = std::max(ghostCells, centre.z - radius); z <= std::min(resolution.z - 1 - ghostCells, centre.z + radius); z++)
+		for (int y = std::max(ghostCells, centre.y - radius); y <= std::min(resolution.y - 1 - ghostCells, centre.y + radius); y++)
+			for (int x = std::max(ghostCells, centre.x - radius); x <= std::min(resolution.x - 1 - ghostCells, centre.x + radius); x++)
+			{
+				float d = std::sqrt(float((x - centre.x) * (x - centre.x) + (y - centre.y) * (y - centre.y) + (z - centre.z) * (z - centre.z)));
+				float weight = std::max(0.0f, 1.0f - d / radius);
+				float& value = edited[(size_t(z) * resolution.y + y) * resolution.x + x];
+				value += 2.0f * weight * (isoValue - value);
+			}
+
+	MarchingCubes incremental;
+	incremental.SetIsoValue(isoValue, insideBelow);
+	incremental.Extract(values, resolution, ghostCells, pool);
+	int threads = pool ? pool->GetThreadCount() : 1;
+	measure("incremental_local", threads, [&](MarchingCubes& mesh, int run) { mesh.Update((run % 2 == 0 ? edited : original).data(), resolution, ghostCells, pool); }, incremental);
+	measure("incremental_unchanged", threads, [&](MarchingCubes& mesh, int) { mesh.Update(original.data(), resolution, ghostCells, pool); }, incremental);
+}
@@ -0,0 +1,98 @@
+#pragma once
+// MarchingCubes
+// Isosurface extraction over a scalar grid such as the fluid density or the scene SDF, both of which carry a
+// layer of ghost cells on every face that is skipped. The cells are split into 4^3 bricks that are extracted
+// in parallel; every brick keeps its own vertices and triangles, so Update() only redoes the bricks whose
+// samples changed since the last call. Vertices sit on grid edges and are welded through a hash keyed on the
+// edge (sample index * 3 + axis), first within the brick and then across bricks when the mesh is assembled.
+// The triangulation per cube case is derived at start-up by tracing the contour over the six faces, with
+// ambiguous faces always separating the inside corners, so neighbouring cubes agree and the mesh is watertight.
+
+#include "pch.h"
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+// position in the grid's unit cube (sample i maps to i / (resolution - 1), like SDFField), outward normal
+struct MarchingCubesVertex
+{
+	XMFLOAT3 position;
+	XMFLOAT3 normal;
+};
+
+struct MarchingCubesStats
+{
+	int bricksExtracted = 0, bricksTotal = 0;
+	size_t trianglesExtracted = 0; // triangles produced by the extracted bricks
+	size_t vertexCount = 0, triangleCount = 0; // welded mesh
+	double extractTime = 0.0, weldTime = 0.0; // ms
+	size_t memoryBytes = 0;
+
+	double TrianglesPerSecond() const { return extractTime + weldTime > 0.0 ? trianglesExtracted * 1000.0 / (extractTime + weldTime) : 0.0; };
+	double BytesPerMillionTriangles() const { return triangleCount > 0 ? memoryBytes * 1e6 / triangleCount : 0.0; };
+};
+
+class MarchingCubes
+{
+public:
+	static constexpr int kBrickSize = 4;
+
+	MarchingCubes();
+
+	// insideBelow: false for densities (the inside is above the iso value), true for distance fields
+	void SetIsoValue(float isoValue, bool insideBelow);
+	float GetIsoValue() const { return m_isoValue; };
+
+	// values hold resolution samples, x fastest; ghostCells sample layers on every face are left out.
+	// pool may be null, in which case the extraction runs on the calling thread
+	void Extract(const float* values, const XMINT3& resolution, int ghostCells, ThreadPool* pool);
+	// re-extracts the bricks whose samples (or the neighbours their normals read) differ from the previous call,
+	// falls back to Extract when nothing was extracted yet or the layout changed
+	void Update(const float* values, const XMINT3& resolution, int ghostCells, ThreadPool* pool);
+
+	const std::vector<MarchingCubesVertex>& GetVertices() const { return m_vertices; };
+	const std::vector<uint32_t>& GetIndices() const { return m_indices; };
+	const MarchingCubesStats& GetStats() const { return m_stats; };
+	bool IsEmpty() const { return m_indices.empty(); };
+
+	// bytes held by the welded mesh, the bricks and the copy of the samples kept for Update
+	size_t GetMemoryUsage() const;
+
+	// times serial, parallel and incremental extraction of the grid, writes a CSV file
+	static void WriteBenchmark(const std::string& filename, const float* values, const XMINT3& resolution, int ghostCells, float isoValue, bool insideBelow, ThreadPool* pool);
+
+private:
+	struct Brick
+	{
+		std::vector<MarchingCubesVertex> vertices;
+		std::vector<uint32_t> edges; // edge key of every vertex
+		std::vector<uint32_t> indices; // into vertices
+	};
+
+	void Reset(const XMINT3& resolution, int ghostCells);
+	void ExtractBrick(const float* values, int brick, Brick& out) const;
+	bool BrickChanged(const float* values, int brick) const;
+	void Weld();
+	XMFLOAT3 SampleGradient(const float* values, int x, int y, int z) const;
+
+	size_t SampleIndex(int x, int y, int z) const { return (size_t(z) * m_resolution.y + y) * m_resolution.x + x; };
+
+	float m_isoValue = 0.5f;
+	bool m_insideBelow = false;
+
+	XMINT3 m_resolution;
+	int m_ghostCells = 0;
+	XMINT3 m_cellCount, m_brickCount;
+
+	std::vector<Brick> m_bricks;
+	std::vector<float> m_previous;
+
+	std::vector<MarchingCubesVertex> m_vertices;
+	std::vector<uint32_t> m_indices;
+	std::vector<uint32_t> m_weldTable; // open addressing, pairs of edge key + 1 and vertex index
+
+	MarchingCubesStats m_stats;
+};
@@ -0,0 +1,105 @@
+#include "pch.h"
+#include "MeshSDFObject.h"
+#include <chrono>
+
+using Microsoft::WRL::ComPtr;
+
+void MeshSDFObject::AddGeometry(const GeometricPrimitive::VertexCollection& vertices, const GeometricPrimitive::IndexCollection& indices)
+{
+	if (vertices.empty() || indices.empty())
+		return;
+
+	m_voxelizer.AddTriangles(&vertices.data()->position, sizeof(GeometricPrimitive::VertexType), indices.data(), indices.size());
+}
+
+void MeshSDFObject::AddModel(ID3D11Device* device, ID3D11DeviceContext* deviceContext, const Model& model)
+{
+	for (const auto& mesh : model.meshes)
+	{
+		for (const auto& part : mesh->meshParts)
+		{
+			if (part->primitiveType != D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+				continue;
+
+			// position offset from the vertex declaration, DirectXTK loaders put it first otherwise
+			size_t positionOffset = 0;
+			if (part->vbDecl)
+			{
+				for (const D3D11_INPUT_ELEMENT_DESC& element : *part->vbDecl)
+				{
+					if (strcmp(element.SemanticName, "SV_Position") == 0 || strcmp(element.SemanticName, "POSITION") == 0)
+						positionOffset = element.AlignedByteOffset;
+				}
+			}
+
+			std::vector<uint8_t> vertices = ReadBuffer(device, deviceContext, part->vertexBuffer.Get());
+			std::vector<uint8_t> indices = ReadBuffer(device, deviceContext, part->indexBuffer.Get());
+
+			const uint8_t* positions = vertices.data() + positionOffset;
+			if (part->indexFormat == DXGI_FORMAT_R32_UINT)
+				m_voxelizer.AddTriangles(positions, part->vertexStride, reinterpret_cast<const uint32_t*>(indices.data()) + part->startIndex, part->indexCount, part->vertexOffset);
+			else
+				m_voxelizer.AddTriangles(positions, part->vertexStride, reinterpret_cast<const uint16_t*>(indices.data()) + part->startIndex, part->indexCount, part->vertexOffset);
+		}
+	}
+}
+
+void MeshSDFObject::Build(ID3D11Device* device, int resolution, ThreadPool* threadPool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<float> sdf;
+	m_voxelizer.Voxelize(resolution, sdf, threadPool);
+	m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	D3D11_TEXTURE3D_DESC textureDesc;
+	textureDesc.Width = resolution;
+	textureDesc.Height = resolution;
+	textureDesc.Depth = resolution;
+	textureDesc.MipLevels = 1;
+	textureDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA initialData = {};
+	initialData.pSysMem = sdf.data();
+	initialData.SysMemPitch = resolution * sizeof(float);
+	initialData.SysMemSlicePitch = resolution * resolution * sizeof(float);
+	DX::ThrowIfFailed(device->CreateTexture3D(&textureDesc, &initialData, m_texture.ReleaseAndGetAddressOf()));
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = textureDesc.Format;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE3D;
+	srvDesc.Texture3D.MipLevels = 1;
+	srvDesc.Texture3D.MostDetailedMip = 0;
+	DX::ThrowIfFailed(device->CreateShaderResourceView(m_texture.Get(), &srvDesc, m_srv.ReleaseAndGetAddressOf()));
+}
+
+XMMATRIX MeshSDFObject::GetUnitTransform() const
+{
+	const XMFLOAT3& origin = m_voxelizer.GetGridOrigin();
+	float size = m_voxelizer.GetGridSize();
+	return XMMatrixScaling(size, size, size) * XMMatrixTranslation(origin.x, origin.y, origin.z);
+}
+
+std::vector<uint8_t> MeshSDFObject::ReadBuffer(ID3D11Device* device, ID3D11DeviceContext* deviceContext, ID3D11Buffer* buffer)
+{
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.MiscFlags = 0;
+
+	ComPtr<ID3D11Buffer> staging;
+	DX::ThrowIfFailed(device->CreateBuffer(&desc, nullptr, staging.GetAddressOf()));
+	deviceContext->CopyResource(staging.Get(), buffer);
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	DX::ThrowIfFailed(deviceContext->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped));
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(mapped.pData);
+	std::vector<uint8_t> bytes(data, data + desc.ByteWidth);
+	deviceContext->Unmap(staging.Get(), 0);
+	return bytes;
+}
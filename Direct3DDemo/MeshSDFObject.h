@@ -0,0 +1,37 @@
+#pragma once
+// MeshSDFObject
+// Voxelizes triangle meshes into a 3D texture that SDFEffect can compose into the scene.
+// Geometry comes from DirectXTK: GeometricPrimitive vertex and index collections, or the mesh parts of a
+// loaded Model, whose buffers are copied back from the GPU once at load time.
+// The texture covers a cube in mesh space; GetUnitTransform maps the unit cube onto it and
+// GetDistanceScale converts the stored distances to mesh units.
+
+#include "pch.h"
+#include "GeometricPrimitive.h"
+#include "Model.h"
+#include "MeshVoxelizer.h"
+
+class MeshSDFObject
+{
+public:
+	void AddGeometry(const GeometricPrimitive::VertexCollection& vertices, const GeometricPrimitive::IndexCollection& indices);
+	// triangle-list parts only; blocks on the GPU, so call it while loading
+	void AddModel(ID3D11Device* device, ID3D11DeviceContext* deviceContext, const Model& model);
+
+	void Build(ID3D11Device* device, int resolution, ThreadPool* threadPool);
+
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetSrv() const { return m_srv; };
+	XMMATRIX GetUnitTransform() const;
+	float GetDistanceScale() const { return m_voxelizer.GetGridSize(); };
+	size_t GetTriangleCount() const { return m_voxelizer.GetTriangleCount(); };
+	float GetBuildTime() const { return m_buildTime; };
+
+private:
+	static std::vector<uint8_t> ReadBuffer(ID3D11Device* device, ID3D11DeviceContext* deviceContext, ID3D11Buffer* buffer);
+
+	MeshVoxelizer m_voxelizer;
+	float m_buildTime = 0.0f;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> m_texture;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_srv;
+};
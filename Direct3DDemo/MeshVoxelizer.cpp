@@ -0,0 +1,369 @@
+#include "pch.h"
+#include "MeshVoxelizer.h"
+#include "ThreadPool.h"
+#include <functional>
+#include <limits>
+
+namespace
+{
+	const float kFloatMax = std::numeric_limits<float>::max();
+
+	XMFLOAT3 Sub(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+	float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	float Component(const XMFLOAT3& v, int axis) { return (&v.x)[axis]; }
+
+	// squared distance from p to the closest point of triangle abc
+	float PointTriangleDistanceSq(const XMFLOAT3& p, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+	{
+		XMFLOAT3 ab = Sub(b, a), ac = Sub(c, a), ap = Sub(p, a);
+		float d1 = Dot(ab, ap), d2 = Dot(ac, ap);
+
+		XMFLOAT3 closest;
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			closest = a;
+		else
+		{
+			XMFLOAT3 bp = Sub(p, b);
+			float d3 = Dot(ab, bp), d4 = Dot(ac, bp);
+			XMFLOAT3 cp = Sub(p, c);
+			float d5 = Dot(ab, cp), d6 = Dot(ac, cp);
+			float vc = d1 * d4 - d3 * d2, vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+
+			if (d3 >= 0.0f && d4 <= d3)
+				closest = b;
+			else if (d6 >= 0.0f && d5 <= d6)
+				closest = c;
+			else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			{
+				float t = d1 / (d1 - d3);
+				closest = XMFLOAT3(a.x + ab.x * t, a.y + ab.y * t, a.z + ab.z * t);
+			}
+			else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			{
+				float t = d2 / (d2 - d6);
+				closest = XMFLOAT3(a.x + ac.x * t, a.y + ac.y * t, a.z + ac.z * t);
+			}
+			else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			{
+				float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+				closest = XMFLOAT3(b.x + (c.x - b.x) * t, b.y + (c.y - b.y) * t, b.z + (c.z - b.z) * t);
+			}
+			else
+			{
+				float denominator = 1.0f / (va + vb + vc);
+				float v = vb * denominator, w = vc * denominator;
+				closest = XMFLOAT3(a.x + ab.x * v + ac.x * w, a.y + ab.y * v + ac.y * w, a.z + ab.z * v + ac.z * w);
+			}
+		}
+
+		XMFLOAT3 d = Sub(p, closest);
+		return Dot(d, d);
+	}
+}
+
+void MeshVoxelizer::Clear()
+{
+	m_triangles.clear();
+	m_nodes.clear();
+	m_order.clear();
+}
+
+void MeshVoxelizer::AddTriangles(const void* positions, size_t stride, const uint32_t* indices, size_t indexCount, int baseVertex)
+{
+	AddIndexedTriangles(positions, stride, indices, indexCount, baseVertex);
+}
+
+void MeshVoxelizer::AddTriangles(const void* positions, size_t stride, const uint16_t* indices, size_t indexCount, int baseVertex)
+{
+	AddIndexedTriangles(positions, stride, indices, indexCount, baseVertex);
+}
+
+template <typename Index>
+void MeshVoxelizer::AddIndexedTriangles(const void* positions, size_t stride, const Index* indices, size_t indexCount, int baseVertex)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(positions);
+	auto position = [&](Index index)
+	{
+		return *reinterpret_cast<const XMFLOAT3*>(bytes + (size_t(index) + baseVertex) * stride);
+	};
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+		m_triangles.push_back({ position(indices[i]), position(indices[i + 1]), position(indices[i + 2]) });
+}
+
+void MeshVoxelizer::Voxelize(int resolution, std::vector<float>& sdf, ThreadPool* pool)
+{
+	const int n = resolution;
+	const size_t cells = size_t(n) * n * n;
+	sdf.assign(cells, 1.0f);
+	if (m_triangles.empty() || n <= 0)
+		return;
+
+	// cube around the mesh, padded so the narrow band never touches the border
+	XMFLOAT3 lower(kFloatMax, kFloatMax, kFloatMax), upper(-kFloatMax, -kFloatMax, -kFloatMax);
+	for (const Triangle& triangle : m_triangles)
+	{
+		for (const XMFLOAT3* p : { &triangle.a, &triangle.b, &triangle.c })
+		{
+			lower = XMFLOAT3(std::min(lower.x, p->x), std::min(lower.y, p->y), std::min(lower.z, p->z));
+			upper = XMFLOAT3(std::max(upper.x, p->x), std::max(upper.y, p->y), std::max(upper.z, p->z));
+		}
+	}
+	float extent = std::max(upper.x - lower.x, std::max(upper.y - lower.y, upper.z - lower.z));
+	int padding = std::min(m_narrowBand + 1, std::max(0, n / 2 - 1));
+	m_gridSize = std::max(extent, 1e-6f) * n / float(n - 2 * padding);
+	m_gridOrigin = XMFLOAT3(
+		(lower.x + upper.x - m_gridSize) * 0.5f,
+		(lower.y + upper.y - m_gridSize) * 0.5f,
+		(lower.z + upper.z - m_gridSize) * 0.5f);
+
+	// everything below works in voxel units with voxel centres at integer coordinates
+	float toGrid = n / m_gridSize;
+	std::vector<Triangle> triangles(m_triangles.size());
+	for (size_t i = 0; i < m_triangles.size(); i++)
+	{
+		auto convert = [&](const XMFLOAT3& p)
+		{
+			return XMFLOAT3((p.x - m_gridOrigin.x) * toGrid - 0.5f, (p.y - m_gridOrigin.y) * toGrid - 0.5f, (p.z - m_gridOrigin.z) * toGrid - 0.5f);
+		};
+		triangles[i] = { convert(m_triangles[i].a), convert(m_triangles[i].b), convert(m_triangles[i].c) };
+	}
+
+	BuildBVH(triangles);
+
+	std::vector<int> closest(cells, -1);
+	std::vector<float> distanceSq(cells, kFloatMax);
+	auto index = [n](int x, int y, int z) { return (size_t(z) * n + y) * n + x; };
+
+	// narrow band: every triangle against the voxels within the band of its bounds, split by z slice
+	const int band = m_narrowBand;
+	std::vector<std::vector<int>> sliceTriangles(n);
+	for (int i = 0; i < int(triangles.size()); i++)
+	{
+		const Triangle& t = triangles[i];
+		int z0 = std::max(0, int(std::ceil(std::min(t.a.z, std::min(t.b.z, t.c.z)) - band)));
+		int z1 = std::min(n - 1, int(std::floor(std::max(t.a.z, std::max(t.b.z, t.c.z)) + band)));
+		for (int z = z0; z <= z1; z++)
+			sliceTriangles[z].push_back(i);
+	}
+
+	ForEachSlice(pool, n, [&](int zBegin, int zEnd)
+	{
+		for (int z = zBegin; z < zEnd; z++)
+		{
+			for (int i : sliceTriangles[z])
+			{
+				const Triangle& t = triangles[i];
+				int x0 = std::max(0, int(std::ceil(std::min(t.a.x, std::min(t.b.x, t.c.x)) - band)));
+				int x1 = std::min(n - 1, int(std::floor(std::max(t.a.x, std::max(t.b.x, t.c.x)) + band)));
+				int y0 = std::max(0, int(std::ceil(std::min(t.a.y, std::min(t.b.y, t.c.y)) - band)));
+				int y1 = std::min(n - 1, int(std::floor(std::max(t.a.y, std::max(t.b.y, t.c.y)) + band)));
+
+				for (int y = y0; y <= y1; y++)
+				{
+					for (int x = x0; x <= x1; x++)
+					{
+						size_t cell = index(x, y, z);
+						float d = PointTriangleDistanceSq(XMFLOAT3(float(x), float(y), float(z)), t.a, t.b, t.c);
+						if (d < distanceSq[cell])
+						{
+							distanceSq[cell] = d;
+							closest[cell] = i;
+						}
+					}
+				}
+			}
+		}
+	});
+
+	// outside the band, the closest triangle is carried forward and backward along x, then y, then z, twice
+	// over so that diagonal neighbours are reached as well; lines along one axis are independent of each other
+	for (int pass = 0; pass < 6; pass++)
+	{
+		int axis = pass % 3;
+		ForEachSlice(pool, n, [&](int begin, int end)
+		{
+			for (int a = begin; a < end; a++)
+			{
+				for (int b = 0; b < n; b++)
+				{
+					auto cellAt = [&](int s)
+					{
+						return axis == 0 ? index(s, b, a) : axis == 1 ? index(b, s, a) : index(b, a, s);
+					};
+					auto propagate = [&](int from, int to, int s)
+					{
+						int candidate = closest[from];
+						if (candidate < 0 || candidate == closest[to])
+							return;
+
+						XMFLOAT3 p = axis == 0 ? XMFLOAT3(float(s), float(b), float(a)) : axis == 1 ? XMFLOAT3(float(b), float(s), float(a)) : XMFLOAT3(float(b), float(a), float(s));
+						const Triangle& t = triangles[candidate];
+						float d = PointTriangleDistanceSq(p, t.a, t.b, t.c);
+						if (d < distanceSq[to])
+						{
+							distanceSq[to] = d;
+							closest[to] = candidate;
+						}
+					};
+
+					for (int s = 1; s < n; s++)
+						propagate(cellAt(s - 1), cellAt(s), s);
+					for (int s = n - 2; s >= 0; s--)
+						propagate(cellAt(s + 1), cellAt(s), s);
+				}
+			}
+		});
+	}
+
+	// sign: parity of the crossings along rows of each axis, two of three votes make a voxel inside
+	std::vector<uint8_t> insideVotes(cells, 0);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		ForEachSlice(pool, n, [&](int begin, int end)
+		{
+			std::vector<float> crossings;
+			for (int a = begin; a < end; a++)
+			{
+				for (int b = 0; b < n; b++)
+				{
+					// rays are nudged off the voxel centres so they rarely pass exactly through edges or vertices
+					RayCrossings(triangles, axis, b + 1.3e-4f, a + 2.7e-4f, crossings);
+					std::sort(crossings.begin(), crossings.end());
+
+					size_t next = 0;
+					bool inside = false;
+					for (int s = 0; s < n; s++)
+					{
+						while (next < crossings.size() && crossings[next] < float(s))
+						{
+							inside = !inside;
+							next++;
+						}
+						if (inside)
+						{
+							size_t cell = axis == 0 ? index(s, b, a) : axis == 1 ? index(a, s, b) : index(b, a, s);
+							insideVotes[cell]++;
+						}
+					}
+				}
+			}
+		});
+	}
+
+	ForEachSlice(pool, n, [&](int zBegin, int zEnd)
+	{
+		for (size_t cell = size_t(zBegin) * n * n; cell < size_t(zEnd) * n * n; cell++)
+		{
+			float distance = closest[cell] >= 0 ? std::sqrt(distanceSq[cell]) / n : 1.0f;
+			sdf[cell] = insideVotes[cell] >= 2 ? -distance : distance;
+		}
+	});
+}
+
+void MeshVoxelizer::BuildBVH(const std::vector<Triangle>& triangles)
+{
+	m_nodes.clear();
+	m_order.resize(triangles.size());
+	for (int i = 0; i < int(triangles.size()); i++)
+		m_order[i] = i;
+
+	if (!triangles.empty())
+		BuildNode(triangles, 0, int(triangles.size()));
+}
+
+int MeshVoxelizer::BuildNode(const std::vector<Triangle>& triangles, int first, int count)
+{
+	int index = int(m_nodes.size());
+	m_nodes.push_back({});
+
+	XMFLOAT3 lower(kFloatMax, kFloatMax, kFloatMax), upper(-kFloatMax, -kFloatMax, -kFloatMax);
+	for (int i = first; i < first + count; i++)
+	{
+		const Triangle& t = triangles[m_order[i]];
+		for (const XMFLOAT3* p : { &t.a, &t.b, &t.c })
+		{
+			lower = XMFLOAT3(std::min(lower.x, p->x), std::min(lower.y, p->y), std::min(lower.z, p->z));
+			upper = XMFLOAT3(std::max(upper.x, p->x), std::max(upper.y, p->y), std::max(upper.z, p->z));
+		}
+	}
+	m_nodes[index].min = lower;
+	m_nodes[index].max = upper;
+	m_nodes[index].first = first;
+	m_nodes[index].count = count;
+	m_nodes[index].left = m_nodes[index].right = -1;
+
+	const int leafSize = 4;
+	if (count <= leafSize)
+		return index;
+
+	XMFLOAT3 extent = Sub(upper, lower);
+	int axis = 0;
+	if (extent.y > Component(extent, axis))
+		axis = 1;
+	if (extent.z > Component(extent, axis))
+		axis = 2;
+
+	// split at the median centroid of the longest axis
+	int half = count / 2;
+	std::nth_element(m_order.begin() + first, m_order.begin() + first + half, m_order.begin() + first + count, [&](int a, int b)
+	{
+		const Triangle& ta = triangles[a];
+		const Triangle& tb = triangles[b];
+		return Component(ta.a, axis) + Component(ta.b, axis) + Component(ta.c, axis) < Component(tb.a, axis) + Component(tb.b, axis) + Component(tb.c, axis);
+	});
+
+	int left = BuildNode(triangles, first, half);
+	int right = BuildNode(triangles, first + half, count - half);
+	m_nodes[index].left = left;
+	m_nodes[index].right = right;
+	return index;
+}
+
+void MeshVoxelizer::RayCrossings(const std::vector<Triangle>& triangles, int axis, float u, float v, std::vector<float>& crossings) const
+{
+	crossings.clear();
+	if (m_nodes.empty())
+		return;
+
+	// the ray runs along axis, u and v are its coordinates on the next two axes
+	int axisU = (axis + 1) % 3, axisV = (axis + 2) % 3;
+
+	int stack[64];
+	int size = 0;
+	stack[size++] = 0;
+	while (size > 0)
+	{
+		const Node& node = m_nodes[stack[--size]];
+		if (u < Component(node.min, axisU) || u > Component(node.max, axisU) || v < Component(node.min, axisV) || v > Component(node.max, axisV))
+			continue;
+
+		if (node.left >= 0)
+		{
+			stack[size++] = node.left;
+			stack[size++] = node.right;
+			continue;
+		}
+
+		for (int i = node.first; i < node.first + node.count; i++)
+		{
+			const Triangle& t = triangles[m_order[i]];
+			float au = Component(t.a, axisU) - u, av = Component(t.a, axisV) - v;
+			float bu = Component(t.b, axisU) - u, bv = Component(t.b, axisV) - v;
+			float cu = Component(t.c, axisU) - u, cv = Component(t.c, axisV) - v;
+
+			// barycentric weights of the ray in the triangle's projection
+			float wa = bu * cv - bv * cu;
+			float wb = cu * av - cv * au;
+			float wc = au * bv - av * bu;
+			if ((wa < 0.0f || wb < 0.0f || wc < 0.0f) && (wa > 0.0f || wb > 0.0f || wc > 0.0f))
+				continue;
+
+			float sum = wa + wb + wc;
+			if (sum == 0.0f)
+				continue;
+
+			crossings.push_back((wa * Component(t.a, axis) + wb * Component(t.b, axis) + wc * Component(t.c, axis)) / sum);
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+// MeshVoxelizer
+// Converts a triangle soup into a signed distance field over a padded cube around it.
+// Distances are exact inside a narrow band around the surface, where every triangle is tested against the
+// voxels near it. Outside the band the closest triangle is propagated along each axis in turn and the
+// distance to it is evaluated exactly, which stays within a voxel or two of the true distance.
+// The sign comes from ray parity along the three axes, with the majority deciding, which keeps small
+// holes in the mesh from flipping whole rows. The triangle BVH serves the parity rays.
+
+#include "pch.h"
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+class MeshVoxelizer
+{
+public:
+	void Clear();
+
+	// appends a triangle list; positions are read with the given byte stride and offset by baseVertex
+	void AddTriangles(const void* positions, size_t stride, const uint32_t* indices, size_t indexCount, int baseVertex = 0);
+	void AddTriangles(const void* positions, size_t stride, const uint16_t* indices, size_t indexCount, int baseVertex = 0);
+	size_t GetTriangleCount() const { return m_triangles.size(); };
+
+	// fills sdf with resolution^3 values, x fastest, sampled at voxel centres; distances are in units of
+	// the cube's edge and negative inside. pool may be null
+	void Voxelize(int resolution, std::vector<float>& sdf, ThreadPool* pool);
+
+	// cube covered by the last Voxelize, in mesh space
+	const XMFLOAT3& GetGridOrigin() const { return m_gridOrigin; };
+	float GetGridSize() const { return m_gridSize; };
+
+	void SetNarrowBand(int voxels) { m_narrowBand = voxels; };
+
+private:
+	struct Triangle
+	{
+		XMFLOAT3 a, b, c;
+	};
+
+	struct Node
+	{
+		XMFLOAT3 min, max;
+		int left, right; // children, -1 for leaves
+		int first, count; // range of m_order held by a leaf
+	};
+
+	template <typename Index>
+	void AddIndexedTriangles(const void* positions, size_t stride, const Index* indices, size_t indexCount, int baseVertex);
+
+	void BuildBVH(const std::vector<Triangle>& triangles);
+	int BuildNode(const std::vector<Triangle>& triangles, int first, int count);
+	// positions along the axis where the axis-aligned ray through (u, v) crosses the surface
+	void RayCrossings(const std::vector<Triangle>& triangles, int axis, float u, float v, std::vector<float>& crossings) const;
+
+	std::vector<Triangle> m_triangles;
+	std::vector<Node> m_nodes;
+	std::vector<int> m_order;
+
+	XMFLOAT3 m_gridOrigin = XMFLOAT3(0, 0, 0);
+	float m_gridSize = 1.0f;
+	int m_narrowBand = 2;
+};
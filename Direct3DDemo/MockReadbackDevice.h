@@ -0,0 +1,79 @@
+#pragma once
+// MockReadbackDevice
+// CPU stand-in for D3D11ReadbackDevice. Copies snapshot the source bytes, and a copy completes after a set
+// number of Advance() calls, one per simulated GPU frame. Maps can be forced to report a busy resource.
+// Lets the ReadbackRing scheduling be exercised without a GPU.
+
+#include "ReadbackDevice.h"
+#include <cstring>
+
+class MockReadbackDevice : public IReadbackDevice
+{
+public:
+	MockReadbackDevice(int slotCount, int latency) : m_slots(slotCount), m_latency(latency) {};
+
+	// sources are read at Copy time and must outlive the device
+	void AddSource(const void* data, uint32_t rowPitch, uint32_t depthPitch, uint32_t depth)
+	{
+		m_sources.push_back({ data, rowPitch, depthPitch, depth });
+	}
+
+	void Advance() { m_frame++; };
+	void SetMapBusy(bool busy) { m_mapBusy = busy; };
+
+	int GetCopyCount() const { return m_copies; };
+	int GetMappedCount() const { return m_mapped; };
+
+	int GetSlotCount() const override { return int(m_slots.size()); };
+
+	void Copy(int slot) override
+	{
+		Slot& s = m_slots[slot];
+		s.readyFrame = m_frame + m_latency;
+		s.data.resize(m_sources.size());
+		for (size_t i = 0; i < m_sources.size(); i++)
+		{
+			const Source& source = m_sources[i];
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(source.data);
+			s.data[i].assign(bytes, bytes + size_t(source.depthPitch) * source.depth);
+		}
+		m_copies++;
+	}
+
+	bool IsComplete(int slot) override { return m_frame >= m_slots[slot].readyFrame; };
+
+	bool Map(int slot, std::vector<ReadbackView>& views) override
+	{
+		if (m_mapBusy || !IsComplete(slot))
+			return false;
+
+		views.resize(m_sources.size());
+		for (size_t i = 0; i < m_sources.size(); i++)
+			views[i] = { m_slots[slot].data[i].data(), m_sources[i].rowPitch, m_sources[i].depthPitch };
+
+		m_mapped++;
+		return true;
+	}
+
+	void Unmap(int) override { m_mapped--; };
+
+private:
+	struct Source
+	{
+		const void* data;
+		uint32_t rowPitch, depthPitch, depth;
+	};
+
+	struct Slot
+	{
+		uint64_t readyFrame = 0;
+		std::vector<std::vector<uint8_t>> data;
+	};
+
+	std::vector<Source> m_sources;
+	std::vector<Slot> m_slots;
+	uint64_t m_frame = 0;
+	int m_latency;
+	bool m_mapBusy = false;
+	int m_copies = 0, m_mapped = 0;
+};
@@ -1,4 +1,5 @@
 #include "Perlin.h"
+#include <cmath>
 
 Perlin::Perlin()
 {
@@ -24,6 +25,74 @@ float Perlin::Noise(float x, float y, float z) const
 {
 	return noiseInternal(x, y, z, perm);
 }
+float Perlin::TiledNoise(float x, float y, float z) const
+{
+	std::call_once(tiledOnce, [this]()
+	{
+		const int n = kTiledResolution;
+		tiled.resize(size_t(n) * n * n);
+		for (int k = 0; k < n; k++)
+			for (int j = 0; j < n; j++)
+				for (int i = 0; i < n; i++)
+					tiled[(size_t(k) * n + j) * n + i] = tiledNoiseInternal(float(i) / n * kTiledPeriod, float(j) / n * kTiledPeriod, float(k) / n * kTiledPeriod);
+	});
+
+	// texel centres sit half a texel in, as for the GPU sampler
+	const int n = kTiledResolution;
+	float tx = x * n - 0.5f, ty = y * n - 0.5f, tz = z * n - 0.5f;
+	float fx = std::floor(tx), fy = std::floor(ty), fz = std::floor(tz);
+	float u = tx - fx, v = ty - fy, w = tz - fz;
+	auto wrap = [n](float i) { int r = int(i) % n; return r < 0 ? r + n : r; };
+	int x0 = wrap(fx), y0 = wrap(fy), z0 = wrap(fz);
+	int x1 = (x0 + 1) % n, y1 = (y0 + 1) % n, z1 = (z0 + 1) % n;
+	auto at = [&](int i, int j, int k) { return tiled[(size_t(k) * n + j) * n + i]; };
+
+	float c00 = mix(at(x0, y0, z0), at(x1, y0, z0), u);
+	float c10 = mix(at(x0, y1, z0), at(x1, y1, z0), u);
+	float c01 = mix(at(x0, y0, z1), at(x1, y0, z1), u);
+	float c11 = mix(at(x0, y1, z1), at(x1, y1, z1), u);
+	return mix(mix(c00, c10, v), mix(c01, c11, v), w);
+}
+std::array<float, 3> Perlin::CurlNoise(float x, float y, float z, float time) const
+{
+	// potential components are the same noise at the shader's decorrelating offsets
+	const float ox[3] = { 0.3862f, 0, 0 };
+	const float oy[3] = { 0, 0.4621f, 0 };
+	const float oz[3] = { 0, 0, 0.5638f };
+
+	float curlFreq = 0.07f * 0.1f;
+	float curlSpeed = 0.03f * 0.1f;
+	float curlAmp = 62.5f;
+	const float eps = 1.0f / 128.0f;
+
+	std::array<float, 3> res = { 0, 0, 0 };
+	for (int i = 0; i < 3; i++)
+	{
+		float px = x * curlFreq - curlSpeed * time;
+		float py = y * curlFreq - curlSpeed * time;
+		float pz = z * curlFreq - curlSpeed * time;
+		auto psi = [&](const float* o, float dx, float dy, float dz) {
+			return TiledNoise(px + dx + o[0], py + dy + o[1], pz + dz + o[2]);
+			};
+
+		float dPsiZ_dy = psi(oz, 0, eps, 0) - psi(oz, 0, -eps, 0);
+		float dPsiY_dz = psi(oy, 0, 0, eps) - psi(oy, 0, 0, -eps);
+		float dPsiX_dz = psi(ox, 0, 0, eps) - psi(ox, 0, 0, -eps);
+		float dPsiZ_dx = psi(oz, eps, 0, 0) - psi(oz, -eps, 0, 0);
+		float dPsiY_dx = psi(oy, eps, 0, 0) - psi(oy, -eps, 0, 0);
+		float dPsiX_dy = psi(ox, 0, eps, 0) - psi(ox, 0, -eps, 0);
+
+		// chain rule: the noise is sampled at position * curlFreq
+		float scale = curlFreq / (2.0f * eps) * curlAmp;
+		res[0] += (dPsiZ_dy - dPsiY_dz) * scale;
+		res[1] += (dPsiX_dz - dPsiZ_dx) * scale;
+		res[2] += (dPsiY_dx - dPsiX_dy) * scale;
+
+		curlFreq *= 1.7f;
+		curlAmp *= 0.4f;
+	}
+	return res;
+}
 float Perlin::noiseInternal(float x, float y, const std::array<int, 512>& perm)
 {
 	int X = fastfloor(x);
@@ -103,6 +172,40 @@ float Perlin::noiseInternal(float x, float y, float z, const std::array<int, 512
 	return nxyz;
 }
 
+// perlin_cs.hlsl's Perlin3D with its 8-entry table, so it tiles with a period of 8 lattice cells
+float Perlin::tiledNoiseInternal(float x, float y, float z)
+{
+	const int period = kTiledPeriod;
+	auto wrap = [period](int i) { i %= period; return i < 0 ? i + period : i; };
+	auto gradient = [](int hash, float dx, float dy, float dz) {
+		const float s = 0.57735027f; // normalize(+-1, +-1, +-1)
+		return ((hash & 1) == 0 ? s : -s) * dx + ((hash & 2) == 0 ? s : -s) * dy + ((hash & 4) == 0 ? s : -s) * dz;
+		};
+	const int* p = tiledPerm;
+
+	int X = wrap(int(std::floor(x)));
+	int Y = wrap(int(std::floor(y)));
+	int Z = wrap(int(std::floor(z)));
+	x -= std::floor(x);
+	y -= std::floor(y);
+	z -= std::floor(z);
+	float u = fade(x), v = fade(y), w = fade(z);
+
+	int A = (p[X] + Y) % period;
+	int AA = (p[A] + Z) % period;
+	int AB = (p[(A + 1) % period] + Z) % period;
+	int B = (p[(X + 1) % period] + Y) % period;
+	int BA = (p[B] + Z) % period;
+	int BB = (p[(B + 1) % period] + Z) % period;
+
+	return mix(
+		mix(mix(gradient(p[AA], x, y, z), gradient(p[BA], x - 1, y, z), u),
+			mix(gradient(p[AB], x, y - 1, z), gradient(p[BB], x - 1, y - 1, z), u), v),
+		mix(mix(gradient(p[(AA + 1) % period], x, y, z - 1), gradient(p[(BA + 1) % period], x - 1, y, z - 1), u),
+			mix(gradient(p[(AB + 1) % period], x, y - 1, z - 1), gradient(p[(BB + 1) % period], x - 1, y - 1, z - 1), u), v),
+		w);
+}
+
 int Perlin::fastfloor(float x)
 {
 	return x > 0 ? (int)x : (int)x - 1;
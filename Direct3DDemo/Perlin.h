@@ -1,5 +1,7 @@
 #pragma once
 #include <array>
+#include <mutex>
+#include <vector>
 
 class Perlin
 {
@@ -13,6 +15,12 @@ public:
 
 	float Noise(float x, float y) const;
 	float Noise(float x, float y, float z) const;
+	// the fluid's noise texture on the CPU: perlin_cs's period-8 noise on its 128^3 lattice, sampled with
+	// trilinear filtering and wrap addressing
+	float TiledNoise(float x, float y, float z) const;
+	// divergence-free curl of a three-component noise potential, the same field as CurlForce in
+	// fluid_force_cs.hlsl; (x, y, z) spans the padded simulation grid over [0, 1]
+	std::array<float, 3> CurlNoise(float x, float y, float z, float time) const;
 
 private:
 	static constexpr int grad2[8][2] = {
@@ -39,10 +47,18 @@ private:
 		138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180 };
 
 
+	static constexpr int kTiledPeriod = 8;
+	static constexpr int kTiledResolution = 128;
+	static constexpr int tiledPerm[kTiledPeriod] = { 3, 6, 1, 0, 5, 7, 4, 2 };
+
 	std::array<int, 512> perm;
+	// built on the first TiledNoise call
+	mutable std::vector<float> tiled;
+	mutable std::once_flag tiledOnce;
 
 	Perlin();
 
+	static float tiledNoiseInternal(float x, float y, float z);
 	static float noiseInternal(float x, float y, const std::array<int, 512>& perm);
 	static float noiseInternal(float x, float y, float z, const std::array<int, 512>& perm);
 	static int fastfloor(float x);
@@ -0,0 +1,164 @@
+#include "pch.h"
+#include "QualityAutotuner.h"
+#include <fstream>
+
+namespace
+{
+	struct CalibrationKnob
+	{
+		const char* name;
+		std::vector<int> values;
+	};
+
+	const std::vector<CalibrationKnob>& CalibrationKnobs()
+	{
+		static const std::vector<CalibrationKnob> knobs =
+		{
+			{ "pressure_iterations", { 10, 20, 30, 40, 50, 60, 70 } },
+			{ "vorticity", { 0, 1 } },
+			{ "max_steps", { 8, 12, 16, 20, 24, 32 } },
+			{ "max_light_steps", { 2, 3, 4, 6, 8 } },
+			{ "sim_interval", { 1, 2, 3, 4 } },
+		};
+		return knobs;
+	}
+
+	void ApplyKnob(QualitySettings& settings, int knob, int value)
+	{
+		switch (knob)
+		{
+		case 0: settings.pressureIterations = value; break;
+		case 1: settings.vorticity = value != 0; break;
+		case 2: settings.maxSteps = value; break;
+		case 3: settings.maxLightSteps = value; break;
+		case 4: settings.simInterval = value; break;
+		}
+	}
+}
+
+QualityAutotuner::QualityAutotuner()
+{
+	// pressure iterations, vorticity, max steps, max light steps, sim interval
+	m_levels =
+	{
+		{ 20, false, 12, 3, 2 },
+		{ 30, false, 16, 4, 2 },
+		{ 40, false, 16, 4, 1 },
+		{ 50, true, 20, 5, 1 },
+		{ 60, true, 24, 6, 1 },
+		{ 70, true, 24, 6, 1 },
+	};
+	m_level = int(m_levels.size()) - 1;
+	m_calibrationSettings = m_levels.back();
+}
+
+void QualityAutotuner::Update(float frameTime, float simTime, float volumeTime)
+{
+	if (m_calibrating)
+	{
+		UpdateCalibration(frameTime, simTime, volumeTime);
+		return;
+	}
+	if (!m_enabled || frameTime <= 0.0f)
+		return;
+
+	if (m_cooldown > 0)
+	{
+		m_cooldown--;
+		return;
+	}
+
+	m_overCount = frameTime > m_budget * m_downThreshold ? m_overCount + 1 : 0;
+	m_underCount = frameTime < m_budget * m_upThreshold ? m_underCount + 1 : 0;
+
+	if (m_overCount >= m_downFrames && m_level > 0)
+		SetLevel(m_level - 1);
+	else if (m_underCount >= m_upFrames && m_level < GetLevelCount() - 1)
+		SetLevel(m_level + 1);
+}
+
+void QualityAutotuner::StartCalibration(const std::string& filename)
+{
+	m_calibrating = true;
+	m_calibrationFile = filename;
+	m_calibrationSamples.clear();
+	m_calibrationKnob = 0;
+	m_calibrationValue = 0;
+	m_calibrationFrame = 0;
+	m_frameSum = m_simSum = m_volumeSum = 0.0;
+
+	m_calibrationSettings = m_levels.back();
+	ApplyKnob(m_calibrationSettings, m_calibrationKnob, CalibrationKnobs()[m_calibrationKnob].values[m_calibrationValue]);
+}
+
+const QualitySettings& QualityAutotuner::GetSettings() const
+{
+	return m_calibrating ? m_calibrationSettings : m_levels[m_level];
+}
+
+void QualityAutotuner::SetLevel(int level)
+{
+	m_level = std::max(0, std::min(level, GetLevelCount() - 1));
+	m_overCount = 0;
+	m_underCount = 0;
+	m_cooldown = m_cooldownFrames;
+}
+
+void QualityAutotuner::UpdateCalibration(float frameTime, float simTime, float volumeTime)
+{
+	// timings lag a few frames behind the settings, so the first frames of every point are discarded
+	m_calibrationFrame++;
+	if (m_calibrationFrame <= m_warmupFrames)
+		return;
+
+	m_frameSum += frameTime;
+	m_simSum += simTime;
+	m_volumeSum += volumeTime;
+	if (m_calibrationFrame < m_warmupFrames + m_sampleFrames)
+		return;
+
+	const CalibrationKnob& knob = CalibrationKnobs()[m_calibrationKnob];
+	m_calibrationSamples.push_back({ knob.name, knob.values[m_calibrationValue],
+		float(m_frameSum / m_sampleFrames), float(m_simSum / m_sampleFrames), float(m_volumeSum / m_sampleFrames) });
+
+	m_calibrationFrame = 0;
+	m_frameSum = m_simSum = m_volumeSum = 0.0;
+
+	if (!NextCalibrationPoint())
+	{
+		m_calibrating = false;
+		WriteCalibration();
+	}
+}
+
+bool QualityAutotuner::NextCalibrationPoint()
+{
+	const auto& knobs = CalibrationKnobs();
+
+	m_calibrationValue++;
+	if (m_calibrationValue >= int(knobs[m_calibrationKnob].values.size()))
+	{
+		m_calibrationKnob++;
+		m_calibrationValue = 0;
+		if (m_calibrationKnob >= int(knobs.size()))
+			return false;
+	}
+
+	// every sweep starts from full quality so each curve isolates a single knob
+	m_calibrationSettings = m_levels.back();
+	ApplyKnob(m_calibrationSettings, m_calibrationKnob, knobs[m_calibrationKnob].values[m_calibrationValue]);
+	return true;
+}
+
+void QualityAutotuner::WriteCalibration() const
+{
+	std::ofstream file(m_calibrationFile);
+	if (!file)
+		return;
+
+	file << "knob,value,frame_ms,sim_ms,volume_ms\n";
+	for (const CalibrationSample& sample : m_calibrationSamples)
+	{
+		file << sample.knob << "," << sample.value << "," << sample.frameTime << "," << sample.simTime << "," << sample.volumeTime << "\n";
+	}
+}
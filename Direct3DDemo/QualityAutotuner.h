@@ -0,0 +1,74 @@
+#pragma once
+// QualityAutotuner
+// Steps the solver and raymarch quality knobs up and down a fixed ladder of levels to keep the measured
+// GPU frame time under a budget. Hysteresis keeps it from oscillating: dropping a level needs a short run
+// of over-budget frames, raising one needs a longer run of frames well under budget, and every change is
+// followed by a cooldown while the delayed timings catch up.
+// Calibration mode sweeps each knob on its own and writes the measured cost curves to a CSV file.
+
+#include <string>
+#include <vector>
+
+struct QualitySettings
+{
+	int pressureIterations;
+	bool vorticity;
+	int maxSteps;
+	int maxLightSteps;
+	int simInterval; // run the simulation once every simInterval frames
+};
+
+class QualityAutotuner
+{
+public:
+	QualityAutotuner();
+
+	// timings in milliseconds, as measured for the previous frames
+	void Update(float frameTime, float simTime, float volumeTime);
+
+	void StartCalibration(const std::string& filename);
+	bool IsCalibrating() const { return m_calibrating; };
+
+	const QualitySettings& GetSettings() const;
+	int GetLevel() const { return m_level; };
+	int GetLevelCount() const { return int(m_levels.size()); };
+	float GetBudget() const { return m_budget; };
+	bool GetEnabled() const { return m_enabled; };
+
+	void SetLevel(int level);
+	void SetBudget(float ms) { m_budget = ms; };
+	void SetEnabled(bool enabled) { m_enabled = enabled; };
+
+private:
+	struct CalibrationSample
+	{
+		std::string knob;
+		int value;
+		float frameTime, simTime, volumeTime;
+	};
+
+	void UpdateCalibration(float frameTime, float simTime, float volumeTime);
+	bool NextCalibrationPoint();
+	void WriteCalibration() const;
+
+	// ordered from cheapest to the full-quality default
+	std::vector<QualitySettings> m_levels;
+	int m_level;
+
+	float m_budget = 12.0f;
+	bool m_enabled = false;
+
+	// hysteresis: frames over budget * m_downThreshold drop a level, frames under budget * m_upThreshold raise one
+	float m_downThreshold = 1.05f, m_upThreshold = 0.8f;
+	int m_downFrames = 10, m_upFrames = 90, m_cooldownFrames = 30;
+	int m_overCount = 0, m_underCount = 0, m_cooldown = 0;
+
+	// calibration sweeps one knob at a time from the full-quality level
+	bool m_calibrating = false;
+	std::string m_calibrationFile;
+	QualitySettings m_calibrationSettings;
+	int m_calibrationKnob = 0, m_calibrationValue = 0, m_calibrationFrame = 0;
+	int m_warmupFrames = 30, m_sampleFrames = 60;
+	double m_frameSum = 0.0, m_simSum = 0.0, m_volumeSum = 0.0;
+	std::vector<CalibrationSample> m_calibrationSamples;
+};
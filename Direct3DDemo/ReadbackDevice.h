@@ -0,0 +1,32 @@
+#pragma once
+// IReadbackDevice
+// The GPU side of an asynchronous readback: a fixed set of staging slots that the source resources can be
+// copied into, each with its own completion query. ReadbackRing only talks to this interface and needs neither
+// pch.h nor any D3D header.
+
+#include <cstdint>
+#include <vector>
+
+// one mapped staging resource
+struct ReadbackView
+{
+	const void* data;
+	uint32_t rowPitch;
+	uint32_t depthPitch;
+};
+
+class IReadbackDevice
+{
+public:
+	virtual ~IReadbackDevice() = default;
+
+	virtual int GetSlotCount() const = 0;
+
+	// records a copy of every source into the slot's staging resources, followed by the slot's completion query
+	virtual void Copy(int slot) = 0;
+	// true once the copy has finished; never blocks
+	virtual bool IsComplete(int slot) = 0;
+	// maps every staging resource of the slot without waiting, one view per source; false if any is still busy
+	virtual bool Map(int slot, std::vector<ReadbackView>& views) = 0;
+	virtual void Unmap(int slot) = 0;
+};
@@ -0,0 +1,62 @@
+#include "ReadbackRing.h"
+
+ReadbackRing::ReadbackRing(std::unique_ptr<IReadbackDevice> device) : m_device(std::move(device))
+{
+	m_slots.resize(m_device->GetSlotCount(), { false, 0, 0 });
+}
+
+uint64_t ReadbackRing::Request()
+{
+	uint64_t request = m_nextRequest++;
+	if (m_deferred)
+		m_merged++;
+
+	m_deferred = true;
+	m_deferredRequest = request;
+	Issue();
+	return request;
+}
+
+void ReadbackRing::Poll()
+{
+	m_pollCount++;
+
+	// stop at the first unfinished slot to keep the callbacks in submission order
+	while (!m_inFlight.empty())
+	{
+		int index = m_inFlight.front();
+		if (!m_device->IsComplete(index) || !m_device->Map(index, m_views))
+			break;
+
+		Slot& slot = m_slots[index];
+		m_inFlight.pop_front();
+		m_latency = m_pollCount - slot.issuedPoll;
+
+		if (m_callback)
+			m_callback(slot.request, m_views);
+
+		m_device->Unmap(index);
+		slot.busy = false;
+		m_completed++;
+	}
+
+	Issue();
+}
+
+void ReadbackRing::Issue()
+{
+	if (!m_deferred)
+		return;
+
+	for (int i = 0; i < int(m_slots.size()); i++)
+	{
+		if (m_slots[i].busy)
+			continue;
+
+		m_device->Copy(i);
+		m_slots[i] = { true, m_deferredRequest, m_pollCount };
+		m_inFlight.push_back(i);
+		m_deferred = false;
+		return;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+// ReadbackRing
+// Schedules readbacks over the staging slots of an IReadbackDevice without ever stalling the CPU.
+// Request() records a copy into a free slot and returns at once; Poll(), called once per frame, hands
+// every finished slot to the callback and frees it. Slots are completed in submission order, so an older
+// result never overwrites a newer one. When every slot is in flight the request waits for the next free
+// slot, and further requests made meanwhile are merged into it, since only the latest contents matter.
+
+#include "ReadbackDevice.h"
+#include <deque>
+#include <functional>
+#include <memory>
+
+class ReadbackRing
+{
+public:
+	// request id and one view per source; the views are only valid during the call
+	using Callback = std::function<void(uint64_t request, const std::vector<ReadbackView>& views)>;
+
+	explicit ReadbackRing(std::unique_ptr<IReadbackDevice> device);
+
+	void SetCallback(Callback callback) { m_callback = callback; };
+
+	uint64_t Request();
+	void Poll();
+
+	IReadbackDevice* GetDevice() const { return m_device.get(); };
+	int GetInFlightCount() const { return int(m_inFlight.size()); };
+	bool HasDeferredRequest() const { return m_deferred; };
+	uint64_t GetCompletedCount() const { return m_completed; };
+	uint64_t GetMergedCount() const { return m_merged; };
+	// number of Poll calls between the copy and the callback of the last completed request
+	uint64_t GetLatency() const { return m_latency; };
+
+private:
+	struct Slot
+	{
+		bool busy;
+		uint64_t request;
+		uint64_t issuedPoll;
+	};
+
+	void Issue();
+
+	std::unique_ptr<IReadbackDevice> m_device;
+	std::vector<Slot> m_slots;
+	std::deque<int> m_inFlight;
+	std::vector<ReadbackView> m_views;
+	Callback m_callback;
+
+	bool m_deferred = false;
+	uint64_t m_deferredRequest = 0;
+	uint64_t m_nextRequest = 1;
+
+	uint64_t m_pollCount = 0;
+	uint64_t m_completed = 0, m_merged = 0, m_latency = 0;
+};
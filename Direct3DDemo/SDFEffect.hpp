@@ -2,111 +2,164 @@
 #include "pch.h"
 #include "ReadData.h"
 #include "ConstantBuffer.hpp"
+#include "SDFField.h"
+#include "SDFPyramid.h"
+#include "ReadbackRing.h"
+#include "D3D11ReadbackDevice.h"
+#include "SDFObjectBVH.h"
+#include "ThreadPool.h"
 
 using namespace DirectX;
 
 namespace CustomEffects
 {
+	// the scene SDF is stored normalized, as distance / distance scale, so a texel costs two bytes or one
+	enum class SDFStorageFormat
+	{
+		Snorm16,
+		Snorm8,
+	};
+
+	struct SDFMemoryUsage
+	{
+		size_t gpu, staging, cpu; // bytes
+	};
+
 	class SDFEffect
 	{
 	public:
-		explicit SDFEffect(ID3D11Device* device, const std::wstring& csPath, const std::wstring& gradientCsPath, const XMFLOAT3& bufferDimensions)
+		explicit SDFEffect(ID3D11Device* device, const std::wstring& csPath, const XMFLOAT3& bufferDimensions, SDFStorageFormat format = SDFStorageFormat::Snorm16)
 		{
 			m_bufferDimensions = bufferDimensions;
+			m_format = format;
 			m_sdfParamsBuffer = std::make_unique<ConstantBuffer<SolidMaskBufferType>>();
 			m_sceneObjects = std::vector<SceneObjectData>();
+			m_brickCount = XMINT3((int(bufferDimensions.x) + 2 + 3) / 4, (int(bufferDimensions.y) + 2 + 3) / 4, (int(bufferDimensions.z) + 2 + 3) / 4);
 
 
 			CreateConstantBuffers(device);
 
-			CreateComputeShader(device, csPath, gradientCsPath);
+			CreateComputeShader(device, csPath);
 		}
 
+		// recomputes the bricks dirtied since the last call, or the whole grid on the first call and whenever
+		// nothing has been marked dirty
 		void Compute(ID3D11DeviceContext* deviceContext, int x, int y, int z)
 		{
+			if (!m_computed || !m_dirty)
+			{
+				m_dirtyMin = XMINT3(0, 0, 0);
+				m_dirtyMax = XMINT3(x, y, z); // account for ghost cells
+			}
+			XMINT3 regionSize(m_dirtyMax.x - m_dirtyMin.x + 1, m_dirtyMax.y - m_dirtyMin.y + 1, m_dirtyMax.z - m_dirtyMin.z + 1);
+
+			UpdateBrickObjects(deviceContext);
+
 			SetConstantBuffers(deviceContext);
 			SetResourceViews(deviceContext);
 
 			deviceContext->CSSetShader(m_cs.Get(), nullptr, 0);
-			deviceContext->Dispatch(x + 1, y + 1, z + 1); // account for ghost cells
-
-			Unbind(deviceContext, 2);
-
-			// gradient calculation
-			SetGradientResourceViews(deviceContext);
-			deviceContext->CSSetShader(m_gradientCs.Get(), nullptr, 0);
-			deviceContext->Dispatch(x + 1, y + 1, z + 1); // account for ghost cells
+			deviceContext->Dispatch(regionSize.x, regionSize.y, regionSize.z);
 
-			Unbind(deviceContext, 1);
+			Unbind(deviceContext, kMaxSceneSDFObjects + 1);
 
+			m_computed = true;
+			m_dirty = false;
 
-			CopyToCPU(deviceContext);
+			// the CPU copy arrives through PollReadback a few frames later, without stalling on the GPU;
+			// only the cells recomputed here are decoded into it
+			XMINT3 cellMin(m_dirtyMin.x * 4, m_dirtyMin.y * 4, m_dirtyMin.z * 4);
+			XMINT3 cellMax(m_dirtyMax.x * 4 + 3, m_dirtyMax.y * 4 + 3, m_dirtyMax.z * 4 + 3);
+			m_readbackRegions.push_back({ m_readback->Request(), cellMin, cellMax });
 		}
 
-		void CopyToCPU(ID3D11DeviceContext* deviceContext)
+		// delivers finished readbacks to the CPU field, call once per frame
+		void PollReadback()
 		{
-			deviceContext->CopyResource(m_stagingTexture.Get(), m_texture.Get());
+			m_readback->Poll();
+		}
 
-			D3D11_MAPPED_SUBRESOURCE mapped;
-			DX::ThrowIfFailed(deviceContext->Map(m_stagingTexture.Get(), 0, D3D11_MAP_READ, 0, &mapped));
+		// samples hold distance / GetDistanceScale(), clamped to [-1, 1]; the sign is exact
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetSrv() const { return m_srv; };
+		float GetDistanceScale() const { return m_distanceScale; };
+		// the CPU copy is decoded to world units, gradients are taken from it on demand;
+		// valid until the next PollReadback, empty until the first readback arrives
+		const SDFField& GetCPUField() const { return m_cpuField; };
+		// min/max pyramid over the CPU copy, rebuilt with it for conservative box and empty-space queries
+		const SDFPyramid& GetCPUPyramid() const { return m_cpuPyramid; };
+		const std::vector<float>& GetCPUSdf() const { return m_cpuField.GetDistances(); };
+
+		SDFMemoryUsage GetMemoryUsage() const
+		{
+			size_t cells = GetCellCount();
+			return { cells * GetTexelSize(), cells * GetTexelSize() * kReadbackSlots, cells * sizeof(float) };
+		}
+		// the previous layout: an R32 distance and an R32G32B32A32 gradient texture, both staged, and float
+		// distances plus float3 gradients on the CPU
+		SDFMemoryUsage GetUncompressedMemoryUsage() const
+		{
+			size_t cells = GetCellCount();
+			return { cells * (4 + 16), cells * (4 + 16) * kReadbackSlots, cells * (4 + 12) };
+		}
 
-			const uint8_t* data = reinterpret_cast<const uint8_t*>(mapped.pData);
-			m_cpuSDF.resize((m_bufferDimensions.x + 2) * (m_bufferDimensions.y + 2) * (m_bufferDimensions.z + 2));
-			for (UINT z = 0; z < m_bufferDimensions.z + 2; ++z)
+		void SetThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; };
+		void SetSimulationTransform(const XMMATRIX transform)
+		{
+			// a new transform moves every cell, so the next Compute covers the whole grid
+			for (int i = 0; i < 4; i++)
 			{
-				for (UINT y = 0; y < m_bufferDimensions.y + 2; ++y)
-				{
-					const float* rowData = reinterpret_cast<const float*>(
-						data + z * mapped.DepthPitch + y * mapped.RowPitch);
-
-					for (UINT x = 0; x < m_bufferDimensions.x + 2; ++x)
-					{
-						size_t index = z * (m_bufferDimensions.y + 2) * (m_bufferDimensions.x + 2) + y * (m_bufferDimensions.x + 2) + x;
-						m_cpuSDF[index] = rowData[x];
-					}
-				}
+				if (!XMVector4Equal(transform.r[i], m_simulationTransform.r[i]))
+					m_computed = false;
 			}
-			deviceContext->Unmap(m_stagingTexture.Get(), 0);
-
-
+			m_simulationTransform = transform;
 
-			// gradient
-			deviceContext->CopyResource(m_stagingGradientTexture.Get(), m_gradientTexture.Get());
-
-			DX::ThrowIfFailed(deviceContext->Map(m_stagingGradientTexture.Get(), 0, D3D11_MAP_READ, 0, &mapped));
+			// the diagonal of the simulation volume bounds every distance inside it
+			m_distanceScale = XMVectorGetX(XMVector3Length(XMVector3TransformNormal(XMVectorSplatOne(), transform)));
+		}
 
-			data = reinterpret_cast<const uint8_t*>(mapped.pData);
-			m_cpuSDFGradient.resize((m_bufferDimensions.x + 2) * (m_bufferDimensions.y + 2) * (m_bufferDimensions.z + 2));
-			for (UINT z = 0; z < m_bufferDimensions.z + 2; ++z)
+		// registering an SDF that is already in the scene updates that object instead of adding it again;
+		// returns the object's id
+		int AddSceneObject(ID3D11Device* device, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> sdfSRV, const XMMATRIX transform, float uniformScale)
+		{
+			for (int i = 0; i < int(m_sceneObjects.size()); i++)
 			{
-				for (UINT y = 0; y < m_bufferDimensions.y + 2; ++y)
+				if (m_sceneObjects[i].sdf == sdfSRV)
 				{
-					const XMFLOAT4* rowData = reinterpret_cast<const XMFLOAT4*>(
-						data + z * mapped.DepthPitch + y * mapped.RowPitch);
-
-					for (UINT x = 0; x < m_bufferDimensions.x + 2; ++x)
-					{
-						size_t index = z * (m_bufferDimensions.y + 2) * (m_bufferDimensions.x + 2) +
-							y * (m_bufferDimensions.x + 2) +
-							x;
-
-						// You can store this however you want  e.g. XMFLOAT3, glm::vec3, or float[3]
-						m_cpuSDFGradient[index] = XMFLOAT3(rowData[x].x, rowData[x].y, rowData[x].z);
-					}
+					m_sceneObjects[i].uniformScale = uniformScale;
+					SetSceneObjectTransform(i, transform);
+					return i;
 				}
 			}
-			deviceContext->Unmap(m_stagingGradientTexture.Get(), 0);
+
+			if (int(m_sceneObjects.size()) >= kMaxSceneSDFObjects)
+				throw std::out_of_range("SDFEffect: too many scene objects");
+
+			m_sceneObjects.push_back({ sdfSRV, transform, uniformScale });
+			m_objectsChanged = true;
+			MarkDirty(GetObjectBounds(m_sceneObjects.back()));
+			return int(m_sceneObjects.size()) - 1;
 		}
 
-		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetSrv() const { return m_srv; };
-		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetGradientSrv() const { return m_gradientSrv; };
-		std::vector<float> GetCPUSdf() const { return m_cpuSDF; };
-		std::vector<XMFLOAT3> GetCPUSdfGradient() const { return m_cpuSDFGradient; };
+		// only the bricks covered by the old and the new bounds are recomputed
+		void SetSceneObjectTransform(int id, const XMMATRIX transform)
+		{
+			MarkDirty(GetObjectBounds(m_sceneObjects[id]));
+			m_sceneObjects[id].transformMatrix = transform;
+			MarkDirty(GetObjectBounds(m_sceneObjects[id]));
+			m_objectsChanged = true;
+		}
 
-		void SetSimulationTransform(const XMMATRIX transform) { m_simulationTransform = transform; };
-		void AddSceneObject(ID3D11Device* device, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> sdfSRV, const XMMATRIX transform, float uniformScale) 
-		{  
-			m_sceneObjects.push_back({ sdfSRV , transform, uniformScale});
+		// the object's SDF contents changed
+		void InvalidateSceneObject(int id)
+		{
+			MarkDirty(GetObjectBounds(m_sceneObjects[id]));
+		}
+		// the object's SDF contents changed within region, given in the object's unit cube
+		void InvalidateSceneObjectRegion(int id, const BoundingBox& region)
+		{
+			BoundingBox bounds;
+			region.Transform(bounds, m_sceneObjects[id].transformMatrix);
+			MarkDirty(bounds);
 		}
 
 	private:
@@ -119,34 +172,60 @@ namespace CustomEffects
 
 		XMFLOAT3 m_bufferDimensions;
 
-		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cs, m_gradientCs;
+		Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_cs;
 
-		Microsoft::WRL::ComPtr<ID3D11Texture3D> m_texture, m_stagingTexture;
-		Microsoft::WRL::ComPtr<ID3D11Texture3D> m_gradientTexture, m_stagingGradientTexture;
+		Microsoft::WRL::ComPtr<ID3D11Texture3D> m_texture;
 
 		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_uav;
-		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_gradientUav;
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_srv;
-		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_gradientSrv;
+
+		SDFStorageFormat m_format;
+		float m_distanceScale = 1.0f;
 
 		std::vector<SceneObjectData> m_sceneObjects;
 
-		XMMATRIX m_simulationTransform;
+		XMMATRIX m_simulationTransform = XMMatrixIdentity();
 		std::unique_ptr<ConstantBuffer<SolidMaskBufferType>> m_sdfParamsBuffer;
 
+		// objects overlapping each 4x4x4 brick, found through a BVH over the object bounds
+		SDFObjectBVH m_objectBVH;
+		std::vector<uint32_t> m_brickObjects;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_brickObjectsBuffer;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_brickObjectsSRV;
+		XMINT3 m_brickCount;
+		bool m_objectsChanged = false;
+		ThreadPool* m_threadPool = nullptr;
 
-		std::vector<float> m_cpuSDF;
-		std::vector<XMFLOAT3> m_cpuSDFGradient;
+		// inclusive brick range to recompute
+		bool m_computed = false, m_dirty = false;
+		XMINT3 m_dirtyMin, m_dirtyMax;
 
 
-		void CreateComputeShader(ID3D11Device* device, const std::wstring& filepath, const std::wstring& gradientFilepath)
+		struct ReadbackRegion
+		{
+			uint64_t request;
+			XMINT3 cellMin, cellMax; // inclusive
+		};
+
+		SDFField m_cpuField;
+		SDFPyramid m_cpuPyramid;
+		// cells recomputed by each readback request that has not been delivered yet
+		std::vector<ReadbackRegion> m_readbackRegions;
+		std::unique_ptr<ReadbackRing> m_readback;
+		static const int kReadbackSlots = 3;
+
+
+		size_t GetCellCount() const
+		{
+			return size_t(m_bufferDimensions.x + 2) * size_t(m_bufferDimensions.y + 2) * size_t(m_bufferDimensions.z + 2);
+		}
+		size_t GetTexelSize() const { return m_format == SDFStorageFormat::Snorm16 ? 2 : 1; };
+
+		void CreateComputeShader(ID3D11Device* device, const std::wstring& filepath)
 		{
 			auto csBlob = DX::ReadData(filepath.c_str());
 			DX::ThrowIfFailed(device->CreateComputeShader(csBlob.data(), csBlob.size(), nullptr, m_cs.ReleaseAndGetAddressOf()));
 
-			auto gradientCsBlob = DX::ReadData(gradientFilepath.c_str());
-			DX::ThrowIfFailed(device->CreateComputeShader(gradientCsBlob.data(), gradientCsBlob.size(), nullptr, m_gradientCs.ReleaseAndGetAddressOf()));
-
 			CreateResourceViews(device);
 		}
 		void CreateConstantBuffers(ID3D11Device* device)
@@ -160,25 +239,13 @@ namespace CustomEffects
 			textureDesc.Height = m_bufferDimensions.y + 2;
 			textureDesc.Depth = m_bufferDimensions.z + 2;
 			textureDesc.MipLevels = 1;
-			textureDesc.Format = DXGI_FORMAT_R32_FLOAT;
+			textureDesc.Format = m_format == SDFStorageFormat::Snorm16 ? DXGI_FORMAT_R16_SNORM : DXGI_FORMAT_R8_SNORM;
 			textureDesc.Usage = D3D11_USAGE_DEFAULT;
 			textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
 			textureDesc.CPUAccessFlags = 0;
 			textureDesc.MiscFlags = 0;
 			DX::ThrowIfFailed(device->CreateTexture3D(&textureDesc, nullptr, m_texture.GetAddressOf()));
 
-			D3D11_TEXTURE3D_DESC stagingTextureDesc;
-			stagingTextureDesc.Width = m_bufferDimensions.x + 2;
-			stagingTextureDesc.Height = m_bufferDimensions.y + 2;
-			stagingTextureDesc.Depth = m_bufferDimensions.z + 2;
-			stagingTextureDesc.MipLevels = 1;
-			stagingTextureDesc.Format = DXGI_FORMAT_R32_FLOAT;
-			stagingTextureDesc.Usage = D3D11_USAGE_STAGING;
-			stagingTextureDesc.BindFlags = 0;
-			stagingTextureDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-			stagingTextureDesc.MiscFlags = 0;
-			DX::ThrowIfFailed(device->CreateTexture3D(&stagingTextureDesc, nullptr, m_stagingTexture.GetAddressOf()));
-
 			D3D11_UNORDERED_ACCESS_VIEW_DESC textureUavDesc = {};
 			textureUavDesc.Format = textureDesc.Format;
 			textureUavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE3D;
@@ -194,24 +261,173 @@ namespace CustomEffects
 			textureSrvDesc.Texture3D.MostDetailedMip = 0;
 			DX::ThrowIfFailed(device->CreateShaderResourceView(m_texture.Get(), &textureSrvDesc, m_srv.GetAddressOf()));
 
+			UINT brickCount = m_brickCount.x * m_brickCount.y * m_brickCount.z;
+			m_brickObjects.assign(brickCount, 0);
+
+			D3D11_BUFFER_DESC bufferDesc = {};
+			bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+			bufferDesc.ByteWidth = sizeof(uint32_t) * brickCount;
+			bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+			bufferDesc.StructureByteStride = sizeof(uint32_t);
+			DX::ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, m_brickObjectsBuffer.GetAddressOf()));
+
+			D3D11_SHADER_RESOURCE_VIEW_DESC bufferSrvDesc = {};
+			bufferSrvDesc.Format = DXGI_FORMAT_UNKNOWN;
+			bufferSrvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+			bufferSrvDesc.Buffer.FirstElement = 0;
+			bufferSrvDesc.Buffer.NumElements = brickCount;
+			DX::ThrowIfFailed(device->CreateShaderResourceView(m_brickObjectsBuffer.Get(), &bufferSrvDesc, m_brickObjectsSRV.GetAddressOf()));
+
+			std::vector<ID3D11Resource*> readbackSources = { m_texture.Get() };
+			std::unique_ptr<IReadbackDevice> readbackDevice(new D3D11ReadbackDevice(device, readbackSources, kReadbackSlots));
+			m_readback = std::make_unique<ReadbackRing>(std::move(readbackDevice));
+			m_readback->SetCallback([this](uint64_t request, const std::vector<ReadbackView>& views) { OnReadback(request, views); });
+		}
+		void OnReadback(uint64_t request, const std::vector<ReadbackView>& views)
+		{
+			// the field carries its own resolution and transform, so queries need nothing hard-coded
+			XMINT3 resolution(int(m_bufferDimensions.x) + 2, int(m_bufferDimensions.y) + 2, int(m_bufferDimensions.z) + 2);
+			bool empty = m_cpuField.IsEmpty();
+			m_cpuField.Reset(resolution, m_simulationTransform);
+			float* distances = m_cpuField.GetDistanceData();
+
+			// the ring merges requests, so this copy covers every request up to this one
+			XMINT3 cellMin = resolution, cellMax(-1, -1, -1);
+			auto delivered = std::remove_if(m_readbackRegions.begin(), m_readbackRegions.end(), [&](const ReadbackRegion& region)
+			{
+				if (region.request > request)
+					return false;
+				cellMin = XMINT3(std::min(cellMin.x, region.cellMin.x), std::min(cellMin.y, region.cellMin.y), std::min(cellMin.z, region.cellMin.z));
+				cellMax = XMINT3(std::max(cellMax.x, region.cellMax.x), std::max(cellMax.y, region.cellMax.y), std::max(cellMax.z, region.cellMax.z));
+				return true;
+			});
+			m_readbackRegions.erase(delivered, m_readbackRegions.end());
+			if (empty)
+			{
+				cellMin = XMINT3(0, 0, 0);
+				cellMax = XMINT3(resolution.x - 1, resolution.y - 1, resolution.z - 1);
+			}
+			cellMax = XMINT3(std::min(cellMax.x, resolution.x - 1), std::min(cellMax.y, resolution.y - 1), std::min(cellMax.z, resolution.z - 1));
 
+			// snorm decoding: the most negative code maps to -1 like the one above it
+			const uint8_t* distanceData = reinterpret_cast<const uint8_t*>(views[0].data);
+			for (int z = cellMin.z; z <= cellMax.z; ++z)
+			{
+				for (int y = cellMin.y; y <= cellMax.y; ++y)
+				{
+					float* row = distances + (size_t(z) * resolution.y + y) * resolution.x;
+					const uint8_t* distanceRow = distanceData + z * views[0].depthPitch + y * views[0].rowPitch;
 
-			textureDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-			DX::ThrowIfFailed(device->CreateTexture3D(&textureDesc, nullptr, m_gradientTexture.GetAddressOf()));
+					if (m_format == SDFStorageFormat::Snorm16)
+					{
+						const int16_t* texels = reinterpret_cast<const int16_t*>(distanceRow);
+						for (int x = cellMin.x; x <= cellMax.x; ++x)
+							row[x] = std::max(texels[x] / 32767.0f, -1.0f) * m_distanceScale;
+					}
+					else
+					{
+						const int8_t* texels = reinterpret_cast<const int8_t*>(distanceRow);
+						for (int x = cellMin.x; x <= cellMax.x; ++x)
+							row[x] = std::max(texels[x] / 127.0f, -1.0f) * m_distanceScale;
+					}
+				}
+			}
 
-			stagingTextureDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-			DX::ThrowIfFailed(device->CreateTexture3D(&stagingTextureDesc, nullptr, m_stagingGradientTexture.GetAddressOf()));
+			m_cpuPyramid.Build(m_cpuField, m_threadPool);
+		}
+		BoundingBox GetObjectBounds(const SceneObjectData& object) const
+		{
+			// objects map the unit cube to world space
+			BoundingBox bounds(XMFLOAT3(0.5f, 0.5f, 0.5f), XMFLOAT3(0.5f, 0.5f, 0.5f));
+			bounds.Transform(bounds, object.transformMatrix);
+			return bounds;
+		}
+		BoundingBox GetBrickBounds(int x, int y, int z) const
+		{
+			// sim cells sit at index / (resolution + 2) in the unit cube
+			XMFLOAT3 gridSize(m_bufferDimensions.x + 2, m_bufferDimensions.y + 2, m_bufferDimensions.z + 2);
+			XMFLOAT3 minCorner(x * 4 / gridSize.x, y * 4 / gridSize.y, z * 4 / gridSize.z);
+			// up to the far face of the brick's last cell, so neighbouring bricks share a face
+			XMFLOAT3 maxCorner(std::min((x * 4 + 4) / gridSize.x, 1.0f), std::min((y * 4 + 4) / gridSize.y, 1.0f), std::min((z * 4 + 4) / gridSize.z, 1.0f));
+
+			BoundingBox bounds;
+			BoundingBox::CreateFromPoints(bounds, XMLoadFloat3(&minCorner), XMLoadFloat3(&maxCorner));
+			bounds.Transform(bounds, m_simulationTransform);
+			return bounds;
+		}
+		void MarkDirty(const BoundingBox& worldBounds)
+		{
+			// world bounds to the unit cube of the sim grid, then to bricks of 4 cells
+			BoundingBox local;
+			worldBounds.Transform(local, XMMatrixInverse(nullptr, m_simulationTransform));
 
-			textureUavDesc.Format = textureDesc.Format;
-			DX::ThrowIfFailed(device->CreateUnorderedAccessView(m_gradientTexture.Get(), &textureUavDesc, m_gradientUav.GetAddressOf()));
+			XMFLOAT3 gridSize(m_bufferDimensions.x + 2, m_bufferDimensions.y + 2, m_bufferDimensions.z + 2);
+			auto toBrick = [](float unit, float size, int count)
+			{
+				return std::max(0, std::min(int(std::floor(unit * size / 4.0f)), count - 1));
+			};
+			XMINT3 brickMin(
+				toBrick(local.Center.x - local.Extents.x, gridSize.x, m_brickCount.x),
+				toBrick(local.Center.y - local.Extents.y, gridSize.y, m_brickCount.y),
+				toBrick(local.Center.z - local.Extents.z, gridSize.z, m_brickCount.z));
+			XMINT3 brickMax(
+				toBrick(local.Center.x + local.Extents.x, gridSize.x, m_brickCount.x),
+				toBrick(local.Center.y + local.Extents.y, gridSize.y, m_brickCount.y),
+				toBrick(local.Center.z + local.Extents.z, gridSize.z, m_brickCount.z));
+
+			if (!m_dirty)
+			{
+				m_dirtyMin = brickMin;
+				m_dirtyMax = brickMax;
+				m_dirty = true;
+				return;
+			}
+			m_dirtyMin = XMINT3(std::min(m_dirtyMin.x, brickMin.x), std::min(m_dirtyMin.y, brickMin.y), std::min(m_dirtyMin.z, brickMin.z));
+			m_dirtyMax = XMINT3(std::max(m_dirtyMax.x, brickMax.x), std::max(m_dirtyMax.y, brickMax.y), std::max(m_dirtyMax.z, brickMax.z));
+		}
+		void UpdateBrickObjects(ID3D11DeviceContext* deviceContext)
+		{
+			if (m_objectsChanged)
+			{
+				std::vector<BoundingBox> bounds;
+				for (const SceneObjectData& object : m_sceneObjects)
+					bounds.push_back(GetObjectBounds(object));
+				m_objectBVH.Build(bounds);
+				m_objectsChanged = false;
+			}
 
-			textureSrvDesc.Format = textureDesc.Format;
-			DX::ThrowIfFailed(device->CreateShaderResourceView(m_gradientTexture.Get(), &textureSrvDesc, m_gradientSrv.GetAddressOf()));
+			// brick slices of the dirty region are independent, so they are split across the pool
+			auto queryBricks = [this](int begin, int end)
+			{
+				for (int z = m_dirtyMin.z + begin; z < m_dirtyMin.z + end; z++)
+					for (int y = m_dirtyMin.y; y <= m_dirtyMax.y; y++)
+						for (int x = m_dirtyMin.x; x <= m_dirtyMax.x; x++)
+							m_brickObjects[(z * m_brickCount.y + y) * m_brickCount.x + x] = m_objectBVH.Query(GetBrickBounds(x, y, z));
+			};
+			int slices = m_dirtyMax.z - m_dirtyMin.z + 1;
+			if (m_threadPool)
+				m_threadPool->ParallelFor(slices, 1, queryBricks);
+			else
+				queryBricks(0, slices);
+
+			deviceContext->UpdateSubresource(m_brickObjectsBuffer.Get(), 0, nullptr, m_brickObjects.data(), 0, 0);
 		}
 		void SetConstantBuffers(ID3D11DeviceContext* deviceContext)
 		{
+			SolidMaskBufferType params = {};
+			params.simulationTransform = XMMatrixTranspose(m_simulationTransform);
+			for (int i = 0; i < int(m_sceneObjects.size()); i++)
+			{
+				params.objects[i].sdfTransformInv = XMMatrixTranspose(XMMatrixInverse(nullptr, m_sceneObjects[i].transformMatrix));
+				params.objects[i].uniformScale = m_sceneObjects[i].uniformScale;
+			}
+			params.objectCount = int(m_sceneObjects.size());
+			params.brickOffset = m_dirtyMin;
+			params.distanceScale = m_distanceScale;
+
 			// set
-			m_sdfParamsBuffer->Apply(deviceContext, { XMMatrixTranspose(m_simulationTransform), XMMatrixTranspose(XMMatrixInverse(nullptr, m_sceneObjects[0].transformMatrix)), m_sceneObjects[0].uniformScale});
+			m_sdfParamsBuffer->Apply(deviceContext, params);
 			// bind
 			deviceContext->CSSetConstantBuffers(0, 1, m_sdfParamsBuffer->GetAddressOf());
 		}
@@ -219,16 +435,12 @@ namespace CustomEffects
 		{
 			deviceContext->CSSetUnorderedAccessViews(0, 1, m_uav.GetAddressOf(), nullptr);
 
-			for (int i = 0; i < m_sceneObjects.size(); i++)
-			{
-				deviceContext->CSSetShaderResources(0, 1, m_sceneObjects[i].sdf.GetAddressOf());
-			}
-		}
-
-		void SetGradientResourceViews(ID3D11DeviceContext* deviceContext)
-		{
-			deviceContext->CSSetUnorderedAccessViews(0, 1, m_gradientUav.GetAddressOf(), nullptr);
-			deviceContext->CSSetShaderResources(0, 1, m_srv.GetAddressOf());
+			// one slot per object, unused slots stay empty, followed by the brick object masks
+			ID3D11ShaderResourceView* srvs[kMaxSceneSDFObjects + 1] = {};
+			for (int i = 0; i < int(m_sceneObjects.size()); i++)
+				srvs[i] = m_sceneObjects[i].sdf.Get();
+			srvs[kMaxSceneSDFObjects] = m_brickObjectsSRV.Get();
+			deviceContext->CSSetShaderResources(0, kMaxSceneSDFObjects + 1, srvs);
 		}
 
 		void Unbind(ID3D11DeviceContext* deviceContext, UINT count)
@@ -236,8 +448,9 @@ namespace CustomEffects
 			std::vector<ID3D11ShaderResourceView*> nullSRVs(count, nullptr);
 			deviceContext->CSSetShaderResources(0, count, nullSRVs.data());
 
-			std::vector<ID3D11UnorderedAccessView*> nullUAVs(count, nullptr);
-			deviceContext->CSSetUnorderedAccessViews(0, count, nullUAVs.data(), nullptr);
+			// every pass writes a single UAV
+			ID3D11UnorderedAccessView* nullUAV = nullptr;
+			deviceContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
 
 			// Disable Compute Shader
 			deviceContext->CSSetShader(nullptr, nullptr, 0);
@@ -0,0 +1,297 @@
+#include "pch.h"
+#include "SDFField.h"
+
+SDFField::SDFField() :
+	m_resolution(0, 0, 0),
+	m_transform(XMMatrixIdentity()),
+	m_transformInv(XMMatrixIdentity())
+{
+}
+
+void SDFField::Reset(const XMINT3& resolution, const XMMATRIX& transform)
+{
+	size_t size = size_t(resolution.x) * resolution.y * resolution.z;
+	m_distances.resize(size);
+	m_resolution = resolution;
+	m_transform = transform;
+	m_transformInv = XMMatrixInverse(nullptr, transform);
+}
+
+XMFLOAT3 SDFField::ToFieldSpace(const XMFLOAT3& position) const
+{
+	XMFLOAT3 local;
+	XMStoreFloat3(&local, XMVector3Transform(XMLoadFloat3(&position), m_transformInv));
+	return local;
+}
+
+bool SDFField::Contains(const XMFLOAT3& position) const
+{
+	XMFLOAT3 fieldPosition = ToFieldSpace(position);
+	XMVECTOR local = XMLoadFloat3(&fieldPosition);
+	return XMVector3InBounds(XMVectorSubtract(local, XMVectorReplicate(0.5f)), XMVectorReplicate(0.5f));
+}
+
+float SDFField::Distance(const XMFLOAT3& position) const
+{
+	float distance;
+	Distances(&position, &distance, 1);
+	return distance;
+}
+
+XMFLOAT3 SDFField::Gradient(const XMFLOAT3& position) const
+{
+	XMFLOAT3 gradient;
+	Gradients(&position, &gradient, 1);
+	return gradient;
+}
+
+void SDFField::Distances(const XMFLOAT3* positions, float* distances, size_t count) const
+{
+	Packet packet;
+	for (size_t base = 0; base < count; base += 4)
+	{
+		size_t lanes = std::min<size_t>(4, count - base);
+		BuildPacket(positions + base, lanes, packet);
+
+		XMFLOAT4 result;
+		XMStoreFloat4(&result, Interpolate(packet));
+
+		const float* values = &result.x;
+		for (size_t lane = 0; lane < lanes; lane++)
+			distances[base + lane] = values[lane];
+	}
+}
+
+void SDFField::Gradients(const XMFLOAT3* positions, XMFLOAT3* gradients, size_t count) const
+{
+	// one sample to either side, pulled in at the borders so the difference stays inside the field
+	XMVECTOR step[3] =
+	{
+		XMVectorReplicate(1.0f / (m_resolution.x - 1)),
+		XMVectorReplicate(1.0f / (m_resolution.y - 1)),
+		XMVectorReplicate(1.0f / (m_resolution.z - 1)),
+	};
+
+	// field-space derivatives to world space: the gradient transforms with the inverse transpose
+	XMMATRIX toWorld = XMMatrixTranspose(m_transformInv);
+
+	Packet packet;
+	for (size_t base = 0; base < count; base += 4)
+	{
+		size_t lanes = std::min<size_t>(4, count - base);
+		XMVECTOR local[3];
+		ToFieldSpace(positions + base, lanes, local[0], local[1], local[2]);
+
+		XMVECTOR derivative[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			XMVECTOR offset[3] = { local[0], local[1], local[2] };
+			XMVECTOR lo = XMVectorSaturate(local[axis] - step[axis]);
+			XMVECTOR hi = XMVectorSaturate(local[axis] + step[axis]);
+
+			offset[axis] = hi;
+			BuildPacket(offset[0], offset[1], offset[2], packet);
+			XMVECTOR dHi = Interpolate(packet);
+
+			offset[axis] = lo;
+			BuildPacket(offset[0], offset[1], offset[2], packet);
+			XMVECTOR dLo = Interpolate(packet);
+
+			derivative[axis] = (dHi - dLo) / XMVectorMax(hi - lo, g_XMEpsilon);
+		}
+
+		// back to one vector per point
+		XMMATRIX aos = XMMatrixTranspose(XMMATRIX(derivative[0], derivative[1], derivative[2], XMVectorZero()));
+		for (size_t lane = 0; lane < lanes; lane++)
+			XMStoreFloat3(&gradients[base + lane], XMVector3TransformNormal(aos.r[lane], toWorld));
+	}
+}
+
+void SDFField::SphereCasts(const SDFSphereCast* casts, SDFHit* hits, size_t count) const
+{
+	// four rays are marched together so every iteration is one packet lookup
+	for (size_t base = 0; base < count; base += 4)
+	{
+		size_t lanes = std::min<size_t>(4, count - base);
+		float t[4] = {};
+		bool active[4] = {};
+		XMFLOAT3 points[4];
+		float distances[4];
+
+		for (size_t lane = 0; lane < lanes; lane++)
+		{
+			hits[base + lane] = { false, casts[base + lane].maxDistance, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0) };
+			active[lane] = true;
+		}
+
+		for (int i = 0; i < m_maxIterations; i++)
+		{
+			for (size_t lane = 0; lane < lanes; lane++)
+			{
+				const SDFSphereCast& cast = casts[base + lane];
+				XMStoreFloat3(&points[lane], XMLoadFloat3(&cast.origin) + XMLoadFloat3(&cast.direction) * t[lane]);
+			}
+			Distances(points, distances, lanes);
+
+			bool anyActive = false;
+			for (size_t lane = 0; lane < lanes; lane++)
+			{
+				if (!active[lane])
+					continue;
+
+				const SDFSphereCast& cast = casts[base + lane];
+				float clearance = distances[lane] - cast.radius;
+				if (clearance < m_hitEpsilon)
+				{
+					XMFLOAT3 normal = Gradient(points[lane]);
+					XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&normal)));
+					hits[base + lane] = { true, t[lane], points[lane], normal };
+					active[lane] = false;
+					continue;
+				}
+
+				t[lane] += std::max(clearance, m_minStep);
+				if (t[lane] > cast.maxDistance)
+					active[lane] = false;
+
+				anyActive |= active[lane];
+			}
+			if (!anyActive)
+				break;
+		}
+	}
+}
+
+void SDFField::CapsuleSweeps(const SDFCapsuleSweep* sweeps, SDFHit* hits, size_t count) const
+{
+	const int maxSamples = 16;
+	XMFLOAT3 points[maxSamples];
+	float distances[maxSamples];
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const SDFCapsuleSweep& sweep = sweeps[i];
+		hits[i] = { false, 1.0f, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0) };
+
+		XMVECTOR a = XMLoadFloat3(&sweep.a);
+		XMVECTOR axis = XMLoadFloat3(&sweep.b) - a;
+		XMVECTOR displacement = XMLoadFloat3(&sweep.displacement);
+		float length = XMVectorGetX(XMVector3Length(axis));
+		float displacementLength = XMVectorGetX(XMVector3Length(displacement));
+
+		// the capsule is covered by spheres along its axis, no further apart than its radius;
+		// the sag between neighbouring spheres is subtracted so the test stays conservative
+		int samples = length > 0.0f ? std::min(maxSamples, std::max(2, int(std::ceil(length / std::max(sweep.radius, 1e-4f))) + 1)) : 1;
+		float spacing = samples > 1 ? length / (samples - 1) : 0.0f;
+		float sag = sweep.radius - std::sqrt(std::max(0.0f, sweep.radius * sweep.radius - 0.25f * spacing * spacing));
+
+		float t = 0.0f;
+		for (int iteration = 0; iteration < m_maxIterations; iteration++)
+		{
+			XMVECTOR offset = a + displacement * t;
+			for (int s = 0; s < samples; s++)
+			{
+				float u = samples > 1 ? float(s) / (samples - 1) : 0.0f;
+				XMStoreFloat3(&points[s], offset + axis * u);
+			}
+			Distances(points, distances, samples);
+
+			int closest = int(std::min_element(distances, distances + samples) - distances);
+			float clearance = distances[closest] - sweep.radius - sag;
+			if (clearance < m_hitEpsilon)
+			{
+				XMFLOAT3 normal = Gradient(points[closest]);
+				XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&normal)));
+				hits[i] = { true, t, points[closest], normal };
+				break;
+			}
+
+			if (displacementLength <= 0.0f)
+				break;
+
+			t += std::max(clearance, m_minStep) / displacementLength;
+			if (t > 1.0f)
+				break;
+		}
+	}
+}
+
+void SDFField::ToFieldSpace(const XMFLOAT3* positions, size_t count, XMVECTOR& x, XMVECTOR& y, XMVECTOR& z) const
+{
+	// unused lanes repeat the last position
+	XMVECTOR local[4];
+	for (size_t lane = 0; lane < 4; lane++)
+		local[lane] = XMVector3Transform(XMLoadFloat3(&positions[std::min(lane, count - 1)]), m_transformInv);
+
+	// one vector per axis, one lane per point
+	XMMATRIX soa = XMMatrixTranspose(XMMATRIX(local[0], local[1], local[2], local[3]));
+	x = soa.r[0];
+	y = soa.r[1];
+	z = soa.r[2];
+}
+
+void SDFField::BuildPacket(const XMFLOAT3* positions, size_t count, Packet& packet) const
+{
+	XMVECTOR x, y, z;
+	ToFieldSpace(positions, count, x, y, z);
+	BuildPacket(x, y, z, packet);
+}
+
+void SDFField::BuildPacket(XMVECTOR x, XMVECTOR y, XMVECTOR z, Packet& packet) const
+{
+	XMVECTOR px = XMVectorSaturate(x) * float(m_resolution.x - 1);
+	XMVECTOR py = XMVectorSaturate(y) * float(m_resolution.y - 1);
+	XMVECTOR pz = XMVectorSaturate(z) * float(m_resolution.z - 1);
+
+	XMVECTOR x0 = XMVectorFloor(px);
+	XMVECTOR y0 = XMVectorFloor(py);
+	XMVECTOR z0 = XMVectorFloor(pz);
+	packet.fx = px - x0;
+	packet.fy = py - y0;
+	packet.fz = pz - z0;
+
+	XMFLOAT4 fx0, fy0, fz0;
+	XMStoreFloat4(&fx0, x0);
+	XMStoreFloat4(&fy0, y0);
+	XMStoreFloat4(&fz0, z0);
+
+	uint32_t strideY = m_resolution.x;
+	uint32_t strideZ = m_resolution.x * m_resolution.y;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		uint32_t ix0 = uint32_t((&fx0.x)[lane]), iy0 = uint32_t((&fy0.x)[lane]), iz0 = uint32_t((&fz0.x)[lane]);
+		uint32_t ix1 = std::min(ix0 + 1, uint32_t(m_resolution.x - 1));
+		uint32_t iy1 = std::min(iy0 + 1, uint32_t(m_resolution.y - 1));
+		uint32_t iz1 = std::min(iz0 + 1, uint32_t(m_resolution.z - 1));
+
+		// corner c: bit 0 selects x1, bit 1 selects y1, bit 2 selects z1
+		for (int c = 0; c < 8; c++)
+		{
+			uint32_t x = (c & 1) ? ix1 : ix0;
+			uint32_t y = (c & 2) ? iy1 : iy0;
+			uint32_t z = (c & 4) ? iz1 : iz0;
+			packet.corners[c][lane] = z * strideZ + y * strideY + x;
+		}
+	}
+}
+
+XMVECTOR SDFField::Interpolate(const Packet& packet) const
+{
+	const float* values = m_distances.data();
+	XMVECTOR v[8];
+	for (int c = 0; c < 8; c++)
+	{
+		const uint32_t* corner = packet.corners[c];
+		v[c] = XMVectorSet(values[corner[0]], values[corner[1]], values[corner[2]], values[corner[3]]);
+	}
+
+	XMVECTOR v00 = XMVectorLerpV(v[0], v[1], packet.fx);
+	XMVECTOR v10 = XMVectorLerpV(v[2], v[3], packet.fx);
+	XMVECTOR v01 = XMVectorLerpV(v[4], v[5], packet.fx);
+	XMVECTOR v11 = XMVectorLerpV(v[6], v[7], packet.fx);
+
+	XMVECTOR v0 = XMVectorLerpV(v00, v10, packet.fy);
+	XMVECTOR v1 = XMVectorLerpV(v01, v11, packet.fy);
+
+	return XMVectorLerpV(v0, v1, packet.fz);
+}
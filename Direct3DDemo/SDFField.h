@@ -0,0 +1,87 @@
+#pragma once
+// SDFField
+// CPU copy of a signed distance field, together with the resolution and the transform that maps the
+// field's unit cube to world space. Distances are stored in world units; gradients are not stored but
+// taken on demand by central differences of the interpolated distance, one sample apart.
+// Queries take world-space positions and are batched so that many bodies can be resolved per call;
+// the batched paths evaluate four points at a time with DirectXMath vectors.
+
+#include "pch.h"
+#include <vector>
+
+using namespace DirectX;
+
+struct SDFSphereCast
+{
+	XMFLOAT3 origin;
+	XMFLOAT3 direction; // normalized
+	float radius;
+	float maxDistance;
+};
+
+struct SDFCapsuleSweep
+{
+	XMFLOAT3 a, b; // capsule axis end points at the start of the sweep
+	float radius;
+	XMFLOAT3 displacement;
+};
+
+struct SDFHit
+{
+	bool hit;
+	float t; // distance along the ray for sphere casts, fraction of the displacement for capsule sweeps
+	XMFLOAT3 position; // sphere centre, or the closest point on the capsule axis, at the time of impact
+	XMFLOAT3 normal;
+};
+
+class SDFField
+{
+public:
+	SDFField();
+
+	// resizes the storage; contents are filled by the owner through the mutable accessors
+	void Reset(const XMINT3& resolution, const XMMATRIX& transform);
+
+	float* GetDistanceData() { return m_distances.data(); };
+
+	const std::vector<float>& GetDistances() const { return m_distances; };
+	const XMINT3& GetResolution() const { return m_resolution; };
+	XMMATRIX GetTransform() const { return m_transform; };
+	bool IsEmpty() const { return m_distances.empty(); };
+
+	// world position to the field's unit cube
+	XMFLOAT3 ToFieldSpace(const XMFLOAT3& position) const;
+	bool Contains(const XMFLOAT3& position) const;
+
+	float Distance(const XMFLOAT3& position) const;
+	XMFLOAT3 Gradient(const XMFLOAT3& position) const;
+
+	void Distances(const XMFLOAT3* positions, float* distances, size_t count) const;
+	void Gradients(const XMFLOAT3* positions, XMFLOAT3* gradients, size_t count) const;
+	void SphereCasts(const SDFSphereCast* casts, SDFHit* hits, size_t count) const;
+	void CapsuleSweeps(const SDFCapsuleSweep* sweeps, SDFHit* hits, size_t count) const;
+
+	// marching parameters shared by the casts
+	void SetMarchParams(int maxIterations, float hitEpsilon, float minStep) { m_maxIterations = maxIterations; m_hitEpsilon = hitEpsilon; m_minStep = minStep; };
+
+private:
+	// corner indices and weights of four trilinear lookups, laid out one lane per point
+	struct Packet
+	{
+		uint32_t corners[8][4];
+		XMVECTOR fx, fy, fz;
+	};
+
+	// field-space coordinates of four points, one vector per axis
+	void ToFieldSpace(const XMFLOAT3* positions, size_t count, XMVECTOR& x, XMVECTOR& y, XMVECTOR& z) const;
+	void BuildPacket(const XMFLOAT3* positions, size_t count, Packet& packet) const;
+	void BuildPacket(XMVECTOR x, XMVECTOR y, XMVECTOR z, Packet& packet) const;
+	XMVECTOR Interpolate(const Packet& packet) const;
+
+	std::vector<float> m_distances;
+	XMINT3 m_resolution;
+	XMMATRIX m_transform, m_transformInv;
+
+	int m_maxIterations = 64;
+	float m_hitEpsilon = 1e-3f, m_minStep = 1e-3f;
+};
@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "SDFObjectBVH.h"
+
+void SDFObjectBVH::Build(const std::vector<BoundingBox>& bounds)
+{
+	m_bounds = bounds;
+	m_nodes.clear();
+	m_indices.resize(bounds.size());
+	for (int i = 0; i < int(bounds.size()); i++)
+		m_indices[i] = i;
+
+	if (!bounds.empty())
+		BuildNode(bounds, 0, int(bounds.size()));
+}
+
+uint32_t SDFObjectBVH::Query(const BoundingBox& box) const
+{
+	uint32_t mask = 0;
+	if (m_nodes.empty())
+		return mask;
+
+	int stack[64];
+	int size = 0;
+	stack[size++] = 0;
+	while (size > 0)
+	{
+		const Node& node = m_nodes[stack[--size]];
+		if (!node.bounds.Intersects(box))
+			continue;
+
+		if (node.left < 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				if (m_bounds[m_indices[i]].Intersects(box))
+					mask |= 1u << m_indices[i];
+			}
+			continue;
+		}
+		stack[size++] = node.left;
+		stack[size++] = node.right;
+	}
+	return mask;
+}
+
+int SDFObjectBVH::BuildNode(const std::vector<BoundingBox>& bounds, int first, int count)
+{
+	int index = int(m_nodes.size());
+	m_nodes.push_back({});
+
+	BoundingBox nodeBounds = bounds[m_indices[first]];
+	for (int i = first + 1; i < first + count; i++)
+		BoundingBox::CreateMerged(nodeBounds, nodeBounds, bounds[m_indices[i]]);
+	m_nodes[index].bounds = nodeBounds;
+
+	if (count <= kLeafSize)
+	{
+		m_nodes[index].left = m_nodes[index].right = -1;
+		m_nodes[index].first = first;
+		m_nodes[index].count = count;
+		return index;
+	}
+
+	const float* extents = &nodeBounds.Extents.x;
+	int axis = 0;
+	if (extents[1] > extents[axis])
+		axis = 1;
+	if (extents[2] > extents[axis])
+		axis = 2;
+
+	int half = count / 2;
+	std::nth_element(m_indices.begin() + first, m_indices.begin() + first + half, m_indices.begin() + first + count, [&](int a, int b)
+	{
+		return (&bounds[a].Center.x)[axis] < (&bounds[b].Center.x)[axis];
+	});
+
+	// children are built after this node, which may reallocate m_nodes, so store them through the index
+	int left = BuildNode(bounds, first, half);
+	int right = BuildNode(bounds, first + half, count - half);
+	m_nodes[index].left = left;
+	m_nodes[index].right = right;
+	m_nodes[index].first = first;
+	m_nodes[index].count = count;
+	return index;
+}
@@ -0,0 +1,36 @@
+#pragma once
+// SDFObjectBVH
+// Bounding volume hierarchy over the world-space bounds of the scene SDF objects. Built top down by
+// splitting each node at the median of its longest axis; queries return the objects whose bounds overlap
+// a box as a bit mask, one bit per object index.
+
+#include "pch.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+using namespace DirectX;
+
+class SDFObjectBVH
+{
+public:
+	void Build(const std::vector<BoundingBox>& bounds);
+
+	uint32_t Query(const BoundingBox& box) const;
+	bool IsEmpty() const { return m_nodes.empty(); };
+
+private:
+	struct Node
+	{
+		BoundingBox bounds;
+		int left, right; // children, -1 for leaves
+		int first, count; // range of m_indices held by a leaf
+	};
+
+	int BuildNode(const std::vector<BoundingBox>& bounds, int first, int count);
+
+	static const int kLeafSize = 2;
+
+	std::vector<Node> m_nodes;
+	std::vector<int> m_indices;
+	std::vector<BoundingBox> m_bounds;
+};
@@ -0,0 +1,332 @@
+#include "pch.h"
+#include "SDFPyramid.h"
+#include "SDFField.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+
+SDFPyramid::SDFPyramid() :
+	m_sampleResolution(0, 0, 0),
+	m_transformInv(XMMatrixIdentity())
+{
+}
+
+void SDFPyramid::Build(const SDFField& field, ThreadPool* pool)
+{
+	m_levels.clear();
+	if (field.IsEmpty())
+		return;
+
+	m_sampleResolution = field.GetResolution();
+	m_transformInv = XMMatrixInverse(nullptr, field.GetTransform());
+
+	const XMINT3& samples = m_sampleResolution;
+	const float* distances = field.GetDistances().data();
+
+	// level 0: one node per cell, bounded by its eight corner samples
+	Level cells;
+	cells.resolution = XMINT3(samples.x - 1, samples.y - 1, samples.z - 1);
+	size_t cellCount = size_t(cells.resolution.x) * cells.resolution.y * cells.resolution.z;
+	cells.minimum.resize(cellCount);
+	cells.maximum.resize(cellCount);
+
+	ForEachSlice(pool, cells.resolution.z, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; z++)
+		{
+			for (int y = 0; y < cells.resolution.y; y++)
+			{
+				for (int x = 0; x < cells.resolution.x; x++)
+				{
+					float lo = std::numeric_limits<float>::max(), hi = -std::numeric_limits<float>::max();
+					for (int c = 0; c < 8; c++)
+					{
+						size_t sample = (size_t(z + ((c >> 2) & 1)) * samples.y + y + ((c >> 1) & 1)) * samples.x + x + (c & 1);
+						lo = std::min(lo, distances[sample]);
+						hi = std::max(hi, distances[sample]);
+					}
+					size_t node = NodeIndex(cells, x, y, z);
+					cells.minimum[node] = lo;
+					cells.maximum[node] = hi;
+				}
+			}
+		}
+	});
+	m_levels.push_back(std::move(cells));
+
+	while (true)
+	{
+		const Level& fine = m_levels.back();
+		if (fine.resolution.x == 1 && fine.resolution.y == 1 && fine.resolution.z == 1)
+			break;
+
+		Level coarse;
+		coarse.resolution = XMINT3((fine.resolution.x + 1) / 2, (fine.resolution.y + 1) / 2, (fine.resolution.z + 1) / 2);
+		size_t nodeCount = size_t(coarse.resolution.x) * coarse.resolution.y * coarse.resolution.z;
+		coarse.minimum.resize(nodeCount);
+		coarse.maximum.resize(nodeCount);
+
+		ForEachSlice(pool, coarse.resolution.z, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; z++)
+			{
+				for (int y = 0; y < coarse.resolution.y; y++)
+				{
+					for (int x = 0; x < coarse.resolution.x; x++)
+					{
+						// odd resolutions leave the last node with fewer children
+						float lo = std::numeric_limits<float>::max(), hi = -std::numeric_limits<float>::max();
+						for (int cz = 2 * z; cz < std::min(2 * z + 2, fine.resolution.z); cz++)
+							for (int cy = 2 * y; cy < std::min(2 * y + 2, fine.resolution.y); cy++)
+								for (int cx = 2 * x; cx < std::min(2 * x + 2, fine.resolution.x); cx++)
+								{
+									size_t child = NodeIndex(fine, cx, cy, cz);
+									lo = std::min(lo, fine.minimum[child]);
+									hi = std::max(hi, fine.maximum[child]);
+								}
+
+						size_t node = NodeIndex(coarse, x, y, z);
+						coarse.minimum[node] = lo;
+						coarse.maximum[node] = hi;
+					}
+				}
+			}
+		});
+		m_levels.push_back(std::move(coarse));
+	}
+}
+
+SDFRange SDFPyramid::QueryCells(const XMINT3& minCell, const XMINT3& maxCell) const
+{
+	// the finest level at which the range covers at most two nodes per axis
+	int level = 0;
+	while (level + 1 < int(m_levels.size()) &&
+		((maxCell.x >> level) - (minCell.x >> level) > 1 ||
+		 (maxCell.y >> level) - (minCell.y >> level) > 1 ||
+		 (maxCell.z >> level) - (minCell.z >> level) > 1))
+		level++;
+
+	const Level& nodes = m_levels[level];
+	SDFRange range = { std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+	for (int z = minCell.z >> level; z <= (maxCell.z >> level); z++)
+		for (int y = minCell.y >> level; y <= (maxCell.y >> level); y++)
+			for (int x = minCell.x >> level; x <= (maxCell.x >> level); x++)
+			{
+				size_t node = NodeIndex(nodes, x, y, z);
+				range.minDistance = std::min(range.minDistance, nodes.minimum[node]);
+				range.maxDistance = std::max(range.maxDistance, nodes.maximum[node]);
+			}
+	return range;
+}
+
+SDFRange SDFPyramid::Query(const BoundingBox& box) const
+{
+	BoundingBox local;
+	box.Transform(local, m_transformInv);
+
+	XMFLOAT3 minCorner, maxCorner;
+	XMStoreFloat3(&minCorner, XMLoadFloat3(&local.Center) - XMLoadFloat3(&local.Extents));
+	XMStoreFloat3(&maxCorner, XMLoadFloat3(&local.Center) + XMLoadFloat3(&local.Extents));
+
+	return QueryCells(ToCell(minCorner), ToCell(maxCorner));
+}
+
+SDFRegion SDFPyramid::Classify(const BoundingBox& box, float clearance) const
+{
+	SDFRange range = Query(box);
+	if (range.minDistance > clearance)
+		return SDFRegion::Free;
+	if (range.maxDistance < 0.0f)
+		return SDFRegion::Solid;
+	return SDFRegion::Surface;
+}
+
+float SDFPyramid::SkipDistance(const XMFLOAT3& origin, const XMFLOAT3& direction, float radius, float maxDistance) const
+{
+	if (m_levels.empty())
+		return 0.0f;
+
+	// march in sample coordinates, where the node boundaries are powers of two
+	XMVECTOR scale = XMVectorSet(float(m_sampleResolution.x - 1), float(m_sampleResolution.y - 1), float(m_sampleResolution.z - 1), 0.0f);
+	XMFLOAT3 o, d;
+	XMStoreFloat3(&o, XMVector3Transform(XMLoadFloat3(&origin), m_transformInv) * scale);
+	XMStoreFloat3(&d, XMVector3TransformNormal(XMLoadFloat3(&direction), m_transformInv) * scale);
+
+	const float* po = &o.x;
+	const float* pd = &d.x;
+	const int* sampleResolution = &m_sampleResolution.x;
+
+	// a nudge past each node boundary, a thousandth of a cell
+	float cellsPerUnit = XMVectorGetX(XMVector3Length(XMLoadFloat3(&d)));
+	float nudge = cellsPerUnit > 0.0f ? 1e-3f / cellsPerUnit : maxDistance;
+
+	float t = 0.0f;
+	while (t < maxDistance)
+	{
+		XMFLOAT3 sample(o.x + d.x * t, o.y + d.y * t, o.z + d.z * t);
+		const float* ps = &sample.x;
+		bool inside = true;
+		for (int axis = 0; axis < 3; axis++)
+			inside &= ps[axis] >= 0.0f && ps[axis] <= float(sampleResolution[axis] - 1);
+		if (!inside)
+			break;
+
+		// coarser nodes never have a larger minimum, so the first level that is too close ends the search
+		XMINT3 cell = ToCell(XMFLOAT3(sample.x / (m_sampleResolution.x - 1), sample.y / (m_sampleResolution.y - 1), sample.z / (m_sampleResolution.z - 1)));
+		int level = -1;
+		for (int l = 0; l < int(m_levels.size()); l++)
+		{
+			const Level& nodes = m_levels[l];
+			if (nodes.minimum[NodeIndex(nodes, cell.x >> l, cell.y >> l, cell.z >> l)] <= radius)
+				break;
+			level = l;
+		}
+		if (level < 0)
+			break;
+
+		// leave the node through the nearest face the ray is heading for
+		const int* pc = &cell.x;
+		float exit = maxDistance;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (pd[axis] == 0.0f)
+				continue;
+
+			int node = pc[axis] >> level;
+			float boundary = pd[axis] > 0.0f ? float(std::min((node + 1) << level, sampleResolution[axis] - 1)) : float(node << level);
+			exit = std::min(exit, (boundary - po[axis]) / pd[axis]);
+		}
+		t = std::max(exit, t) + nudge;
+	}
+	return std::min(t, maxDistance);
+}
+
+XMINT3 SDFPyramid::ToCell(const XMFLOAT3& local) const
+{
+	// same clamping as SDFField's lookups, a position on a cell face belongs to the cell above it
+	auto cell = [](float u, int samples)
+	{
+		float position = std::max(0.0f, std::min(u, 1.0f)) * (samples - 1);
+		return std::min(int(position), samples - 2);
+	};
+	return XMINT3(cell(local.x, m_sampleResolution.x), cell(local.y, m_sampleResolution.y), cell(local.z, m_sampleResolution.z));
+}
+
+void SDFPyramid::WriteBenchmark(const std::string& filename, const SDFField& field) const
+{
+	std::ofstream file(filename);
+	if (!file || m_levels.empty())
+		return;
+
+	file << "query,size_cells,count,dense_ms,pyramid_ms,speedup,decided,mismatches\n";
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	XMMATRIX transform = field.GetTransform();
+	const XMINT3& resolution = field.GetResolution();
+	float cellSize = XMVectorGetX(XMVector3Length(XMVector3TransformNormal(XMVectorSet(1.0f / (resolution.x - 1), 0.0f, 0.0f, 0.0f), transform)));
+
+	auto elapsed = [](std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	// boxes: dense classification samples the field at every sample spacing across the box
+	const int boxCount = 2000;
+	std::vector<XMFLOAT3> points;
+	std::vector<float> distances;
+	for (int size : { 2, 4, 8, 16, 32 })
+	{
+		std::vector<BoundingBox> boxes(boxCount);
+		float extent = 0.5f * size / (resolution.x - 1);
+		for (BoundingBox& box : boxes)
+		{
+			XMFLOAT3 centre(extent + unit(random) * (1.0f - 2.0f * extent), extent + unit(random) * (1.0f - 2.0f * extent), extent + unit(random) * (1.0f - 2.0f * extent));
+			BoundingBox(centre, XMFLOAT3(extent, extent, extent)).Transform(box, transform);
+		}
+
+		std::vector<SDFRegion> dense(boxCount), pyramid(boxCount);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < boxCount; i++)
+		{
+			XMVECTOR minCorner = XMLoadFloat3(&boxes[i].Center) - XMLoadFloat3(&boxes[i].Extents);
+			XMVECTOR span = XMLoadFloat3(&boxes[i].Extents) * 2.0f;
+			points.clear();
+			for (int z = 0; z <= size; z++)
+				for (int y = 0; y <= size; y++)
+					for (int x = 0; x <= size; x++)
+					{
+						XMFLOAT3 point;
+						XMStoreFloat3(&point, minCorner + span * XMVectorSet(float(x), float(y), float(z), 0.0f) / float(size));
+						points.push_back(point);
+					}
+			distances.resize(points.size());
+			field.Distances(points.data(), distances.data(), points.size());
+
+			auto range = std::minmax_element(distances.begin(), distances.end());
+			dense[i] = *range.first > 0.0f ? SDFRegion::Free : (*range.second < 0.0f ? SDFRegion::Solid : SDFRegion::Surface);
+		}
+		double denseTime = elapsed(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < boxCount; i++)
+			pyramid[i] = Classify(boxes[i]);
+		double pyramidTime = elapsed(start);
+
+		// the pyramid may leave a box undecided, but must never contradict the dense answer
+		int decided = 0, mismatches = 0;
+		for (int i = 0; i < boxCount; i++)
+		{
+			if (pyramid[i] != SDFRegion::Surface)
+			{
+				decided++;
+				mismatches += pyramid[i] != dense[i];
+			}
+		}
+		file << "box," << size << "," << boxCount << "," << denseTime << "," << pyramidTime << "," << denseTime / std::max(pyramidTime, 1e-6) << ","
+			<< decided << "," << mismatches << "\n";
+	}
+
+	// sphere casts: the pyramid moves each origin past the free nodes before the usual march
+	const int castCount = 4000;
+	std::vector<SDFSphereCast> casts(castCount), skipped(castCount);
+	for (SDFSphereCast& cast : casts)
+	{
+		XMFLOAT3 origin(unit(random), unit(random), unit(random));
+		XMStoreFloat3(&cast.origin, XMVector3Transform(XMLoadFloat3(&origin), transform));
+		XMFLOAT3 direction(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f);
+		XMStoreFloat3(&cast.direction, XMVector3Normalize(XMLoadFloat3(&direction)));
+		cast.radius = cellSize * 0.5f;
+		cast.maxDistance = cellSize * (resolution.x - 1);
+	}
+
+	std::vector<SDFHit> denseHits(castCount), pyramidHits(castCount);
+	auto start = std::chrono::high_resolution_clock::now();
+	field.SphereCasts(casts.data(), denseHits.data(), castCount);
+	double denseTime = elapsed(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	std::vector<float> skips(castCount);
+	for (int i = 0; i < castCount; i++)
+	{
+		skips[i] = SkipDistance(casts[i].origin, casts[i].direction, casts[i].radius, casts[i].maxDistance);
+		skipped[i] = casts[i];
+		XMStoreFloat3(&skipped[i].origin, XMLoadFloat3(&casts[i].origin) + XMLoadFloat3(&casts[i].direction) * skips[i]);
+		skipped[i].maxDistance -= skips[i];
+	}
+	field.SphereCasts(skipped.data(), pyramidHits.data(), castCount);
+	double pyramidTime = elapsed(start);
+
+	// the march overshoots the surface by up to its hit epsilon either way, a cell is plenty of tolerance
+	int hits = 0, mismatches = 0;
+	for (int i = 0; i < castCount; i++)
+	{
+		hits += denseHits[i].hit;
+		bool agree = denseHits[i].hit == pyramidHits[i].hit && (!denseHits[i].hit || std::abs(denseHits[i].t - (pyramidHits[i].t + skips[i])) < cellSize);
+		mismatches += !agree;
+	}
+	file << "sphere_cast,1," << castCount << "," << denseTime << "," << pyramidTime << "," << denseTime / std::max(pyramidTime, 1e-6) << ","
+		<< hits << "," << mismatches << "\n";
+}
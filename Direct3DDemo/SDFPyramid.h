@@ -0,0 +1,70 @@
+#pragma once
+// SDFPyramid
+// Min/max pyramid over the cells of an SDFField. Level 0 stores, for every cell between eight samples, the
+// smallest and largest of its corner samples, which bound the trilinear distance anywhere inside the cell.
+// Each coarser level halves the resolution and keeps the min/max of its up to eight children.
+// A box query picks the finest level at which the box spans at most two nodes per axis, so any box costs
+// at most eight lookups. The bounds are conservative: they may be looser than the field, never tighter.
+
+#include "pch.h"
+#include <DirectXCollision.h>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+class SDFField;
+class ThreadPool;
+
+enum class SDFRegion
+{
+	Free, // every point is farther than the clearance from the surface
+	Solid, // every point is inside
+	Surface, // anything else, the field has to be sampled
+};
+
+struct SDFRange
+{
+	float minDistance, maxDistance;
+};
+
+class SDFPyramid
+{
+public:
+	SDFPyramid();
+
+	// pool may be null, in which case the build runs on the calling thread
+	void Build(const SDFField& field, ThreadPool* pool);
+	bool IsEmpty() const { return m_levels.empty(); };
+
+	// bounds of the distance over a world-space box
+	SDFRange Query(const BoundingBox& box) const;
+	SDFRegion Classify(const BoundingBox& box, float clearance = 0.0f) const;
+
+	// how far a sphere can travel along a ray before it enters a node that may lie within its radius of the
+	// surface; marching can start from there. direction is normalized, the result is at most maxDistance
+	float SkipDistance(const XMFLOAT3& origin, const XMFLOAT3& direction, float radius, float maxDistance) const;
+
+	// bounds over the inclusive cell range, in grid coordinates
+	SDFRange QueryCells(const XMINT3& minCell, const XMINT3& maxCell) const;
+
+	int GetLevelCount() const { return int(m_levels.size()); };
+	const XMINT3& GetLevelResolution(int level) const { return m_levels[level].resolution; };
+
+	// times box classification and sphere casts against dense sampling of the field, writes a CSV file
+	void WriteBenchmark(const std::string& filename, const SDFField& field) const;
+
+private:
+	struct Level
+	{
+		XMINT3 resolution;
+		std::vector<float> minimum, maximum;
+	};
+
+	size_t NodeIndex(const Level& level, int x, int y, int z) const { return (size_t(z) * level.resolution.y + y) * level.resolution.x + x; };
+	XMINT3 ToCell(const XMFLOAT3& local) const;
+
+	std::vector<Level> m_levels;
+	XMINT3 m_sampleResolution;
+	XMMATRIX m_transformInv;
+};
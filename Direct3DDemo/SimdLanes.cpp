@@ -0,0 +1,56 @@
+#include "SimdLanes.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	struct CpuFeatures
+	{
+		bool avx2 = false;
+		bool avx512 = false;
+
+		CpuFeatures()
+		{
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return;
+
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+			if (!osxsave || !avx)
+				return;
+
+			// the OS has to save the ymm registers for AVX2 and the opmask and zmm registers for AVX-512
+			unsigned long long xcr0 = _xgetbv(0);
+			bool ymm = (xcr0 & 0x6) == 0x6, zmm = (xcr0 & 0xe6) == 0xe6;
+
+			__cpuidex(info, 7, 0);
+			avx2 = ymm && (info[1] & (1 << 5)) != 0;
+			avx512 = zmm && (info[1] & (1 << 16)) != 0;
+#else
+			avx2 = __builtin_cpu_supports("avx2");
+			avx512 = __builtin_cpu_supports("avx512f");
+#endif
+		}
+	};
+
+	const CpuFeatures& Features()
+	{
+		static CpuFeatures features;
+		return features;
+	}
+}
+
+bool SimdLanes::IsAvx2Supported()
+{
+	return Features().avx2;
+}
+
+bool SimdLanes::IsAvx512Supported()
+{
+	return Features().avx512;
+}
@@ -0,0 +1,125 @@
+#pragma once
+// SimdLanes
+// Thin wrappers over the AVX2 and AVX-512 intrinsics with a common set of operations, so packet code can be
+// written once as a template over the lane width. Masks are whatever the instruction set compares into: a
+// float vector for AVX2, a bit mask for AVX-512. Both widths are always built and the rest of the build stays at
+// the baseline; callers check IsSupported before running one. MSVC compiles these intrinsics anywhere, while gcc
+// and clang only compile them into functions built for their instruction set: the lane functions carry it as an
+// attribute, and code templated over the lanes is defined between SIMD_LANES_BEGIN_AVX2 or _AVX512 and
+// SIMD_LANES_END, which give it to every function in between, lambdas included.
+
+#include <immintrin.h>
+#include <cstdint>
+
+#if defined(__clang__)
+#define SIMD_LANES_AVX2 __attribute__((target("avx2")))
+#define SIMD_LANES_AVX512 __attribute__((target("avx512f")))
+#define SIMD_LANES_BEGIN_AVX2 _Pragma("clang attribute push (__attribute__((target(\"avx2\"))), apply_to = function)")
+#define SIMD_LANES_BEGIN_AVX512 _Pragma("clang attribute push (__attribute__((target(\"avx512f\"))), apply_to = function)")
+#define SIMD_LANES_END _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#define SIMD_LANES_AVX2 __attribute__((target("avx2")))
+#define SIMD_LANES_AVX512 __attribute__((target("avx512f")))
+#define SIMD_LANES_BEGIN_AVX2 _Pragma("GCC push_options") _Pragma("GCC target(\"avx2\")")
+#define SIMD_LANES_BEGIN_AVX512 _Pragma("GCC push_options") _Pragma("GCC target(\"avx512f\")")
+#define SIMD_LANES_END _Pragma("GCC pop_options")
+#else
+#define SIMD_LANES_AVX2
+#define SIMD_LANES_AVX512
+#define SIMD_LANES_BEGIN_AVX2
+#define SIMD_LANES_BEGIN_AVX512
+#define SIMD_LANES_END
+#endif
+
+namespace SimdLanes
+{
+	bool IsAvx2Supported();
+	bool IsAvx512Supported();
+
+	inline int CountLanes(uint32_t mask)
+	{
+		int count = 0;
+		for (; mask; mask &= mask - 1)
+			count++;
+		return count;
+	}
+
+	struct Avx2
+	{
+		static constexpr int kWidth = 8;
+		typedef __m256 Float;
+		typedef __m256i Int;
+		typedef __m256 Mask;
+
+		static bool IsSupported() { return IsAvx2Supported(); };
+
+		SIMD_LANES_AVX2 static Float Set1(float x) { return _mm256_set1_ps(x); };
+		SIMD_LANES_AVX2 static Float Load(const float* p) { return _mm256_load_ps(p); };
+		SIMD_LANES_AVX2 static void Store(float* p, Float a) { _mm256_store_ps(p, a); };
+
+		SIMD_LANES_AVX2 static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); };
+		SIMD_LANES_AVX2 static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); };
+		SIMD_LANES_AVX2 static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); };
+		SIMD_LANES_AVX2 static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); };
+		SIMD_LANES_AVX2 static Float Min(Float a, Float b) { return _mm256_min_ps(a, b); };
+		SIMD_LANES_AVX2 static Float Max(Float a, Float b) { return _mm256_max_ps(a, b); };
+		SIMD_LANES_AVX2 static Float Sqrt(Float a) { return _mm256_sqrt_ps(a); };
+		SIMD_LANES_AVX2 static Float Floor(Float a) { return _mm256_floor_ps(a); };
+
+		SIMD_LANES_AVX2 static Mask Less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); };
+		SIMD_LANES_AVX2 static Mask LessEqual(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); };
+		SIMD_LANES_AVX2 static Mask Greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); };
+		SIMD_LANES_AVX2 static Mask GreaterEqual(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); };
+		SIMD_LANES_AVX2 static Mask And(Mask a, Mask b) { return _mm256_and_ps(a, b); };
+		SIMD_LANES_AVX2 static Mask Or(Mask a, Mask b) { return _mm256_or_ps(a, b); };
+		// a and not b
+		SIMD_LANES_AVX2 static Mask AndNot(Mask a, Mask b) { return _mm256_andnot_ps(b, a); };
+		SIMD_LANES_AVX2 static bool Any(Mask m) { return _mm256_movemask_ps(m) != 0; };
+		SIMD_LANES_AVX2 static uint32_t Bits(Mask m) { return uint32_t(_mm256_movemask_ps(m)); };
+		// a where the mask is set, b elsewhere
+		SIMD_LANES_AVX2 static Float Select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b, a, m); };
+
+		SIMD_LANES_AVX2 static Int ToInt(Float a) { return _mm256_cvttps_epi32(a); };
+		SIMD_LANES_AVX2 static Float Gather(const float* base, Int index) { return _mm256_i32gather_ps(base, index, 4); };
+		// 2^n for integral n in the normal range
+		SIMD_LANES_AVX2 static Float Exp2Int(Float n) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127)), 23)); };
+	};
+
+	struct Avx512
+	{
+		static constexpr int kWidth = 16;
+		typedef __m512 Float;
+		typedef __m512i Int;
+		typedef __mmask16 Mask;
+
+		static bool IsSupported() { return IsAvx512Supported(); };
+
+		SIMD_LANES_AVX512 static Float Set1(float x) { return _mm512_set1_ps(x); };
+		SIMD_LANES_AVX512 static Float Load(const float* p) { return _mm512_load_ps(p); };
+		SIMD_LANES_AVX512 static void Store(float* p, Float a) { _mm512_store_ps(p, a); };
+
+		SIMD_LANES_AVX512 static Float Add(Float a, Float b) { return _mm512_add_ps(a, b); };
+		SIMD_LANES_AVX512 static Float Sub(Float a, Float b) { return _mm512_sub_ps(a, b); };
+		SIMD_LANES_AVX512 static Float Mul(Float a, Float b) { return _mm512_mul_ps(a, b); };
+		SIMD_LANES_AVX512 static Float Div(Float a, Float b) { return _mm512_div_ps(a, b); };
+		SIMD_LANES_AVX512 static Float Min(Float a, Float b) { return _mm512_min_ps(a, b); };
+		SIMD_LANES_AVX512 static Float Max(Float a, Float b) { return _mm512_max_ps(a, b); };
+		SIMD_LANES_AVX512 static Float Sqrt(Float a) { return _mm512_sqrt_ps(a); };
+		SIMD_LANES_AVX512 static Float Floor(Float a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); };
+
+		SIMD_LANES_AVX512 static Mask Less(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); };
+		SIMD_LANES_AVX512 static Mask LessEqual(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); };
+		SIMD_LANES_AVX512 static Mask Greater(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); };
+		SIMD_LANES_AVX512 static Mask GreaterEqual(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); };
+		SIMD_LANES_AVX512 static Mask And(Mask a, Mask b) { return Mask(a & b); };
+		SIMD_LANES_AVX512 static Mask Or(Mask a, Mask b) { return Mask(a | b); };
+		SIMD_LANES_AVX512 static Mask AndNot(Mask a, Mask b) { return Mask(a & ~b); };
+		SIMD_LANES_AVX512 static bool Any(Mask m) { return m != 0; };
+		SIMD_LANES_AVX512 static uint32_t Bits(Mask m) { return uint32_t(m); };
+		SIMD_LANES_AVX512 static Float Select(Mask m, Float a, Float b) { return _mm512_mask_blend_ps(m, b, a); };
+
+		SIMD_LANES_AVX512 static Int ToInt(Float a) { return _mm512_cvttps_epi32(a); };
+		SIMD_LANES_AVX512 static Float Gather(const float* base, Int index) { return _mm512_i32gather_ps(index, base, 4); };
+		SIMD_LANES_AVX512 static Float Exp2Int(Float n) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(n), _mm512_set1_epi32(127)), 23)); };
+	};
+}
@@ -0,0 +1,413 @@
+#include "SpatiotemporalBlueNoise.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+
+namespace
+{
+	struct CacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		int32_t size, slices;
+		float spatialSigma, temporalSigma;
+		uint32_t seed;
+	};
+	const uint32_t kCacheMagic = 0x4e425453; // "STBN"
+	const uint32_t kCacheVersion = 1;
+
+	BlueNoiseParameters Validated(const BlueNoiseParameters& parameters)
+	{
+		BlueNoiseParameters p = parameters;
+		p.size = std::min(std::max(p.size, 4), 1024);
+		p.slices = std::min(std::max(p.slices, 1), 256);
+		p.spatialSigma = std::max(p.spatialSigma, 0.1f);
+		p.temporalSigma = std::max(p.temporalSigma, 0.1f);
+		return p;
+	}
+
+	// the set texels of a binary pattern over the noise and the energy they put on every texel. A texel feels the
+	// set texels of its slice through the spatial kernel, itself included, and the set texels at its pixel in the
+	// other slices through the temporal one
+	class EnergyField
+	{
+	public:
+		explicit EnergyField(const BlueNoiseParameters& p) :
+			m_size(p.size), m_slices(p.slices)
+		{
+			// the kernels wrap around, and must not reach far enough to meet themselves
+			m_radius = std::min(int(std::ceil(3.0f * p.spatialSigma)), (m_size - 1) / 2);
+			m_temporalRadius = std::min(int(std::ceil(3.0f * p.temporalSigma)), (m_slices - 1) / 2);
+
+			const int side = 2 * m_radius + 1;
+			m_spatial.resize(size_t(side) * side);
+			for (int dy = -m_radius; dy <= m_radius; dy++)
+			{
+				for (int dx = -m_radius; dx <= m_radius; dx++)
+					m_spatial[size_t(dy + m_radius) * side + dx + m_radius] = std::exp(-float(dx * dx + dy * dy) / (2.0f * p.spatialSigma * p.spatialSigma));
+			}
+			m_temporal.resize(2 * m_temporalRadius + 1);
+			for (int dt = -m_temporalRadius; dt <= m_temporalRadius; dt++)
+				m_temporal[dt + m_temporalRadius] = dt == 0 ? 0.0f : std::exp(-float(dt * dt) / (2.0f * p.temporalSigma * p.temporalSigma));
+
+			pattern.assign(GetCount(), 0);
+			energy.assign(GetCount(), 0.0f);
+		}
+
+		int GetCount() const { return m_size * m_size * m_slices; };
+
+		// the energy of every texel from the texels whose pattern is value. A slice's texels only spread spatial
+		// energy within the slice, so each slice scatters its own and then gathers the temporal energy
+		void Compute(uint8_t value, ThreadPool* pool)
+		{
+			const int side = 2 * m_radius + 1;
+			const size_t sliceTexels = size_t(m_size) * m_size;
+			ForEachSlice(pool, m_slices, [&](int begin, int end)
+			{
+				for (int t = begin; t < end; t++)
+				{
+					float* slice = &energy[t * sliceTexels];
+					std::fill(slice, slice + sliceTexels, 0.0f);
+					for (int y = 0; y < m_size; y++)
+					{
+						for (int x = 0; x < m_size; x++)
+						{
+							if (pattern[Index(x, y, t)] != value)
+								continue;
+							for (int dy = -m_radius; dy <= m_radius; dy++)
+							{
+								float* row = &slice[size_t(Wrap(y + dy, m_size)) * m_size];
+								const float* weights = &m_spatial[size_t(dy + m_radius) * side + m_radius];
+								for (int dx = -m_radius; dx <= m_radius; dx++)
+									row[Wrap(x + dx, m_size)] += weights[dx];
+							}
+						}
+					}
+					for (int dt = -m_temporalRadius; dt <= m_temporalRadius; dt++)
+					{
+						if (dt == 0)
+							continue;
+						const uint8_t* other = &pattern[Wrap(t + dt, m_slices) * sliceTexels];
+						float weight = m_temporal[dt + m_temporalRadius];
+						for (size_t i = 0; i < sliceTexels; i++)
+						{
+							if (other[i] == value)
+								slice[i] += weight;
+						}
+					}
+				}
+			});
+		}
+
+		// adds sign times the kernels around a texel; touched receives the texels whose energy changed, in
+		// increasing order
+		void Splat(int index, float sign, std::vector<int>& touched)
+		{
+			const int side = 2 * m_radius + 1;
+			int x = index % m_size, y = (index / m_size) % m_size, t = index / (m_size * m_size);
+			Neighbours(x, m_radius, m_size, m_xs);
+			Neighbours(y, m_radius, m_size, m_ys);
+			Neighbours(t, m_temporalRadius, m_slices, m_ts);
+			touched.clear();
+			for (const auto& slice : m_ts)
+			{
+				if (slice.second != 0)
+				{
+					int neighbour = Index(x, y, slice.first);
+					energy[neighbour] += sign * m_temporal[slice.second + m_temporalRadius];
+					touched.push_back(neighbour);
+					continue;
+				}
+				for (const auto& row : m_ys)
+				{
+					const float* weights = &m_spatial[size_t(row.second + m_radius) * side + m_radius];
+					for (const auto& column : m_xs)
+					{
+						int neighbour = Index(column.first, row.first, t);
+						energy[neighbour] += sign * weights[column.second];
+						touched.push_back(neighbour);
+					}
+				}
+			}
+		}
+
+		std::vector<uint8_t> pattern;
+		std::vector<float> energy;
+
+	private:
+		static int Wrap(int i, int n) { return i < 0 ? i + n : (i >= n ? i - n : i); };
+		int Index(int x, int y, int t) const { return (t * m_size + y) * m_size + x; };
+		// the wrapped coordinates within radius of c, in increasing order, with their offsets from c
+		static void Neighbours(int c, int radius, int n, std::vector<std::pair<int, int>>& out)
+		{
+			out.clear();
+			for (int d = -radius; d <= radius; d++)
+				out.emplace_back(Wrap(c + d, n), d);
+			std::rotate(out.begin(), std::min_element(out.begin(), out.end()), out.end());
+		}
+
+		int m_size, m_slices;
+		int m_radius, m_temporalRadius;
+		std::vector<float> m_spatial, m_temporal;
+		std::vector<std::pair<int, int>> m_xs, m_ys, m_ts;
+	};
+
+	// a tournament over the texels whose pattern is value: every node holds the texel of largest (or smallest)
+	// energy below it, ties going to the lower index. The leaves are the texels themselves, so a changed texel
+	// only replays the matches on its path to the root, and stops where a match comes out as before
+	class WinnerTree
+	{
+	public:
+		WinnerTree(const EnergyField& field, uint8_t value, bool largest) :
+			m_pattern(field.pattern), m_energy(field.energy), m_value(value), m_largest(largest), m_count(field.GetCount())
+		{
+			m_leaves = 1;
+			while (m_leaves < m_count)
+				m_leaves *= 2;
+			m_nodes.resize(size_t(2) * m_leaves);
+		}
+
+		void Build(ThreadPool* pool)
+		{
+			const int grain = 4096;
+			ForEachSlice(pool, (m_leaves + grain - 1) / grain, [&](int begin, int end)
+			{
+				for (int texel = begin * grain; texel < std::min(end * grain, m_leaves); texel++)
+					m_nodes[size_t(m_leaves) + texel] = Leaf(texel);
+			});
+			for (int first = m_leaves / 2; first >= 1; first /= 2)
+			{
+				ForEachSlice(pool, (first + grain - 1) / grain, [&](int begin, int end)
+				{
+					for (int node = first + begin * grain; node < std::min(first + end * grain, 2 * first); node++)
+						m_nodes[node] = Match(m_nodes[2 * node], m_nodes[2 * node + 1]);
+				});
+			}
+		}
+
+		// -1 once no texel's pattern is value
+		int GetWinner() const { return m_nodes[1].key < kNone ? m_nodes[1].texel : -1; };
+
+		// texels holds the changed texels in increasing order and is overwritten
+		void Update(std::vector<int>& texels)
+		{
+			size_t count = 0;
+			for (size_t i = 0; i < texels.size(); i++)
+			{
+				int node = m_leaves + texels[i];
+				Node leaf = Leaf(texels[i]);
+				if (leaf.key == m_nodes[node].key)
+					continue;
+				m_nodes[node] = leaf;
+				texels[count++] = node;
+			}
+			texels.resize(count);
+
+			// the parents of nodes in order are in order, so shared ones are next to each other
+			while (!texels.empty() && texels[0] > 1)
+			{
+				count = 0;
+				int previous = 0;
+				for (size_t i = 0; i < texels.size(); i++)
+				{
+					int parent = texels[i] >> 1;
+					if (parent == previous)
+						continue;
+					previous = parent;
+					Node winner = Match(m_nodes[2 * parent], m_nodes[2 * parent + 1]);
+					if (winner.key == m_nodes[parent].key && winner.texel == m_nodes[parent].texel)
+						continue;
+					m_nodes[parent] = winner;
+					texels[count++] = parent;
+				}
+				texels.resize(count);
+			}
+		}
+
+	private:
+		// the key is the energy, negated for the largest, so that every match goes to the smaller key
+		struct Node
+		{
+			float key;
+			int texel;
+		};
+		static constexpr float kNone = std::numeric_limits<float>::max();
+
+		Node Leaf(int texel) const
+		{
+			if (texel >= m_count || m_pattern[texel] != m_value)
+				return { kNone, texel };
+			return { m_largest ? -m_energy[texel] : m_energy[texel], texel };
+		}
+		static Node Match(const Node& a, const Node& b)
+		{
+			return a.key < b.key || (a.key == b.key && a.texel < b.texel) ? a : b;
+		}
+
+		const std::vector<uint8_t>& m_pattern;
+		const std::vector<float>& m_energy;
+		uint8_t m_value;
+		bool m_largest;
+		int m_count, m_leaves;
+		std::vector<Node> m_nodes;
+	};
+}
+
+void SpatiotemporalBlueNoise::Generate(const BlueNoiseParameters& parameters, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	m_parameters = Validated(parameters);
+	EnergyField field(m_parameters);
+	const int count = field.GetCount();
+	std::vector<int> ranks(count);
+	std::vector<int> touched, scratch;
+
+	// the initial pattern: a tenth of the texels at random, relaxed by moving the tightest cluster into the
+	// largest void until the largest void is where the cluster was taken from
+	std::mt19937 random(m_parameters.seed);
+	const int initial = std::max(1, count / 10);
+	for (int placed = 0; placed < initial;)
+	{
+		int index = int(random() % uint32_t(count));
+		if (!field.pattern[index])
+		{
+			field.pattern[index] = 1;
+			placed++;
+		}
+	}
+
+	field.Compute(1, pool);
+	WinnerTree clusters(field, 1, true), voids(field, 0, false);
+	clusters.Build(pool);
+	voids.Build(pool);
+	auto set = [&](int index, uint8_t value, WinnerTree& tree, WinnerTree* other)
+	{
+		field.pattern[index] = value;
+		field.Splat(index, value ? 1.0f : -1.0f, touched);
+		if (other)
+		{
+			scratch = touched;
+			other->Update(scratch);
+		}
+		tree.Update(touched);
+	};
+	for (int iteration = 0; iteration < count; iteration++)
+	{
+		int cluster = clusters.GetWinner();
+		set(cluster, 0, clusters, &voids);
+		int gap = voids.GetWinner();
+		if (gap == cluster)
+		{
+			set(cluster, 1, clusters, &voids);
+			break;
+		}
+		set(gap, 1, clusters, &voids);
+	}
+	const std::vector<uint8_t> initialPattern = field.pattern;
+	const std::vector<float> initialEnergy = field.energy;
+
+	// the initial texels rank last to first by taking the tightest cluster away
+	for (int rank = initial - 1; rank >= 0; rank--)
+	{
+		int cluster = clusters.GetWinner();
+		set(cluster, 0, clusters, nullptr);
+		ranks[cluster] = rank;
+	}
+
+	// up to half, from the initial pattern, by filling the largest void
+	field.pattern = initialPattern;
+	field.energy = initialEnergy;
+	voids.Build(pool);
+	for (int rank = initial; rank < count / 2; rank++)
+	{
+		int gap = voids.GetWinner();
+		set(gap, 1, voids, nullptr);
+		ranks[gap] = rank;
+	}
+
+	// the rest with the roles swapped: the unset texels are the minority, and the tightest cluster of them is
+	// the next to set
+	field.Compute(0, pool);
+	WinnerTree unsetClusters(field, 0, true);
+	unsetClusters.Build(pool);
+	for (int rank = std::max(initial, count / 2); rank < count; rank++)
+	{
+		int cluster = unsetClusters.GetWinner();
+		field.pattern[cluster] = 1;
+		field.Splat(cluster, -1.0f, touched);
+		unsetClusters.Update(touched);
+		ranks[cluster] = rank;
+	}
+
+	m_values.resize(count);
+	for (int i = 0; i < count; i++)
+		m_values[i] = uint8_t(uint64_t(ranks[i]) * 256 / uint64_t(count));
+	m_loadedFromCache = false;
+
+	m_generateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SpatiotemporalBlueNoise::LoadOrGenerate(const std::string& directory, const BlueNoiseParameters& parameters, ThreadPool* pool)
+{
+	BlueNoiseParameters p = Validated(parameters);
+	std::string filename = directory.empty() ? GetCacheName(p) : directory + "/" + GetCacheName(p);
+	if (Load(filename, p))
+		return;
+
+	Generate(p, pool);
+	Save(filename);
+}
+
+bool SpatiotemporalBlueNoise::Load(const std::string& filename, const BlueNoiseParameters& parameters)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	CacheHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return false;
+	if (header.magic != kCacheMagic || header.version != kCacheVersion || header.size != parameters.size || header.slices != parameters.slices ||
+		header.spatialSigma != parameters.spatialSigma || header.temporalSigma != parameters.temporalSigma || header.seed != parameters.seed)
+		return false;
+
+	std::vector<uint8_t> values(size_t(header.size) * header.size * header.slices);
+	if (!file.read(reinterpret_cast<char*>(values.data()), values.size()))
+		return false;
+
+	m_parameters = parameters;
+	m_values.swap(values);
+	m_loadedFromCache = true;
+	m_generateTime = 0.0;
+	return true;
+}
+
+bool SpatiotemporalBlueNoise::Save(const std::string& filename) const
+{
+	if (m_values.empty())
+		return false;
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	CacheHeader header = { kCacheMagic, kCacheVersion, m_parameters.size, m_parameters.slices, m_parameters.spatialSigma, m_parameters.temporalSigma, m_parameters.seed };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_values.data()), m_values.size());
+	return bool(file);
+}
+
+std::string SpatiotemporalBlueNoise::GetCacheName(const BlueNoiseParameters& parameters)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "blue_noise_%dx%dx%d_s%.2f_t%.2f_seed%u.bin", parameters.size, parameters.size, parameters.slices,
+		parameters.spatialSigma, parameters.temporalSigma, parameters.seed);
+	return name;
+}
@@ -0,0 +1,64 @@
+#pragma once
+// SpatiotemporalBlueNoise
+// A stack of blue noise slices, one per frame, for jittering ray marches: every slice on its own is blue noise
+// over the screen, and every pixel's values through the slices are blue noise over time, so the error of a
+// jittered march sits in high frequencies in both and disappears under a small blur or a few frames of
+// accumulation far sooner than the error of white noise does.
+// The values are the ranks of a void-and-cluster ordering of all texels, with an energy that lets two texels
+// interact through a Gaussian over their toroidal screen distance if they are in the same slice, and through a
+// Gaussian over their toroidal distance in slices if they are the same pixel. Each rank goes to the texel with
+// the largest void (or, in the second half, the tightest cluster of the texels still unranked), found by
+// tournament trees over the energy that only the texels near the last placed one update.
+// Ranking is sequential, each rank depending on all earlier ones; the pool fills the energy fields and the trees
+// at the start of each phase. At 128^2 x 64 generation takes seconds, so the result is cached in a file named
+// after the parameters and loaded from there on later runs.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+struct BlueNoiseParameters
+{
+	int size = 128; // width and height of a slice
+	int slices = 64; // frames before the sequence repeats
+	float spatialSigma = 1.9f; // pixels
+	float temporalSigma = 1.9f; // slices
+	uint32_t seed = 1;
+};
+
+class SpatiotemporalBlueNoise
+{
+public:
+	// pool may be null
+	void Generate(const BlueNoiseParameters& parameters, ThreadPool* pool);
+	// loads the cache for the parameters from directory, which may be empty for the working directory, or
+	// generates the noise and writes the cache there
+	void LoadOrGenerate(const std::string& directory, const BlueNoiseParameters& parameters, ThreadPool* pool);
+	bool Load(const std::string& filename, const BlueNoiseParameters& parameters);
+	bool Save(const std::string& filename) const;
+	static std::string GetCacheName(const BlueNoiseParameters& parameters);
+
+	// in (0, 1), wrapping around in all three coordinates
+	float Sample(int x, int y, int frame) const
+	{
+		const int size = m_parameters.size;
+		x %= size; if (x < 0) x += size;
+		y %= size; if (y < 0) y += size;
+		frame %= m_parameters.slices; if (frame < 0) frame += m_parameters.slices;
+		return (m_values[(size_t(frame) * size + y) * size + x] + 0.5f) / 256.0f;
+	}
+	const std::vector<uint8_t>& GetValues() const { return m_values; };
+	const BlueNoiseParameters& GetParameters() const { return m_parameters; };
+	bool IsEmpty() const { return m_values.empty(); };
+
+	bool GetLoadedFromCache() const { return m_loadedFromCache; };
+	double GetGenerateTime() const { return m_generateTime; }; // ms
+
+private:
+	BlueNoiseParameters m_parameters;
+	std::vector<uint8_t> m_values; // slice by slice, rows of x
+	bool m_loadedFromCache = false;
+	double m_generateTime = 0.0;
+};
@@ -0,0 +1,123 @@
+#include "SunTransmittanceVolume.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+SunTransmittanceVolume::SunTransmittanceVolume() :
+	m_toLight(0.0f, 1.0f, 0.0f)
+{
+}
+
+void SunTransmittanceVolume::Build(int resolution, float boxMin, float boxMax, const XMFLOAT3& toLight, const std::function<float(const XMFLOAT3&)>& density, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const int n = std::max(2, resolution);
+	m_resolution = n;
+	m_boxMin = boxMin;
+	m_boxMax = boxMax;
+	XMStoreFloat3(&m_toLight, XMVector3Normalize(XMLoadFloat3(&toLight)));
+	m_depths.assign(size_t(n) * n * n, 0.0f);
+
+	const float cellSize = (boxMax - boxMin) / (n - 1);
+	const float l[3] = { m_toLight.x, m_toLight.y, m_toLight.z };
+
+	// slices run across axis a; b and c span a slice
+	int a = std::abs(l[0]) >= std::abs(l[1]) ? (std::abs(l[0]) >= std::abs(l[2]) ? 0 : 2) : (std::abs(l[1]) >= std::abs(l[2]) ? 1 : 2);
+	int b = (a + 1) % 3, c = (a + 2) % 3;
+	int step = l[a] > 0.0f ? 1 : -1;
+	int first = step > 0 ? n - 1 : 0;
+	// distance along the light, in samples, from one slice to the next
+	float advance = 1.0f / std::abs(l[a]);
+
+	auto world = [&](const float v[3]) { return XMFLOAT3(boxMin + v[0] * cellSize, boxMin + v[1] * cellSize, boxMin + v[2] * cellSize); };
+
+	// the slice on the face the light enters through has nothing between it and the sun
+	for (int s = 1; s < n; s++)
+	{
+		int k = first - step * s, upstream = k + step;
+		ForEachSlice(pool, n, [&](int begin, int end)
+		{
+			for (int j = begin; j < end; j++)
+			{
+				for (int i = 0; i < n; i++)
+				{
+					float v[3];
+					v[a] = float(k);
+					v[b] = float(i);
+					v[c] = float(j);
+
+					// the step ends early where the ray leaves through a side of the box
+					float exit = std::numeric_limits<float>::max();
+					for (int axis = 0; axis < 3; axis++)
+					{
+						if (l[axis] > 0.0f)
+							exit = std::min(exit, (n - 1 - v[axis]) / l[axis]);
+						else if (l[axis] < 0.0f)
+							exit = std::min(exit, -v[axis] / l[axis]);
+					}
+					float length = std::min(advance, exit);
+
+					// Simpson's rule over the step
+					float mid[3], last[3];
+					for (int axis = 0; axis < 3; axis++)
+					{
+						mid[axis] = v[axis] + l[axis] * length * 0.5f;
+						last[axis] = v[axis] + l[axis] * length;
+					}
+					float depth = (density(world(v)) + 4.0f * density(world(mid)) + density(world(last))) * (length * cellSize / 6.0f);
+
+					if (exit >= advance)
+					{
+						// bilinear on the previous slice where the step meets it
+						float ub = std::min(std::max(last[b], 0.0f), float(n - 1)), uc = std::min(std::max(last[c], 0.0f), float(n - 1));
+						int ib = std::min(int(ub), n - 2), ic = std::min(int(uc), n - 2);
+						float fb = ub - ib, fc = uc - ic;
+						int u[3];
+						u[a] = upstream;
+						auto at = [&](int db, int dc)
+						{
+							u[b] = ib + db;
+							u[c] = ic + dc;
+							return m_depths[Index(u[0], u[1], u[2])];
+						};
+						float d0 = at(0, 0) * (1.0f - fb) + at(1, 0) * fb;
+						float d1 = at(0, 1) * (1.0f - fb) + at(1, 1) * fb;
+						depth += d0 * (1.0f - fc) + d1 * fc;
+					}
+
+					int w[3];
+					w[a] = k;
+					w[b] = i;
+					w[c] = j;
+					m_depths[Index(w[0], w[1], w[2])] = depth;
+				}
+			}
+		});
+	}
+
+	m_buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+float SunTransmittanceVolume::SampleDepth(const XMFLOAT3& position) const
+{
+	const int n = m_resolution;
+	const float scale = (n - 1) / (m_boxMax - m_boxMin);
+	float px = std::min(std::max((position.x - m_boxMin) * scale, 0.0f), float(n - 1));
+	float py = std::min(std::max((position.y - m_boxMin) * scale, 0.0f), float(n - 1));
+	float pz = std::min(std::max((position.z - m_boxMin) * scale, 0.0f), float(n - 1));
+	int x = std::min(int(px), n - 2), y = std::min(int(py), n - 2), z = std::min(int(pz), n - 2);
+	float fx = px - x, fy = py - y, fz = pz - z;
+
+	const float* d = &m_depths[Index(x, y, z)];
+	const size_t row = n, slice = size_t(n) * n;
+	float c00 = d[0] * (1.0f - fx) + d[1] * fx;
+	float c10 = d[row] * (1.0f - fx) + d[row + 1] * fx;
+	float c01 = d[slice] * (1.0f - fx) + d[slice + 1] * fx;
+	float c11 = d[slice + row] * (1.0f - fx) + d[slice + row + 1] * fx;
+	float c0 = c00 * (1.0f - fy) + c10 * fy;
+	float c1 = c01 * (1.0f - fy) + c11 * fy;
+	return c0 * (1.0f - fz) + c1 * fz;
+}
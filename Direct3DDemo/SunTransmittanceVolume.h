@@ -0,0 +1,49 @@
+#pragma once
+// SunTransmittanceVolume
+// Optical depth toward the sun, the integral of density from a point to where its light ray leaves the box,
+// stored on a grid over the box so a ray march can look up the sun's attenuation with one trilinear fetch
+// instead of a secondary march per sample. Storing depth rather than transmittance keeps the volume valid
+// when the extinction coefficient changes; it only has to be rebuilt when the density or the sun moves.
+// The grid is built in slices along the axis the light travels most along, starting from the face the light
+// enters through: every point steps toward the light to the next slice, integrates the density over that
+// step and adds the depth interpolated on the slice, so each slice only reads the one before it and its
+// points are computed in parallel.
+
+#include <DirectXMath.h>
+#include <functional>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+class SunTransmittanceVolume
+{
+public:
+	SunTransmittanceVolume();
+
+	// resolution samples per axis over [boxMin, boxMax]^3; toLight points from the volume toward the sun and
+	// density is evaluated at world positions. pool may be null
+	void Build(int resolution, float boxMin, float boxMax, const XMFLOAT3& toLight, const std::function<float(const XMFLOAT3&)>& density, ThreadPool* pool);
+	bool IsEmpty() const { return m_depths.empty(); };
+
+	// density integrated toward the sun from a world position inside the box
+	float SampleDepth(const XMFLOAT3& position) const;
+
+	int GetResolution() const { return m_resolution; };
+	float GetBoxMin() const { return m_boxMin; };
+	float GetBoxMax() const { return m_boxMax; };
+	XMFLOAT3 GetLightDirection() const { return m_toLight; };
+	// x fastest
+	const std::vector<float>& GetDepths() const { return m_depths; };
+	double GetBuildTime() const { return m_buildTime; }; // ms
+
+private:
+	size_t Index(int x, int y, int z) const { return (size_t(z) * m_resolution + y) * m_resolution + x; };
+
+	int m_resolution = 0;
+	float m_boxMin = 0.0f, m_boxMax = 0.0f;
+	XMFLOAT3 m_toLight;
+	std::vector<float> m_depths;
+	double m_buildTime = 0.0;
+};
@@ -0,0 +1,173 @@
+#include "TemporalAccumulator.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+namespace
+{
+	const float kNoDepth = std::numeric_limits<float>::max();
+}
+
+TemporalAccumulator::TemporalAccumulator() :
+	m_previousPosition(0.0f, 0.0f, 0.0f)
+{
+	XMStoreFloat4x4(&m_previousViewProj, XMMatrixIdentity());
+}
+
+void TemporalAccumulator::Reset()
+{
+	m_history.clear();
+	m_frameCount = 0;
+}
+
+float TemporalAccumulator::GetJitterOffset() const
+{
+	float offset = m_frameCount * 0.618034f;
+	return offset - std::floor(offset);
+}
+
+void TemporalAccumulator::Accumulate(const CPUVolumeCamera& camera, const std::vector<XMFLOAT4>& image, const std::vector<float>& depth, int width, int height, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const size_t pixels = size_t(width) * height;
+	if (width <= 0 || height <= 0 || image.size() < pixels || depth.size() < pixels)
+		return;
+
+	XMMATRIX clipToWorld = camera.projInv * camera.viewInv;
+	XMMATRIX viewProj = XMMatrixInverse(nullptr, clipToWorld);
+
+	m_motion.assign(pixels, XMFLOAT2(0.0f, 0.0f));
+	if (m_history.empty() || m_width != width || m_height != height)
+	{
+		m_history = image;
+		m_historyDepth = depth;
+		m_age.assign(pixels, 1);
+		m_width = width;
+		m_height = height;
+		m_frameCount = 1;
+		m_rejected = int(pixels);
+		XMStoreFloat4x4(&m_previousViewProj, viewProj);
+		m_previousPosition = camera.position;
+		m_accumulateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return;
+	}
+
+	m_next.resize(pixels);
+	m_nextDepth.resize(pixels);
+	m_nextAge.resize(pixels);
+
+	XMMATRIX previousViewProj = XMLoadFloat4x4(&m_previousViewProj);
+	XMVECTOR eye = XMLoadFloat3(&camera.position), previousEye = XMLoadFloat3(&m_previousPosition);
+	std::atomic<int> rejected{ 0 };
+	ForEachSlice(pool, height, [&](int begin, int end)
+	{
+		int localRejected = 0;
+		for (int y = begin; y < end; y++)
+		{
+			float v = (y + 0.5f) / height;
+			for (int x = 0; x < width; x++)
+			{
+				const size_t index = size_t(y) * width + x;
+				float u = (x + 0.5f) / width;
+				const XMFLOAT4& current = image[index];
+				float cloudDepth = depth[index];
+
+				// where the pixel's cloud, or its direction where it saw none, was on the previous frame's screen
+				XMVECTOR farPoint = XMVector3TransformCoord(XMVectorSet(u * 2.0f - 1.0f, (1.0f - v) * 2.0f - 1.0f, 1.0f, 1.0f), clipToWorld);
+				XMVECTOR direction = XMVector3Normalize(farPoint - eye);
+				XMVECTOR world = cloudDepth < kNoDepth ? XMVectorSetW(eye + direction * cloudDepth, 1.0f) : XMVectorSetW(direction, 0.0f);
+				XMFLOAT4 clip;
+				XMStoreFloat4(&clip, XMVector4Transform(world, previousViewProj));
+
+				bool valid = clip.w > 1e-6f;
+				float previousU = 0.0f, previousV = 0.0f;
+				if (valid)
+				{
+					previousU = (clip.x / clip.w) * 0.5f + 0.5f;
+					previousV = 0.5f - (clip.y / clip.w) * 0.5f;
+					m_motion[index] = XMFLOAT2(previousU - u, previousV - v);
+					valid = previousU >= 0.0f && previousU <= 1.0f && previousV >= 0.0f && previousV <= 1.0f;
+				}
+
+				float px = 0.0f, py = 0.0f;
+				int x0 = 0, y0 = 0;
+				float historyDepth = kNoDepth, expected = 0.0f;
+				if (valid)
+				{
+					px = std::min(std::max(previousU * width - 0.5f, 0.0f), float(width - 1));
+					py = std::min(std::max(previousV * height - 0.5f, 0.0f), float(height - 1));
+					x0 = std::min(int(px), std::max(width - 2, 0));
+					y0 = std::min(int(py), std::max(height - 2, 0));
+
+					// a cloud seen at another depth from the previous camera than the history's is something else
+					historyDepth = m_historyDepth[size_t(int(py + 0.5f)) * width + int(px + 0.5f)];
+					if (cloudDepth < kNoDepth && historyDepth < kNoDepth)
+					{
+						expected = XMVectorGetX(XMVector3Length(XMVectorSetW(world, 0.0f) - previousEye));
+						valid = std::abs(historyDepth - expected) <= m_depthTolerance * expected;
+					}
+				}
+
+				if (!valid)
+				{
+					m_next[index] = current;
+					m_nextDepth[index] = cloudDepth;
+					m_nextAge[index] = 1;
+					localRejected++;
+					continue;
+				}
+
+				int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+				float fx = px - x0, fy = py - y0;
+				auto lerp = [](const XMFLOAT4& a, const XMFLOAT4& b, float f)
+				{
+					return XMFLOAT4(a.x + (b.x - a.x) * f, a.y + (b.y - a.y) * f, a.z + (b.z - a.z) * f, a.w + (b.w - a.w) * f);
+				};
+				auto at = [&](int hx, int hy) -> const XMFLOAT4& { return m_history[size_t(hy) * width + hx]; };
+				XMFLOAT4 history = lerp(lerp(at(x0, y0), at(x1, y0), fx), lerp(at(x0, y1), at(x1, y1), fx), fy);
+				int age = std::min(std::min(std::min(m_age[size_t(y0) * width + x0], m_age[size_t(y0) * width + x1]), m_age[size_t(y1) * width + x0]), m_age[size_t(y1) * width + x1]);
+
+				if (m_clampHistory)
+				{
+					XMFLOAT4 low = current, high = current;
+					for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ny++)
+					{
+						for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); nx++)
+						{
+							const XMFLOAT4& n = image[size_t(ny) * width + nx];
+							low = XMFLOAT4(std::min(low.x, n.x), std::min(low.y, n.y), std::min(low.z, n.z), std::min(low.w, n.w));
+							high = XMFLOAT4(std::max(high.x, n.x), std::max(high.y, n.y), std::max(high.z, n.z), std::max(high.w, n.w));
+						}
+					}
+					history = XMFLOAT4(std::min(std::max(history.x, low.x), high.x), std::min(std::max(history.y, low.y), high.y),
+						std::min(std::max(history.z, low.z), high.z), std::min(std::max(history.w, low.w), high.w));
+				}
+
+				float blend = std::max(1.0f / (age + 1), m_minimumBlend);
+				m_next[index] = lerp(history, current, blend);
+				// the history's depth moved to the current camera by the same amount as the pixel's cloud
+				if (cloudDepth < kNoDepth && historyDepth < kNoDepth)
+					m_nextDepth[index] = historyDepth + (cloudDepth - expected) + (expected - historyDepth) * blend;
+				else
+					m_nextDepth[index] = cloudDepth;
+				m_nextAge[index] = uint16_t(std::min(age + 1, 0xffff));
+			}
+		}
+		rejected += localRejected;
+	});
+
+	m_history.swap(m_next);
+	m_historyDepth.swap(m_nextDepth);
+	m_age.swap(m_nextAge);
+	m_rejected = rejected;
+	m_frameCount++;
+	XMStoreFloat4x4(&m_previousViewProj, viewProj);
+	m_previousPosition = camera.position;
+
+	m_accumulateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,74 @@
+#pragma once
+// TemporalAccumulator
+// Accumulates cheap, noisy cloud frames over time: every frame is rendered with few steps and a step jitter
+// that moves between frames, and the history of earlier frames is reprojected onto it and blended in, so the
+// samples of several frames add up to the image of one finely stepped frame while each frame only pays for its
+// own. A pixel's cloud depth puts its ray's cloud at a world position, and the previous frame's view-projection
+// takes that position to where the same cloud was on the previous frame's screen; rays that saw no cloud are
+// reprojected as directions, like the sky. The screen offset between the two is the pixel's motion vector. The
+// history is fetched there bilinearly and clamped to the range of the current frame's 3x3 neighbourhood, which
+// throws away history that no longer matches what the pixel sees without having to detect why. A pixel's
+// history restarts where it left the previous screen or its reprojected depth disagrees with the history's.
+// Every pixel blends in the current frame by the larger of 1 / (frames accumulated + 1) and a minimum weight,
+// which averages evenly until the history is long enough and then becomes an exponential average.
+
+#include <DirectXMath.h>
+#include "CPUVolumeRenderer.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace DirectX;
+
+class ThreadPool;
+
+class TemporalAccumulator
+{
+public:
+	TemporalAccumulator();
+
+	// forgets the history, so the next frame starts over
+	void Reset();
+
+	// the jitter offset to render the next frame with, from a golden ratio sequence so that consecutive frames
+	// sample far apart and any run of frames covers a step evenly
+	float GetJitterOffset() const;
+
+	// image and depth as written by CPUVolumeRenderer::Render with the same camera; pool may be null
+	void Accumulate(const CPUVolumeCamera& camera, const std::vector<XMFLOAT4>& image, const std::vector<float>& depth, int width, int height, ThreadPool* pool);
+	const std::vector<XMFLOAT4>& GetResult() const { return m_history; };
+	// offset in [0, 1] screen units from a pixel to where its cloud was on the previous frame
+	const std::vector<XMFLOAT2>& GetMotionVectors() const { return m_motion; };
+
+	// the smallest weight of the current frame, which bounds how long the history lasts
+	void SetMinimumBlend(float blend) { m_minimumBlend = std::min(std::max(blend, 0.01f), 1.0f); };
+	float GetMinimumBlend() const { return m_minimumBlend; };
+	void SetClampHistory(bool clampHistory) { m_clampHistory = clampHistory; };
+	bool GetClampHistory() const { return m_clampHistory; };
+	// relative difference between a pixel's reprojected depth and the history's at which the history restarts
+	void SetDepthTolerance(float tolerance) { m_depthTolerance = std::max(tolerance, 0.0f); };
+	float GetDepthTolerance() const { return m_depthTolerance; };
+
+	int GetFrameCount() const { return m_frameCount; };
+	// pixels of the last frame whose history was thrown away
+	int GetRejectedCount() const { return m_rejected; };
+	double GetAccumulateTime() const { return m_accumulateTime; }; // ms
+
+private:
+	std::vector<XMFLOAT4> m_history, m_next;
+	std::vector<float> m_historyDepth, m_nextDepth;
+	std::vector<uint16_t> m_age, m_nextAge; // frames accumulated in a pixel
+	std::vector<XMFLOAT2> m_motion;
+	int m_width = 0, m_height = 0;
+
+	XMFLOAT4X4 m_previousViewProj;
+	XMFLOAT3 m_previousPosition;
+
+	float m_minimumBlend = 0.1f;
+	bool m_clampHistory = true;
+	float m_depthTolerance = 0.5f;
+
+	int m_frameCount = 0;
+	int m_rejected = 0;
+	double m_accumulateTime = 0.0;
+};
@@ -0,0 +1,448 @@
+#include "pch.h"
+#include "TerrainSDFGenerator.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <fstream>
+#include <limits>
+
+void TerrainSDFGenerator::SetHeightfield(const float* heights, int width, int depth)
+{
+	m_heights.assign(heights, heights + size_t(width) * depth);
+	m_width = width;
+	m_depth = depth;
+}
+
+float TerrainSDFGenerator::SampleHeight(float u, float v) const
+{
+	float fx = std::max(0.0f, std::min(u, 1.0f)) * (m_width - 1);
+	float fz = std::max(0.0f, std::min(v, 1.0f)) * (m_depth - 1);
+	int x0 = std::min(int(fx), m_width - 2);
+	int z0 = std::min(int(fz), m_depth - 2);
+	float tx = fx - x0, tz = fz - z0;
+
+	const float* row0 = &m_heights[size_t(z0) * m_width];
+	const float* row1 = row0 + m_width;
+	float h0 = row0[x0] + (row0[x0 + 1] - row0[x0]) * tx;
+	float h1 = row1[x0] + (row1[x0 + 1] - row1[x0]) * tx;
+	return h0 + (h1 - h0) * tz;
+}
+
+TerrainSDFGenerator::HeightRegion TerrainSDFGenerator::FindChangedTiles(const std::vector<float>& previous, int tileSize) const
+{
+	HeightRegion region = { m_width, m_depth, 0, 0 };
+	if (previous.size() != m_heights.size())
+		return { 0, 0, m_width, m_depth };
+
+	for (int tz = 0; tz * tileSize < m_depth; tz++)
+	{
+		for (int tx = 0; tx * tileSize < m_width; tx++)
+		{
+			int x0 = tx * tileSize, x1 = std::min(x0 + tileSize, m_width);
+			int z0 = tz * tileSize, z1 = std::min(z0 + tileSize, m_depth);
+
+			bool changed = false;
+			for (int z = z0; z < z1 && !changed; z++)
+				changed = !std::equal(&m_heights[size_t(z) * m_width + x0], &m_heights[size_t(z) * m_width + x1], &previous[size_t(z) * m_width + x0]);
+
+			if (changed)
+				region = { std::min(region.x0, x0), std::min(region.z0, z0), std::max(region.x1, x1), std::max(region.z1, z1) };
+		}
+	}
+	return region;
+}
+
+int TerrainSDFGenerator::GetSeedLattice(int resolution) const
+{
+	// sample at least once per voxel and once per heightfield texel
+	return std::max(resolution, std::max(m_width, m_depth));
+}
+
+void TerrainSDFGenerator::CreateSeeds(int resolution, int i0, int j0, int i1, int j1, std::vector<Seed>& seeds) const
+{
+	int samples = GetSeedLattice(resolution);
+	float scale = float(resolution);
+
+	int width = i1 - i0, depth = j1 - j0;
+	std::vector<float> heights(size_t(width) * depth);
+	for (int j = j0; j < j1; j++)
+		for (int i = i0; i < i1; i++)
+			heights[size_t(j - j0) * width + i - i0] = SampleHeight(float(i) / (samples - 1), float(j) / (samples - 1));
+
+	auto toGrid = [&](float u, float h, float v)
+	{
+		return Seed{ u * scale - 0.5f, (h + 0.5f) * scale - 0.5f, v * scale - 0.5f };
+	};
+
+	seeds.clear();
+	for (int j = j0; j < j1; j++)
+	{
+		for (int i = i0; i < i1; i++)
+		{
+			float u = float(i) / (samples - 1), v = float(j) / (samples - 1);
+			float h = heights[size_t(j - j0) * width + i - i0];
+			seeds.push_back(toGrid(u, h, v));
+
+			// steep edges span several voxels vertically, fill them so no crossed voxel is left without a seed
+			const int dx[] = { 1, 0 }, dz[] = { 0, 1 };
+			for (int n = 0; n < 2; n++)
+			{
+				int ni = i + dx[n], nj = j + dz[n];
+				if (ni >= i1 || nj >= j1)
+					continue;
+
+				float nh = heights[size_t(nj - j0) * width + ni - i0];
+				int steps = int(std::ceil(std::abs(nh - h) * scale));
+				for (int s = 1; s < steps; s++)
+				{
+					float t = float(s) / steps;
+					float nu = float(ni) / (samples - 1), nv = float(nj) / (samples - 1);
+					seeds.push_back(toGrid(u + (nu - u) * t, h + (nh - h) * t, v + (nv - v) * t));
+				}
+			}
+		}
+	}
+}
+
+void TerrainSDFGenerator::Flood(const std::vector<Seed>& seeds, const VoxelBox& box, std::vector<int>& nearest, ThreadPool* pool) const
+{
+	const int sx = box.x1 - box.x0, sy = box.y1 - box.y0, sz = box.z1 - box.z0;
+	const size_t cells = size_t(sx) * sy * sz;
+
+	// distances are measured in the full grid, indices are local to the box
+	auto distanceSq = [&](int x, int y, int z, int seed)
+	{
+		const Seed& s = seeds[seed];
+		float dx = s.x - (x + box.x0), dy = s.y - (y + box.y0), dz = s.z - (z + box.z0);
+		return dx * dx + dy * dy + dz * dz;
+	};
+
+	// every voxel keeps the closest of the seeds that fall into it; seeds outside the box are clamped in
+	std::vector<int> next(cells);
+	nearest.assign(cells, -1);
+	for (int i = 0; i < int(seeds.size()); i++)
+	{
+		int x = std::max(0, std::min(int(std::lround(seeds[i].x)) - box.x0, sx - 1));
+		int y = std::max(0, std::min(int(std::lround(seeds[i].y)) - box.y0, sy - 1));
+		int z = std::max(0, std::min(int(std::lround(seeds[i].z)) - box.z0, sz - 1));
+		int& cell = nearest[(size_t(z) * sy + y) * sx + x];
+		if (cell < 0 || distanceSq(x, y, z, i) < distanceSq(x, y, z, cell))
+			cell = i;
+	}
+
+	std::vector<int> steps;
+	for (int step = std::max(1, std::max(sx, std::max(sy, sz)) / 2); step >= 1; step /= 2)
+		steps.push_back(step);
+	steps.push_back(1);
+
+	for (int step : steps)
+	{
+		ForEachSlice(pool, sz, [&](int zBegin, int zEnd)
+		{
+			for (int z = zBegin; z < zEnd; z++)
+			{
+				for (int y = 0; y < sy; y++)
+				{
+					for (int x = 0; x < sx; x++)
+					{
+						size_t index = (size_t(z) * sy + y) * sx + x;
+						int best = nearest[index];
+						float bestDistance = best >= 0 ? distanceSq(x, y, z, best) : std::numeric_limits<float>::max();
+
+						for (int dz = -step; dz <= step; dz += step)
+						{
+							int nz = z + dz;
+							if (nz < 0 || nz >= sz)
+								continue;
+							for (int dy = -step; dy <= step; dy += step)
+							{
+								int ny = y + dy;
+								if (ny < 0 || ny >= sy)
+									continue;
+								for (int dx = -step; dx <= step; dx += step)
+								{
+									int nx = x + dx;
+									if (nx < 0 || nx >= sx)
+										continue;
+
+									int candidate = nearest[(size_t(nz) * sy + ny) * sx + nx];
+									if (candidate < 0 || candidate == best)
+										continue;
+
+									float d = distanceSq(x, y, z, candidate);
+									if (d < bestDistance)
+									{
+										best = candidate;
+										bestDistance = d;
+									}
+								}
+							}
+						}
+						next[index] = best;
+					}
+				}
+			}
+		});
+		nearest.swap(next);
+	}
+}
+
+void TerrainSDFGenerator::Generate(int resolution, std::vector<float>& sdf, ThreadPool* pool, std::vector<SurfacePoint>* closest) const
+{
+	const int n = resolution;
+	const size_t cells = size_t(n) * n * n;
+	sdf.assign(cells, 0.0f);
+	if (closest)
+		closest->assign(cells, SurfacePoint{ 0.0f, 0.0f });
+	if (!HasHeightfield() || n <= 0)
+		return;
+
+	std::vector<Seed> seeds;
+	int lattice = GetSeedLattice(n);
+	CreateSeeds(n, 0, 0, lattice, lattice, seeds);
+
+	std::vector<int> nearest;
+	Flood(seeds, { 0, 0, 0, n, n, n }, nearest, pool);
+
+	// the flood finds the closest seed, a short pattern search around it then finds the closest point of the
+	// continuous surface; the sign comes from the heightfield directly above or below the voxel centre
+	float spacing = 1.0f / (lattice - 1);
+	ForEachSlice(pool, n, [&](int zBegin, int zEnd)
+	{
+		for (int z = zBegin; z < zEnd; z++)
+		{
+			for (int x = 0; x < n; x++)
+			{
+				float u = (x + 0.5f) / n, v = (z + 0.5f) / n;
+				float height = SampleHeight(u, v);
+				for (int y = 0; y < n; y++)
+				{
+					size_t index = (size_t(z) * n + y) * n + x;
+					float normY = (y + 0.5f) / n - 0.5f;
+					float distance = std::abs(normY - height);
+					SurfacePoint point = { u, v };
+					if (nearest[index] >= 0)
+					{
+						const Seed& seed = seeds[nearest[index]];
+						point = { (seed.x + 0.5f) / n, (seed.z + 0.5f) / n };
+						distance = std::sqrt(ClosestSurfacePoint(u, normY, v, point.u, point.v, spacing));
+					}
+					sdf[index] = normY >= height ? distance : -distance;
+					if (closest)
+						(*closest)[index] = point;
+				}
+			}
+		}
+	});
+}
+
+TerrainSDFGenerator::VoxelBox TerrainSDFGenerator::Update(int resolution, const HeightRegion& changed, std::vector<float>& sdf, std::vector<SurfacePoint>& closest, ThreadPool* pool) const
+{
+	const int n = resolution;
+	VoxelBox none = { 0, 0, 0, 0, 0, 0 };
+	if (changed.IsEmpty() || !HasHeightfield() || n <= 0)
+		return none;
+
+	// the interpolated surface moves over every heightfield cell touching a changed sample
+	float u0 = float(std::max(changed.x0 - 1, 0)) / (m_width - 1);
+	float u1 = float(std::min(changed.x1, m_width - 1)) / (m_width - 1);
+	float v0 = float(std::max(changed.z0 - 1, 0)) / (m_depth - 1);
+	float v1 = float(std::min(changed.z1, m_depth - 1)) / (m_depth - 1);
+
+	auto outsideChange = [&](const SurfacePoint& point)
+	{
+		return point.u < u0 || point.u > u1 || point.v < v0 || point.v > v1;
+	};
+
+	// a voxel is affected when the moved surface may come closer than its distance, or when its closest
+	// point lay on the moved surface, which is the same test since that point is at least as far away.
+	// The new closest point of an affected voxel is no farther than the surface straight above or below
+	// it, or than its old closest point if that one stayed, which bounds the area that has to be seeded
+	struct SliceBounds
+	{
+		VoxelBox voxels;
+		float u0, v0, u1, v1;
+	};
+	std::vector<uint8_t> affected(size_t(n) * n * n, 0);
+	std::vector<SliceBounds> sliceBounds(n, { none, 1.0f, 1.0f, 0.0f, 0.0f });
+	ForEachSlice(pool, n, [&](int zBegin, int zEnd)
+	{
+		for (int z = zBegin; z < zEnd; z++)
+		{
+			SliceBounds bounds = { { n, n, z, 0, 0, z + 1 }, 1.0f, 1.0f, 0.0f, 0.0f };
+			for (int x = 0; x < n; x++)
+			{
+				float u = (x + 0.5f) / n, v = (z + 0.5f) / n;
+				float du = std::max(0.0f, std::max(u0 - u, u - u1));
+				float dv = std::max(0.0f, std::max(v0 - v, v - v1));
+				float columnSq = du * du + dv * dv;
+				float height = SampleHeight(u, v);
+				for (int y = 0; y < n; y++)
+				{
+					size_t index = (size_t(z) * n + y) * n + x;
+					if (columnSq > sdf[index] * sdf[index])
+						continue;
+
+					affected[index] = 1;
+					VoxelBox& box = bounds.voxels;
+					box = { std::min(box.x0, x), std::min(box.y0, y), z, std::max(box.x1, x + 1), std::max(box.y1, y + 1), z + 1 };
+
+					float normY = (y + 0.5f) / n - 0.5f;
+					float reach = std::abs(normY - height);
+					if (outsideChange(closest[index]))
+						reach = std::min(reach, std::abs(sdf[index]));
+					bounds.u0 = std::min(bounds.u0, u - reach);
+					bounds.v0 = std::min(bounds.v0, v - reach);
+					bounds.u1 = std::max(bounds.u1, u + reach);
+					bounds.v1 = std::max(bounds.v1, v + reach);
+				}
+			}
+			if (!bounds.voxels.IsEmpty())
+				sliceBounds[z] = bounds;
+		}
+	});
+
+	VoxelBox box = { n, n, n, 0, 0, 0 };
+	float seedU0 = u0, seedV0 = v0, seedU1 = u1, seedV1 = v1;
+	for (const SliceBounds& bounds : sliceBounds)
+	{
+		const VoxelBox& voxels = bounds.voxels;
+		if (voxels.IsEmpty())
+			continue;
+		box = { std::min(box.x0, voxels.x0), std::min(box.y0, voxels.y0), std::min(box.z0, voxels.z0),
+			std::max(box.x1, voxels.x1), std::max(box.y1, voxels.y1), std::max(box.z1, voxels.z1) };
+		seedU0 = std::min(seedU0, bounds.u0);
+		seedV0 = std::min(seedV0, bounds.v0);
+		seedU1 = std::max(seedU1, bounds.u1);
+		seedV1 = std::max(seedV1, bounds.v1);
+	}
+	if (box.IsEmpty())
+		return none;
+
+	int lattice = GetSeedLattice(n);
+	auto toLattice = [&](float u, bool upper)
+	{
+		float i = std::max(0.0f, std::min(u, 1.0f)) * (lattice - 1);
+		return upper ? int(std::ceil(i)) + 1 : int(std::floor(i));
+	};
+	std::vector<Seed> seeds;
+	CreateSeeds(n, toLattice(seedU0, false), toLattice(seedV0, false), toLattice(seedU1, true), toLattice(seedV1, true), seeds);
+
+	std::vector<int> nearest;
+	Flood(seeds, box, nearest, pool);
+
+	const int sx = box.x1 - box.x0, sy = box.y1 - box.y0;
+	float spacing = 1.0f / (lattice - 1);
+	ForEachSlice(pool, box.z1 - box.z0, [&](int zBegin, int zEnd)
+	{
+		for (int z = box.z0 + zBegin; z < box.z0 + zEnd; z++)
+		{
+			for (int x = box.x0; x < box.x1; x++)
+			{
+				float u = (x + 0.5f) / n, v = (z + 0.5f) / n;
+				float height = SampleHeight(u, v);
+				for (int y = box.y0; y < box.y1; y++)
+				{
+					size_t index = (size_t(z) * n + y) * n + x;
+					if (!affected[index])
+						continue;
+
+					float normY = (y + 0.5f) / n - 0.5f;
+					SurfacePoint point = { u, v };
+					float distanceSq = (normY - height) * (normY - height);
+
+					// the old closest point still lies on the surface when it is outside the moved area
+					const SurfacePoint& previous = closest[index];
+					if (outsideChange(previous))
+					{
+						float dx = previous.u - u, dy = SampleHeight(previous.u, previous.v) - normY, dz = previous.v - v;
+						if (dx * dx + dy * dy + dz * dz < distanceSq)
+						{
+							point = previous;
+							distanceSq = dx * dx + dy * dy + dz * dz;
+						}
+					}
+
+					int seed = nearest[(size_t(z - box.z0) * sy + y - box.y0) * sx + x - box.x0];
+					if (seed >= 0)
+					{
+						SurfacePoint candidate = { (seeds[seed].x + 0.5f) / n, (seeds[seed].z + 0.5f) / n };
+						float candidateSq = ClosestSurfacePoint(u, normY, v, candidate.u, candidate.v, spacing);
+						if (candidateSq < distanceSq)
+						{
+							point = candidate;
+							distanceSq = candidateSq;
+						}
+					}
+
+					float distance = std::sqrt(distanceSq);
+					sdf[index] = normY >= height ? distance : -distance;
+					closest[index] = point;
+				}
+			}
+		}
+	});
+	return box;
+}
+
+float TerrainSDFGenerator::ClosestSurfacePoint(float x, float y, float z, float& u, float& v, float step) const
+{
+	auto distanceSq = [&](float su, float sv)
+	{
+		float dx = su - x, dy = SampleHeight(su, sv) - y, dz = sv - z;
+		return dx * dx + dy * dy + dz * dz;
+	};
+
+	u = std::max(0.0f, std::min(u, 1.0f));
+	v = std::max(0.0f, std::min(v, 1.0f));
+	float best = distanceSq(u, v);
+	for (int i = 0; i < 12; i++)
+	{
+		bool moved = false;
+		for (int dv = -1; dv <= 1; dv++)
+		{
+			for (int du = -1; du <= 1; du++)
+			{
+				float su = std::max(0.0f, std::min(u + du * step, 1.0f));
+				float sv = std::max(0.0f, std::min(v + dv * step, 1.0f));
+				float d = distanceSq(su, sv);
+				if (d < best)
+				{
+					best = d;
+					u = su;
+					v = sv;
+					moved = true;
+				}
+			}
+		}
+		if (!moved)
+			step *= 0.5f;
+	}
+	return best;
+}
+
+void TerrainSDFGenerator::WriteBenchmark(const std::string& filename, const std::vector<int>& resolutions, ThreadPool* pool) const
+{
+	std::ofstream file(filename);
+	if (!file)
+		return;
+
+	file << "resolution,threads,ms\n";
+
+	std::vector<ThreadPool*> pools = { nullptr };
+	if (pool)
+		pools.push_back(pool);
+
+	std::vector<float> sdf;
+	for (int resolution : resolutions)
+	{
+		for (ThreadPool* p : pools)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			Generate(resolution, sdf, p);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			file << resolution << "," << (p ? p->GetThreadCount() : 1) << "," << ms << "\n";
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+// TerrainSDFGenerator
+// Builds a Euclidean signed distance field from a heightfield with a 3D jump flood.
+// The surface of the bilinearly interpolated heightfield is seeded densely enough that every voxel it
+// crosses holds a seed; each flood pass then lets every voxel adopt the closest seed held by its 26
+// neighbours at the pass's step, halving the step down to one voxel, followed by one extra unit pass.
+// The closest seed is then refined to the closest point of the continuous surface.
+// The output layout matches terrain_sdf_cs.hlsl: an N^3 grid over x, z in [0,1] and y in [-0.5,0.5],
+// sampled at voxel centres, x fastest, in the same units as the heights and positive above the terrain.
+// Update rebuilds only the voxels a local change of the heightfield can reach: a voxel whose column is
+// farther from the changed area than its current distance keeps both its distance and its sign.
+
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+class TerrainSDFGenerator
+{
+public:
+	// surface point (u, SampleHeight(u, v), v) a voxel's distance was measured to
+	struct SurfacePoint
+	{
+		float u, v;
+	};
+
+	// heightfield samples [x0, x1) x [z0, z1)
+	struct HeightRegion
+	{
+		int x0, z0, x1, z1;
+		bool IsEmpty() const { return x1 <= x0 || z1 <= z0; };
+	};
+
+	// voxels [x0, x1) x [y0, y1) x [z0, z1)
+	struct VoxelBox
+	{
+		int x0, y0, z0, x1, y1, z1;
+		bool IsEmpty() const { return x1 <= x0 || y1 <= y0 || z1 <= z0; };
+	};
+
+	// heights are indexed z * width + x, with sample (x, z) at (x / (width - 1), z / (depth - 1))
+	void SetHeightfield(const float* heights, int width, int depth);
+	bool HasHeightfield() const { return !m_heights.empty(); };
+
+	float SampleHeight(float u, float v) const;
+
+	// bounds of the tiles of tileSize x tileSize samples that differ from previous, which has the same size
+	HeightRegion FindChangedTiles(const std::vector<float>& previous, int tileSize) const;
+	const std::vector<float>& GetHeights() const { return m_heights; };
+
+	// pool may be null, in which case the build runs on the calling thread; closest, when given, receives
+	// the surface point of every voxel, which Update needs
+	void Generate(int resolution, std::vector<float>& sdf, ThreadPool* pool, std::vector<SurfacePoint>* closest = nullptr) const;
+
+	// brings sdf and closest, as left by Generate or Update, up to date after the samples in changed were
+	// replaced, and returns the bounds of the voxels it rewrote
+	VoxelBox Update(int resolution, const HeightRegion& changed, std::vector<float>& sdf, std::vector<SurfacePoint>& closest, ThreadPool* pool) const;
+
+	// times Generate at each resolution on one thread and on the pool, and writes the results to a CSV file
+	void WriteBenchmark(const std::string& filename, const std::vector<int>& resolutions, ThreadPool* pool) const;
+
+private:
+	struct Seed
+	{
+		float x, y, z; // grid coordinates, voxel centres at integers
+	};
+
+	// seeds on the lattice points [i0, i1) x [j0, j1) of the surface sampling used at this resolution
+	int GetSeedLattice(int resolution) const;
+	void CreateSeeds(int resolution, int i0, int j0, int i1, int j1, std::vector<Seed>& seeds) const;
+	// leaves the closest seed of every voxel of box in nearest, indexed within the box
+	void Flood(const std::vector<Seed>& seeds, const VoxelBox& box, std::vector<int>& nearest, ThreadPool* pool) const;
+	// squared distance from (x, y, z) to the surface, searched from the surface point above (u, v); (u, v)
+	// is moved to the closest point found
+	float ClosestSurfacePoint(float x, float y, float z, float& u, float& v, float step) const;
+
+	std::vector<float> m_heights;
+	int m_width = 0, m_depth = 0;
+};
@@ -0,0 +1,94 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+	thread_local bool t_insideParallelFor = false;
+}
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+
+	for (int i = 1; i < threadCount; i++)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::ParallelFor(int count, int grain, const std::function<void(int, int)>& fn)
+{
+	if (count <= 0)
+		return;
+	grain = std::max(1, grain);
+
+	if (m_workers.empty() || t_insideParallelFor || count <= grain)
+	{
+		for (int begin = 0; begin < count; begin += grain)
+			fn(begin, std::min(begin + grain, count));
+		return;
+	}
+
+	std::lock_guard<std::mutex> call(m_callMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fn = &fn;
+		m_count = count;
+		m_grain = grain;
+		m_next = 0;
+		m_active = int(m_workers.size());
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	RunChunks();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_active == 0; });
+	m_fn = nullptr;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	uint64_t generation = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+			if (m_stop)
+				return;
+			generation = m_generation;
+		}
+
+		RunChunks();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_active == 0)
+			m_done.notify_one();
+	}
+}
+
+void ThreadPool::RunChunks()
+{
+	t_insideParallelFor = true;
+	for (;;)
+	{
+		int begin = m_next.fetch_add(m_grain);
+		if (begin >= m_count)
+			break;
+		(*m_fn)(begin, std::min(begin + m_grain, m_count));
+	}
+	t_insideParallelFor = false;
+}
@@ -0,0 +1,57 @@
+#pragma once
+// ThreadPool
+// Persistent worker threads for data-parallel CPU work. ParallelFor splits a range into chunks that the
+// workers and the calling thread claim from a shared counter, and returns once every chunk has run.
+// A ParallelFor issued from inside a running one runs serially on the calling thread.
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// threadCount includes the calling thread; 0 uses every hardware thread
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int GetThreadCount() const { return int(m_workers.size()) + 1; };
+
+	// runs fn(begin, end) over [0, count) in chunks of at most grain items
+	void ParallelFor(int count, int grain, const std::function<void(int, int)>& fn);
+
+private:
+	void WorkerLoop();
+	void RunChunks();
+
+	std::vector<std::thread> m_workers;
+
+	// serializes ParallelFor calls made from different threads
+	std::mutex m_callMutex;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake, m_done;
+	bool m_stop = false;
+	uint64_t m_generation = 0;
+	int m_active = 0;
+
+	const std::function<void(int, int)>* m_fn = nullptr;
+	int m_count = 0, m_grain = 1;
+	std::atomic<int> m_next{ 0 };
+};
+
+// runs fn(begin, end) over [0, count) one item per chunk on pool, or as a single call on the calling thread
+// when pool is null
+inline void ForEachSlice(ThreadPool* pool, int count, const std::function<void(int, int)>& fn)
+{
+	if (pool)
+		pool->ParallelFor(count, 1, fn);
+	else
+		fn(0, count);
+}
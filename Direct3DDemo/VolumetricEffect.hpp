@@ -26,21 +26,50 @@ namespace CustomEffects
 		DirectX::XMMATRIX GetMainCameraProjInv() const { return m_mainCameraProjInv; }
 		float GetAbsorptionCoeff() const { return m_absorptionCoeff; }
 		float GetScatterCoeff() const { return m_scatterCoeff; }
+		int GetMaxSteps() const { return m_maxSteps; }
+		int GetMaxLightSteps() const { return m_maxLightSteps; }
+		bool GetAdaptiveSteps() const { return m_adaptiveSteps; }
+		float GetMinStepScale() const { return m_minStepScale; }
+		float GetMaxStepScale() const { return m_maxStepScale; }
+		float GetEdgeThreshold() const { return m_edgeThreshold; }
+		float GetNearDistance() const { return m_nearDistance; }
+		float GetTerminationThreshold() const { return m_terminationThreshold; }
+		bool GetBlueNoise() const { return m_blueNoise; }
+		bool GetSkipEmpty() const { return m_skipEmpty; }
 
 		void SetMainCameraViewInv(const DirectX::XMMATRIX& viewInv) { m_mainCameraViewInv = viewInv; }
 		void SetMainCameraProjInv(const DirectX::XMMATRIX& projInv) { m_mainCameraProjInv = projInv; }
 		void SetAbsorptionCoeff(float coeff) { m_absorptionCoeff = coeff; }
 		void SetScatterCoeff(float coeff) { m_scatterCoeff = coeff; }
+		void SetMaxSteps(int steps) { m_maxSteps = std::max(1, steps); }
+		void SetMaxLightSteps(int steps) { m_maxLightSteps = std::max(1, steps); }
+		// the adaptive march scales the even step by up to maxScale where the density barely changes and down to
+		// minScale across edges and within nearDistance of the camera
+		void SetAdaptiveSteps(bool adaptive) { m_adaptiveSteps = adaptive; }
+		void SetStepScales(float minScale, float maxScale) { m_minStepScale = std::max(0.05f, minScale); m_maxStepScale = std::max(m_minStepScale, maxScale); }
+		void SetEdgeThreshold(float threshold) { m_edgeThreshold = std::max(1e-4f, threshold); }
+		void SetNearDistance(float distance) { m_nearDistance = std::max(1e-4f, distance); }
+		// rays stop once their transmittance falls below this
+		void SetTerminationThreshold(float threshold) { m_terminationThreshold = std::max(0.0f, threshold); }
+		// offsets every ray by one value of the blue noise texture, a slice per frame, instead of hashing each step;
+		// off by default, and the steps stay hashed until the texture is set
+		void SetBlueNoise(bool blueNoise) { m_blueNoise = blueNoise; }
+		void SetFrameIndex(int frameIndex) { m_frameIndex = std::max(0, frameIndex); }
+		// jumps the view and light marches over macrocells whose density is zero throughout, as read from the
+		// macrocell SRV; with even steps the image does not change. Off while no macrocell SRV is set
+		void SetSkipEmpty(bool skipEmpty) { m_skipEmpty = skipEmpty; }
 		void SetCameraPosition(const XMFLOAT3& cameraPos) { m_cameraPos = cameraPos; }
 		void SetDensityMapSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_densityMapSrv = srv; }
 		void SetSceneColorSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_sceneColorSrv = srv; }
 		void SetSceneDepthSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_sceneDepthSrv = srv; }
+		void SetBlueNoiseSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_blueNoiseSrv = srv; }
+		void SetMacrocellSrv(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) { m_macrocellSrv = srv; }
 
 		void Unbind(ID3D11DeviceContext* deviceContext)
 		{
 			// unbind density map, main render color & depth srvs for writing again
-			ID3D11ShaderResourceView* nullSRV[] = { NULL, NULL, NULL, NULL };
-			deviceContext->PSSetShaderResources(0, 4, nullSRV);
+			ID3D11ShaderResourceView* nullSRV[] = { NULL, NULL, NULL, NULL, NULL, NULL };
+			deviceContext->PSSetShaderResources(0, 6, nullSRV);
 		}
 
 		void Compute(ID3D11DeviceContext* deviceContext)
@@ -102,13 +131,17 @@ namespace CustomEffects
 			m_cameraBuffer->Apply(deviceContext, { m_cameraPos });
 			m_volumeBuffer->Apply(deviceContext, { 
 				XMMatrixTranspose(m_mainCameraViewInv), XMMatrixTranspose(m_mainCameraProjInv),
-				m_absorptionCoeff, m_scatterCoeff});
+				m_absorptionCoeff, m_scatterCoeff, float(m_maxSteps), float(m_maxLightSteps),
+				m_adaptiveSteps ? 1.0f : 0.0f, m_minStepScale, m_maxStepScale,
+				std::max(1e-4f, m_edgeThreshold), std::max(1e-4f, m_nearDistance), m_terminationThreshold,
+				m_blueNoise && m_blueNoiseSrv ? 1.0f : 0.0f, float(m_frameIndex),
+				m_skipEmpty && m_macrocellSrv ? 1.0f : 0.0f });
 			// bind
 			deviceContext->PSSetConstantBuffers(1, 1, m_cameraBuffer->GetAddressOf());
 			deviceContext->PSSetConstantBuffers(2, 1, m_volumeBuffer->GetAddressOf());
 
-			ID3D11ShaderResourceView* srvs[] = { m_densityMapSrv.Get(), m_worleyNoiseSRV.Get(), m_sceneColorSrv.Get(), m_sceneDepthSrv.Get()};
-			deviceContext->PSSetShaderResources(0, 4, srvs);
+			ID3D11ShaderResourceView* srvs[] = { m_densityMapSrv.Get(), m_worleyNoiseSRV.Get(), m_sceneColorSrv.Get(), m_sceneDepthSrv.Get(), m_blueNoiseSrv.Get(), m_macrocellSrv.Get() };
+			deviceContext->PSSetShaderResources(0, 6, srvs);
 			
 
 			auto sampler = m_states->LinearClamp();
@@ -167,6 +200,14 @@ namespace CustomEffects
 
 	private:
 		float m_absorptionCoeff = 0.7f, m_scatterCoeff = 3.5f;
+		int m_maxSteps = 24, m_maxLightSteps = 6;
+		bool m_adaptiveSteps = false;
+		float m_minStepScale = 0.5f, m_maxStepScale = 2.0f;
+		float m_edgeThreshold = 0.05f, m_nearDistance = 4.0f;
+		float m_terminationThreshold = 1e-3f;
+		bool m_blueNoise = false;
+		int m_frameIndex = 0;
+		bool m_skipEmpty = true;
 		DirectX::XMMATRIX m_mainCameraViewInv, m_mainCameraProjInv;
 
 		Microsoft::WRL::ComPtr<ID3D11BlendState> m_blendState;
@@ -186,6 +227,8 @@ namespace CustomEffects
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_densityMapSrv;
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_sceneColorSrv;
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_sceneDepthSrv;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_blueNoiseSrv;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_macrocellSrv;
 
 		std::unique_ptr<DirectX::CommonStates> m_states;
 	};
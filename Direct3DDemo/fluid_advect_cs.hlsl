@@ -1,11 +1,19 @@
-RWStructuredBuffer<float> gNewDensity : register(u0);
+// advected scalars are stored SoA: field f of cell i lives at f * cellCount + i
+#define SCALAR_FIELD_COUNT 4
+static const int FIELD_DENSITY = 0;
+static const int FIELD_TEMPERATURE = 1; // excess over ambient temperature
+static const int FIELD_VAPOUR = 2;
+static const int FIELD_CONDENSATE = 3;
+
+RWStructuredBuffer<float> gNewScalars : register(u0);
 StructuredBuffer<float> gVelocityX : register(t0);
 StructuredBuffer<float> gVelocityY : register(t1);
 StructuredBuffer<float> gVelocityZ : register(t2);
-StructuredBuffer<float> gDensity : register(t3);
+StructuredBuffer<float> gScalars : register(t3);
 Texture3D<float> gSDF : register(t4);
 StructuredBuffer<float> gSurface : register(t5);
 Texture3D<float> gNoiseMap : register(t6);
+StructuredBuffer<float> gBrickSteps : register(t7); // per thread group: 0 = skipped this step, otherwise steps covered
 
 SamplerState samplerClamp : register(s0);
 SamplerState samplerWrap : register(s1);
@@ -76,6 +84,21 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
         return;
 
     int index = GridIndex(x, y, z, gridSize);
+    int cellCount = gridSize.x * gridSize.y * gridSize.z;
+
+    // brick level of detail: skipped bricks carry their scalars over, updated bricks integrate the steps they covered
+    int3 brickGridSize = int3(dimension + 1, dimension + 1, dimension + 1);
+    float brickSteps = gBrickSteps[GridIndex(groupID.x, groupID.y, groupID.z, brickGridSize)];
+    if (brickSteps == 0)
+    {
+        [unroll]
+        for (int k = 0; k < SCALAR_FIELD_COUNT; k++)
+        {
+            gNewScalars[k * cellCount + index] = gScalars[k * cellCount + index];
+        }
+        return;
+    }
+    float dt = deltaTime * brickSteps;
     
     //if (gSDF.SampleLevel(samplerClamp, float3(x, y, z) / gridSize, 0) > 0.5f)
     //{
@@ -92,12 +115,46 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     float3 velocity = SampleVelocity(float3(x, y, z), gridSizeX, gridSizeY, gridSizeZ);
 
     // Compute backtraced position
-    float3 prevPosition = float3(x, y, z) - velocity * deltaTime;
+    float3 prevPosition = float3(x, y, z) - velocity * dt;
     
     prevPosition = clamp(prevPosition, float3(1, 1, 1), float3(gridSize - 2));
 
-    // Sample density at the backtraced position
-    float newDensity = TrilinearSample(gDensity, gridSize, prevPosition);
+    // Sample all scalar fields at the backtraced position - corner indices and weights are shared, one gather set per field
+    int3 p0 = (int3) floor(prevPosition);
+    int3 p1 = p0 + int3(1, 1, 1);
+    p0 = clamp(p0, int3(0, 0, 0), gridSize - 1);
+    p1 = clamp(p1, int3(0, 0, 0), gridSize - 1);
+    float3 f = prevPosition - (float3) p0;
+
+    int corners[8] =
+    {
+        GridIndex(p0.x, p0.y, p0.z, gridSize), GridIndex(p1.x, p0.y, p0.z, gridSize),
+        GridIndex(p0.x, p1.y, p0.z, gridSize), GridIndex(p1.x, p1.y, p0.z, gridSize),
+        GridIndex(p0.x, p0.y, p1.z, gridSize), GridIndex(p1.x, p0.y, p1.z, gridSize),
+        GridIndex(p0.x, p1.y, p1.z, gridSize), GridIndex(p1.x, p1.y, p1.z, gridSize)
+    };
+    float weights[8] =
+    {
+        (1 - f.x) * (1 - f.y) * (1 - f.z), f.x * (1 - f.y) * (1 - f.z),
+        (1 - f.x) * f.y * (1 - f.z), f.x * f.y * (1 - f.z),
+        (1 - f.x) * (1 - f.y) * f.z, f.x * (1 - f.y) * f.z,
+        (1 - f.x) * f.y * f.z, f.x * f.y * f.z
+    };
+
+    float scalars[SCALAR_FIELD_COUNT];
+    [unroll]
+    for (int field = 0; field < SCALAR_FIELD_COUNT; field++)
+    {
+        int base = field * cellCount;
+        float value = 0;
+        [unroll]
+        for (int c = 0; c < 8; c++)
+        {
+            value += weights[c] * gScalars[base + corners[c]];
+        }
+        scalars[field] = value;
+    }
+    float newDensity = scalars[FIELD_DENSITY];
     
     
     //--- DEBUGGING
@@ -140,6 +197,10 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
         
         
         newDensity = saturate(injected * smoothstep(0, 0.2, 1 - y / (gridSize.y * 0.35f)));
+
+        // the warm, moist surface layer is what drives the rising plumes
+        scalars[FIELD_TEMPERATURE] = max(scalars[FIELD_TEMPERATURE], newDensity);
+        scalars[FIELD_VAPOUR] = max(scalars[FIELD_VAPOUR], newDensity);
     }
     else
     {   
@@ -150,10 +211,19 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
         float decayRate = baseDecayRate / (1.0 + newDensity * sharpness);
         //decayRate = max(decayRate, minDecay); // ensure some decay always happens
 
-        newDensity -= decayRate * deltaTime;
+        newDensity -= decayRate * dt;
         newDensity = saturate(newDensity);
+
+        // temperature relaxes towards ambient
+        float coolingRate = 0.05f;
+        scalars[FIELD_TEMPERATURE] -= scalars[FIELD_TEMPERATURE] * coolingRate * dt;
     }
+    scalars[FIELD_DENSITY] = newDensity;
 
-    // Store new density
-    gNewDensity[index] = newDensity;
+    // Store new scalars
+    [unroll]
+    for (int k = 0; k < SCALAR_FIELD_COUNT; k++)
+    {
+        gNewScalars[k * cellCount + index] = scalars[k];
+    }
 }
\ No newline at end of file
@@ -5,16 +5,18 @@ StructuredBuffer<float> gVelocityX : register(t0);
 StructuredBuffer<float> gVelocityY : register(t1);
 StructuredBuffer<float> gVelocityZ : register(t2);
 Texture3D<float> gSDF : register(t3);
-Texture3D<float> gNoiseMap : register(t4);
-StructuredBuffer<float> gDensity : register(t5);
+Texture3D<float4> gForceField : register(t4);
+StructuredBuffer<float> gScalars : register(t5); // SoA scalar fields, see fluid_advect_cs
+StructuredBuffer<float> gBrickSteps : register(t6); // per thread group: 0 = skipped this step, otherwise steps covered
 
 SamplerState samplerClamp : register(s0);
-SamplerState samplerWrap : register(s1);
 
 cbuffer FluidParams : register(b0)
 {
     float deltaTime;
     float elapsedTime;
+    float densityWeight;
+    float thermalBuoyancy;
 }
 
 int GridIndex(int x, int y, int z, int3 size)
@@ -69,87 +71,36 @@ float3 SampleVelocity(float3 pos, int3 gridSizeX, int3 gridSizeY, int3 gridSizeZ
     return float3(u, v, w);
 }
 
-float3 WindForce(float3 samplePos)
+float3 ExternalForce(float3 cellPos, float3 gridSize)
 {
-    float3 windDir = float3(0, 0, 0);
-    
-    // Wind field parameters
-    float gustSpeed = 0.07f * 0.13f;
-    float windStrength = 52.0f;
-    
-    // fBm scalar for wind strength modulation
-    float strengthFreq = 1.2f * 0.11f;
-    float strengthAmp = 0.5f;
-    float gust = 0.0f;
-
-    for (int j = 0; j < 3; j++)
-    {
-        float noise = gNoiseMap.SampleLevel(samplerWrap, samplePos * strengthFreq - gustSpeed * elapsedTime, 0).r;
-        gust += (noise * 0.5f + 0.5f) * strengthAmp;
-        strengthFreq *= 1.8;
-        strengthAmp *= 0.5;
-    }
-            
-    float threshold = 0.43f;
-    gust = smoothstep(threshold, threshold + 0.15f, gust);
+    // wind + curl forces change slowly, so they're cached on a coarse grid and refreshed in slabs (fluid_force_cs)
+    // map the cell onto the cache texels (texel i sits at cell i * (gridSize - 1) / (forceRes - 1)) and let the sampler do the trilinear filtering
+    uint3 forceRes;
+    gForceField.GetDimensions(forceRes.x, forceRes.y, forceRes.z);
 
-    
-    if (gust > 0)
-    {
-        // fBm vector noise for wind direction
-        float dirFreq = 1.462f * 0.13f;
-        float dirAmp = 1.0f;
-        float windSpeed = 0.1f * 0.09f;
-
-        for (int i = 0; i < 4; i++)
-        {               
-            windDir.x += gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0.92, 0, 0)) * dirFreq - windSpeed * elapsedTime, 0).r * dirAmp;
-            windDir.y += gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0, 1.679, 0)) * dirFreq - windSpeed * elapsedTime, 0).r * dirAmp;
-            windDir.z += gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0, 0, 2.697)) * dirFreq - windSpeed * elapsedTime, 0).r * dirAmp;
-
-            dirFreq *= 1.8;
-            dirAmp *= 0.6;
-        }
-
-        windDir = normalize(windDir); // direction only
-    }
-    
-    return windDir * gust * windStrength;
+    float3 texel = cellPos / (gridSize - 1) * (forceRes - 1);
+    return gForceField.SampleLevel(samplerClamp, (texel + 0.5f) / forceRes, 0).xyz;
 }
-
-float3 CurlForce(float3 samplePos)
+float3 BuoyancyForce(float3 samplePos, int3 scalarGridSize)
 {
-    float3 res = float3(0, 0, 0);
-    float curlFreq = 0.07f * 0.1f;
-    float curlSpeed = 0.03f * 0.1f;
-    float curlAmp = 3.5f;
-    for (int i = 0; i < 3; i++)
-    {
-        res.x += saturate(gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(3.862, 0, 0)) * curlFreq - curlSpeed * elapsedTime, 0).r) * curlAmp;
-        res.y += saturate(gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0, 4.621, 0)) * curlFreq - curlSpeed * elapsedTime, 0).r) * curlAmp;
-        res.z += saturate(gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0, 0, 5.638)) * curlFreq - curlSpeed * elapsedTime, 0).r) * curlAmp;
+    int cellCount = scalarGridSize.x * scalarGridSize.y * scalarGridSize.z;
+    int index = GridIndex(samplePos.x, samplePos.y, samplePos.z, scalarGridSize);
 
-        curlFreq *= 1.7;
-        curlAmp *= 0.4;
-    }
-    return res;
-}
-float3 BuoyancyForce(float3 samplePos, float3 densityGridSize)
-{
-    float density = gDensity[GridIndex(samplePos.x, samplePos.y, samplePos.z, densityGridSize)];
-    
-    float kDensity = 13.0f;
-    float buoyancy = -kDensity * density;
+    float density = gScalars[index]; // field 0
+    float temperature = gScalars[cellCount + index]; // field 1, excess over ambient
+
+    // warm air rises, cloud matter weighs it down
+    float buoyancy = thermalBuoyancy * temperature - densityWeight * density;
     
     return float3(0, buoyancy, 0);
 }
 
-float3 Advect(float3 facePos, float3 gridSizeX, float3 gridSizeY, float3 gridSizeZ)
+float3 Advect(float3 facePos, float3 gridSizeX, float3 gridSizeY, float3 gridSizeZ, float dt)
 {   
     // Sample current full velocity field
     float3 velocity = SampleVelocity(facePos, gridSizeX, gridSizeY, gridSizeZ);
         
-    float3 prevPos = facePos - deltaTime * velocity;
+    float3 prevPos = facePos - dt * velocity;
     float3 newVelocity = SampleVelocity(prevPos, gridSizeX, gridSizeY, gridSizeZ);
         
     return newVelocity;
@@ -181,13 +132,21 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
         return;
     }
     
+    // brick level of detail: skipped bricks carry their velocities over, updated bricks integrate the steps they covered
+    int3 brickGridSize = int3(dimension + 1, dimension + 1, dimension + 1);
+    float brickSteps = gBrickSteps[GridIndex(groupID.x, groupID.y, groupID.z, brickGridSize)];
+    if (brickSteps == 0)
+    {
+        gNewVelocityX[GridIndex(x, y, z, gridSizeX)] = gVelocityX[GridIndex(x, y, z, gridSizeX)];
+        gNewVelocityY[GridIndex(x, y, z, gridSizeY)] = gVelocityY[GridIndex(x, y, z, gridSizeY)];
+        gNewVelocityZ[GridIndex(x, y, z, gridSizeZ)] = gVelocityZ[GridIndex(x, y, z, gridSizeZ)];
+        return;
+    }
+    float dt = deltaTime * brickSteps;
     
-    float3 windForce = WindForce(float3(x, y, z) / (simRes + 2));
-    float3 curlForce = CurlForce(float3(x, y, z) / (simRes + 2));
-    //float3 windForce = float3(0, 0, 0);
-    //float3 curlForce = float3(0, 0, 0);
+    float3 externalForce = ExternalForce(float3(x, y, z), gridSize);
     float3 buoyancyForce = BuoyancyForce(float3(x, y, z), gridSize);
-    float3 force = windForce + curlForce + buoyancyForce;
+    float3 force = externalForce + buoyancyForce;
     
     int velocityIndex;
     float3 facePos, prevPos;
@@ -196,10 +155,10 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     // U COMPONENT ADVECTION
     velocityIndex = GridIndex(x, y, z, gridSizeX);
     facePos = float3(x, y + 0.5f, z + 0.5f); // physical position of right face
-    newVelocity.x = Advect(facePos, gridSizeX, gridSizeY, gridSizeZ).x;
+    newVelocity.x = Advect(facePos, gridSizeX, gridSizeY, gridSizeZ, dt).x;
     
     // U COMPONENT FORCE APPLICATION
-    newVelocity.x += force.x * deltaTime;
+    newVelocity.x += force.x * dt;
         
     gNewVelocityX[velocityIndex] = newVelocity.x;
     
@@ -207,10 +166,10 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     // V COMPONENT ADVECTION
     velocityIndex = GridIndex(x, y, z, gridSizeY);
     facePos = float3(x + 0.5f, y, z + 0.5f);
-    newVelocity.y = Advect(facePos, gridSizeX, gridSizeY, gridSizeZ).y;
+    newVelocity.y = Advect(facePos, gridSizeX, gridSizeY, gridSizeZ, dt).y;
     
     // V COMPONENT FORCE APPLICATION
-    newVelocity.y += force.y * deltaTime;
+    newVelocity.y += force.y * dt;
         
     gNewVelocityY[velocityIndex] = newVelocity.y;
     
@@ -218,10 +177,10 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     // W COMPONENT ADVECTION
     velocityIndex = GridIndex(x, y, z, gridSizeZ);
     facePos = float3(x + 0.5f, y + 0.5f, z);
-    newVelocity.z = Advect(facePos, gridSizeX, gridSizeY, gridSizeZ).z;
+    newVelocity.z = Advect(facePos, gridSizeX, gridSizeY, gridSizeZ, dt).z;
     
     // W COMPONENT FORCE APPLICATION
-    newVelocity.z += force.z * deltaTime;
+    newVelocity.z += force.z * dt;
         
     gNewVelocityZ[velocityIndex] = newVelocity.z;
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+// per-group partial reductions of the solver state, one record of DIAGNOSTICS_VALUE_COUNT floats per thread group
+#define DIAGNOSTICS_VALUE_COUNT 7
+#define DIAGNOSTICS_GROUP_SIZE 64
+
+RWStructuredBuffer<float> gPartials : register(u0);
+
+StructuredBuffer<float> gVelocityX : register(t0); // U-Velocity (Nx+1, Ny+2, Nz+2)
+StructuredBuffer<float> gVelocityY : register(t1); // V-Velocity (Nx+2, Ny+1, Nz+2)
+StructuredBuffer<float> gVelocityZ : register(t2); // W-Velocity (Nx+2, Ny+2, Nz+1)
+StructuredBuffer<float> gDivergence : register(t3);
+StructuredBuffer<float> gDensity : register(t4);
+
+cbuffer DiagnosticsParams : register(b0)
+{
+    int stage; // 0 = before projection, 1 = after projection
+    float activeThreshold; // density above which a cell counts as active
+}
+
+// value slots, max-reduced: 0, 3, 5 - sum-reduced: 1, 2, 4, 6
+static const int VALUE_MAX_DIVERGENCE = 0;
+static const int VALUE_DIVERGENCE_SQ = 1;
+static const int VALUE_TOTAL_DENSITY = 2;
+static const int VALUE_MAX_DENSITY = 3;
+static const int VALUE_KINETIC_ENERGY = 4;
+static const int VALUE_MAX_SPEED_SQ = 5;
+static const int VALUE_ACTIVE_CELLS = 6;
+
+groupshared float sharedValues[DIAGNOSTICS_GROUP_SIZE][DIAGNOSTICS_VALUE_COUNT];
+
+int GridIndex(int x, int y, int z, int3 size)
+{
+    return (z * size.y * size.x) + (y * size.x) + x;
+}
+
+bool IsMaxSlot(int k)
+{
+    return k == VALUE_MAX_DIVERGENCE || k == VALUE_MAX_DENSITY || k == VALUE_MAX_SPEED_SQ;
+}
+
+[numthreads(4, 4, 4)]
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID, uint groupIndex : SV_GroupIndex)
+{
+    int subdivision = 4;
+    int dimension = 8;
+    int simRes = dimension * subdivision;
+
+    int3 gridSizeX = int3(simRes + 3, simRes + 2, simRes + 2);
+    int3 gridSizeY = int3(simRes + 2, simRes + 3, simRes + 2);
+    int3 gridSizeZ = int3(simRes + 2, simRes + 2, simRes + 3);
+    int3 gridSize = int3(simRes + 2, simRes + 2, simRes + 2);
+
+    // interior cells only, ghost layer is skipped
+    int x = groupID.x * subdivision + groupThreadID.x + 1;
+    int y = groupID.y * subdivision + groupThreadID.y + 1;
+    int z = groupID.z * subdivision + groupThreadID.z + 1;
+
+    int index = GridIndex(x, y, z, gridSize);
+
+    float divergence = gDivergence[index];
+    float density = gDensity[index];
+
+    // cell-centred velocity from the staggered faces
+    float u = 0.5f * (gVelocityX[GridIndex(x, y, z, gridSizeX)] + gVelocityX[GridIndex(x + 1, y, z, gridSizeX)]);
+    float v = 0.5f * (gVelocityY[GridIndex(x, y, z, gridSizeY)] + gVelocityY[GridIndex(x, y + 1, z, gridSizeY)]);
+    float w = 0.5f * (gVelocityZ[GridIndex(x, y, z, gridSizeZ)] + gVelocityZ[GridIndex(x, y, z + 1, gridSizeZ)]);
+    float speedSq = u * u + v * v + w * w;
+
+    sharedValues[groupIndex][VALUE_MAX_DIVERGENCE] = abs(divergence);
+    sharedValues[groupIndex][VALUE_DIVERGENCE_SQ] = divergence * divergence;
+    sharedValues[groupIndex][VALUE_TOTAL_DENSITY] = density;
+    sharedValues[groupIndex][VALUE_MAX_DENSITY] = density;
+    sharedValues[groupIndex][VALUE_KINETIC_ENERGY] = 0.5f * speedSq;
+    sharedValues[groupIndex][VALUE_MAX_SPEED_SQ] = speedSq;
+    sharedValues[groupIndex][VALUE_ACTIVE_CELLS] = density > activeThreshold ? 1.0f : 0.0f;
+    GroupMemoryBarrierWithGroupSync();
+
+    // tree reduction, all values in the same sweep
+    [unroll]
+    for (uint s = DIAGNOSTICS_GROUP_SIZE / 2; s > 0; s >>= 1)
+    {
+        if (groupIndex < s)
+        {
+            [unroll]
+            for (int k = 0; k < DIAGNOSTICS_VALUE_COUNT; k++)
+            {
+                float a = sharedValues[groupIndex][k];
+                float b = sharedValues[groupIndex + s][k];
+                sharedValues[groupIndex][k] = IsMaxSlot(k) ? max(a, b) : a + b;
+            }
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (groupIndex == 0)
+    {
+        int groupCount = dimension * dimension * dimension;
+        int group = GridIndex(groupID.x, groupID.y, groupID.z, int3(dimension, dimension, dimension));
+        int base = (stage * groupCount + group) * DIAGNOSTICS_VALUE_COUNT;
+
+        [unroll]
+        for (int k = 0; k < DIAGNOSTICS_VALUE_COUNT; k++)
+        {
+            gPartials[base + k] = sharedValues[0][k];
+        }
+    }
+}
@@ -0,0 +1,54 @@
+// final reduction of the per-group partials written by fluid_diagnostics_cs, one thread group per stage
+#define DIAGNOSTICS_VALUE_COUNT 7
+#define DIAGNOSTICS_PARTIAL_COUNT 512
+
+RWStructuredBuffer<float> gResult : register(u0);
+
+StructuredBuffer<float> gPartials : register(t0);
+
+groupshared float sharedValues[DIAGNOSTICS_PARTIAL_COUNT][DIAGNOSTICS_VALUE_COUNT];
+
+bool IsMaxSlot(int k)
+{
+    // max divergence, max density, max squared speed
+    return k == 0 || k == 3 || k == 5;
+}
+
+[numthreads(DIAGNOSTICS_PARTIAL_COUNT, 1, 1)]
+void main(uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+    int stage = groupID.x;
+    int base = (stage * DIAGNOSTICS_PARTIAL_COUNT + groupIndex) * DIAGNOSTICS_VALUE_COUNT;
+
+    [unroll]
+    for (int k = 0; k < DIAGNOSTICS_VALUE_COUNT; k++)
+    {
+        sharedValues[groupIndex][k] = gPartials[base + k];
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint s = DIAGNOSTICS_PARTIAL_COUNT / 2; s > 0; s >>= 1)
+    {
+        if (groupIndex < s)
+        {
+            [unroll]
+            for (int k = 0; k < DIAGNOSTICS_VALUE_COUNT; k++)
+            {
+                float a = sharedValues[groupIndex][k];
+                float b = sharedValues[groupIndex + s][k];
+                sharedValues[groupIndex][k] = IsMaxSlot(k) ? max(a, b) : a + b;
+            }
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (groupIndex == 0)
+    {
+        [unroll]
+        for (int k = 0; k < DIAGNOSTICS_VALUE_COUNT; k++)
+        {
+            gResult[stage * DIAGNOSTICS_VALUE_COUNT + k] = sharedValues[0][k];
+        }
+    }
+}
@@ -0,0 +1,133 @@
+RWTexture3D<float4> gForceField : register(u0); // coarse cache of external forces (wind + curl noise)
+Texture3D<float> gNoiseMap : register(t0);
+
+SamplerState samplerWrap : register(s0);
+
+cbuffer ForceFieldParams : register(b0)
+{
+    float elapsedTime;
+    int sliceStart; // first z slice refreshed by this dispatch
+    int sliceCount; // number of z slices refreshed by this dispatch
+}
+
+float3 WindForce(float3 samplePos)
+{
+    float3 windDir = float3(0, 0, 0);
+
+    // Wind field parameters
+    float gustSpeed = 0.07f * 0.13f;
+    float windStrength = 52.0f;
+
+    // fBm scalar for wind strength modulation
+    float strengthFreq = 1.2f * 0.11f;
+    float strengthAmp = 0.5f;
+    float gust = 0.0f;
+
+    for (int j = 0; j < 3; j++)
+    {
+        float noise = gNoiseMap.SampleLevel(samplerWrap, samplePos * strengthFreq - gustSpeed * elapsedTime, 0).r;
+        gust += (noise * 0.5f + 0.5f) * strengthAmp;
+        strengthFreq *= 1.8;
+        strengthAmp *= 0.5;
+    }
+
+    float threshold = 0.43f;
+    gust = smoothstep(threshold, threshold + 0.15f, gust);
+
+
+    if (gust > 0)
+    {
+        // fBm vector noise for wind direction
+        float dirFreq = 1.462f * 0.13f;
+        float dirAmp = 1.0f;
+        float windSpeed = 0.1f * 0.09f;
+
+        for (int i = 0; i < 4; i++)
+        {
+            windDir.x += gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0.92, 0, 0)) * dirFreq - windSpeed * elapsedTime, 0).r * dirAmp;
+            windDir.y += gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0, 1.679, 0)) * dirFreq - windSpeed * elapsedTime, 0).r * dirAmp;
+            windDir.z += gNoiseMap.SampleLevel(samplerWrap, (samplePos + float3(0, 0, 2.697)) * dirFreq - windSpeed * elapsedTime, 0).r * dirAmp;
+
+            dirFreq *= 1.8;
+            dirAmp *= 0.6;
+        }
+
+        windDir = normalize(windDir); // direction only
+    }
+
+    return windDir * gust * windStrength;
+}
+
+// one component of the vector potential, offset per axis so the three components are uncorrelated
+float Potential(float3 noisePos, float3 offset)
+{
+    return gNoiseMap.SampleLevel(samplerWrap, noisePos + offset, 0).r;
+}
+
+float3 CurlForce(float3 samplePos)
+{
+    // curl of a noise vector potential psi, so the resulting field is divergence-free by construction
+    float3 offsetX = float3(0.3862, 0, 0);
+    float3 offsetY = float3(0, 0.4621, 0);
+    float3 offsetZ = float3(0, 0, 0.5638);
+
+    float3 res = float3(0, 0, 0);
+    float curlFreq = 0.07f * 0.1f;
+    float curlSpeed = 0.03f * 0.1f;
+    float curlAmp = 62.5f; // the first octave as strong as the old per-lattice-cell derivative
+
+    // central differences one noise texel apart in noise space
+    float eps = 1.0f / 128.0f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        float3 p = samplePos * curlFreq - curlSpeed * elapsedTime;
+        // chain rule: p = samplePos * curlFreq, so d/dsamplePos = curlFreq * d/dp
+        float derivScale = curlFreq / (2.0f * eps);
+
+        float3 dx = float3(eps, 0, 0);
+        float3 dy = float3(0, eps, 0);
+        float3 dz = float3(0, 0, eps);
+
+        float dPsiZ_dy = Potential(p + dy, offsetZ) - Potential(p - dy, offsetZ);
+        float dPsiY_dz = Potential(p + dz, offsetY) - Potential(p - dz, offsetY);
+        float dPsiX_dz = Potential(p + dz, offsetX) - Potential(p - dz, offsetX);
+        float dPsiZ_dx = Potential(p + dx, offsetZ) - Potential(p - dx, offsetZ);
+        float dPsiY_dx = Potential(p + dx, offsetY) - Potential(p - dx, offsetY);
+        float dPsiX_dy = Potential(p + dy, offsetX) - Potential(p - dy, offsetX);
+
+        res += float3(dPsiZ_dy - dPsiY_dz, dPsiX_dz - dPsiZ_dx, dPsiY_dx - dPsiX_dy) * derivScale * curlAmp;
+
+        curlFreq *= 1.7;
+        curlAmp *= 0.4;
+    }
+    return res;
+}
+
+[numthreads(4, 4, 4)]
+void main(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    int subdivision = 4;
+    int dimension = 8;
+    int simRes = dimension * subdivision;
+
+    uint3 forceRes;
+    gForceField.GetDimensions(forceRes.x, forceRes.y, forceRes.z);
+
+    int x = dispatchThreadID.x;
+    int y = dispatchThreadID.y;
+    // the slab wraps past the last slice, so every slice is refreshed once per pass even when sliceCount does not
+    // divide the resolution
+    int z = (sliceStart + (int) dispatchThreadID.z) % (int) forceRes.z;
+
+    if (x >= (int) forceRes.x || y >= (int) forceRes.y || (int) dispatchThreadID.z >= min(sliceCount, (int) forceRes.z))
+        return;
+
+    // texel (0..forceRes-1) spans the whole sim grid including ghost cells (0..simRes+1)
+    float3 cellPos = float3(x, y, z) / float3(forceRes - 1) * (simRes + 1);
+    float3 samplePos = cellPos / (simRes + 2);
+
+    float3 force = WindForce(samplePos) + CurlForce(samplePos);
+
+    gForceField[int3(x, y, z)] = float4(force, 0);
+}
@@ -0,0 +1,49 @@
+// lowest and highest density sample that trilinear interpolation reads anywhere inside each macrocell of
+// MACROCELL_SIZE^3 voxels, one advection brick, as MacrocellGrid builds them on the CPU; volume_ps.hlsl skips the
+// macrocells whose highest sample is not positive, as the density interpolates to zero everywhere in them
+#define MACROCELL_SIZE 4
+
+RWStructuredBuffer<float2> gMacrocells : register(u0); // (Nx/4, Ny/4, Nz/4), x fastest
+
+StructuredBuffer<float> gDensity : register(t0); // (Nx+2, Ny+2, Nz+2) with ghost cells
+
+int GridIndex(int x, int y, int z, int3 size)
+{
+    return (z * size.y * size.x) + (y * size.x) + x;
+}
+
+[numthreads(4, 4, 4)]
+void main(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    int subdivision = 4;
+    int dimension = 8;
+    int simRes = dimension * subdivision;
+    int cellCount = simRes / MACROCELL_SIZE;
+    int3 gridSize = int3(simRes + 2, simRes + 2, simRes + 2);
+
+    int3 cell = int3(dispatchThreadID);
+    if (any(cell >= cellCount))
+        return;
+
+    // positions in [c * size, (c + 1) * size) interpolate interior samples c * size to (c + 1) * size, clamped
+    // to the interior; the ghost layer shifts them by one
+    int3 first = cell * MACROCELL_SIZE + 1;
+    int3 last = min((cell + 1) * MACROCELL_SIZE, simRes - 1) + 1;
+
+    float lowest = 3.402823466e+38f;
+    float highest = -3.402823466e+38f;
+    for (int z = first.z; z <= last.z; z++)
+    {
+        for (int y = first.y; y <= last.y; y++)
+        {
+            for (int x = first.x; x <= last.x; x++)
+            {
+                float density = gDensity[GridIndex(x, y, z, gridSize)];
+                lowest = min(lowest, density);
+                highest = max(highest, density);
+            }
+        }
+    }
+
+    gMacrocells[GridIndex(cell.x, cell.y, cell.z, int3(cellCount, cellCount, cellCount))] = float2(lowest, highest);
+}
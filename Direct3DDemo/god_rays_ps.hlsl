@@ -1,7 +1,15 @@
 Texture2D sceneColor : register(t0); // Main rendered scene
 Texture2D occlusion : register(t1); // Occlusion mask with sun & sky
+Texture2DArray<float> blueNoise : register(t2); // a blue noise slice per frame
 SamplerState samplerState : register(s0); // Clamp sampler
 
+cbuffer GodRaysBuffer : register(b1)
+{
+    float sample_count; // samples toward the sun
+    float blue_noise; // 1 starts each pixel's samples a blue noise fraction of a sample toward the sun
+    float frame_index; // the blue noise slice
+};
+
 struct InputType
 {
     float4 position : SV_POSITION;
@@ -12,32 +20,46 @@ struct InputType
 
 float4 main(InputType input) : SV_TARGET
 {
-    const int NUM_SAMPLES = 80;
+    const float REFERENCE_SAMPLES = 80; // the decay and weight are per sample of this many
     const float density = 0.926;
     const float decay = 0.96815;
     const float exposure = 0.1f;
     const float weight = 0.58767f;
 
+    // fewer samples each cover more of the way to the sun, so they decay and weigh as much as the samples they replace
+    int numSamples = max(int(sample_count), 1);
+    float sampleScale = REFERENCE_SAMPLES / numSamples;
+    float sampleDecay = pow(decay, sampleScale);
+    float sampleWeight = weight * sampleScale;
+
     float2 texCoord = input.tex;
-    float2 deltaTexCoord = (texCoord - input.sunPosition) * (density / NUM_SAMPLES);
+    float2 deltaTexCoord = (texCoord - input.sunPosition) * (density / numSamples);
     
     float illuminationDecay = 1.0f;
     float occlusionValue = occlusion.Sample(samplerState, texCoord).r;
     
     float3 rayColor = occlusionValue.rrr;
     float2 sampleCoord = texCoord;
+    if (blue_noise > 0)
+    {
+        // the slice half the sequence away from the clouds' so the two marches do not jitter together
+        uint width, height, slices;
+        blueNoise.GetDimensions(width, height, slices);
+        uint slice = (uint(frame_index) + slices / 2) % slices;
+        sampleCoord += deltaTexCoord * blueNoise.Load(int4(uint2(input.position.xy) % uint2(width, height), slice, 0));
+    }
 
-    [unroll]
-    for (int i = 0; i < NUM_SAMPLES; ++i)
+    [loop]
+    for (int i = 0; i < numSamples; ++i)
     {
         sampleCoord -= deltaTexCoord; // step towards the sun
 
         float3 sampleLight = occlusion.Sample(samplerState, sampleCoord).rrr;
-        sampleLight *= illuminationDecay * weight;
+        sampleLight *= illuminationDecay * sampleWeight;
 
         rayColor += sampleLight;
 
-        illuminationDecay *= decay;
+        illuminationDecay *= sampleDecay;
     }
 
     // final brightness scale
@@ -1,16 +1,30 @@
-RWTexture3D<float> gSDF : register(u0);
+#define MAX_SCENE_OBJECTS 8
 
-Texture3D<float> gSDF0 : register(t0);
-//StructuredBuffer<float> gSDF1 : register(t1);
+RWTexture3D<snorm float> gSDF : register(u0); // distance / distanceScale
+
+Texture3D<float> gObjectSDF[MAX_SCENE_OBJECTS] : register(t0);
+StructuredBuffer<uint> gBrickObjects : register(t8); // per 4x4x4 brick, one bit per object overlapping it
 
 SamplerState samplerClamp : register(s0);
 
+struct SceneObject
+{
+    matrix sdfTransformInv;
+    float uniformScale;
+};
+
 cbuffer SDFParams : register(b0)
 {
     matrix simulationTransform;
-    matrix sdfTransformInv0;
-    //matrix sdfTransformInv1;
-    float sdfScale0;
+    SceneObject objects[MAX_SCENE_OBJECTS];
+    int objectCount;
+    int3 brickOffset; // first brick of the dispatched region
+    float distanceScale; // world distance stored as 1, larger distances are clamped
+}
+
+int GridIndex(int x, int y, int z, int3 size)
+{
+    return (z * size.y * size.x) + (y * size.x) + x;
 }
 
 [numthreads(4, 4, 4)]
@@ -20,14 +34,12 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     int dimension = 16;
     int simRes = dimension * subdivision;
     int3 gridSize = int3(simRes + 2, simRes + 2, simRes + 2); // account for ghost cells
+    int3 brickCount = (gridSize + subdivision - 1) / subdivision;
     
-    //int x = groupID.x * subdivision + groupThreadID.x;
-    //int y = groupID.y * subdivision + groupThreadID.y;
-    //int z = groupID.z * subdivision + groupThreadID.z;
-    
-    int x = dispatchThreadID.x;
-    int y = dispatchThreadID.y;
-    int z = dispatchThreadID.z;
+    int3 brick = int3(groupID) + brickOffset;
+    int x = brick.x * subdivision + groupThreadID.x;
+    int y = brick.y * subdivision + groupThreadID.y;
+    int z = brick.z * subdivision + groupThreadID.z;
     
     if (x > gridSize.x - 1 || y > gridSize.y - 1 || z > gridSize.z - 1)
         return;
@@ -35,7 +47,7 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     // ghost cells are boundaries
     if (x == 0 || x == gridSize.x - 1 || y == 0 || y == gridSize.y - 1 || z == 0 || z == gridSize.z - 1)
     {
-        gSDF[float3(x, y, z)] = -(simRes + 2);
+        gSDF[float3(x, y, z)] = -1.0f;
         
         return;
     }
@@ -46,25 +58,23 @@ void main(uint3 dispatchThreadID : SV_DispatchThreadID, uint3 groupID : SV_Group
     
     float minDist = simRes;
 
+    // only the objects whose bounds overlap this brick are sampled
+    uint brickObjects = gBrickObjects[GridIndex(brick.x, brick.y, brick.z, brickCount)];
+
+    [unroll]
+    for (int i = 0; i < MAX_SCENE_OBJECTS; i++)
     {
-        float3 sdfLocal0 = mul(float4(worldPos, 1.0f), sdfTransformInv0).xyz;
-        bool inside0 = all(sdfLocal0 >= 0.0f) && all(sdfLocal0 <= 1.0f);
-        if (inside0)
+        if (i < objectCount && (brickObjects & (1u << i)) != 0)
         {
-            float d0 = gSDF0.SampleLevel(samplerClamp, sdfLocal0, 0) * sdfScale0;
-            minDist = min(minDist, d0);
+            float3 sdfLocal = mul(float4(worldPos, 1.0f), objects[i].sdfTransformInv).xyz;
+            bool inside = all(sdfLocal >= 0.0f) && all(sdfLocal <= 1.0f);
+            if (inside)
+            {
+                float d = gObjectSDF[i].SampleLevel(samplerClamp, sdfLocal, 0) * objects[i].uniformScale;
+                minDist = min(minDist, d);
+            }
         }
     }
-
-    //{
-    //    float3 sdfLocal1 = mul(float4(worldPos, 1.0f), sdfTransformInv1).xyz;
-    //    bool inside1 = all(sdfLocal1 >= 0.0f) && all(sdfLocal1 <= 1.0f);
-    //    if (inside1)
-    //    {
-    //        float d1 = SampleSDF(gSDF1, int3(32, 32, 32), sdfLocal1);
-    //        minDist = min(minDist, d1);
-    //    }
-    //}
     
-    gSDF[float3(x, y, z)] = minDist;
+    gSDF[float3(x, y, z)] = clamp(minDist / distanceScale, -1.0f, 1.0f);
 }
\ No newline at end of file
@@ -4,6 +4,8 @@ StructuredBuffer<float> densityMap : register(t0);
 StructuredBuffer<float> noiseMap : register(t1);
 Texture2D sceneColor : register(t2);
 Texture2D sceneDepth : register(t3);
+Texture2DArray<float> blueNoise : register(t4);
+StructuredBuffer<float2> macrocells : register(t5); // min and max density per macrocell, see fluid_macrocell_cs
 
 SamplerState samplerState : register(s0);
 
@@ -25,6 +27,17 @@ cbuffer VolumeBuffer : register(b2)
     matrix mainCameraProjInv;
     float sigma_a; // absorption coefficient
     float sigma_s; // scattering coefficient
+    float max_steps; // primary raymarch steps
+    float max_light_steps; // shadow raymarch steps per primary sample
+    float adaptive; // 0 for max_steps even steps, 1 to adapt the step to the density
+    float min_step_scale; // smallest and largest step, as multiples of the even step
+    float max_step_scale;
+    float edge_threshold; // density change between samples that shrinks the step to the smallest
+    float near_distance; // distance from the camera within which steps shrink toward the smallest
+    float termination_threshold; // transmittance below which a ray stops
+    float blue_noise; // 1 offsets each ray by the blue noise texture instead of hashing every step
+    float frame_index; // the blue noise slice
+    float skip_empty; // 1 jumps the marches over macrocells without density
 };
 
 struct InputType
@@ -149,6 +162,18 @@ float hash11(float3 p)
 
     return float(n) / 4294967295.0;
 }
+// the offset of a step within its section. The spatio-temporal blue noise gives one offset per ray, which keeps
+// the error in high frequencies over the screen and over frames; the hash gives one per step
+float stepJitter(float2 pixel, float2 samplingPos, int n)
+{
+    if (blue_noise > 0)
+    {
+        uint width, height, slices;
+        blueNoise.GetDimensions(width, height, slices);
+        return blueNoise.Load(int4(uint2(pixel) % uint2(width, height), uint(frame_index) % slices, 0)) * 0.7 + 0.15;
+    }
+    return (hash11(float3(samplingPos, n)) * 0.7) + 0.15;
+}
 // the Henyey-Greenstein phase function
 float phase(float g, float cos_theta)
 {
@@ -232,13 +257,109 @@ float eval_density(float3 sample_pos)
     
     return saturate(value * noise);
 }
-float4 traceVolume(float3 ro, float3 rd, float2 uv, float2 samplingPos)
+// the density grid's voxels across the 16-unit box and its macrocells of MACROCELL_SIZE^3 voxels, as in eval_density
+// and fluid_macrocell_cs
+static const float VOXELS_PER_UNIT = 32.0 / 16;
+static const int MACROCELL_SIZE = 4;
+static const int MACROCELL_COUNT = 32 / MACROCELL_SIZE;
+
+float3 toVoxel(float3 sample_pos)
+{
+    return (sample_pos + 8) * VOXELS_PER_UNIT;
+}
+bool isMacrocellOccupied(int3 cell)
+{
+    // a macrocell whose highest sample is not positive interpolates to zero density everywhere
+    return macrocells[(cell.z * MACROCELL_COUNT + cell.y) * MACROCELL_COUNT + cell.x].y > 0;
+}
+// distance along the ray (direction in voxels per unit of distance) to the first macrocell with density, walking
+// the grid with a 3D DDA as MacrocellGrid::SkipEmpty does; 0 when the voxel's macrocell has density, max_distance
+// when none is reached before it
+float skipEmpty(float3 voxel, float3 direction, float max_distance)
+{
+    // clamped to the grid like the interpolation clamps its samples
+    int3 cell = clamp(int3(floor(voxel / MACROCELL_SIZE)), 0, MACROCELL_COUNT - 1);
+    if (isMacrocellOccupied(cell))
+        return 0;
+
+    // distance to the next macrocell boundary on each axis and between boundaries
+    int3 stepDir = int3(sign(direction));
+    float3 boundary = (cell + (direction > 0 ? 1 : 0)) * MACROCELL_SIZE;
+    float3 next = direction != 0 ? (boundary - voxel) / direction : 3.402823466e+38f;
+    float3 delta = direction != 0 ? MACROCELL_SIZE / abs(direction) : 3.402823466e+38f;
+
+    // a ray crosses at most every macrocell of each axis
+    [loop]
+    for (int i = 0; i < 3 * MACROCELL_COUNT; i++)
+    {
+        int axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+        float t = max(next[axis], 0);
+        if (t >= max_distance)
+            return max_distance;
+
+        // leaving the grid means leaving the volume, where nothing is sampled
+        cell[axis] += stepDir[axis];
+        if (cell[axis] < 0 || cell[axis] >= MACROCELL_COUNT)
+            return max_distance;
+        if (isMacrocellOccupied(cell))
+            return t;
+        next[axis] += delta[axis];
+    }
+    return max_distance;
+}
+// attenuates the view ray over a step of length dt and adds the ambient and in-scattered light of its sample
+void shadeSample(float3 sample_pos, float density, float dt, float3 to_light, float3 light_color, float phase_scatter, float sigma_t, inout float transparency, inout float3 result)
+{
+    float sample_attenuation = exp(-dt * sigma_t * density); // beer's law - light transmitted over the sample distance
+    
+    transparency *= sample_attenuation; // update overal volume light transmission with each step
+    
+    
+    // AMBIENT LIGHT CONTRIBUTION
+    result += ambientColor * ambientIntensity * 0.5f * density * dt * transparency;
+    
+    
+    //---  in-scattering
+    // t0 will be 0, cause we're casting from sample_pos, t1 will be distance light traveled through the volume
+    float _t0_sample, t1_sample;
+    if (density > 0 && intersectBox(sample_pos, to_light, _t0_sample, t1_sample)) 
+    {   
+        //int ns_light = ceil(t1_sample / step_size);
+        float stride_light = t1_sample / max_light_steps;
+        float tau = 0;
+        
+        
+        for (int nl = 0; nl < max_light_steps; ++nl)
+        {
+            float t_light = stride_light * (nl + 0.5);
+            float3 light_sample_pos = sample_pos + to_light * t_light;
+            if (skip_empty > 0)
+            {
+                float skip = skipEmpty(toVoxel(light_sample_pos), to_light * VOXELS_PER_UNIT, t1_sample - t_light);
+                if (skip > 0)
+                {
+                    // to the last step whose midpoint is short of the macrocell with density
+                    nl = max(nl, int(ceil((t_light + skip) / stride_light - 0.5)) - 1);
+                    continue;
+                }
+            }
+            tau += eval_density(light_sample_pos);
+        }
+        
+        float light_ray_att = exp(-tau * stride_light * sigma_t);
+        result += light_color * // light color
+              light_ray_att * // light ray transmission value
+              phase_scatter * // phase function and scattering coefficient
+              transparency * // ray current transmission value
+              dt * // dx in Riemann sum
+              density; // volume density at the sample location
+    }
+}
+float4 traceVolume(float3 ro, float3 rd, float2 uv, float2 samplingPos, float2 pixel)
 {
     float3 light_color = sunColor * sunIntensity;
     float3 background_color = float3(0, 0, 0);
     
-    float max_steps = 24;
-    float max_light_steps = 6;
     float3 to_light = -normalize(sunDirection);
     
     float g = 0.2;
@@ -259,58 +380,105 @@ float4 traceVolume(float3 ro, float3 rd, float2 uv, float2 samplingPos)
         
         
         float stride = (t1 - t0) / max_steps;
+        float phase_scatter = phase(g, cos_theta) * sigma_s;
         
         float transparency = 1.0f;
         float3 result = float3(0, 0, 0);
         
+        if (adaptive > 0)
+        {
+            // the step grows where the density barely changed since the last sample and shrinks across edges and
+            // near the camera. A sample weighs the ray from where the last one stopped to the next accepted
+            // sample, so it is shaded once that one is taken; a sample across an edge after a longer than
+            // smallest step is thrown away and the ray goes back to cross the edge in smallest steps
+            float min_step = stride * min_step_scale;
+            // an accepted sample moves at least the smallest step and at most every other sample is thrown away;
+            // every skip over empty macrocells lands in one with density, so they add at most one each
+            int steps = 2 * (int(max_steps / min_step_scale) + 1) + 3 * MACROCELL_COUNT;
+            float t = t0 + stride * stepJitter(pixel, samplingPos, 0);
+            float covered = t0;
+            float pending_t = 0;
+            float pending_density = -1; // negative while no sample is pending
+            float refine_until = 0;
+            for (int n = 0; n < steps && t < t1; n++)
+            {
+                if (skip_empty > 0)
+                {
+                    float skip = skipEmpty(toVoxel(ro + rd * t), rd * VOXELS_PER_UNIT, t1 - t);
+                    if (skip > 0)
+                    {
+                        // nothing is lost over empty space, so weighing starts again at the macrocell with density
+                        if (pending_density >= 0)
+                        {
+                            shadeSample(ro + rd * pending_t, pending_density, t - covered, to_light, light_color, phase_scatter, sigma_t, transparency, result);
+                            if (transparency < termination_threshold)
+                                return float4(result, transparency);
+                        }
+                        t = max(t + skip, asfloat(asuint(t) + 1));
+                        covered = t;
+                        pending_density = -1;
+                        continue;
+                    }
+                }
+                
+                float density = eval_density(ro + rd * t);
+                
+                float change = 0;
+                if (pending_density >= 0)
+                {
+                    change = abs(density - pending_density);
+                    if (change > edge_threshold && t - pending_t > min_step * 1.001)
+                    {
+                        refine_until = t;
+                        t = pending_t + min_step;
+                        continue;
+                    }
+                    
+                    shadeSample(ro + rd * pending_t, pending_density, t - covered, to_light, light_color, phase_scatter, sigma_t, transparency, result);
+                    if (transparency < termination_threshold)
+                        return float4(result, transparency);
+                    covered = t;
+                }
+                pending_t = t;
+                pending_density = density;
+                
+                float scale = lerp(max_step_scale, min_step_scale, saturate(change / edge_threshold));
+                scale *= lerp(min_step_scale, 1, saturate(t / near_distance));
+                scale = t < refine_until ? min_step_scale : clamp(scale, min_step_scale, max_step_scale);
+                t += stride * scale;
+            }
+            
+            if (pending_density >= 0)
+                shadeSample(ro + rd * pending_t, pending_density, t1 - covered, to_light, light_color, phase_scatter, sigma_t, transparency, result);
+            return float4(result, transparency);
+        }
+        
         for (int n = 0; n < max_steps; n++)
         {
             // distance to middle of current section
-            float jitter = (hash11(float3(samplingPos, n)) * 0.7) + 0.15; // instead of 0.5
+            float jitter = stepJitter(pixel, samplingPos, n); // instead of 0.5
             //jitter = 0.5f;
             float t = t0 + stride * (n + jitter);
             
             float3 sample_pos = ro + rd * t;
             
-            float density = eval_density(sample_pos);
-            
-            float sample_attenuation = exp(-stride * sigma_t * density); // beer's law - light transmitted over the sample distance
-            
-            transparency *= sample_attenuation; // update overal volume light transmission with each step
-            
-            
-            // AMBIENT LIGHT CONTRIBUTION
-            result += ambientColor * ambientIntensity * 0.5f * density * stride * transparency;
-            
-            
-            //---  in-scattering
-            // t0 will be 0, cause we're casting from sample_pos, t1 will be distance light traveled through the volume
-            float _t0_sample, t1_sample;
-            if (density > 0 && intersectBox(sample_pos, to_light, _t0_sample, t1_sample)) 
-            {   
-                //int ns_light = ceil(t1_sample / step_size);
-                float stride_light = t1_sample / max_light_steps;
-                float tau = 0;
-                
-                
-                for (int nl = 0; nl < max_light_steps; ++nl)
+            if (skip_empty > 0)
+            {
+                float skip = skipEmpty(toVoxel(sample_pos), rd * VOXELS_PER_UNIT, t1 - t);
+                if (skip > 0)
                 {
-                    float t_light = stride_light * (nl + 0.5);
-                    float3 light_sample_pos = sample_pos + to_light * t_light;
-                    tau += eval_density(light_sample_pos);
+                    // the jitter keeps every sample within [0.15, 0.85] of its step, so the steps before this one
+                    // all land short of the next macrocell with density
+                    n = max(n, int(ceil((t + skip - t0) / stride - 0.85)) - 1);
+                    continue;
                 }
-                
-                float light_ray_att = exp(-tau * stride_light * sigma_t);
-                result += light_color * // light color
-                      light_ray_att * // light ray transmission value
-                      phase(g, cos_theta) * // phase function
-                      sigma_s * // scattering coefficient
-                      transparency * // ray current transmission value
-                      stride * // dx in Riemann sum
-                      density; // volume density at the sample location
             }
             
-            if (transparency < 1e-3)
+            float density = eval_density(sample_pos);
+            
+            shadeSample(sample_pos, density, stride, to_light, light_color, phase_scatter, sigma_t, transparency, result);
+            
+            if (transparency < termination_threshold)
             {
                 break;
             }
@@ -350,7 +518,7 @@ OutputType main(InputType input)
     reconstructedWorldPos = mul(reconstructedWorldPos, mainCameraViewInv);
     
     
-    output.color = traceVolume(cameraPos, normalize(input.wPosition.xyz - cameraPos), input.tex, samplingPos);
+    output.color = traceVolume(cameraPos, normalize(input.wPosition.xyz - cameraPos), input.tex, samplingPos, input.position.xy);
     output.occlusion = float4(output.color.a, 0, 0, 1);
     
     return output;
@@ -0,0 +1,179 @@
+// ReadbackRingTest
+// Drives ReadbackRing through MockReadbackDevice: callbacks in submission order with the contents at copy
+// time, requests merged while every slot is in flight, busy slots skipped when a request is issued, and
+// busy maps retried on a later Poll without blocking.
+
+#include "MockReadbackDevice.h"
+#include "ReadbackRing.h"
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	int failures = 0;
+
+	void Check(bool condition, const char* expression, int line)
+	{
+		if (condition)
+			return;
+
+		std::printf("ReadbackRingTest.cpp(%d): check failed: %s\n", line, expression);
+		failures++;
+	}
+
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+	// a ring over a mock device reading back one uint32, recording every callback
+	struct Fixture
+	{
+		uint32_t value = 0;
+		MockReadbackDevice* device;
+		std::unique_ptr<ReadbackRing> ring;
+		std::vector<uint64_t> requests;
+		std::vector<uint32_t> values;
+
+		Fixture(int slotCount, int latency)
+		{
+			auto mock = std::make_unique<MockReadbackDevice>(slotCount, latency);
+			mock->AddSource(&value, sizeof(value), sizeof(value), 1);
+			device = mock.get();
+			ring = std::make_unique<ReadbackRing>(std::move(mock));
+			ring->SetCallback([this](uint64_t request, const std::vector<ReadbackView>& views)
+			{
+				requests.push_back(request);
+				values.push_back(*static_cast<const uint32_t*>(views[0].data));
+			});
+		}
+
+		// one simulated frame: the GPU moves on, then the ring is polled
+		void Frame()
+		{
+			device->Advance();
+			ring->Poll();
+		}
+	};
+
+	void TestOrder()
+	{
+		Fixture f(3, 2);
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			f.value = 10 + i;
+			f.ring->Request();
+			// changing the source after the copy must not reach the callback
+			f.value = 99;
+			f.Frame();
+		}
+		f.Frame();
+		f.Frame();
+
+		CHECK((f.requests == std::vector<uint64_t>{ 1, 2, 3 }));
+		CHECK((f.values == std::vector<uint32_t>{ 10, 11, 12 }));
+		CHECK(f.ring->GetCompletedCount() == 3);
+		CHECK(f.ring->GetInFlightCount() == 0);
+		CHECK(f.ring->GetLatency() == 2);
+		CHECK(f.device->GetMappedCount() == 0);
+	}
+
+	void TestNoCallbackBeforeCompletion()
+	{
+		Fixture f(2, 3);
+		f.ring->Request();
+		f.Frame();
+		f.Frame();
+		CHECK(f.requests.empty());
+		CHECK(f.ring->GetInFlightCount() == 1);
+		f.Frame();
+		CHECK((f.requests == std::vector<uint64_t>{ 1 }));
+	}
+
+	void TestMerge()
+	{
+		Fixture f(2, 2);
+		f.value = 1;
+		f.ring->Request();
+		f.value = 2;
+		f.ring->Request();
+
+		// both slots are in flight, so these wait and only the last one is copied
+		f.value = 3;
+		f.ring->Request();
+		f.value = 4;
+		uint64_t last = f.ring->Request();
+		CHECK(f.ring->HasDeferredRequest());
+		CHECK(f.ring->GetMergedCount() == 1);
+		CHECK(f.device->GetCopyCount() == 2);
+
+		f.Frame();
+		f.Frame();
+		CHECK(!f.ring->HasDeferredRequest());
+		CHECK(f.device->GetCopyCount() == 3);
+		f.Frame();
+		f.Frame();
+
+		CHECK((f.requests == std::vector<uint64_t>{ 1, 2, last }));
+		CHECK((f.values == std::vector<uint32_t>{ 1, 2, 4 }));
+	}
+
+	void TestSkipBusySlot()
+	{
+		// slot 0 is copied a frame before slot 1, so it frees first and takes the deferred request, which
+		// leaves slot 0 busy and slot 1 free for the next one
+		Fixture f(2, 2);
+		f.ring->Request();
+		f.Frame();
+		f.ring->Request();
+		f.ring->Request();
+		CHECK(f.ring->HasDeferredRequest());
+
+		f.Frame();
+		CHECK((f.requests == std::vector<uint64_t>{ 1 }));
+		CHECK(!f.ring->HasDeferredRequest());
+
+		f.Frame();
+		CHECK((f.requests == std::vector<uint64_t>{ 1, 2 }));
+		f.ring->Request();
+		CHECK(!f.ring->HasDeferredRequest());
+		CHECK(f.ring->GetInFlightCount() == 2);
+
+		f.Frame();
+		f.Frame();
+		CHECK((f.requests == std::vector<uint64_t>{ 1, 2, 3, 4 }));
+		CHECK(f.device->GetCopyCount() == 4);
+	}
+
+	void TestBusyMap()
+	{
+		Fixture f(2, 1);
+		f.ring->Request();
+		f.device->SetMapBusy(true);
+		f.Frame();
+		f.Frame();
+		CHECK(f.requests.empty());
+		CHECK(f.ring->GetInFlightCount() == 1);
+
+		f.device->SetMapBusy(false);
+		f.Frame();
+		CHECK((f.requests == std::vector<uint64_t>{ 1 }));
+		CHECK(f.ring->GetLatency() == 3);
+		CHECK(f.device->GetMappedCount() == 0);
+	}
+}
+
+int main()
+{
+	TestOrder();
+	TestNoCallbackBeforeCompletion();
+	TestMerge();
+	TestSkipBusySlot();
+	TestBusyMap();
+
+	if (failures > 0)
+	{
+		std::printf("%d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("all checks passed\n");
+	return 0;
+}
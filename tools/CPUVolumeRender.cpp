@@ -0,0 +1,178 @@
+// cpu_volume_render
+// Renders a cloud frame saved by the game (Save frame for cpu_volume_render) with the CPU cloud renderer, without
+// a GPU, and writes the HDR image as a PFM and the renderer's benchmark as a CSV file.
+
+#include "CPUVolumeRenderer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	void PrintUsage()
+	{
+		std::printf(
+			"usage: cpu_volume_render <frame.cvf> [options]\n"
+			"       cpu_volume_render --synthetic <resolution> [options]\n"
+			"  --out <file.pfm>          image, default cpu_volume.pfm\n"
+			"  --benchmark <file.csv>    benchmark, default cpu_volume_benchmark.csv\n"
+			"  --no-benchmark            render the image only\n"
+			"  --threads <count>         threads including the calling one, default every hardware thread\n"
+			"  --path scalar|avx2|avx512 default the widest the CPU supports\n"
+			"  --size <width> <height>   render at another resolution than the frame's\n"
+			"  --write-frame <file.cvf>  save the frame before rendering it\n");
+	}
+
+	// a few overlapping Gaussian blobs in a resolution^3 grid with its ghost layers, seen from the front of the
+	// volume, for trying the renderer without a saved frame
+	CPUVolumeFrame SyntheticFrame(int resolution)
+	{
+		CPUVolumeFrame frame;
+		const int size = resolution + 2;
+		frame.densityResolution = XMINT3(size, size, size);
+		frame.density.resize(size_t(size) * size * size);
+
+		const float blobs[][4] = { { 0.5f, 0.45f, 0.5f, 0.22f }, { 0.32f, 0.55f, 0.42f, 0.15f }, { 0.68f, 0.5f, 0.6f, 0.17f } };
+		for (int z = 0; z < size; z++)
+		{
+			for (int y = 0; y < size; y++)
+			{
+				for (int x = 0; x < size; x++)
+				{
+					float u = float(x) / (size - 1), v = float(y) / (size - 1), w = float(z) / (size - 1);
+					float density = 0.0f;
+					for (const auto& blob : blobs)
+					{
+						float dx = u - blob[0], dy = v - blob[1], dz = w - blob[2];
+						density += std::exp(-(dx * dx + dy * dy + dz * dz) / (blob[3] * blob[3]));
+					}
+					// the ghost layers stay empty, as the fluid's do
+					bool ghost = x == 0 || y == 0 || z == 0 || x == size - 1 || y == size - 1 || z == size - 1;
+					frame.density[(size_t(z) * size + y) * size + x] = ghost ? 0.0f : std::max(0.0f, density - 0.2f);
+				}
+			}
+		}
+
+		frame.width = 640;
+		frame.height = 360;
+		XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 2.0f, -24.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PI / 4.0f, float(frame.width) / frame.height, 0.1f, 100.0f);
+		frame.camera.position = XMFLOAT3(0.0f, 2.0f, -24.0f);
+		frame.camera.viewInv = XMMatrixInverse(nullptr, view);
+		frame.camera.projInv = XMMatrixInverse(nullptr, proj);
+		frame.settings.ambientColor = XMFLOAT3(0.45f, 0.55f, 0.7f);
+		frame.settings.sunDirection = XMFLOAT3(-0.4f, -0.8f, 0.45f);
+		return frame;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string input, imageFile = "cpu_volume.pfm", benchmarkFile = "cpu_volume_benchmark.csv", frameFile;
+	int synthetic = 0, threads = 0, width = 0, height = 0;
+	bool benchmark = true;
+	CPUVolumePath path = CPUVolumePath::Avx512;
+	bool pathSet = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--synthetic" && hasValue)
+			synthetic = std::atoi(argv[++i]);
+		else if (arg == "--out" && hasValue)
+			imageFile = argv[++i];
+		else if (arg == "--benchmark" && hasValue)
+			benchmarkFile = argv[++i];
+		else if (arg == "--no-benchmark")
+			benchmark = false;
+		else if (arg == "--threads" && hasValue)
+			threads = std::atoi(argv[++i]);
+		else if (arg == "--size" && i + 2 < argc)
+		{
+			width = std::atoi(argv[++i]);
+			height = std::atoi(argv[++i]);
+		}
+		else if (arg == "--write-frame" && hasValue)
+			frameFile = argv[++i];
+		else if (arg == "--path" && hasValue)
+		{
+			std::string name = argv[++i];
+			pathSet = true;
+			if (name == "scalar")
+				path = CPUVolumePath::Scalar;
+			else if (name == "avx2")
+				path = CPUVolumePath::Avx2;
+			else if (name == "avx512")
+				path = CPUVolumePath::Avx512;
+			else
+			{
+				PrintUsage();
+				return 2;
+			}
+		}
+		else if (arg[0] != '-' && input.empty())
+			input = arg;
+		else
+		{
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (input.empty() == (synthetic <= 0))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	CPUVolumeFrame frame;
+	if (synthetic > 0)
+		frame = SyntheticFrame(synthetic);
+	else if (!CPUVolumeRenderer::ReadFrame(input, frame))
+	{
+		std::fprintf(stderr, "cannot read the frame %s\n", input.c_str());
+		return 1;
+	}
+	if (width > 0 && height > 0)
+	{
+		frame.width = width;
+		frame.height = height;
+	}
+	if (!frameFile.empty() && !CPUVolumeRenderer::WriteFrame(frameFile, frame))
+	{
+		std::fprintf(stderr, "cannot write the frame %s\n", frameFile.c_str());
+		return 1;
+	}
+
+	// a single thread renders every tile on the calling thread
+	std::unique_ptr<ThreadPool> pool;
+	if (threads != 1)
+		pool = std::make_unique<ThreadPool>(std::max(0, threads));
+
+	CPUVolumeRenderer renderer;
+	if (pathSet)
+		renderer.SetPath(path);
+	renderer.SetDensity(frame.density.data(), frame.densityResolution, pool.get());
+	if (!frame.sceneDepth.empty())
+		renderer.SetSceneDepth(frame.sceneDepth.data(), frame.sceneDepthWidth, frame.sceneDepthHeight);
+
+	std::vector<XMFLOAT4> image;
+	renderer.Render(frame.camera, frame.settings, frame.width, frame.height, image, pool.get());
+	const CPUVolumeStats& stats = renderer.GetStats();
+	std::printf("%s %dx%d: %.1f ms, %.1f Msamples/s on %d threads\n", CPUVolumeRenderer::GetPathName(stats.path), stats.width, stats.height,
+		stats.renderTime, stats.MegasamplesPerSecond(), stats.threads);
+	if (!CPUVolumeRenderer::WritePFM(imageFile, image, frame.width, frame.height))
+	{
+		std::fprintf(stderr, "cannot write the image %s\n", imageFile.c_str());
+		return 1;
+	}
+
+	if (benchmark)
+		renderer.WriteBenchmark(benchmarkFile, frame.camera, frame.settings, pool.get());
+	return 0;
+}